@@ -0,0 +1,218 @@
+#!/bin/bash
+
+# Immediately fail if any common problems occur
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "${SCRIPT_DIR}"
+shopt -s nullglob
+
+SRC_STAGE0_DIR="./src/stage0"
+ARCH_DIR="${SRC_STAGE0_DIR}/arch"
+BENCH_DIR="./bench"
+BUILD_DIRECTORY="./build/bench"
+
+# Input sizes, in lines, compiled by `stress`.
+STRESS_SIZES=(1000 10000 100000 1000000)
+# Largest growth in time or memory per line allowed between consecutive sizes.
+STRESS_TOLERANCE="${STRESS_TOLERANCE:-3}"
+# Function counts of the programs `gas` assembles.
+GAS_SIZES=(1000 10000 50000)
+# Iterations of the inner loop run by the program `vm` generates.
+VM_STEPS="${VM_STEPS:-10000000}"
+
+# Arguments:
+# lex [functions]: Lexer throughput (MB/s) on a generated program with
+#                  `functions` functions (default 100000, ~43 MB).
+# buffer [MB]:     Append throughput of the chunked output buffer against a
+#                  doubling array, filling `MB` megabytes (default 64).
+# stress:          Compiles generated programs of 1K to 1M lines and fails if
+#                  the time or memory per line grows with the input.
+# vm [iterations]: Runs the examples and a generated loop of `VM_STEPS` steps
+#                  natively and on the bytecode VM, best of `iterations`
+#                  (default 10).
+# gas [iterations]:
+#                  Assembles generated programs of 1K to 50K functions with
+#                  nasm from a file, if installed, and with GAS from a file
+#                  and through a pipe, best of `iterations` (default 3).
+usage()
+{
+    echo "Usage: $0 lex [functions]" >&2
+    echo "       $0 buffer [megabytes]" >&2
+    echo "       $0 stress" >&2
+    echo "       $0 vm [iterations]" >&2
+    echo "       $0 gas [iterations]" >&2
+    exit 1
+}
+
+# Writes a synthetic program with `$1` functions to `$2`. Each function is
+# 16 lines of declarations, loops, calls, comments and string literals.
+generate_program()
+{
+    awk -v n="$1" 'BEGIN {
+        print "let TOTAL = 0;\n";
+        for (i = 0; i < n; i++) {
+            printf "// Function number %d accumulates a running total.\n", i;
+            printf "fn func_%d(limit: int, offset: int): int =>\n{\n", i;
+            printf "    let count = 0;\n";
+            printf "    let value_%d = offset * 2 + %d;\n", i, i;
+            printf "    while (count < limit)\n    {\n";
+            printf "        printf(\"step %%d of %%d\\n\", count, limit); // progress\n";
+            printf "        value_%d = value_%d + count * 3 - 1;\n", i, i;
+            printf "        count = count + 1;\n    }\n";
+            printf "    if (value_%d > 1000)\n    {\n", i;
+            printf "        TOTAL = TOTAL + 1;\n    }\n";
+            printf "    return value_%d;\n}\n\n", i;
+        }
+        print "fn main(): int =>\n{\n    return 0;\n}";
+    }' > "$2"
+}
+
+# Writes a program of about `$1` lines to `$2`, split into functions of about
+# 1000 lines. Each function is far longer than any fixed statement limit and
+# mixes loops, branches, global reads and 24-term expressions, deeper than
+# there are registers to hold them.
+generate_stress_program()
+{
+    awk -v lines="$1" 'BEGIN {
+        globals = 64;
+        for (g = 0; g < globals; g++) {
+            printf "let G_%d = %d;\n", g, g;
+        }
+        print "";
+        functions = int(lines / 1000);
+        if (functions < 1) functions = 1;
+        for (i = 0; i < functions; i++) {
+            printf "fn stress_%d(limit: int): int =>\n{\n", i;
+            print "    let a = 0;";
+            print "    let b = 1;";
+            print "    let c = 2;";
+            # 13 lines per block.
+            for (j = 0; j < 76; j++) {
+                print "    while (a < limit)";
+                print "    {";
+                print "        a = a + 1;";
+                printf "        b = b + a * 2 - G_%d;\n", (i + j) % globals;
+                print "        if (b > c)";
+                print "        {";
+                print "            c = c + b - a;";
+                print "        }";
+                print "        else";
+                print "        {";
+                printf "            c = a";
+                for (k = 0; k < 23; k++) printf " + %s", (k % 2 ? "b" : "c");
+                print ";";
+                print "        }";
+                print "    }";
+            }
+            print "    return a + b + c;";
+            print "}\n";
+        }
+        print "fn main(): int =>\n{\n    return stress_0(10);\n}";
+    }' > "$2"
+}
+
+# Writes a program to `$2` that spends `$1` steps in a loop of arithmetic,
+# comparisons, a branch and a call, with no output until the end.
+generate_vm_program()
+{
+    awk -v steps="$1" 'BEGIN {
+        print "let TOTAL = 0;\n";
+        print "fn mix(x: int, y: int): int =>\n{\n    return x * 3 + y - 7;\n}\n";
+        print "fn main(): int =>\n{";
+        print "    let i = 0;";
+        print "    let acc = 1;";
+        printf "    while (i < %d)\n    {\n", steps;
+        print "        acc = mix(acc, i);";
+        print "        if (acc > 1000000)";
+        print "        {";
+        print "            acc = acc - 999999;";
+        print "            TOTAL = TOTAL + 1;";
+        print "        }";
+        print "        i = i + 1;";
+        print "    }";
+        print "    printf(\"%d %d\\n\", acc, TOTAL);";
+        print "    return 0;\n}";
+    }' > "$2"
+}
+
+# Compiles `bench/$1.c` against the Stage 0 sources (excluding main.c).
+build_bench()
+{
+    local sources=()
+    for file in "${SRC_STAGE0_DIR}/"*.c "${ARCH_DIR}/"*.c; do
+        if [ "$(basename "${file}")" != "main.c" ]; then
+            sources+=("${file}")
+        fi
+    done
+    gcc -O2 "-I${SRC_STAGE0_DIR}" "-I${ARCH_DIR}" "${BENCH_DIR}/$1.c" \
+        "${sources[@]}" -pthread -ldl -o "${BUILD_DIRECTORY}/$1"
+}
+
+mkdir -p "${BUILD_DIRECTORY}"
+
+case "${1:-}" in
+    lex)
+        FUNCTIONS="${2:-100000}"
+        INPUT="${BUILD_DIRECTORY}/lex_${FUNCTIONS}.g2"
+        generate_program "${FUNCTIONS}" "${INPUT}"
+        build_bench lex
+        "${BUILD_DIRECTORY}/lex" "${INPUT}"
+        ;;
+    buffer)
+        build_bench buffer
+        "${BUILD_DIRECTORY}/buffer" "${2:-64}"
+        ;;
+    stress)
+        build_bench stress
+        RESULTS="${BUILD_DIRECTORY}/stress.tsv"
+        : > "${RESULTS}"
+        for size in "${STRESS_SIZES[@]}"; do
+            INPUT="${BUILD_DIRECTORY}/stress_${size}.g2"
+            generate_stress_program "${size}" "${INPUT}"
+            # Each size runs in its own process so its peak RSS stands alone.
+            "${BUILD_DIRECTORY}/stress" "${INPUT}" 2>> "${RESULTS}" > /dev/null
+        done
+        awk -v tolerance="${STRESS_TOLERANCE}" '
+            BEGIN { printf "%10s %10s %14s %10s %14s\n", "lines", "ms",
+                           "us/line", "peak KB", "bytes/line"; }
+            {
+                time = $2 * 1e6 / $1;
+                memory = $3 * 1024 / $1;
+                printf "%10d %10.1f %14.3f %10d %14.1f\n", $1, $2 * 1000,
+                       time, $3, memory;
+                if (NR > 1 && time > last_time * tolerance) {
+                    printf "Time per line grew %.1fx from %d to %d lines.\n",
+                           time / last_time, last_lines, $1;
+                    failed = 1;
+                }
+                if (NR > 1 && memory > last_memory * tolerance) {
+                    printf "Memory per line grew %.1fx from %d to %d lines.\n",
+                           memory / last_memory, last_lines, $1;
+                    failed = 1;
+                }
+                last_lines = $1; last_time = time; last_memory = memory;
+            }
+            END { exit failed; }' "${RESULTS}"
+        ;;
+    vm)
+        build_bench vm
+        INPUT="${BUILD_DIRECTORY}/vm_${VM_STEPS}.g2"
+        generate_vm_program "${VM_STEPS}" "${INPUT}"
+        for program in ./examples/fibonacci.g2 ./examples/program.g2 \
+                       "${INPUT}"; do
+            "${BUILD_DIRECTORY}/vm" "${program}" "${2:-10}" > /dev/null
+        done
+        ;;
+    gas)
+        build_bench gas
+        for size in "${GAS_SIZES[@]}"; do
+            INPUT="${BUILD_DIRECTORY}/gas_${size}.g2"
+            generate_program "${size}" "${INPUT}"
+            "${BUILD_DIRECTORY}/gas" "${INPUT}" "${2:-3}" > /dev/null
+        done
+        ;;
+    *)
+        usage
+        ;;
+esac
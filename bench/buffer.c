@@ -0,0 +1,243 @@
+/*
+ * Buffer append benchmark.
+ *
+ * Appends the kinds of output codegen produces to the stage0 chunked buffer
+ * and to a reference buffer modelled on the one stage0 used to ship: a
+ * single array starting at 8 bytes that doubles, copying everything written
+ * so far, whenever an append does not fit, and that retries `vsnprintf`
+ * after each doubling. Checks that both hold the same bytes and reports the
+ * best time of each, along with the bytes the reference copied while
+ * growing.
+ *
+ * Usage: buffer [megabytes] [iterations]
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Reference buffer */
+
+typedef struct flat_t
+{
+    char* data;
+    size_t size;
+    size_t capacity;
+} flat_t;
+
+static size_t g_flat_copied = 0;
+
+static flat_t* flat_new()
+{
+    flat_t* buf = (flat_t*)calloc(1, sizeof(flat_t));
+    buf->data = (char*)calloc(1, 8);
+    buf->capacity = 8;
+    return buf;
+}
+
+static void flat_recalloc(flat_t* buf, size_t new_capacity)
+{
+    char* new_data = (char*)malloc(new_capacity);
+    memcpy(new_data, buf->data, buf->size);
+    new_data[buf->size] = '\0';
+    g_flat_copied += buf->size;
+    free(buf->data);
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+}
+
+static void flat_write(flat_t* buf, const void* data, size_t size)
+{
+    if (buf->capacity - buf->size <= size)
+    {
+        size_t new_capacity = buf->capacity * 2;
+        while (new_capacity < buf->size + size + 1)
+        {
+            new_capacity *= 2;
+        }
+        flat_recalloc(buf, new_capacity);
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+    buf->data[buf->size] = '\0';
+}
+
+static void flat_puts(flat_t* buf, const char* str)
+{
+    flat_write(buf, str, strlen(str));
+}
+
+static void flat_printf(flat_t* buf, const char* format, ...)
+{
+    va_list args;
+    while (1)
+    {
+        size_t remaining = buf->capacity - buf->size;
+        va_start(args, format);
+        size_t written =
+            vsnprintf(buf->data + buf->size, remaining, format, args);
+        va_end(args);
+        if (remaining <= written)
+        {
+            flat_recalloc(buf, buf->capacity * 2);
+            continue;
+        }
+        buf->size += written;
+        return;
+    }
+}
+
+/* Workloads */
+
+static const char* REGISTERS[] = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi"};
+
+// An instruction record the size of `x86_inst_t`.
+typedef struct record_t
+{
+    uint8_t bytes[20];
+} record_t;
+
+// Each workload appends until `target` bytes are held, to either buffer.
+typedef enum workload_t
+{
+    WORKLOAD_PRINTF,
+    WORKLOAD_PUTS,
+    WORKLOAD_RECORDS,
+    WORKLOAD_COUNT,
+} workload_t;
+
+static const char* WORKLOAD_NAMES[] = {"printf", "puts", "records"};
+
+static size_t g_target = 0;
+// Time the last fill spent appending, not counting reading the result back.
+static double g_elapsed = 0.0;
+
+static char* fill_flat(workload_t workload, size_t* size)
+{
+    double start = now();
+    flat_t* buf = flat_new();
+    record_t record = {{0}};
+    for (uint32_t i = 0; buf->size < g_target; i++)
+    {
+        switch (workload)
+        {
+        case WORKLOAD_PRINTF:
+            flat_printf(buf, "\tmov %s, [rbp%+d]\n", REGISTERS[i % 6],
+                        -8 * (int)(i % 512));
+            break;
+        case WORKLOAD_PUTS:
+            flat_puts(buf, "\tpush rbp\n");
+            break;
+        default:
+            record.bytes[0] = (uint8_t)i;
+            flat_write(buf, &record, sizeof(record));
+            break;
+        }
+    }
+    g_elapsed = now() - start;
+    *size = buf->size;
+    char* text = buf->data;
+    free(buf);
+    return text;
+}
+
+static char* fill_chunked(workload_t workload, size_t* size)
+{
+    double start = now();
+    buffer_t* buf = buffer_new();
+    record_t record = {{0}};
+    for (uint32_t i = 0; buf->size < g_target; i++)
+    {
+        switch (workload)
+        {
+        case WORKLOAD_PRINTF:
+            buffer_printf(buf, "\tmov %s, [rbp%+d]\n", REGISTERS[i % 6],
+                          -8 * (int)(i % 512));
+            break;
+        case WORKLOAD_PUTS:
+            buffer_puts(buf, "\tpush rbp\n");
+            break;
+        default:
+            record.bytes[0] = (uint8_t)i;
+            buffer_write(buf, &record, sizeof(record));
+            break;
+        }
+    }
+    g_elapsed = now() - start;
+    *size = buf->size;
+    return buffer_release(buf);
+}
+
+static double run(const char* name, char* (*fill)(workload_t, size_t*),
+                  workload_t workload, int iterations, char** output,
+                  size_t* size)
+{
+    double best = 0.0;
+    for (int i = 0; i < iterations; i++)
+    {
+        free(*output);
+        *output = fill(workload, size);
+        if (i == 0 || g_elapsed < best)
+        {
+            best = g_elapsed;
+        }
+    }
+    printf("%-8s %-10s %9.3f ms %9.1f MB/s\n", WORKLOAD_NAMES[workload], name,
+           best * 1e3, (double)*size / 1e6 / best);
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc >= 2 ? (size_t)atol(argv[1]) : 64;
+    int iterations = argc >= 3 ? atoi(argv[2]) : 5;
+    if (megabytes == 0 || iterations <= 0)
+    {
+        fprintf(stderr, "Usage: %s [megabytes] [iterations]\n", argv[0]);
+        return 1;
+    }
+    g_target = megabytes * 1000 * 1000;
+    printf("Appending %zu MB per run\n", megabytes);
+
+    int status = 0;
+    for (int workload = 0; workload < WORKLOAD_COUNT; workload++)
+    {
+        char* flat = NULL;
+        char* chunked = NULL;
+        size_t flat_size = 0;
+        size_t chunked_size = 0;
+
+        g_flat_copied = 0;
+        double reference = run("reference", fill_flat, (workload_t)workload,
+                               iterations, &flat, &flat_size);
+        size_t copied = g_flat_copied / (size_t)iterations;
+        double stage0 = run("stage0", fill_chunked, (workload_t)workload,
+                            iterations, &chunked, &chunked_size);
+        printf("%-8s speedup %.2fx, reference copied %.1f MB growing\n",
+               WORKLOAD_NAMES[workload], reference / stage0,
+               (double)copied / 1e6);
+
+        if (flat_size != chunked_size ||
+            memcmp(flat, chunked, flat_size) != 0)
+        {
+            fprintf(stderr, "%s: buffers hold different bytes.\n",
+                    WORKLOAD_NAMES[workload]);
+            status = 1;
+        }
+        free(flat);
+        free(chunked);
+    }
+    return status;
+}
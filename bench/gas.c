@@ -0,0 +1,179 @@
+/*
+ * Assembler benchmark.
+ *
+ * Compiles the input once as NASM assembly and once as GNU assembler
+ * syntax, then times turning each into an object file: NASM from a file
+ * written first, as the compiler does by default; GAS from a file written
+ * first; and GAS fed through a pipe, as `--emit=gas` does, with nothing but
+ * the object on disk. Each time covers writing the assembly as well as
+ * assembling it. NASM is skipped if it is not installed. Reports the best
+ * time of each in milliseconds.
+ *
+ * The assembly and objects are written next to the input. The compiler's
+ * own logging goes to stdout, the results to stderr.
+ *
+ * Usage: gas <file.g2> [iterations]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "codegen.h"
+#include "intern.h"
+#include "sema.h"
+#include "source.h"
+#include "tree.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Writes the assembly of `code` to `path` and runs `command` on it.
+static bool assemble_file(const codegen_t* code, const char* path,
+                          const char* command)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return false;
+    }
+    bool written = codegen_write(code, fd);
+    written = close(fd) == 0 && written;
+    return written && system(command) == 0;
+}
+
+// Pipes the assembly of `code` into `command`.
+static bool assemble_pipe(const codegen_t* code, const char* command)
+{
+    FILE* pipe = popen(command, "w");
+    if (!pipe)
+    {
+        perror("popen");
+        return false;
+    }
+    bool written = codegen_write(code, fileno(pipe));
+    int status = pclose(pipe);
+    return written && status == 0;
+}
+
+typedef struct assembler_t
+{
+    const char* name;
+    const codegen_t* code;
+    // File the assembly is written to, or NULL to pipe it into `command`.
+    const char* path;
+    const char* command;
+} assembler_t;
+
+// Returns the best time of `iterations` runs of `assembler`, or a negative
+// time if it failed.
+static double best_time(const assembler_t* assembler, int iterations)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        double start = now();
+        bool assembled =
+            assembler->path
+                ? assemble_file(assembler->code, assembler->path,
+                                assembler->command)
+                : assemble_pipe(assembler->code, assembler->command);
+        double elapsed = now() - start;
+        if (!assembled)
+        {
+            return -1.0;
+        }
+        if (elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file.g2> [iterations]\n", argv[0]);
+        return 1;
+    }
+    const char* input = argv[1];
+    int iterations = argc > 2 ? atoi(argv[2]) : 3;
+    if (iterations < 1)
+    {
+        iterations = 1;
+    }
+
+    source_t* source = source_open(input);
+    if (!source)
+    {
+        return 1;
+    }
+    ast* program = parse(source);
+    source_close(source);
+    tree_t* tree = tree_build(program);
+    ast_free(program);
+    sema_t* sema = sema_check(tree);
+    codegen_t* nasm = ast_codegen(tree, sema, X86_64, NULL);
+    codegen_t* gas = ast_codegen(tree, sema, X86_64_GAS, NULL);
+    sema_free(sema);
+    tree_free(tree);
+
+    char asm_path[1024];
+    char s_path[1024];
+    char nasm_command[4096];
+    char gas_command[4096];
+    char pipe_command[4096];
+    snprintf(asm_path, sizeof(asm_path), "%s.asm", input);
+    snprintf(s_path, sizeof(s_path), "%s.s", input);
+    snprintf(nasm_command, sizeof(nasm_command),
+             "nasm -f elf64 %s -o %s.nasm.o", asm_path, input);
+    snprintf(gas_command, sizeof(gas_command),
+             "gcc -x assembler -c %s -o %s.gas.o", s_path, input);
+    snprintf(pipe_command, sizeof(pipe_command),
+             "gcc -x assembler -c - -o %s.pipe.o", input);
+
+    const assembler_t assemblers[] = {
+        {"nasm (file)", nasm, asm_path, nasm_command},
+        {"gas (file)", gas, s_path, gas_command},
+        {"gas (pipe)", gas, NULL, pipe_command},
+    };
+    bool have_nasm = system("command -v nasm > /dev/null 2>&1") == 0;
+
+    int status = 0;
+    fprintf(stderr, "%s (best of %d)\n", input, iterations);
+    for (size_t i = 0; i < sizeof(assemblers) / sizeof(assemblers[0]); i++)
+    {
+        const assembler_t* assembler = &assemblers[i];
+        if (assembler->code == nasm && !have_nasm)
+        {
+            fprintf(stderr, "  %-12s  not installed\n", assembler->name);
+            continue;
+        }
+        double elapsed = best_time(assembler, iterations);
+        if (elapsed < 0.0)
+        {
+            fprintf(stderr, "  %-12s  failed\n", assembler->name);
+            status = 1;
+            continue;
+        }
+        fprintf(stderr, "  %-12s  %10.1f ms\n", assembler->name,
+                elapsed * 1e3);
+    }
+
+    codegen_free(nasm);
+    codegen_free(gas);
+    intern_free();
+    return status;
+}
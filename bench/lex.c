@@ -0,0 +1,293 @@
+/*
+ * Lexer throughput benchmark.
+ *
+ * Tokenizes the input file repeatedly with the stage0 lexer and with a
+ * reference lexer modelled on the one stage0 used to ship: bytes are
+ * classified one at a time through <ctype.h>, keywords are matched with a
+ * chain of string compares, and every token is heap allocated along with a
+ * copy of its text. Also tokenizes it in chunks on one thread per CPU and
+ * checks that the chunked lexer reads the same tokens. Reports the best
+ * throughput of each in MB/s.
+ *
+ * Usage: lex <file.g2> [iterations]
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intern.h"
+#include "tokenize.h"
+
+static const char* KEYWORDS[] = {"const", "let",   "fn",   "return",
+                                 "if",    "else",  "for",  "in",
+                                 "while", "true",  "false"};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char* read_input(const char* path, size_t* size)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror("Error opening file");
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = (size_t)ftell(fp);
+    rewind(fp);
+    char* buffer = (char*)malloc(*size + 1);
+    if (fread(buffer, 1, *size, fp) != *size)
+    {
+        perror("Error reading file");
+        exit(1);
+    }
+    buffer[*size] = '\0';
+    fclose(fp);
+    return buffer;
+}
+
+static size_t g_input_size = 0;
+
+static size_t lex_stage0(char* buffer)
+{
+    // The input is already in memory, so it is handed to the lexer as a
+    // complete source.
+    source_t source = {
+        .data = buffer, .size = g_input_size, .complete = true, .fd = -1};
+
+    size_t count = 0;
+    token_t token;
+    tokenize_begin(&source);
+    do
+    {
+        tokenize_next(&token);
+        count++;
+    } while (token.type != TOK_EOF);
+    return count;
+}
+
+static size_t g_workers = 1;
+static size_t g_parallel_count = 0;
+static uint64_t g_parallel_sum = 0;
+
+// Order-sensitive checksum of the tokens read by a lexer.
+static uint64_t token_sum(uint64_t sum, const token_t* token)
+{
+    return (sum ^ (token->start * 31 + token->end) ^ token->type) *
+           0x100000001b3ull;
+}
+
+static void count_parallel(const token_t* tokens, size_t count, void* context)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        g_parallel_sum = token_sum(g_parallel_sum, &tokens[i]);
+    }
+    g_parallel_count += count;
+}
+
+static size_t lex_parallel(char* buffer)
+{
+    source_t source = {
+        .data = buffer, .size = g_input_size, .complete = true, .fd = -1};
+
+    g_parallel_count = 0;
+    g_parallel_sum = 0;
+    tokenize_parallel(&source, g_workers, count_parallel, NULL);
+    return g_parallel_count;
+}
+
+// Returns the checksum of the tokens a single lexer reads from `buffer`.
+static uint64_t serial_sum(char* buffer)
+{
+    source_t source = {
+        .data = buffer, .size = g_input_size, .complete = true, .fd = -1};
+
+    uint64_t sum = 0;
+    token_t token;
+    tokenize_begin(&source);
+    do
+    {
+        tokenize_next(&token);
+        sum = token_sum(sum, &token);
+    } while (token.type != TOK_EOF);
+    return sum;
+}
+
+// Tokens built by the reference lexer stay alive until the whole input has
+// been lexed, as they used to live until the end of parsing.
+static token_t** g_reference_tokens = NULL;
+static char** g_reference_values = NULL;
+static size_t g_reference_count = 0;
+static size_t g_reference_capacity = 0;
+
+// Heap-allocates a token and a copy of its text.
+static char* reference_token(const char* text, size_t length, int type)
+{
+    if (g_reference_count >= g_reference_capacity)
+    {
+        g_reference_capacity =
+            g_reference_capacity ? g_reference_capacity * 2 : 4096;
+        g_reference_tokens = (token_t**)realloc(
+            g_reference_tokens, g_reference_capacity * sizeof(token_t*));
+        g_reference_values = (char**)realloc(
+            g_reference_values, g_reference_capacity * sizeof(char*));
+    }
+    token_t* token = (token_t*)calloc(1, sizeof(token_t));
+    char* value = (char*)calloc(1, length + 1);
+    memcpy(value, text, length);
+    token->type = (token_type_t)type;
+    g_reference_tokens[g_reference_count] = token;
+    g_reference_values[g_reference_count] = value;
+    g_reference_count++;
+    return value;
+}
+
+static size_t lex_reference(char* buffer)
+{
+    size_t pos = 0;
+    g_reference_count = 0;
+    while (buffer[pos] != '\0')
+    {
+        char c = buffer[pos];
+        size_t start = pos;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            pos++;
+            continue;
+        }
+        if (c == '/' && buffer[pos + 1] == '/')
+        {
+            while (buffer[pos] != '\0' && buffer[pos] != '\n')
+            {
+                pos++;
+            }
+            continue;
+        }
+        if (isdigit((unsigned char)c))
+        {
+            while (isdigit((unsigned char)buffer[pos]))
+            {
+                pos++;
+            }
+            reference_token(buffer + start, pos - start, TOK_NUMBER);
+        }
+        else if (isalpha((unsigned char)c))
+        {
+            while (isalnum((unsigned char)buffer[pos]) || buffer[pos] == '_')
+            {
+                pos++;
+            }
+            char* value =
+                reference_token(buffer + start, pos - start, TOK_IDENTIFIER);
+            for (size_t k = 0; k < sizeof(KEYWORDS) / sizeof(KEYWORDS[0]); k++)
+            {
+                if (strcmp(value, KEYWORDS[k]) == 0)
+                {
+                    g_reference_tokens[g_reference_count - 1]->type =
+                        TOK_DECLVAR;
+                    break;
+                }
+            }
+        }
+        else if (c == '"')
+        {
+            pos++;
+            while (buffer[pos] != '\0' && buffer[pos] != '"')
+            {
+                pos++;
+            }
+            reference_token(buffer + start + 1, pos - start - 1, TOK_STRING);
+            if (buffer[pos] == '"')
+            {
+                pos++;
+            }
+        }
+        else if (c == '=' && (buffer[pos + 1] == '>' || buffer[pos + 1] == '='))
+        {
+            pos += 2;
+            reference_token(buffer + start, 2, TOK_EQ);
+        }
+        else
+        {
+            pos++;
+            reference_token(buffer + start, 1, c);
+        }
+    }
+
+    size_t count = g_reference_count + 1;
+    for (size_t i = 0; i < g_reference_count; i++)
+    {
+        free(g_reference_values[i]);
+        free(g_reference_tokens[i]);
+    }
+    return count;
+}
+
+static double run(const char* name, size_t (*lex)(char*), char* buffer,
+                  size_t size, int iterations)
+{
+    double best = 0.0;
+    size_t count = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        double start = now();
+        count = lex(buffer);
+        double elapsed = now() - start;
+        if (i == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    double mbps = (double)size / 1e6 / best;
+    printf("%-10s %10zu tokens %9.3f ms %9.1f MB/s\n", name, count,
+           best * 1e3, mbps);
+    return mbps;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file.g2> [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc >= 3 ? atoi(argv[2]) : 10;
+
+    size_t size = 0;
+    char* buffer = read_input(argv[1], &size);
+    g_input_size = size;
+    printf("Input: %s (%.2f MB)\n", argv[1], (double)size / 1e6);
+
+    double reference = run("reference", lex_reference, buffer, size,
+                           iterations);
+    double stage0 = run("stage0", lex_stage0, buffer, size, iterations);
+    printf("Speedup: %.2fx\n", stage0 / reference);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    g_workers = cpus > 1 ? (size_t)cpus : 1;
+    double parallel = run("chunked", lex_parallel, buffer, size, iterations);
+    printf("Chunked speedup on %zu workers: %.2fx\n", g_workers,
+           parallel / stage0);
+    if (g_parallel_sum != serial_sum(buffer))
+    {
+        fprintf(stderr, "Chunked lexing read different tokens.\n");
+        return 1;
+    }
+
+    tokenize_free();
+    intern_free();
+    free(g_reference_tokens);
+    free(g_reference_values);
+    free(buffer);
+    return 0;
+}
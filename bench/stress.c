@@ -0,0 +1,81 @@
+/*
+ * Compiler scaling benchmark.
+ *
+ * Compiles one input from source to assembly in-process, the way the
+ * compiler itself does, and reports the line count, the wall time and the
+ * peak resident set size. `bench.sh stress` runs it once per input size, each
+ * in a fresh process, so every peak is measured on its own.
+ *
+ * Prints a single tab-separated line to stderr: lines, seconds, peak KB. The
+ * compiler's own logging goes to stdout.
+ *
+ * Usage: stress <file.g2>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "ast.h"
+#include "codegen.h"
+#include "intern.h"
+#include "sema.h"
+#include "source.h"
+#include "tree.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t count_lines(const source_t* source)
+{
+    size_t lines = 0;
+    for (size_t i = 0; i < source->size; i++)
+    {
+        lines += source->data[i] == '\n';
+    }
+    return lines;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file.g2>\n", argv[0]);
+        return 1;
+    }
+
+    double start = now();
+
+    source_t* source = source_open(argv[1]);
+    if (!source)
+    {
+        return 1;
+    }
+
+    ast* program = parse(source);
+    size_t lines = count_lines(source);
+    source_close(source);
+
+    tree_t* tree = tree_build(program);
+    ast_free(program);
+
+    sema_t* sema = sema_check(tree);
+    codegen_t* code = ast_codegen(tree, sema, X86_64, NULL);
+    sema_free(sema);
+    tree_free(tree);
+    intern_free();
+    codegen_free(code);
+
+    double elapsed = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "%zu\t%.6f\t%ld\n", lines, elapsed, usage.ru_maxrss);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Bytecode VM benchmark.
+ *
+ * Compiles the input once to x86-64 and once to bytecode, then runs each in
+ * process the way `--exec` and `--run` do, and reports the best time of
+ * either over the iterations and how many times slower the VM is. The
+ * native time includes encoding and loading the program, the VM time
+ * loading and threading the bytecode; a program that computes for longer
+ * than that weighs the interpreter itself.
+ *
+ * The program's output and the compiler's logging go to stdout, the results
+ * to stderr.
+ *
+ * Usage: vm <file.g2> [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ast.h"
+#include "codegen.h"
+#include "intern.h"
+#include "sema.h"
+#include "source.h"
+#include "tree.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Runs `code` `iterations` times and returns the best time, or a negative
+// time if it failed to run. The status of the last run goes to `status`.
+static double best_run(const codegen_t* code, int iterations, int* status)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        double start = now();
+        if (!codegen_run(code, status))
+        {
+            return -1.0;
+        }
+        double elapsed = now() - start;
+        if (elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file.g2> [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if (iterations < 1)
+    {
+        iterations = 1;
+    }
+
+    source_t* source = source_open(argv[1]);
+    if (!source)
+    {
+        return 1;
+    }
+    ast* program = parse(source);
+    source_close(source);
+    tree_t* tree = tree_build(program);
+    ast_free(program);
+    sema_t* sema = sema_check(tree);
+
+    codegen_t* native = ast_codegen(tree, sema, X86_64, NULL);
+    codegen_t* bytecode = ast_codegen(tree, sema, BYTECODE, NULL);
+    sema_free(sema);
+    tree_free(tree);
+
+    int native_status = 0;
+    int vm_status = 0;
+    double native_time = best_run(native, iterations, &native_status);
+    double vm_time = best_run(bytecode, iterations, &vm_status);
+    codegen_free(native);
+    codegen_free(bytecode);
+    intern_free();
+
+    if (native_time < 0.0 || vm_time < 0.0)
+    {
+        fprintf(stderr, "%s: failed to run.\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(stderr, "%s (best of %d)\n", argv[1], iterations);
+    fprintf(stderr, "  native:   %10.3f ms  (exit %d)\n", native_time * 1e3,
+            native_status);
+    fprintf(stderr, "  bytecode: %10.3f ms  (exit %d)\n", vm_time * 1e3,
+            vm_status);
+    fprintf(stderr, "  VM / native: %.2fx\n", vm_time / native_time);
+    return 0;
+}
@@ -0,0 +1,452 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "ast.h"
+#include "buffer.h"
+#include "codegen.h"
+#include "log.h"
+#include "macros.h"
+#include "vm.h"
+#include "vm_inst.h"
+
+// Arguments the x86-64 emitter passes in registers. It evaluates any beyond
+// them first, right to left, and the bytecode keeps the same order.
+#define VM_REGISTER_ARGS 6
+
+// Shorthands for reading the compact tree being emitted.
+#define KIND(node) tree_kind(g_vm.tree, (node))
+#define IDENT(node) tree_identifier(g_vm.tree, (node))
+#define NAME(node) tree_name(g_vm.tree, (node))
+// Shorthands for what semantic analysis resolved for a node.
+#define VALUE_TYPE(node) sema_type(g_vm.sema, (node))
+#define SYMBOL(node) sema_symbol(g_vm.sema, (node))
+
+codegen_t CODEGEN_BYTECODE = {
+    .ops =
+        {
+            .program = vm_program,
+            .statement = vm_statement,
+            .run = vm_run,
+        },
+    .type = BYTECODE,
+};
+
+static vm_context_t g_vm = {
+    .tree = NULL,
+    .sema = NULL,
+    .label_count = 0,
+    .function = NODE_NONE,
+    .locals = 0,
+    .top = 0,
+    .frame = 0,
+    .has_returned = false,
+};
+
+static uint32_t vm_expr(node_t node);
+static void vm_expr_into(node_t node, uint32_t dst);
+
+// Appends an instruction to the records.
+static void vm_emit(vm_opcode_t op, uint32_t a, uint32_t b, int32_t c)
+{
+    vm_inst_t inst = {(uintptr_t)op, (uint16_t)a, (uint16_t)b, c};
+    buffer_write(g_codegen->records, &inst, sizeof(inst));
+}
+
+// Returns the register of the local `symbol`, numbered from its stack slot.
+static uint32_t vm_local(const symbol_t* symbol)
+{
+    return (uint32_t)(-symbol->offset / 8 - 1);
+}
+
+// Counts `reg` among the registers the current function uses.
+static uint32_t vm_use(uint32_t reg)
+{
+    ASSERT(reg < UINT16_MAX, "Function %s needs more than %d registers.",
+           NAME(tree_declfn(g_vm.tree, g_vm.function)->identifier),
+           UINT16_MAX);
+    if (reg >= g_vm.frame)
+    {
+        g_vm.frame = reg + 1;
+    }
+    return reg;
+}
+
+// Claims the next temporary register. Temporaries live until the end of
+// the expression claiming them, so each statement starts over above the
+// locals. A local declared later in the function may share a temporary's
+// register, but is never in scope while the temporary is in use.
+static uint32_t vm_temp()
+{
+    return vm_use(g_vm.top++);
+}
+
+/* Expressions */
+
+// Emits the call `node` and returns the register left holding its result.
+static uint32_t vm_call(node_t node)
+{
+    const tree_call_t* call = tree_call(g_vm.tree, node);
+    uint32_t count = call->args.count;
+
+    // Arguments go in consecutive registers above every live one, which the
+    // callee takes over as its own. The first also receives the result.
+    uint32_t base = g_vm.top;
+    vm_use(base + (count > 0 ? count - 1 : 0));
+    g_vm.top = base + (count > 0 ? count : 1);
+
+    for (uint32_t i = count; i > VM_REGISTER_ARGS; i--)
+    {
+        vm_expr_into(tree_child(g_vm.tree, call->args, i - 1), base + i - 1);
+    }
+    for (uint32_t i = 0; i < count && i < VM_REGISTER_ARGS; i++)
+    {
+        vm_expr_into(tree_child(g_vm.tree, call->args, i), base + i);
+    }
+
+    // Whether the callee is part of the program or of the C library is
+    // decided when the program is loaded, as a function may be called before
+    // it is declared.
+    vm_emit(VM_CALL, count, base, (int32_t)IDENT(call->identifier));
+    g_vm.top = base + 1;
+    return base;
+}
+
+static void vm_binop(node_t node, uint32_t dst)
+{
+    const tree_binop_t* binop = tree_binop(g_vm.tree, node);
+    uint32_t mark = g_vm.top;
+
+    if (binop->op == BIN_ADD &&
+        VALUE_TYPE(binop->lhs) == SYMBOL_VALUE_STRING &&
+        VALUE_TYPE(binop->rhs) == SYMBOL_VALUE_STRING)
+    {
+        uint32_t lhs = vm_expr(binop->lhs);
+        uint32_t rhs = vm_expr(binop->rhs);
+        vm_emit(VM_CONCAT, dst, lhs, (int32_t)rhs);
+        g_vm.top = mark;
+        return;
+    }
+
+    vm_opcode_t op = VM_ADD;
+    switch (binop->op)
+    {
+    case BIN_ADD:
+        op = VM_ADD;
+        break;
+    case BIN_SUB:
+        op = VM_SUB;
+        break;
+    case BIN_MUL:
+        op = VM_MUL;
+        break;
+    case BIN_EQ:
+        op = VM_EQ;
+        break;
+    case BIN_GT:
+        op = VM_GT;
+        break;
+    case BIN_LT:
+        op = VM_LT;
+        break;
+    case BIN_DIV:
+    default:
+        ASSERT(false, "BINOP %s not implemented yet.",
+               binop_to_string(binop->op));
+        break;
+    }
+
+    // Operands are evaluated left to right before `dst` is written, so the
+    // destination may be one of them.
+    uint32_t lhs = vm_expr(binop->lhs);
+    if (KIND(binop->rhs) == AST_CONSTANT &&
+        tree_constant(g_vm.tree, binop->rhs)->type != TYPE_STRING)
+    {
+        // A constant right operand is carried by the instruction.
+        vm_emit((vm_opcode_t)(op + VM_ADD_IMM - VM_ADD), dst, lhs,
+                tree_constant(g_vm.tree, binop->rhs)->value);
+    }
+    else
+    {
+        uint32_t rhs = vm_expr(binop->rhs);
+        vm_emit(op, dst, lhs, (int32_t)rhs);
+    }
+    g_vm.top = mark;
+}
+
+// Emits `node` so its value ends up in `dst`.
+static void vm_expr_into(node_t node, uint32_t dst)
+{
+    switch (KIND(node))
+    {
+    case AST_BINOP:
+        vm_binop(node, dst);
+        break;
+    case AST_CONSTANT:
+    {
+        const tree_constant_t* constant = tree_constant(g_vm.tree, node);
+        if (constant->type == TYPE_STRING)
+        {
+            // Equal literals share their pool entry.
+            vm_emit(VM_STRING, dst, 0,
+                    (int32_t)sema_literal(g_vm.sema, node));
+        }
+        else
+        {
+            vm_emit(VM_INT, dst, 0, constant->value);
+        }
+        break;
+    }
+    case AST_IDENTIFIER:
+    {
+        symbol_t* symbol = SYMBOL(node);
+        if (symbol->type == SYMBOL_GLOBAL)
+        {
+            vm_emit(VM_LOAD_GLOBAL, dst, 0, (int32_t)symbol->name);
+        }
+        else if (vm_local(symbol) != dst)
+        {
+            vm_emit(VM_MOVE, dst, vm_local(symbol), 0);
+        }
+        break;
+    }
+    case AST_CALL:
+    {
+        uint32_t result = vm_call(node);
+        if (result != dst)
+        {
+            vm_emit(VM_MOVE, dst, result, 0);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Returns a register holding the value of `node`: a local's own register,
+// or a temporary the value is emitted into.
+static uint32_t vm_expr(node_t node)
+{
+    if (KIND(node) == AST_IDENTIFIER && SYMBOL(node)->type == SYMBOL_LOCAL)
+    {
+        return vm_local(SYMBOL(node));
+    }
+    uint32_t reg = vm_temp();
+    vm_expr_into(node, reg);
+    return reg;
+}
+
+// Jumps to `label` unless `condition` holds. Comparisons branch on their
+// operands directly rather than producing a bool first.
+static void vm_jump_unless(node_t condition, int32_t label)
+{
+    uint32_t mark = g_vm.top;
+    if (KIND(condition) == AST_BINOP)
+    {
+        const tree_binop_t* binop = tree_binop(g_vm.tree, condition);
+        vm_opcode_t op = binop->op == BIN_EQ   ? VM_JUMP_NE
+                         : binop->op == BIN_GT ? VM_JUMP_LE
+                         : binop->op == BIN_LT ? VM_JUMP_GE
+                                               : VM_JUMP;
+        if (op != VM_JUMP)
+        {
+            uint32_t lhs = vm_expr(binop->lhs);
+            uint32_t rhs = vm_expr(binop->rhs);
+            vm_emit(op, lhs, rhs, label);
+            g_vm.top = mark;
+            return;
+        }
+    }
+    vm_emit(VM_JUMP_ZERO, vm_expr(condition), 0, label);
+    g_vm.top = mark;
+}
+
+/* Statements */
+
+static void vm_block(node_t node)
+{
+    ASSERT(KIND(node) == AST_BLOCK, "Expected BLOCK node, got %s",
+           ast_to_string(KIND(node)));
+    tree_list_t block = tree_list(g_vm.tree, node);
+    for (uint32_t i = 0; i < block.count; i++)
+    {
+        vm_statement(tree_child(g_vm.tree, block, i));
+    }
+}
+
+static void vm_declfn(node_t node)
+{
+    const tree_declfn_t* declfn = tree_declfn(g_vm.tree, node);
+    ASSERT(g_vm.function == NODE_NONE,
+           "Function %s cannot be declared within another function.",
+           NAME(declfn->identifier));
+
+    // Arguments take the first registers, as their stack slots come first.
+    g_vm.function = node;
+    g_vm.locals = declfn->args.count;
+    g_vm.top = g_vm.locals;
+    g_vm.frame = 0;
+    g_vm.has_returned = false;
+    if (declfn->args.count > 0)
+    {
+        vm_use(declfn->args.count - 1);
+    }
+
+    vm_emit(VM_FUNCTION, 0, 0, (int32_t)IDENT(declfn->identifier));
+    vm_block(declfn->block);
+
+    // Void functions may omit their return. Semantic analysis has already
+    // rejected any other function without one.
+    if (!g_vm.has_returned)
+    {
+        vm_emit(VM_LEAVE, 0, 0, 0);
+    }
+    vm_emit(VM_END, g_vm.frame, 0, 0);
+    g_vm.function = NODE_NONE;
+}
+
+static void vm_assign(node_t node)
+{
+    const tree_assign_t* assign = tree_assign(g_vm.tree, node);
+    symbol_t* symbol = SYMBOL(assign->lhs);
+
+    if (symbol->type == SYMBOL_GLOBAL)
+    {
+        if (KIND(assign->lhs) == AST_DECLVAR)
+        {
+            vm_emit(VM_GLOBAL, 0, 0, (int32_t)symbol->name);
+        }
+        // Outside functions only the declaration counts, as the global
+        // starts at zero regardless.
+        if (g_vm.function != NODE_NONE)
+        {
+            vm_emit(VM_STORE_GLOBAL, vm_expr(assign->rhs), 0,
+                    (int32_t)symbol->name);
+        }
+        return;
+    }
+
+    uint32_t reg = vm_local(symbol);
+    if (KIND(assign->lhs) == AST_DECLVAR && reg >= g_vm.locals)
+    {
+        // The value is emitted straight into the new local, so temporaries
+        // start above it.
+        g_vm.locals = vm_use(reg) + 1;
+        g_vm.top = g_vm.locals;
+    }
+    vm_expr_into(assign->rhs, reg);
+}
+
+static void vm_if(node_t node)
+{
+    const tree_if_t* stmt = tree_if(g_vm.tree, node);
+    int32_t else_label = g_vm.label_count++;
+    int32_t end_label = g_vm.label_count++;
+
+    vm_jump_unless(stmt->condition, stmt->else_branch != NODE_NONE
+                                        ? else_label
+                                        : end_label);
+    vm_statement(stmt->then_branch);
+    if (stmt->else_branch != NODE_NONE)
+    {
+        vm_emit(VM_JUMP, 0, 0, end_label);
+        vm_emit(VM_LABEL, 0, 0, else_label);
+        vm_statement(stmt->else_branch);
+    }
+    vm_emit(VM_LABEL, 0, 0, end_label);
+}
+
+static void vm_while(node_t node)
+{
+    const tree_while_t* stmt = tree_while(g_vm.tree, node);
+    int32_t start_label = g_vm.label_count++;
+    int32_t end_label = g_vm.label_count++;
+
+    vm_emit(VM_LABEL, 0, 0, start_label);
+    vm_jump_unless(stmt->condition, end_label);
+    vm_statement(stmt->block);
+    vm_emit(VM_JUMP, 0, 0, start_label);
+    vm_emit(VM_LABEL, 0, 0, end_label);
+}
+
+static void vm_return(node_t node)
+{
+    node_t rhs = tree_return(g_vm.tree, node);
+    if (rhs != NODE_NONE)
+    {
+        vm_emit(VM_RETURN, vm_expr(rhs), 0, 0);
+    }
+    else
+    {
+        vm_emit(VM_LEAVE, 0, 0, 0);
+    }
+    g_vm.has_returned = true;
+}
+
+void vm_statement(node_t node)
+{
+    // No temporary outlives the statement that claimed it.
+    g_vm.top = g_vm.locals;
+    switch (KIND(node))
+    {
+    case AST_ASSIGN:
+        vm_assign(node);
+        break;
+    case AST_DECLFN:
+        vm_declfn(node);
+        break;
+    case AST_BLOCK:
+        vm_block(node);
+        break;
+    case AST_RETURN:
+        vm_return(node);
+        break;
+    case AST_CALL:
+        vm_call(node);
+        break;
+    case AST_IF:
+        vm_if(node);
+        break;
+    case AST_WHILE:
+        vm_while(node);
+        break;
+    default:
+        break;
+    }
+}
+
+void vm_program(tree_t* tree, sema_t* sema)
+{
+    g_vm.tree = tree;
+    g_vm.sema = sema;
+    g_vm.label_count = 0;
+    g_vm.function = NODE_NONE;
+    ASSERT(KIND(tree->root) == AST_PROGRAM, "Wanted node type PROGRAM, got %s",
+           ast_to_string(KIND(tree->root)));
+
+    tree_list_t program = tree_list(tree, tree->root);
+    for (uint32_t i = 0; i < program.count; i++)
+    {
+        tree_list_t body = tree_list(tree, tree_child(tree, program, i));
+        for (uint32_t j = 0; j < body.count; j++)
+        {
+            // Native code places statements outside functions where nothing
+            // jumps to them, so only declarations are kept.
+            node_t statement = tree_child(tree, body, j);
+            if (KIND(statement) == AST_DECLFN || KIND(statement) == AST_ASSIGN)
+            {
+                vm_statement(statement);
+            }
+        }
+    }
+
+    // The string literal pool, each entry NULL-terminated.
+    for (uint32_t i = 0; i < sema->pool_count; i++)
+    {
+        const char* text = tree->strings + sema->pool[i];
+        buffer_write(g_codegen->rodata_bytes, text, strlen(text) + 1);
+    }
+
+    g_vm.tree = NULL;
+    g_vm.sema = NULL;
+}
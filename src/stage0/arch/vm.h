@@ -0,0 +1,53 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "codegen.h"
+#include "sema.h"
+#include "tree.h"
+
+/* Bytecode VM
+ *
+ * Compiles a program to the register-based bytecode of vm_inst.h rather
+ * than to assembly, and runs it within the compiler, so a program can be
+ * tried without an assembler or a linker. The bytecode follows the x86-64
+ * emitter: statements outside functions never run and globals start at
+ * zero, and functions outside the program are called in the C library.
+ */
+
+typedef struct vm_context_t
+{
+    // Program being emitted
+    tree_t* tree;
+    // Names and types resolved for `tree` ahead of emission
+    sema_t* sema;
+
+    // Count of labels
+    int32_t label_count;
+
+    // Function being emitted, or NODE_NONE outside functions
+    node_t function;
+    // Registers of the current function holding its arguments and the
+    // locals declared so far. Temporaries are handed out above them.
+    uint32_t locals;
+    // Next free temporary register
+    uint32_t top;
+    // Registers the current function uses so far
+    uint32_t frame;
+    // Has this function returned at least once?
+    bool has_returned;
+} vm_context_t;
+
+void vm_program(tree_t* tree, sema_t* sema);
+void vm_statement(node_t node);
+
+// Loads the bytecode held by `codegen` and runs its `main` function,
+// storing the result in `status`. Returns false if the program could not
+// be loaded or ran out of stack.
+bool vm_run(const codegen_t* codegen, int* status);
+
+extern codegen_t CODEGEN_BYTECODE;
+
+#endif
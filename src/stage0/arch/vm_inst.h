@@ -0,0 +1,101 @@
+#ifndef VM_INST_H
+#define VM_INST_H
+
+#include <stdint.h>
+
+/* Bytecode
+ *
+ * Instructions of the bytecode VM, each a fixed-size record appended to the
+ * codegen records as the program is emitted. Every value is 64 bits: an
+ * integer, a bool as 0 or 1, or the address of a string.
+ *
+ * Each call runs in a frame of registers on the VM's value stack. A function
+ * of n arguments finds them in registers 0 to n-1, followed by its locals in
+ * declaration order, as semantic analysis numbered their stack slots, and
+ * then its temporaries. A call passes its arguments in consecutive
+ * registers of the caller starting at `b`, which become the callee's first
+ * registers without being copied, and the result is left in register `b`.
+ *
+ * As with the x86-64 records, names and labels are left symbolic while the
+ * program is emitted: directives mark where functions, globals and labels
+ * are defined, and instructions refer to them by atom or label number.
+ * Loading the program resolves every reference and drops the directives.
+ */
+
+typedef enum vm_opcode_t
+{
+    // Starts the function named by the atom `c`.
+    VM_FUNCTION,
+    // Ends the current function, which uses `a` registers.
+    VM_END,
+    // Defines the global variable named by the atom `c`, zero until set.
+    VM_GLOBAL,
+    // Defines the label numbered `c` within the current function.
+    VM_LABEL,
+
+    // a = c
+    VM_INT,
+    // a = address of the string `c`: its pool entry as emitted, its offset
+    // within the loaded strings once loaded.
+    VM_STRING,
+    // a = b
+    VM_MOVE,
+    // a = the global `c`: its atom as emitted, its index once loaded.
+    VM_LOAD_GLOBAL,
+    // The global `c` = a
+    VM_STORE_GLOBAL,
+
+    // a = b op register c
+    VM_ADD,
+    VM_SUB,
+    VM_MUL,
+    VM_EQ,
+    VM_GT,
+    VM_LT,
+    // a = b op the immediate c, in the same order as the forms above
+    VM_ADD_IMM,
+    VM_SUB_IMM,
+    VM_MUL_IMM,
+    VM_EQ_IMM,
+    VM_GT_IMM,
+    VM_LT_IMM,
+    // a = a newly allocated string holding b followed by c
+    VM_CONCAT,
+
+    // Jumps to the label `c`: its number as emitted, its instruction index
+    // once loaded.
+    VM_JUMP,
+    // Jumps to `c` if a is zero.
+    VM_JUMP_ZERO,
+    // Jumps to `c` unless a == b, a > b or a < b respectively.
+    VM_JUMP_NE,
+    VM_JUMP_LE,
+    VM_JUMP_GE,
+
+    // Calls the function `c` with the `a` arguments starting at register b,
+    // leaving its result in b. `c` is the callee's atom as emitted; once
+    // loaded, the index of a function of the program.
+    VM_CALL,
+    // As VM_CALL, for a function of the C library: once loaded, `c` indexes
+    // the functions the program binds from it.
+    VM_CALL_NATIVE,
+    // Returns a to the caller.
+    VM_RETURN,
+    // Returns without a value.
+    VM_LEAVE,
+    // Stops the program, which returned a. Only added by the loader.
+    VM_HALT,
+    VM_OPCODE_COUNT,
+} vm_opcode_t;
+
+typedef struct vm_inst_t
+{
+    // `vm_opcode_t` as emitted. Where the VM dispatches through computed
+    // gotos, the address of the instruction's handler once loaded.
+    uintptr_t op;
+    uint16_t a;
+    uint16_t b;
+    int32_t c;
+} vm_inst_t;
+
+#endif
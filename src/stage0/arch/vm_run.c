@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include "intern.h"
+#include "log.h"
+#include "macros.h"
+#include "vm.h"
+#include "vm_inst.h"
+
+// Dispatch jumps straight from each handler to the next through the handler
+// address stored in the instruction, where the compiler supports taking the
+// address of a label. Elsewhere a switch decodes each opcode.
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+// Values on the stack shared by every frame, as much as the native stack
+// holds at one value per 8 bytes.
+#define VM_STACK_VALUES (1 << 20)
+// Calls in progress at once.
+#define VM_FRAMES (1 << 18)
+// Arguments a function of the C library may be passed. Up to
+// VM_NATIVE_REGISTER_ARGS go in registers alone; longer calls pass all of
+// these, the extra ones ignored as under the C calling convention.
+#define VM_NATIVE_ARGS 16
+#define VM_NATIVE_REGISTER_ARGS 6
+#define VM_NONE UINT32_MAX
+
+typedef int64_t (*vm_native_t)(int64_t, ...);
+
+typedef struct vm_function_t
+{
+    const vm_inst_t* entry;
+    // Registers used, counting the arguments.
+    uint32_t frame;
+} vm_function_t;
+
+// A call in progress.
+typedef struct vm_frame_t
+{
+    const vm_inst_t* pc;
+    int64_t* fp;
+} vm_frame_t;
+
+// A program loaded from the records of a codegen object, with every
+// reference resolved.
+typedef struct vm_module_t
+{
+    vm_inst_t* code;
+    uint32_t code_count;
+    vm_function_t* functions;
+    vm_native_t* natives;
+    int64_t* globals;
+    char* strings;
+    // Index of the first instruction run, which calls `main`.
+    uint32_t start;
+} vm_module_t;
+
+static void vm_module_free(vm_module_t* module)
+{
+    free(module->code);
+    free(module->functions);
+    free(module->natives);
+    free(module->globals);
+    free(module->strings);
+}
+
+// Returns the address of the C library function `name`, or NULL.
+static vm_native_t vm_native(void* self, const char* name)
+{
+#ifndef _WIN32
+    void* function = self ? dlsym(self, name) : NULL;
+    vm_native_t native = NULL;
+    memcpy(&native, &function, sizeof(native));
+    return native;
+#else
+    (void)self;
+    (void)name;
+    return NULL;
+#endif
+}
+
+// Copies the records of `codegen` into `module`, dropping the directives,
+// and resolves every label, string, global and function they refer to.
+static bool vm_load(const codegen_t* codegen, vm_module_t* module)
+{
+    memset(module, 0, sizeof(*module));
+
+    // Gather the records, with room for the two instructions starting the
+    // program.
+    size_t record_count = codegen->records->size / sizeof(vm_inst_t);
+    module->code = (vm_inst_t*)malloc((record_count + 2) * sizeof(vm_inst_t));
+    ASSERT(module->code != NULL, "Out of memory loading the program.");
+    size_t copied = 0;
+    for (const buffer_chunk_t* chunk = codegen->records->head; chunk;
+         chunk = chunk->next)
+    {
+        memcpy((char*)module->code + copied, chunk->data, chunk->size);
+        copied += chunk->size;
+    }
+
+    // Size the tables of each kind of definition.
+    uint32_t function_count = 0;
+    uint32_t global_count = 0;
+    uint32_t label_count = 0;
+    for (size_t i = 0; i < record_count; i++)
+    {
+        const vm_inst_t* inst = &module->code[i];
+        function_count += inst->op == VM_FUNCTION;
+        global_count += inst->op == VM_GLOBAL;
+        if (inst->op == VM_LABEL && (uint32_t)inst->c >= label_count)
+        {
+            label_count = (uint32_t)inst->c + 1;
+        }
+    }
+
+    size_t atom_count = intern_count();
+    uint32_t* function_of = (uint32_t*)malloc(atom_count * sizeof(uint32_t));
+    uint32_t* global_of = (uint32_t*)malloc(atom_count * sizeof(uint32_t));
+    uint32_t* native_of = (uint32_t*)malloc(atom_count * sizeof(uint32_t));
+    uint32_t* labels = (uint32_t*)calloc(label_count + 1, sizeof(uint32_t));
+    module->functions =
+        (vm_function_t*)calloc(function_count + 1, sizeof(vm_function_t));
+    module->natives = (vm_native_t*)calloc(atom_count + 1, sizeof(vm_native_t));
+    module->globals = (int64_t*)calloc(global_count + 1, sizeof(int64_t));
+    ASSERT(function_of != NULL && global_of != NULL && native_of != NULL &&
+               labels != NULL && module->functions != NULL &&
+               module->natives != NULL && module->globals != NULL,
+           "Out of memory loading the program.");
+    memset(function_of, 0xFF, atom_count * sizeof(uint32_t));
+    memset(global_of, 0xFF, atom_count * sizeof(uint32_t));
+    memset(native_of, 0xFF, atom_count * sizeof(uint32_t));
+
+    // Record where each definition lands as the directives are dropped.
+    // Functions keep the index of their entry until every one is placed.
+    uint32_t* entries = (uint32_t*)calloc(function_count + 1, sizeof(uint32_t));
+    ASSERT(entries != NULL, "Out of memory loading the program.");
+    uint32_t count = 0;
+    uint32_t functions = 0;
+    uint32_t globals = 0;
+    for (size_t i = 0; i < record_count; i++)
+    {
+        const vm_inst_t inst = module->code[i];
+        switch (inst.op)
+        {
+        case VM_FUNCTION:
+            function_of[inst.c] = functions;
+            entries[functions++] = count;
+            break;
+        case VM_END:
+            module->functions[functions - 1].frame = inst.a;
+            break;
+        case VM_GLOBAL:
+            global_of[inst.c] = globals++;
+            break;
+        case VM_LABEL:
+            labels[inst.c] = count;
+            break;
+        default:
+            module->code[count++] = inst;
+            break;
+        }
+    }
+
+    // Start by calling `main` from a frame of one register, which receives
+    // its result.
+    atom_t main_atom = intern("main", strlen("main"));
+    ASSERT(main_atom < atom_count && function_of[main_atom] != VM_NONE,
+           "The program has no main function.");
+    module->start = count;
+    vm_inst_t start[] = {
+        {VM_CALL, 0, 0, (int32_t)function_of[main_atom]},
+        {VM_HALT, 0, 0, 0},
+    };
+    memcpy(module->code + count, start, sizeof(start));
+    module->code_count = count + 2;
+    for (uint32_t i = 0; i < function_count; i++)
+    {
+        module->functions[i].entry = module->code + entries[i];
+    }
+
+    // Strings are laid out in pool order, each after the previous one's
+    // NULL-terminator.
+    size_t strings_size = codegen->rodata_bytes->size;
+    module->strings = (char*)malloc(strings_size + 1);
+    ASSERT(module->strings != NULL, "Out of memory loading the program.");
+    copied = 0;
+    for (const buffer_chunk_t* chunk = codegen->rodata_bytes->head; chunk;
+         chunk = chunk->next)
+    {
+        memcpy(module->strings + copied, chunk->data, chunk->size);
+        copied += chunk->size;
+    }
+    uint32_t* string_offsets =
+        (uint32_t*)malloc((strings_size + 1) * sizeof(uint32_t));
+    ASSERT(string_offsets != NULL, "Out of memory loading the program.");
+    uint32_t string_count = 0;
+    for (size_t offset = 0; offset < strings_size;
+         offset += strlen(module->strings + offset) + 1)
+    {
+        string_offsets[string_count++] = (uint32_t)offset;
+    }
+
+    // Calls to names the program does not define go to the C library.
+    bool resolved = true;
+    uint32_t native_count = 0;
+#ifndef _WIN32
+    void* self = dlopen(NULL, RTLD_NOW);
+#else
+    void* self = NULL;
+#endif
+    for (uint32_t i = 0; i < count; i++)
+    {
+        vm_inst_t* inst = &module->code[i];
+        switch (inst->op)
+        {
+        case VM_STRING:
+            inst->c = (int32_t)string_offsets[inst->c];
+            break;
+        case VM_LOAD_GLOBAL:
+        case VM_STORE_GLOBAL:
+            inst->c = (int32_t)global_of[inst->c];
+            break;
+        case VM_JUMP:
+        case VM_JUMP_ZERO:
+        case VM_JUMP_NE:
+        case VM_JUMP_LE:
+        case VM_JUMP_GE:
+            inst->c = (int32_t)labels[inst->c];
+            break;
+        case VM_CALL:
+        {
+            atom_t callee = (atom_t)inst->c;
+            if (function_of[callee] != VM_NONE)
+            {
+                inst->c = (int32_t)function_of[callee];
+                break;
+            }
+            if (inst->a > VM_NATIVE_ARGS)
+            {
+                log_error("%s takes more than %d arguments.",
+                          atom_name(callee), VM_NATIVE_ARGS);
+                resolved = false;
+                break;
+            }
+            if (native_of[callee] == VM_NONE)
+            {
+                vm_native_t native = vm_native(self, atom_name(callee));
+                if (!native)
+                {
+                    log_error("Undefined function %s.", atom_name(callee));
+                    resolved = false;
+                    break;
+                }
+                native_of[callee] = native_count;
+                module->natives[native_count++] = native;
+            }
+            inst->op = VM_CALL_NATIVE;
+            inst->c = (int32_t)native_of[callee];
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+#ifndef _WIN32
+    if (self)
+    {
+        dlclose(self);
+    }
+#endif
+    free(function_of);
+    free(global_of);
+    free(native_of);
+    free(labels);
+    free(entries);
+    free(string_offsets);
+    return resolved;
+}
+
+// Concatenates the strings at `lhs` and `rhs` into a new allocation, as the
+// native `concat` helper does.
+static int64_t vm_concat(int64_t lhs, int64_t rhs)
+{
+    const char* left = (const char*)(intptr_t)lhs;
+    const char* right = (const char*)(intptr_t)rhs;
+    char* result = (char*)malloc(strlen(left) + strlen(right) + 1);
+    ASSERT(result != NULL, "Out of memory concatenating strings.");
+    strcpy(result, left);
+    strcat(result, right);
+    return (int64_t)(intptr_t)result;
+}
+
+// Runs `module` from its start. Returns false if it ran out of stack.
+static bool vm_execute(vm_module_t* module, int* status)
+{
+#ifdef VM_THREADED
+    static const void* const HANDLERS[VM_OPCODE_COUNT] = {
+        [VM_INT] = &&vm_op_INT,
+        [VM_STRING] = &&vm_op_STRING,
+        [VM_MOVE] = &&vm_op_MOVE,
+        [VM_LOAD_GLOBAL] = &&vm_op_LOAD_GLOBAL,
+        [VM_STORE_GLOBAL] = &&vm_op_STORE_GLOBAL,
+        [VM_ADD] = &&vm_op_ADD,
+        [VM_SUB] = &&vm_op_SUB,
+        [VM_MUL] = &&vm_op_MUL,
+        [VM_EQ] = &&vm_op_EQ,
+        [VM_GT] = &&vm_op_GT,
+        [VM_LT] = &&vm_op_LT,
+        [VM_ADD_IMM] = &&vm_op_ADD_IMM,
+        [VM_SUB_IMM] = &&vm_op_SUB_IMM,
+        [VM_MUL_IMM] = &&vm_op_MUL_IMM,
+        [VM_EQ_IMM] = &&vm_op_EQ_IMM,
+        [VM_GT_IMM] = &&vm_op_GT_IMM,
+        [VM_LT_IMM] = &&vm_op_LT_IMM,
+        [VM_CONCAT] = &&vm_op_CONCAT,
+        [VM_JUMP] = &&vm_op_JUMP,
+        [VM_JUMP_ZERO] = &&vm_op_JUMP_ZERO,
+        [VM_JUMP_NE] = &&vm_op_JUMP_NE,
+        [VM_JUMP_LE] = &&vm_op_JUMP_LE,
+        [VM_JUMP_GE] = &&vm_op_JUMP_GE,
+        [VM_CALL] = &&vm_op_CALL,
+        [VM_CALL_NATIVE] = &&vm_op_CALL_NATIVE,
+        [VM_RETURN] = &&vm_op_RETURN,
+        [VM_LEAVE] = &&vm_op_LEAVE,
+        [VM_HALT] = &&vm_op_HALT,
+    };
+    // Thread the code: each instruction names its handler from now on.
+    for (uint32_t i = 0; i < module->code_count; i++)
+    {
+        module->code[i].op = (uintptr_t)HANDLERS[module->code[i].op];
+    }
+#define VM_OP(name) vm_op_##name:
+#define VM_DISPATCH() goto *(const void*)pc->op
+#else
+#define VM_OP(name) case VM_##name:
+#define VM_DISPATCH() goto vm_dispatch
+#endif
+#define VM_NEXT()                                                              \
+    pc++;                                                                      \
+    VM_DISPATCH()
+
+    int64_t* stack = (int64_t*)calloc(VM_STACK_VALUES + VM_NATIVE_ARGS,
+                                      sizeof(int64_t));
+    vm_frame_t* frames = (vm_frame_t*)malloc(VM_FRAMES * sizeof(vm_frame_t));
+    ASSERT(stack != NULL && frames != NULL,
+           "Out of memory running the program.");
+    const int64_t* stack_end = stack + VM_STACK_VALUES;
+    const vm_frame_t* frames_end = frames + VM_FRAMES;
+
+    const vm_inst_t* code = module->code;
+    const vm_function_t* functions = module->functions;
+    vm_native_t* natives = module->natives;
+    int64_t* globals = module->globals;
+    const char* strings = module->strings;
+    const vm_inst_t* pc = code + module->start;
+    vm_frame_t* frame = frames;
+    int64_t* fp = stack;
+    bool finished = false;
+
+#ifdef VM_THREADED
+    VM_DISPATCH();
+#else
+vm_dispatch:
+    switch ((vm_opcode_t)pc->op)
+    {
+#endif
+    VM_OP(INT)
+    {
+        fp[pc->a] = pc->c;
+        VM_NEXT();
+    }
+    VM_OP(STRING)
+    {
+        fp[pc->a] = (int64_t)(intptr_t)(strings + pc->c);
+        VM_NEXT();
+    }
+    VM_OP(MOVE)
+    {
+        fp[pc->a] = fp[pc->b];
+        VM_NEXT();
+    }
+    VM_OP(LOAD_GLOBAL)
+    {
+        fp[pc->a] = globals[pc->c];
+        VM_NEXT();
+    }
+    VM_OP(STORE_GLOBAL)
+    {
+        globals[pc->c] = fp[pc->a];
+        VM_NEXT();
+    }
+    // Arithmetic wraps, as it does in native code.
+    VM_OP(ADD)
+    {
+        fp[pc->a] = (int64_t)((uint64_t)fp[pc->b] + (uint64_t)fp[pc->c]);
+        VM_NEXT();
+    }
+    VM_OP(SUB)
+    {
+        fp[pc->a] = (int64_t)((uint64_t)fp[pc->b] - (uint64_t)fp[pc->c]);
+        VM_NEXT();
+    }
+    VM_OP(MUL)
+    {
+        fp[pc->a] = (int64_t)((uint64_t)fp[pc->b] * (uint64_t)fp[pc->c]);
+        VM_NEXT();
+    }
+    VM_OP(EQ)
+    {
+        fp[pc->a] = fp[pc->b] == fp[pc->c];
+        VM_NEXT();
+    }
+    VM_OP(GT)
+    {
+        fp[pc->a] = fp[pc->b] > fp[pc->c];
+        VM_NEXT();
+    }
+    VM_OP(LT)
+    {
+        fp[pc->a] = fp[pc->b] < fp[pc->c];
+        VM_NEXT();
+    }
+    VM_OP(ADD_IMM)
+    {
+        fp[pc->a] = (int64_t)((uint64_t)fp[pc->b] + (uint64_t)(int64_t)pc->c);
+        VM_NEXT();
+    }
+    VM_OP(SUB_IMM)
+    {
+        fp[pc->a] = (int64_t)((uint64_t)fp[pc->b] - (uint64_t)(int64_t)pc->c);
+        VM_NEXT();
+    }
+    VM_OP(MUL_IMM)
+    {
+        fp[pc->a] = (int64_t)((uint64_t)fp[pc->b] * (uint64_t)(int64_t)pc->c);
+        VM_NEXT();
+    }
+    VM_OP(EQ_IMM)
+    {
+        fp[pc->a] = fp[pc->b] == pc->c;
+        VM_NEXT();
+    }
+    VM_OP(GT_IMM)
+    {
+        fp[pc->a] = fp[pc->b] > pc->c;
+        VM_NEXT();
+    }
+    VM_OP(LT_IMM)
+    {
+        fp[pc->a] = fp[pc->b] < pc->c;
+        VM_NEXT();
+    }
+    VM_OP(CONCAT)
+    {
+        fp[pc->a] = vm_concat(fp[pc->b], fp[pc->c]);
+        VM_NEXT();
+    }
+    VM_OP(JUMP)
+    {
+        pc = code + pc->c;
+        VM_DISPATCH();
+    }
+    VM_OP(JUMP_ZERO)
+    {
+        pc = fp[pc->a] == 0 ? code + pc->c : pc + 1;
+        VM_DISPATCH();
+    }
+    VM_OP(JUMP_NE)
+    {
+        pc = fp[pc->a] != fp[pc->b] ? code + pc->c : pc + 1;
+        VM_DISPATCH();
+    }
+    VM_OP(JUMP_LE)
+    {
+        pc = fp[pc->a] <= fp[pc->b] ? code + pc->c : pc + 1;
+        VM_DISPATCH();
+    }
+    VM_OP(JUMP_GE)
+    {
+        pc = fp[pc->a] >= fp[pc->b] ? code + pc->c : pc + 1;
+        VM_DISPATCH();
+    }
+    VM_OP(CALL)
+    {
+        const vm_function_t* function = &functions[pc->c];
+        int64_t* callee = fp + pc->b;
+        if (callee + function->frame > stack_end || frame == frames_end)
+        {
+            log_error("Stack overflow.");
+            goto vm_done;
+        }
+        frame->pc = pc + 1;
+        frame->fp = fp;
+        frame++;
+        fp = callee;
+        pc = function->entry;
+        VM_DISPATCH();
+    }
+    VM_OP(CALL_NATIVE)
+    {
+        const int64_t* args = fp + pc->b;
+        vm_native_t native = natives[pc->c];
+        fp[pc->b] = pc->a <= VM_NATIVE_REGISTER_ARGS
+                        ? native(args[0], args[1], args[2], args[3], args[4],
+                                 args[5])
+                        : native(args[0], args[1], args[2], args[3], args[4],
+                                 args[5], args[6], args[7], args[8], args[9],
+                                 args[10], args[11], args[12], args[13],
+                                 args[14], args[15]);
+        VM_NEXT();
+    }
+    // The result goes to the callee's first register, which is the register
+    // of the caller that held the first argument.
+    VM_OP(RETURN)
+    {
+        fp[0] = fp[pc->a];
+        frame--;
+        fp = frame->fp;
+        pc = frame->pc;
+        VM_DISPATCH();
+    }
+    VM_OP(LEAVE)
+    {
+        fp[0] = 0;
+        frame--;
+        fp = frame->fp;
+        pc = frame->pc;
+        VM_DISPATCH();
+    }
+    VM_OP(HALT)
+    {
+        *status = (int)fp[pc->a];
+        finished = true;
+        goto vm_done;
+    }
+#ifndef VM_THREADED
+    default:
+        ASSERT(false, "Invalid bytecode %d.", (int)pc->op);
+    }
+#endif
+
+vm_done:
+    free(stack);
+    free(frames);
+    return finished;
+
+#undef VM_OP
+#undef VM_DISPATCH
+#undef VM_NEXT
+}
+
+bool vm_run(const codegen_t* codegen, int* status)
+{
+    vm_module_t module;
+    bool ran = vm_load(codegen, &module);
+    if (ran)
+    {
+        // The program writes through this same stdout.
+        fflush(stdout);
+        ran = vm_execute(&module, status);
+        fflush(stdout);
+    }
+    vm_module_free(&module);
+    return ran;
+}
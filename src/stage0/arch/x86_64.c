@@ -9,11 +9,31 @@
 #include "reg.h"
 #include "stdlib.h"
 #include "x86_64.h"
+#include "x86_64_encode.h"
+#include "x86_64_inst.h"
 
 #define FN_CONCAT "concat"
 #define ENTER(name) log_debug("Entering " #name)
 #define EXIT(name) log_debug("Exiting " #name)
 
+// Free registers needed to evaluate a binary operation with both operands
+// held in registers: the result and the two operands. Below this, operands
+// are spilled to the stack instead.
+#define BINOP_REGISTERS 3
+
+// Shorthands for reading the compact tree being emitted.
+#define KIND(node) tree_kind(g_ctx.tree, (node))
+#define IDENT(node) tree_identifier(g_ctx.tree, (node))
+#define NAME(node) tree_name(g_ctx.tree, (node))
+// Shorthands for what semantic analysis resolved for a node.
+#define VALUE_TYPE(node) sema_type(g_ctx.sema, (node))
+#define SYMBOL(node) sema_symbol(g_ctx.sema, (node))
+// Shorthands for appending instructions to the text section.
+#define INST0(opcode) INST2(opcode, x86_none(), x86_none())
+#define INST1(opcode, dst) INST2(opcode, dst, x86_none())
+#define INST2(opcode, dst, src)                                                \
+    x86_inst(g_codegen->records, (opcode), (dst), (src))
+
 codegen_t CODEGEN_X86_64 = {
     .ops =
         {
@@ -25,521 +45,279 @@ codegen_t CODEGEN_X86_64 = {
             .declvar = x86_declvar,
             .assign = x86_assign,
             .call = x86_call,
-            .string = x86_string,
             .expr = x86_expr,
             .syscall = x86_syscall,
             .comment = x86_comment,
             .epilogue = x86_epilogue,
+            .object = x86_elf_object,
+            .executable = x86_elf_executable,
+            .run = x86_jit_run,
         },
     .type = X86_64,
 };
 
+// The same emitter printing GNU assembler syntax rather than NASM's.
+codegen_t CODEGEN_X86_64_GAS = {
+    .ops =
+        {
+            .program = x86_program,
+            .body = x86_body,
+            .statement = x86_statement,
+            .binop = x86_binop,
+            .declfn = x86_declfn,
+            .declvar = x86_declvar,
+            .assign = x86_assign,
+            .call = x86_call,
+            .expr = x86_expr,
+            .syscall = x86_syscall,
+            .comment = x86_comment,
+            .epilogue = x86_epilogue,
+            .object = x86_elf_object,
+            .executable = x86_elf_executable,
+            .run = x86_jit_run,
+        },
+    .type = X86_64_GAS,
+};
+
 static codegen_context_t g_ctx = {
-    .current_scope = NULL,
-    .global_scope = NULL,
-    .stack_offset = 0,
-    .string_count = 0,
+    .tree = NULL,
+    .sema = NULL,
     .branch_count = 0,
-    .in_function = false,
-    .current_function_name = NULL,
-    .expected_return_type = SYMBOL_VALUE_UNKNOWN,
     .has_returned = false,
-    .pending_function = NULL,
+    .pending_function = NODE_NONE,
 };
 
+// Is the program printed for the GNU assembler rather than NASM?
+static bool x86_gas()
+{
+    return g_codegen->type == X86_64_GAS;
+}
+
 /* x86 registers used for passing arguments */
 
-static const char* ARG_REGISTERS[] = {RDI, RSI, RDX, RCX, R8, R9};
+static const x86_reg_t ARG_REGISTERS[] = {X86_RDI, X86_RSI, X86_RDX,
+                                          X86_RCX, X86_R8,  X86_R9};
 static const size_t ARG_REGISTER_COUNT =
     sizeof(ARG_REGISTERS) / sizeof(ARG_REGISTERS[0]);
 
-static symbol_value_t symbol_value_from_ast_type(ast_value_type_t type)
+// Moves the stack pointer past the next local's slot. Semantic analysis has
+// already assigned each local its offset, in this same order.
+static void x86_reserve_slot()
 {
-    switch (type)
-    {
-    case TYPE_BOOL:
-        return SYMBOL_VALUE_BOOL;
-    case TYPE_INT:
-        return SYMBOL_VALUE_INT;
-    case TYPE_STRING:
-        return SYMBOL_VALUE_STRING;
-    case TYPE_VOID:
-    default:
-        ASSERT(false, "Invalid or unsupported parameter type: %d", type);
-        return SYMBOL_VALUE_UNKNOWN;
-    }
+    INST2(X86_SUB, x86_reg(X86_RSP), x86_imm(8));
 }
 
-static void x86_bind_function_args(ast* block_node)
+static atom_t x86_atom(const char* name)
 {
-    ast_declfn* pending = (ast_declfn*)g_ctx.pending_function;
-    if (!pending || !block_node || pending->block != block_node)
+    return intern(name, strlen(name));
+}
+
+static void x86_bind_function_args(node_t block_node)
+{
+    node_t pending_node = g_ctx.pending_function;
+    if (pending_node == NODE_NONE)
     {
         return;
     }
-
-    for (int i = 0; i < pending->count; i++)
+    const tree_declfn_t* pending = tree_declfn(g_ctx.tree, pending_node);
+    if (pending->block != block_node)
     {
-        ast* arg_ident = pending->args ? pending->args[i] : NULL;
-        if (!arg_ident)
-        {
-            continue;
-        }
+        return;
+    }
 
-        char* name = arg_ident->data.identifier.name;
-        symbol_t* symbol = symbol_define_local(name);
-        ast_value_type_t arg_type = (pending->arg_types && i < pending->count)
-                                        ? pending->arg_types[i]
-                                        : TYPE_INT;
-        symbol->value_type = symbol_value_from_ast_type(arg_type);
+    for (uint32_t i = 0; i < pending->args.count; i++)
+    {
+        node_t arg_ident = tree_child(g_ctx.tree, pending->args, i);
+        symbol_t* symbol = SYMBOL(arg_ident);
+        x86_reserve_slot();
 
         if ((size_t)i < ARG_REGISTER_COUNT)
         {
-            const char* src = ARG_REGISTERS[i];
-            EMIT(SECTION_TEXT, "\tmov [rbp%+td], %s\n", symbol->offset, src);
+            INST2(X86_MOV, x86_mem(X86_RBP, (int32_t)symbol->offset),
+                  x86_reg(ARG_REGISTERS[i]));
         }
         else
         {
             size_t stack_index = (size_t)i - ARG_REGISTER_COUNT;
             size_t src_offset = 16 + stack_index * 8;
-            char* tmp = register_lock();
-            ASSERT(tmp != NULL,
+            x86_reg_t tmp = register_lock();
+            ASSERT(tmp != REG_NONE,
                    "Ran out of registers while binding function arguments.");
-            EMIT(SECTION_TEXT, "\tmov %s, [rbp+%zu]\n", tmp, src_offset);
-            EMIT(SECTION_TEXT, "\tmov [rbp%+td], %s\n", symbol->offset, tmp);
+            INST2(X86_MOV, x86_reg(tmp),
+                  x86_mem(X86_RBP, (int32_t)src_offset));
+            INST2(X86_MOV, x86_mem(X86_RBP, (int32_t)symbol->offset),
+                  x86_reg(tmp));
             register_unlock();
         }
     }
 
-    g_ctx.pending_function = NULL;
+    g_ctx.pending_function = NODE_NONE;
 }
 
-static char* x86_concat_strings(ast* lhs_node, ast* rhs_node)
+// Evaluates `node` and pushes its value onto the stack, leaving no register
+// locked.
+static void x86_push_operand(node_t node)
 {
-    ENTER(STR_CONCAT);
-
-    // Evaluate both operands so we have registers holding their addresses.
-    char* lhs_reg = x86_expr(lhs_node);
-    char* rhs_reg = x86_expr(rhs_node);
-
-    // Move the evaluated pointers into calling-convention registers.
-    EMIT(SECTION_TEXT, "\tmov rdi, %s\n", lhs_reg);
-    EMIT(SECTION_TEXT, "\tmov rsi, %s\n", rhs_reg);
-
-    if (rhs_node->type != AST_CALL)
+    x86_reg_t reg = x86_expr(node);
+    INST1(X86_PUSH, x86_reg(reg));
+    if (KIND(node) != AST_CALL)
     {
         register_unlock();
     }
-    if (lhs_node->type != AST_CALL)
-    {
-        register_unlock();
-    }
-
-    // Call the shared helper which returns the concatenated buffer in RAX.
-    EMIT(SECTION_TEXT, "\tcall %s\n", FN_CONCAT);
-
-    char* dest_reg = register_lock();
-    EMIT(SECTION_TEXT, "\tmov %s, rax\n", dest_reg);
-
-    EXIT(STR_CONCAT);
-    return dest_reg;
 }
 
-static void emit_concat(void)
+// Emits a binary operation whose operands are evaluated onto the stack, so
+// that nesting depth is not limited by the number of registers. Only the
+// result register is locked, and only once both operands are computed.
+static x86_reg_t x86_binop_spilled(const tree_binop_t* binop)
 {
-    EMIT(SECTION_TEXT, "%s:\n", FN_CONCAT);
-    // Function prologue and a small spill area for temporaries/locals.
-    EMIT(SECTION_TEXT, "\tpush rbp\n");
-    EMIT(SECTION_TEXT, "\tmov rbp, rsp\n");
-    EMIT(SECTION_TEXT, "\tsub rsp, 40\n");
-    // Persist the incoming string pointers on the stack frame.
-    EMIT(SECTION_TEXT, "\tmov [rbp-8], rdi\n");
-    EMIT(SECTION_TEXT, "\tmov [rbp-16], rsi\n");
-    // Measure lhs length and stash the result.
-    EMIT(SECTION_TEXT, "\tmov rdi, [rbp-8]\n");
-    EMIT(SECTION_TEXT, "\tcall strlen\n");
-    EMIT(SECTION_TEXT, "\tmov [rbp-24], rax\n");
-    // Measure rhs length and stash the result.
-    EMIT(SECTION_TEXT, "\tmov rdi, [rbp-16]\n");
-    EMIT(SECTION_TEXT, "\tcall strlen\n");
-    EMIT(SECTION_TEXT, "\tmov [rbp-32], rax\n");
-    // Compute total size (lhs + rhs + null terminator) and allocate buffer.
-    EMIT(SECTION_TEXT, "\tmov rax, [rbp-24]\n");
-    EMIT(SECTION_TEXT, "\tadd rax, [rbp-32]\n");
-    EMIT(SECTION_TEXT, "\tadd rax, 1\n");
-    EMIT(SECTION_TEXT, "\tmov rdi, rax\n");
-    EMIT(SECTION_TEXT, "\tcall malloc\n");
-    EMIT(SECTION_TEXT, "\tmov [rbp-40], rax\n");
-    // Copy lhs into the destination buffer.
-    EMIT(SECTION_TEXT, "\tmov rdi, rax\n");
-    EMIT(SECTION_TEXT, "\tmov rsi, [rbp-8]\n");
-    EMIT(SECTION_TEXT, "\tcall strcpy\n");
-    // Append rhs immediately after lhs in the buffer.
-    EMIT(SECTION_TEXT, "\tmov rdi, [rbp-40]\n");
-    EMIT(SECTION_TEXT, "\tmov rsi, [rbp-16]\n");
-    EMIT(SECTION_TEXT, "\tcall strcat\n");
-    // Move the result pointer into RAX and tear down the frame.
-    EMIT(SECTION_TEXT, "\tmov rax, [rbp-40]\n");
-    EMIT(SECTION_TEXT, "\tadd rsp, 40\n");
-    EMIT(SECTION_TEXT, "\tpop rbp\n");
-    EMIT(SECTION_TEXT, "\tret\n");
-}
+    x86_push_operand(binop->lhs);
+    x86_push_operand(binop->rhs);
 
-/* Scope & Symbols */
+    x86_reg_t out_reg = register_lock();
+    ASSERT(out_reg != REG_NONE,
+           "Ran out of registers evaluating an expression.");
 
-scope_t* scope_new(scope_t* parent)
-{
-    scope_t* scope = (scope_t*)calloc(1, sizeof(scope_t));
-    // Chain to parent so lookups can walk outward when resolving symbols.
-    scope->parent = parent;
-    // Start with a modest capacity to minimize allocations for small blocks.
-    scope->capacity = 8;
-    scope->symbols = (symbol_t*)calloc(scope->capacity, sizeof(symbol_t));
-    return scope;
-}
-
-void scope_free(scope_t* scope)
-{
-    if (!scope)
+    // The left operand sits at [rsp+8] and the right one at [rsp].
+    INST2(X86_MOV, x86_reg(out_reg), x86_mem(X86_RSP, 8));
+    switch (binop->op)
     {
-        return;
-    }
-    // Symbols are POD so freeing the backing array cleans up the entries.
-    free(scope->symbols);
-    free(scope);
-}
-
-void scope_push()
-{
-    ASSERT(g_ctx.current_scope != NULL, "Cannot push scope with no parent.");
-    // Create a child scope whose parent is the current scope and make it
-    // active. Locals declared after this point live inside this new scope.
-    g_ctx.current_scope = scope_new(g_ctx.current_scope);
-}
-
-void scope_pop()
-{
-    ASSERT(g_ctx.current_scope != NULL, "No scope to pop.");
-    scope_t* current = g_ctx.current_scope;
-    ASSERT(current->parent != NULL, "Cannot pop the global scope.");
-    // Restore the parent scope and release the storage used for the child.
-    g_ctx.current_scope = current->parent;
-    scope_free(current);
-}
-
-symbol_t* scope_lookup_shallow(scope_t* scope, const char* name)
-{
-    if (!scope)
+    case BIN_ADD:
+        INST2(X86_ADD, x86_reg(out_reg), x86_mem(X86_RSP, 0));
+        break;
+    case BIN_SUB:
+        INST2(X86_SUB, x86_reg(out_reg), x86_mem(X86_RSP, 0));
+        break;
+    case BIN_MUL:
+        INST2(X86_IMUL, x86_reg(out_reg), x86_mem(X86_RSP, 0));
+        break;
+    case BIN_DIV:
+        ASSERT(false, "BINOP %s not implemented yet.",
+               binop_to_string(binop->op));
+        break;
+    case BIN_EQ:
+    case BIN_GT:
+    case BIN_LT:
     {
-        return NULL;
+        x86_opcode_t condition = binop->op == BIN_EQ   ? X86_CMOVE
+                                 : binop->op == BIN_GT ? X86_CMOVG
+                                                       : X86_CMOVL;
+        // Without a spare register, the truthy value is staged in the
+        // right operand's (now consumed) stack slot. Neither `mov` changes
+        // the flags set by `cmp`.
+        INST2(X86_CMP, x86_reg(out_reg), x86_mem(X86_RSP, 0));
+        INST2(X86_MOV, x86_reg(out_reg), x86_imm(0));
+        INST2(X86_MOV, x86_mem(X86_RSP, 0), x86_imm(1));
+        INST2(condition, x86_reg(out_reg), x86_mem(X86_RSP, 0));
+        break;
     }
-    // Search only the provided scope so we can enforce one definition per
-    // block when adding locals.
-    for (size_t i = 0; i < scope->count; i++)
-    {
-        if (strcmp(scope->symbols[i].name, name) == 0)
-        {
-            return &scope->symbols[i];
-        }
+    default:
+        break;
     }
-    return NULL;
+    INST2(X86_ADD, x86_reg(X86_RSP), x86_imm(16));
+    return out_reg;
 }
 
-symbol_t* scope_lookup(scope_t* scope, const char* name)
+static x86_reg_t x86_concat_strings(node_t lhs_node, node_t rhs_node)
 {
-    scope_t* current = scope;
-    while (current)
+    ENTER(STR_CONCAT);
+
+    if (register_free_count() < BINOP_REGISTERS)
     {
-        // Try the innermost scope first; if not found, walk to the parent and
-        // keep searching until a match is discovered or we hit the root.
-        symbol_t* symbol = scope_lookup_shallow(current, name);
-        if (symbol)
+        // Too few registers to hold the left operand while evaluating the
+        // right one, so park it on the stack meanwhile.
+        x86_push_operand(lhs_node);
+        x86_reg_t rhs_reg = x86_expr(rhs_node);
+        INST2(X86_MOV, x86_reg(X86_RSI), x86_reg(rhs_reg));
+        INST1(X86_POP, x86_reg(X86_RDI));
+        if (KIND(rhs_node) != AST_CALL)
         {
-            return symbol;
+            register_unlock();
         }
-        current = current->parent;
     }
-    return NULL;
-}
-
-symbol_t* scope_add_symbol(scope_t* scope, const char* name,
-                           symbol_scope_t type)
-{
-    ASSERT(scope != NULL, "Scope cannot be NULL when adding a symbol.");
-
-    if (scope->count >= scope->capacity)
+    else
     {
-        // Grow the underlying array and zero the newly added slots so future
-        // bookkeeping starts from a clean state.
-        size_t new_capacity = scope->capacity ? scope->capacity * 2 : 8;
-        scope->symbols =
-            (symbol_t*)realloc(scope->symbols, new_capacity * sizeof(symbol_t));
-        memset(scope->symbols + scope->capacity, 0,
-               (new_capacity - scope->capacity) * sizeof(symbol_t));
-        scope->capacity = new_capacity;
-    }
+        // Evaluate both operands so we have registers holding their
+        // addresses.
+        x86_reg_t lhs_reg = x86_expr(lhs_node);
+        x86_reg_t rhs_reg = x86_expr(rhs_node);
 
-    symbol_t* symbol = &scope->symbols[scope->count++];
-    symbol->name = name;
-    symbol->type = type;
-    symbol->value_type = SYMBOL_VALUE_UNKNOWN;
-    symbol->offset = 0;
-
-    char* message = symbol_to_string(symbol);
-    log_debug("New symbol: %s", message);
-    free(message);
-    return symbol;
-}
-
-ptrdiff_t allocate_stack_slot()
-{
-    ASSERT(g_ctx.in_function,
-           "Stack slots can only be allocated inside functions.");
-    // Move the stack pointer once per slot and track the total offset so we
-    // can address locals relative to RBP.
-    g_ctx.stack_offset += 8;
-    EMIT(SECTION_TEXT, "\tsub rsp, 8\n");
-    return -g_ctx.stack_offset;
-}
-
-symbol_t* symbol_define_global(const char* name)
-{
-    ASSERT(g_ctx.global_scope != NULL, "Global scope is not initialized.");
-    symbol_t* existing = scope_lookup_shallow(g_ctx.global_scope, name);
-    ASSERT(existing == NULL, "Global symbol %s already defined.", name);
-    // Record the new binding in the global scope table so it can be referenced
-    // from anywhere in the program.
-    return scope_add_symbol(g_ctx.global_scope, name, SYMBOL_GLOBAL);
-}
-
-symbol_t* symbol_define_local(const char* name)
-{
-    ASSERT(g_ctx.current_scope != NULL, "Current scope is not set.");
-    ASSERT(g_ctx.current_scope != g_ctx.global_scope,
-           "Local declarations require a function scope.");
-    symbol_t* existing = scope_lookup_shallow(g_ctx.current_scope, name);
-    ASSERT(existing == NULL, "Symbol %s already defined in this scope.", name);
-
-    symbol_t* symbol =
-        scope_add_symbol(g_ctx.current_scope, name, SYMBOL_LOCAL);
-    // Locals reside on the stack, so reserve and record their frame offset.
-    symbol->offset = allocate_stack_slot();
-    return symbol;
-}
+        // Move the evaluated pointers into calling-convention registers.
+        INST2(X86_MOV, x86_reg(X86_RDI), x86_reg(lhs_reg));
+        INST2(X86_MOV, x86_reg(X86_RSI), x86_reg(rhs_reg));
 
-symbol_t* symbol_resolve(const char* name)
-{
-    // Walk outward through scopes (starting from current) until a declaration
-    // appears. This enforces Gentoo's requirement that identifiers must be
-    // defined in an enclosing lexical scope.
-    symbol_t* symbol = scope_lookup(g_ctx.current_scope, name);
-    ASSERT(symbol != NULL, "Undefined symbol: %s", name);
-    return symbol;
-}
-
-symbol_value_t get_symbol_value_type(ast* node)
-{
-    if (!node)
-    {
-        return SYMBOL_VALUE_UNKNOWN;
-    }
-
-    // Determine the value type by looking at the syntactic shape; literals and
-    // explicit type annotations provide their type immediately, while
-    // identifiers require symbol resolution.
-    switch (node->type)
-    {
-    case AST_TYPE:
-    {
-        switch (node->data.type.type)
-        {
-        case TYPE_VOID:
-        {
-            return SYMBOL_VALUE_VOID;
-        }
-        case TYPE_BOOL:
-        {
-            return SYMBOL_VALUE_BOOL;
-        }
-        case TYPE_INT:
-        {
-            return SYMBOL_VALUE_INT;
-        }
-        case TYPE_STRING:
-        {
-            return SYMBOL_VALUE_STRING;
-        }
-        default:
+        if (KIND(rhs_node) != AST_CALL)
         {
-            return SYMBOL_VALUE_INT;
-        }
-        }
-    }
-    // Constants can only be one of BOOL, INT, or STRING
-    case AST_CONSTANT:
-    {
-        switch (node->data.constant.type)
-        {
-        case TYPE_BOOL:
-        {
-            return SYMBOL_VALUE_BOOL;
-        }
-        case TYPE_STRING:
-        {
-            return SYMBOL_VALUE_STRING;
+            register_unlock();
         }
-        default:
+        if (KIND(lhs_node) != AST_CALL)
         {
-            return SYMBOL_VALUE_INT;
-        }
+            register_unlock();
         }
     }
-    // Resolve the symbol of the identifier by its name and return the symbol's
-    // `value_type`.
-    case AST_IDENTIFIER:
-    {
-        char* name = node->data.identifier.name;
-        symbol_t* symbol = symbol_resolve(name);
-        ASSERT(symbol->value_type != SYMBOL_VALUE_UNKNOWN,
-               "Symbol '%s' has unknown type.", symbol->name);
-        return symbol->value_type;
-    }
-    // Evalutate the binary operation and determine the resulting symbol value
-    // type.
-    case AST_BINOP:
-    {
-        symbol_value_t lhs = get_symbol_value_type(node->data.binop.lhs);
-        symbol_value_t rhs = get_symbol_value_type(node->data.binop.rhs);
 
-        ASSERT(lhs != SYMBOL_VALUE_UNKNOWN,
-               "Left-hand symbol has unknown type.");
-        ASSERT(rhs != SYMBOL_VALUE_UNKNOWN,
-               "Right-hand symbol has unknown type.");
-
-        log_debug("lhs: %s", ast_to_string(node->data.binop.lhs->type));
-        log_debug("rhs: %s", ast_to_string(node->data.binop.rhs->type));
-
-        switch (node->data.binop.op)
-        {
-        case BIN_ADD:
-        { // Strings can only be added to strings
-            if (lhs == SYMBOL_VALUE_STRING && rhs == SYMBOL_VALUE_STRING)
-            {
-                return SYMBOL_VALUE_STRING;
-            }
+    // Call the shared helper which returns the concatenated buffer in RAX.
+    INST1(X86_CALL, x86_name(x86_atom(FN_CONCAT)));
 
-            // Otherwise only allow adding ints to ints.
-            ASSERT(lhs == SYMBOL_VALUE_INT && rhs == SYMBOL_VALUE_INT,
-                   "Cannot add %s to %s.", symbol_value_to_string(lhs),
-                   symbol_value_to_string(rhs));
-            return SYMBOL_VALUE_INT;
-        }
-        case BIN_SUB:
-        case BIN_MUL:
-        case BIN_DIV:
-        { // Only allow subtracting, multiplying, and dividing ints by ints.
-            ASSERT(lhs == SYMBOL_VALUE_INT && rhs == SYMBOL_VALUE_INT,
-                   "Operator %s only supports integers.",
-                   binop_to_string(node->data.binop.op));
-            return SYMBOL_VALUE_INT;
-        }
-        case BIN_EQ:
-        {
-            ASSERT(lhs == rhs, "Equality only supports comparing same types.");
-            return SYMBOL_VALUE_BOOL;
-        }
-        case BIN_GT:
-        case BIN_LT:
-        {
-            ASSERT(lhs == SYMBOL_VALUE_INT && rhs == SYMBOL_VALUE_INT,
-                   "Operator %s only supports integers.",
-                   binop_to_string(node->data.binop.op));
-            return SYMBOL_VALUE_BOOL;
-        }
-        default:
-        {
-            break;
-        }
-        }
-        break;
-    }
-    // Return the function's return type
-    case AST_CALL:
-    {
-        symbol_t* symbol =
-            symbol_resolve(node->data.call.identifier->data.identifier.name);
-        return symbol->ret_type;
-    }
-    default:
-    {
-        break;
-    }
-    }
+    x86_reg_t dest_reg = register_lock();
+    ASSERT(dest_reg != REG_NONE,
+           "Ran out of registers concatenating strings.");
+    INST2(X86_MOV, x86_reg(dest_reg), x86_reg(X86_RAX));
 
-    return SYMBOL_VALUE_UNKNOWN;
+    EXIT(STR_CONCAT);
+    return dest_reg;
 }
 
-void x86_globals(ast* node)
+static void emit_concat(void)
 {
-    if (!node)
-    {
-        return;
-    }
-
-    ASSERT(node->type == AST_PROGRAM,
-           "Expected PROGRAM node when collecting globals, got %s",
-           ast_to_string(node->type));
-
-    ast_program* program = &node->data.program;
-    for (int i = 0; i < program->count; i++)
-    {
-        ast* body_node = program->body[i];
-        if (!body_node || body_node->type != AST_BODY)
-        {
-            continue;
-        }
-
-        ast_body* body = &body_node->data.body;
-        for (int j = 0; j < body->count; j++)
-        {
-            ast* statement = body->statements[j];
-            if (!statement || statement->type != AST_ASSIGN)
-            {
-                continue;
-            }
-
-            ast* lhs = statement->data.assign.lhs;
-            if (lhs && lhs->type == AST_DECLVAR)
-            {
-                // Only declarations at the top level become globals; record
-                // them so codegen knows every symbol up front.
-                char* name = lhs->data.declvar.identifier->data.identifier.name;
-                symbol_t* symbol =
-                    scope_lookup_shallow(g_ctx.global_scope, name);
-                if (symbol == NULL)
-                {
-                    symbol = scope_add_symbol(g_ctx.global_scope, name,
-                                              SYMBOL_GLOBAL);
-                }
-
-                symbol_value_t rhs_type =
-                    get_symbol_value_type(statement->data.assign.rhs);
-                // The first assignment sets the type, subsequent ones must
-                // match to avoid conflicting global definitions.
-                if (symbol->value_type == SYMBOL_VALUE_UNKNOWN)
-                {
-                    symbol->value_type = rhs_type;
-                }
-                else
-                {
-                    ASSERT(symbol->value_type == rhs_type,
-                           "Global '%s' type mismatch (%s vs %s).", name,
-                           symbol_value_to_string(symbol->value_type),
-                           symbol_value_to_string(rhs_type));
-                }
-            }
-        }
-    }
+    x86_operand_t rax = x86_reg(X86_RAX);
+    x86_operand_t rdi = x86_reg(X86_RDI);
+    x86_operand_t rsi = x86_reg(X86_RSI);
+    x86_operand_t rbp = x86_reg(X86_RBP);
+    x86_operand_t rsp = x86_reg(X86_RSP);
+    x86_operand_t lhs = x86_mem(X86_RBP, -8);
+    x86_operand_t rhs = x86_mem(X86_RBP, -16);
+    x86_operand_t lhs_length = x86_mem(X86_RBP, -24);
+    x86_operand_t rhs_length = x86_mem(X86_RBP, -32);
+    x86_operand_t result = x86_mem(X86_RBP, -40);
+    x86_operand_t strlen_fn = x86_name(x86_atom("strlen"));
+
+    INST1(X86_FUNCTION, x86_name(x86_atom(FN_CONCAT)));
+    // Function prologue and a small spill area for temporaries/locals.
+    INST1(X86_PUSH, rbp);
+    INST2(X86_MOV, rbp, rsp);
+    INST2(X86_SUB, rsp, x86_imm(40));
+    // Persist the incoming string pointers on the stack frame.
+    INST2(X86_MOV, lhs, rdi);
+    INST2(X86_MOV, rhs, rsi);
+    // Measure lhs length and stash the result.
+    INST2(X86_MOV, rdi, lhs);
+    INST1(X86_CALL, strlen_fn);
+    INST2(X86_MOV, lhs_length, rax);
+    // Measure rhs length and stash the result.
+    INST2(X86_MOV, rdi, rhs);
+    INST1(X86_CALL, strlen_fn);
+    INST2(X86_MOV, rhs_length, rax);
+    // Compute total size (lhs + rhs + null terminator) and allocate buffer.
+    INST2(X86_MOV, rax, lhs_length);
+    INST2(X86_ADD, rax, rhs_length);
+    INST2(X86_ADD, rax, x86_imm(1));
+    INST2(X86_MOV, rdi, rax);
+    INST1(X86_CALL, x86_name(x86_atom("malloc")));
+    INST2(X86_MOV, result, rax);
+    // Copy lhs into the destination buffer.
+    INST2(X86_MOV, rdi, rax);
+    INST2(X86_MOV, rsi, lhs);
+    INST1(X86_CALL, x86_name(x86_atom("strcpy")));
+    // Append rhs immediately after lhs in the buffer.
+    INST2(X86_MOV, rdi, result);
+    INST2(X86_MOV, rsi, rhs);
+    INST1(X86_CALL, x86_name(x86_atom("strcat")));
+    // Move the result pointer into RAX and tear down the frame.
+    INST2(X86_MOV, rax, result);
+    INST2(X86_ADD, rsp, x86_imm(40));
+    INST1(X86_POP, rbp);
+    INST0(X86_RET);
 }
 
 /* Emitters */
@@ -547,13 +325,13 @@ void x86_globals(ast* node)
 void x86_epilogue(bool returns)
 {
     // Tear down this stack frame so the caller regains ownership of RSP/RBP.
-    EMIT(SECTION_TEXT, "\tmov rsp, rbp\n");
-    EMIT(SECTION_TEXT, "\tpop rbp\n");
+    INST2(X86_MOV, x86_reg(X86_RSP), x86_reg(X86_RBP));
+    INST1(X86_POP, x86_reg(X86_RBP));
     if (returns)
     {
         // Only emit `ret` when ending a function, not internal helper
         // epilogues.
-        EMIT(SECTION_TEXT, "\tret\n");
+        INST0(X86_RET);
         g_ctx.has_returned = true;
     }
 }
@@ -561,48 +339,55 @@ void x86_epilogue(bool returns)
 void x86_prologue()
 {
     // Save the caller's RBP and anchor a fresh base pointer at the current SP.
-    EMIT(SECTION_TEXT, "\tpush rbp\n");
-    EMIT(SECTION_TEXT, "\tmov rbp, rsp\n");
+    INST1(X86_PUSH, x86_reg(X86_RBP));
+    INST2(X86_MOV, x86_reg(X86_RBP), x86_reg(X86_RSP));
 }
 
 void x86_comment(char* text)
 {
-    // Comments are prefixed with ';' in NASM syntax.
-    EMIT(SECTION_TEXT, "; %s\n", text);
+    INST1(X86_COMMENT, x86_name(x86_atom(text)));
 }
 
 void x86_syscall(int code)
 {
     // System V ABI expects the syscall number in RAX before invoking `syscall`.
-    EMIT(SECTION_TEXT, "\tmov %s, %d\n", RAX, code);
-    EMIT(SECTION_TEXT, "\tsyscall\n");
+    INST2(X86_MOV, x86_reg(X86_RAX), x86_imm(code));
+    INST0(X86_SYSCALL);
 }
 
-char* x86_binop(ast* node)
+x86_reg_t x86_binop(node_t node)
 {
     ENTER(BINOP);
 
-    ast_binop* binop = &node->data.binop;
+    const tree_binop_t* binop = tree_binop(g_ctx.tree, node);
 
     if (binop->op == BIN_ADD)
     {
-        symbol_value_t lhs_type = get_symbol_value_type(binop->lhs);
-        symbol_value_t rhs_type = get_symbol_value_type(binop->rhs);
-        if (lhs_type == SYMBOL_VALUE_STRING && rhs_type == SYMBOL_VALUE_STRING)
+        if (VALUE_TYPE(binop->lhs) == SYMBOL_VALUE_STRING &&
+            VALUE_TYPE(binop->rhs) == SYMBOL_VALUE_STRING)
         {
             // String concatenation is implemented via the helper; bail out of
             // the numeric pipeline once we detect both operands are strings.
-            char* string_reg = x86_concat_strings(binop->lhs, binop->rhs);
+            x86_reg_t string_reg = x86_concat_strings(binop->lhs, binop->rhs);
             EXIT(BINOP);
             return string_reg;
         }
     }
 
+    // Deeply nested expressions would otherwise run out of registers, as
+    // every enclosing operation holds its result and left operand.
+    if (register_free_count() < BINOP_REGISTERS)
+    {
+        x86_reg_t spilled_reg = x86_binop_spilled(binop);
+        EXIT(BINOP);
+        return spilled_reg;
+    }
+
     // Reserve a register to hold the result of the operation, then evaluate
     // the operands so their values reside in registers before we emit ops.
-    char* out_reg = register_lock();
-    char* lhs = x86_expr(binop->lhs);
-    char* rhs = x86_expr(binop->rhs);
+    x86_reg_t out_reg = register_lock();
+    x86_reg_t lhs = x86_expr(binop->lhs);
+    x86_reg_t rhs = x86_expr(binop->rhs);
 
     // Emit the instruction sequence matching the requested operator.
     switch (binop->op)
@@ -610,8 +395,8 @@ char* x86_binop(ast* node)
     case BIN_ADD:
     {
         // Compute out_reg = lhs + rhs (preserve left-to-right order)
-        EMIT(SECTION_TEXT, "\tmov %s, %s\n", out_reg, lhs);
-        EMIT(SECTION_TEXT, "\tadd %s, %s\n", out_reg, rhs);
+        INST2(X86_MOV, x86_reg(out_reg), x86_reg(lhs));
+        INST2(X86_ADD, x86_reg(out_reg), x86_reg(rhs));
         // Release rhs
         register_unlock();
         // Release lhs
@@ -622,8 +407,8 @@ char* x86_binop(ast* node)
     case BIN_SUB:
     {
         // Compute out_reg = lhs - rhs (preserve left-to-right order)
-        EMIT(SECTION_TEXT, "\tmov %s, %s\n", out_reg, lhs);
-        EMIT(SECTION_TEXT, "\tsub %s, %s\n", out_reg, rhs);
+        INST2(X86_MOV, x86_reg(out_reg), x86_reg(lhs));
+        INST2(X86_SUB, x86_reg(out_reg), x86_reg(rhs));
         // Release rhs
         register_unlock();
         // Release lhs
@@ -634,8 +419,8 @@ char* x86_binop(ast* node)
     case BIN_MUL:
     {
         // Move lhs into the output register, then multiply by rhs
-        EMIT(SECTION_TEXT, "\tmov %s, %s\n", out_reg, lhs);
-        EMIT(SECTION_TEXT, "\timul %s, %s\n", out_reg, rhs);
+        INST2(X86_MOV, x86_reg(out_reg), x86_reg(lhs));
+        INST2(X86_IMUL, x86_reg(out_reg), x86_reg(rhs));
         // Release rhs
         register_unlock();
         // Release lhs
@@ -654,32 +439,32 @@ char* x86_binop(ast* node)
         // All comparison forms reuse the same register pattern: compare the
         // operands, load 0/1 sentinels, then conditionally move the truthy
         // value into the output register.
-        const char* condition = NULL;
+        x86_opcode_t condition;
         if (binop->op == BIN_EQ)
         {
-            condition = "cmove";
+            condition = X86_CMOVE;
         }
         else if (binop->op == BIN_GT)
         {
-            condition = "cmovg";
+            condition = X86_CMOVG;
         }
         else
         {
-            condition = "cmovl";
+            condition = X86_CMOVL;
         }
 
-        EMIT(SECTION_TEXT, "\tcmp %s, %s\n", lhs, rhs);
+        INST2(X86_CMP, x86_reg(lhs), x86_reg(rhs));
         // Release rhs
         register_unlock();
         // Release lhs
         register_unlock();
 
-        EMIT(SECTION_TEXT, "\tmov %s, 0\n", out_reg);
-        char* true_reg = register_lock();
-        ASSERT(true_reg != NULL,
+        INST2(X86_MOV, x86_reg(out_reg), x86_imm(0));
+        x86_reg_t true_reg = register_lock();
+        ASSERT(true_reg != REG_NONE,
                "Unable to allocate register for comparison result.");
-        EMIT(SECTION_TEXT, "\tmov %s, 1\n", true_reg);
-        EMIT(SECTION_TEXT, "\t%s %s, %s\n", condition, out_reg, true_reg);
+        INST2(X86_MOV, x86_reg(true_reg), x86_imm(1));
+        INST2(condition, x86_reg(out_reg), x86_reg(true_reg));
         register_unlock();
         break;
     }
@@ -690,168 +475,122 @@ char* x86_binop(ast* node)
     return out_reg;
 }
 
-void x86_declvar(ast* node)
+void x86_declvar(node_t node)
 {
     ENTER(DECLVAR);
-    char* name = node->data.declvar.identifier->data.identifier.name;
+    atom_t name = IDENT(tree_declvar(g_ctx.tree, node)->identifier);
     // Reserve eight bytes (dq) initialized to zero for this global symbol.
-    EMIT(SECTION_DATA, "\t%s: dq %d\n", name, 0);
+    buffer_putc(g_codegen->data, '\t');
+    buffer_write(g_codegen->data, atom_name(name), atom_length(name));
+    if (x86_gas())
+    {
+        buffer_put_literal(g_codegen->data, ": .quad 0\n");
+    }
+    else
+    {
+        buffer_put_literal(g_codegen->data, ": dq 0\n");
+    }
+    INST1(X86_VARIABLE, x86_name(name));
     EXIT(DECLVAR);
 }
 
-void x86_block(ast* node)
+void x86_block(node_t node)
 {
-    ASSERT(node->type == AST_BLOCK, "Expected BLOCK node, got %s",
-           ast_to_string(node->type));
+    ASSERT(KIND(node) == AST_BLOCK, "Expected BLOCK node, got %s",
+           ast_to_string(KIND(node)));
 
-    // Each block introduces a fresh scope to keep locals isolated.
-    scope_push();
     x86_bind_function_args(node);
-    ast_block* block = &node->data.block;
-    for (int i = 0; i < block->count; i++)
+    tree_list_t block = tree_list(g_ctx.tree, node);
+    for (uint32_t i = 0; i < block.count; i++)
     {
         // Emit each statement in order; side-effects accumulate on the current
         // scope and stack frame until the block completes.
-        x86_statement(block->statements[i]);
+        x86_statement(tree_child(g_ctx.tree, block, i));
     }
-
-    scope_pop();
 }
 
-void x86_declfn(ast* node)
+void x86_declfn(node_t node)
 {
     ENTER(DECLFN);
 
     // Get the function name
-    char* name = node->data.declfn.identifier->data.identifier.name;
+    const tree_declfn_t* declfn = tree_declfn(g_ctx.tree, node);
+    atom_t name = IDENT(declfn->identifier);
+    symbol_t* symbol = SYMBOL(node);
+    g_ctx.has_returned = false;
 
-    // Define a new global symbol if it's not found
-    symbol_t* symbol = scope_lookup_shallow(g_ctx.global_scope, name);
-    if (!symbol)
+    if (x86_gas())
     {
-        symbol = symbol_define_global(name);
-        symbol->ret_type = get_symbol_value_type(node->data.declfn.ret_type);
+        buffer_put_literal(g_codegen->global, ".globl ");
     }
     else
     {
-        log_error("Symbol %s already defined.", name);
-        exit(1);
+        buffer_put_literal(g_codegen->global, "global ");
     }
-
-    bool prev_in_function = g_ctx.in_function;
-    ptrdiff_t prev_stack_offset = g_ctx.stack_offset;
-    const char* prev_function_name = g_ctx.current_function_name;
-    symbol_value_t prev_return_type = g_ctx.expected_return_type;
-
-    g_ctx.in_function = true;
-    g_ctx.stack_offset = 0;
-    g_ctx.current_function_name = name;
-    g_ctx.expected_return_type = symbol->ret_type;
-    g_ctx.has_returned = false;
-
-    EMIT(SECTION_GLOBAL, "global %s\n", name);
-    EMIT(SECTION_TEXT, "%s:\n", name);
+    buffer_write(g_codegen->global, atom_name(name), atom_length(name));
+    buffer_putc(g_codegen->global, '\n');
+    INST1(X86_GLOBAL, x86_name(name));
+    INST1(X86_FUNCTION, x86_name(name));
 
     // Standard prologue gives us a stable frame pointer so locals have fixed
     // offsets and call/return conventions stay consistent.
     x86_prologue();
 
     // Emit the body statements with the newly created function context.
-    g_ctx.pending_function = (ast*)&node->data.declfn;
-    x86_block(node->data.declfn.block);
+    g_ctx.pending_function = node;
+    x86_block(declfn->block);
 
     // Allow omission of explicit return for void functions by emitting the
-    // shared epilogue if no earlier return ran.
+    // shared epilogue if no earlier return ran. Semantic analysis has already
+    // rejected any other function without one.
     if (symbol->ret_type == SYMBOL_VALUE_VOID && !g_ctx.has_returned)
     {
         x86_epilogue(true);
     }
-    else if (!g_ctx.has_returned)
-    {
-        log_error("Missing return type in function '%s' (expected %s).",
-                  symbol->name, symbol_value_to_string(symbol->ret_type));
-        exit(1);
-    }
     g_ctx.has_returned = false;
-    g_ctx.pending_function = NULL;
-
-    g_ctx.in_function = prev_in_function;
-    g_ctx.stack_offset = prev_stack_offset;
-    g_ctx.current_function_name = prev_function_name;
-    g_ctx.expected_return_type = prev_return_type;
+    g_ctx.pending_function = NODE_NONE;
     EXIT(DECLFN);
 }
 
-void x86_assign(ast* node)
+void x86_assign(node_t node)
 {
     ENTER(ASSIGN);
 
     // Emit the right hand side first (fully processing any expressions)
-    ast* rhs = node->data.assign.rhs;
-    symbol_value_t rhs_type = get_symbol_value_type(rhs);
-    char* rhs_reg = x86_expr(rhs);
-
-    ast* lhs = node->data.assign.lhs;
-    char* name = NULL;
-    symbol_t* symbol = NULL;
+    const tree_assign_t* assign = tree_assign(g_ctx.tree, node);
+    node_t rhs = assign->rhs;
+    x86_reg_t rhs_reg = x86_expr(rhs);
 
-    switch (lhs->type)
+    node_t lhs = assign->lhs;
+    symbol_t* symbol = SYMBOL(lhs);
+    if (KIND(lhs) == AST_DECLVAR)
     {
-    // If it's a new variable, declare it
-    case AST_DECLVAR:
-        name = lhs->data.declvar.identifier->data.identifier.name;
-        if (g_ctx.in_function)
+        if (symbol->type == SYMBOL_LOCAL)
         {
             // Locals consume stack slots inside the current function.
-            symbol = symbol_define_local(name);
+            x86_reserve_slot();
         }
         else
         {
-            symbol = scope_lookup_shallow(g_ctx.global_scope, name);
-            if (!symbol)
-            {
-                symbol = symbol_define_global(name);
-            }
             // Global declarations reserve space in the data segment so they
             // can be addressed directly.
             x86_declvar(lhs);
         }
-        break;
-    // Otherwise obtain the existing variable name
-    case AST_IDENTIFIER:
-        name = lhs->data.identifier.name;
-        symbol = symbol_resolve(name);
-        break;
-    }
-
-    ASSERT(symbol != NULL, "Failed to resolve symbol for %s", name);
-
-    // Fix up the symbol's value type the first time we encounter it and ensure
-    // subsequent assignments respect the inferred/static type.
-    if (symbol->value_type == SYMBOL_VALUE_UNKNOWN)
-    {
-        symbol->value_type = rhs_type;
-    }
-    else
-    {
-        ASSERT(symbol->value_type == rhs_type,
-               "Cannot assign %s value to %s (expected %s).",
-               symbol_value_to_string(rhs_type), name,
-               symbol_value_to_string(symbol->value_type));
     }
 
     if (symbol->type == SYMBOL_GLOBAL)
     {
         // Globals live in memory, so store into the named label.
-        EMIT(SECTION_TEXT, "\tmov [%s], %s\n", name, rhs_reg);
+        INST2(X86_MOV, x86_mem_global(symbol->name), x86_reg(rhs_reg));
     }
     else
     {
         // Stack locals are addressed relative to RBP.
-        EMIT(SECTION_TEXT, "\tmov [rbp%+td], %s\n", symbol->offset, rhs_reg);
+        INST2(X86_MOV, x86_mem(X86_RBP, (int32_t)symbol->offset),
+              x86_reg(rhs_reg));
     }
 
-    if (rhs->type != AST_CALL)
+    if (KIND(rhs) != AST_CALL)
     {
         register_unlock();
     }
@@ -859,32 +598,31 @@ void x86_assign(ast* node)
     EXIT(ASSIGN);
 }
 
-void x86_if(ast* node)
+void x86_if(node_t node)
 {
     ENTER(IF);
-    ASSERT(node->type == AST_IF, "Expected IF node, got %s",
-           ast_to_string(node->type));
+    ASSERT(KIND(node) == AST_IF, "Expected IF node, got %s",
+           ast_to_string(KIND(node)));
 
-    ast_if_stmt* stmt = &node->data.if_stmt;
+    const tree_if_t* stmt = tree_if(g_ctx.tree, node);
     int label_id = g_ctx.branch_count++;
 
     // Evaluate the condition once and compare the result against zero.
-    char* cond_reg = x86_expr(stmt->condition);
-    char* else_label = NULL;
-    char* end_label = formats(".Lendif_%d", label_id);
+    x86_reg_t cond_reg = x86_expr(stmt->condition);
+    x86_operand_t else_label = x86_symbol(X86_SYMBOL_ELSE, label_id);
+    x86_operand_t end_label = x86_symbol(X86_SYMBOL_ENDIF, label_id);
 
-    EMIT(SECTION_TEXT, "\tcmp %s, 0\n", cond_reg);
-    if (stmt->else_branch)
+    INST2(X86_CMP, x86_reg(cond_reg), x86_imm(0));
+    if (stmt->else_branch != NODE_NONE)
     {
-        else_label = formats(".Lelse_%d", label_id);
-        EMIT(SECTION_TEXT, "\tje %s\n", else_label);
+        INST1(X86_JE, else_label);
     }
     else
     {
-        EMIT(SECTION_TEXT, "\tje %s\n", end_label);
+        INST1(X86_JE, end_label);
     }
 
-    if (stmt->condition->type != AST_CALL)
+    if (KIND(stmt->condition) != AST_CALL)
     {
         register_unlock();
     }
@@ -892,109 +630,74 @@ void x86_if(ast* node)
     // Emit the `then` branch when the condition is truthy.
     x86_statement(stmt->then_branch);
 
-    if (stmt->else_branch)
+    if (stmt->else_branch != NODE_NONE)
     {
         // Skip the else block after executing the then branch, mirroring high
         // level structured flow.
-        EMIT(SECTION_TEXT, "\tjmp %s\n", end_label);
-        EMIT(SECTION_TEXT, "%s:\n", else_label);
+        INST1(X86_JMP, end_label);
+        INST1(X86_LABEL, else_label);
         x86_statement(stmt->else_branch);
     }
 
-    EMIT(SECTION_TEXT, "%s:\n", end_label);
-
-    free(end_label);
-    if (else_label)
-    {
-        free(else_label);
-    }
+    INST1(X86_LABEL, end_label);
     EXIT(IF);
 }
 
-void x86_while(ast* node)
+void x86_while(node_t node)
 {
     ENTER(WHILE);
     log_info("Emitting WHILE loop...");
-    ASSERT(node->type == AST_WHILE, "Expected WHILE node, got %s",
-           ast_to_string(node->type));
+    ASSERT(KIND(node) == AST_WHILE, "Expected WHILE node, got %s",
+           ast_to_string(KIND(node)));
 
-    ast_while_stmt* stmt = &node->data.while_stmt;
+    const tree_while_t* stmt = tree_while(g_ctx.tree, node);
 
     // Construct new start and end labels for this while block
     int label_id = g_ctx.branch_count++;
-    char* start_label = formats(".Lwhile_begin_%d", label_id);
-    char* end_label = formats(".Lwhile_end_%d", label_id);
+    x86_operand_t start_label = x86_symbol(X86_SYMBOL_WHILE_BEGIN, label_id);
+    x86_operand_t end_label = x86_symbol(X86_SYMBOL_WHILE_END, label_id);
 
-    EMIT(SECTION_TEXT, "%s:\n", start_label);
+    INST1(X86_LABEL, start_label);
 
     // Evaluate the expression
-    char* cond_reg = x86_expr(stmt->condition);
+    x86_reg_t cond_reg = x86_expr(stmt->condition);
 
     // Does the expression evaluate true?
-    EMIT(SECTION_TEXT, "\tcmp %s, 0\n", cond_reg);
+    INST2(X86_CMP, x86_reg(cond_reg), x86_imm(0));
 
     //
-    if (stmt->condition->type != AST_CALL)
+    if (KIND(stmt->condition) != AST_CALL)
     {
         register_unlock();
     }
 
     // If true, jump to the end label
-    EMIT(SECTION_TEXT, "\tje %s\n", end_label);
+    INST1(X86_JE, end_label);
 
     // Emit the block
     x86_statement(stmt->block);
 
     // At the end of the block, jump back to the condition
-    EMIT(SECTION_TEXT, "\tjmp %s\n", start_label);
+    INST1(X86_JMP, start_label);
 
     // Emit the end label (continue beyond the while statement)
-    EMIT(SECTION_TEXT, "%s:\n", end_label);
-
-    free(start_label);
-    free(end_label);
+    INST1(X86_LABEL, end_label);
 
     EXIT(WHILE);
 }
 
-void x86_return(ast* node)
+void x86_return(node_t node)
 {
     ENTER(RET);
-    ast* rhs = node->data.ret.node;
-    symbol_value_t expected_type = g_ctx.expected_return_type;
-    ASSERT(expected_type != SYMBOL_VALUE_UNKNOWN,
-           "Return statement outside of a function context.");
-
-    symbol_value_t actual_type =
-        rhs ? get_symbol_value_type(rhs) : SYMBOL_VALUE_VOID;
-    const char* fn_name = g_ctx.current_function_name
-                              ? g_ctx.current_function_name
-                              : "<anonymous>";
-
-    // Enforce that void signatures never produce a value and non-void
-    // signatures always return exactly one value of the right type.
-    if (expected_type == SYMBOL_VALUE_VOID)
-    {
-        ASSERT(rhs == NULL || actual_type == SYMBOL_VALUE_VOID,
-               "Function '%s' declared void cannot return a value.", fn_name);
-    }
-    else
-    {
-        ASSERT(rhs != NULL, "Function '%s' must return a %s value.", fn_name,
-               symbol_value_to_string(expected_type));
-        ASSERT(actual_type == expected_type,
-               "Return type mismatch in function '%s' (expected %s, got %s).",
-               fn_name, symbol_value_to_string(expected_type),
-               symbol_value_to_string(actual_type));
-    }
+    node_t rhs = tree_return(g_ctx.tree, node);
 
-    if (rhs)
+    if (rhs != NODE_NONE)
     {
-        char* rhs_reg;
+        x86_reg_t rhs_reg = REG_NONE;
 
         // Only a handful of node types are valid return expressions; ensure
         // we delegate to the expression emitter for those shapes.
-        switch (rhs->type)
+        switch (KIND(rhs))
         {
         case AST_BINOP:
         case AST_CONSTANT:
@@ -1006,12 +709,12 @@ void x86_return(ast* node)
             ASSERT(false,
                    "Invalid right-hand type for RETURN: %d. Wanted one of "
                    "[BINOP, CONSTANT, IDENTIFIER, CALL].",
-                   rhs->type);
+                   KIND(rhs));
         }
 
         // Move the result into RAX before returning to the caller.
-        EMIT(SECTION_TEXT, "\tmov rax, %s\n", rhs_reg);
-        if (rhs->type != AST_CALL)
+        INST2(X86_MOV, x86_reg(X86_RAX), x86_reg(rhs_reg));
+        if (KIND(rhs) != AST_CALL)
         {
             register_unlock();
         }
@@ -1022,12 +725,13 @@ void x86_return(ast* node)
     EXIT(RET);
 }
 
-char* x86_call(ast* node)
+x86_reg_t x86_call(node_t node)
 {
     ENTER(CALL);
-    char* reg = RAX;
-    char* callee = node->data.call.identifier->data.identifier.name;
-    size_t arg_count = node->data.call.count;
+    x86_reg_t reg = X86_RAX;
+    const tree_call_t* call = tree_call(g_ctx.tree, node);
+    atom_t callee = IDENT(call->identifier);
+    size_t arg_count = call->args.count;
     size_t reg_arg_count =
         arg_count < ARG_REGISTER_COUNT ? arg_count : ARG_REGISTER_COUNT;
     size_t stack_arg_count =
@@ -1038,10 +742,10 @@ char* x86_call(ast* node)
     for (size_t idx = arg_count; idx > reg_arg_count;)
     {
         idx--;
-        ast* arg = node->data.call.args[idx];
-        char* arg_reg = x86_expr(arg);
-        EMIT(SECTION_TEXT, "\tpush %s\n", arg_reg);
-        if (arg->type != AST_CALL)
+        node_t arg = tree_child(g_ctx.tree, call->args, (uint32_t)idx);
+        x86_reg_t arg_reg = x86_expr(arg);
+        INST1(X86_PUSH, x86_reg(arg_reg));
+        if (KIND(arg) != AST_CALL)
         {
             register_unlock();
         }
@@ -1051,10 +755,10 @@ char* x86_call(ast* node)
     // them into the actual calling-convention registers in reverse order.
     for (size_t i = 0; i < reg_arg_count; i++)
     {
-        ast* arg = node->data.call.args[i];
-        char* arg_reg = x86_expr(arg);
-        EMIT(SECTION_TEXT, "\tpush %s\n", arg_reg);
-        if (arg->type != AST_CALL)
+        node_t arg = tree_child(g_ctx.tree, call->args, (uint32_t)i);
+        x86_reg_t arg_reg = x86_expr(arg);
+        INST1(X86_PUSH, x86_reg(arg_reg));
+        if (KIND(arg) != AST_CALL)
         {
             register_unlock();
         }
@@ -1062,80 +766,123 @@ char* x86_call(ast* node)
 
     for (size_t i = reg_arg_count; i > 0; i--)
     {
-        const char* target = ARG_REGISTERS[i - 1];
-        EMIT(SECTION_TEXT, "\tpop %s\n", target);
+        INST1(X86_POP, x86_reg(ARG_REGISTERS[i - 1]));
     }
 
     // System V varargs require RAX to contain the number of vector registers
     // used. We only pass integer arguments, so set it to zero.
-    EMIT(SECTION_TEXT, "\txor rax, rax\n");
-    EMIT(SECTION_TEXT, "\tcall %s\n", callee);
+    INST2(X86_XOR, x86_reg(X86_RAX), x86_reg(X86_RAX));
+    INST1(X86_CALL, x86_name(callee));
 
     if (stack_arg_count > 0)
     {
-        EMIT(SECTION_TEXT, "\tadd rsp, %zu\n", stack_arg_count * 8);
+        INST2(X86_ADD, x86_reg(X86_RSP), x86_imm((int32_t)stack_arg_count * 8));
     }
 
     EXIT(CALL);
     return reg;
 }
 
-char* x86_string(char* text)
+static const char HEX[] = "0123456789ABCDEF";
+
+// Emits the string literal `text` labelled string_<index> in GNU assembler
+// syntax. Runs of printable characters are quoted, and every other byte is
+// a .byte of its own; '\\' is one of them, as GAS interprets escapes within
+// .ascii and NASM does not.
+//
+// "hi \"x\"" => .ascii "hi ", .byte 0x22, .ascii "x", .byte 0x22, .byte 0
+static void x86_literal_gas(buffer_t* rodata, uint32_t index,
+                            const char* text)
 {
-    // Create a new buffer for the line we're going to format. This is to
-    // manage memory in a more efficient way.
-    buffer_t* line = buffer_new();
-
-    // Define the name as 'string_n' where 'n' is the current
-    // string count.
-    // Always define as bytes.
-    char* string_name = formats("string_%d", g_ctx.string_count);
-    buffer_printf(line, "\t%s: db ", string_name);
-
-    // Write each character of the string individually in order
-    // to emit the exact string as an array of bytes.
-    //
-    // For example, having "\n" is recognized as '\' and 'n', a two character
-    // string, rather than the explicit '\n' value. While this is 'messier'
-    // for the output assembly, it maintains a 1:1 mapping of the input
-    // string and the output string.
-    //
-    // "dog" => 0x64, 0x6F, 0x67
-    size_t text_len = strlen(text);
-    for (size_t i = 0; i < text_len; i++)
+    buffer_put_literal(rodata, "string_");
+    buffer_put_int(rodata, index);
+    buffer_put_literal(rodata, ":\n");
+    const char* c = text;
+    while (*c != '\0')
     {
-        // Only pre-pend ", " if we're on the second or greater
-        // character.
-        if (i > 0)
+        uint8_t byte = (uint8_t)*c;
+        if (byte >= 0x20 && byte < 0x7F && byte != '"' && byte != '\\')
         {
-            buffer_puts(line, ", ");
+            const char* run = c;
+            while ((uint8_t)*c >= 0x20 && (uint8_t)*c < 0x7F && *c != '"' &&
+                   *c != '\\')
+            {
+                c++;
+            }
+            buffer_put_literal(rodata, "\t.ascii \"");
+            buffer_write(rodata, run, (size_t)(c - run));
+            buffer_put_literal(rodata, "\"\n");
+            continue;
         }
-
-        // Output the current character as a hexadecimal integer.
-        buffer_printf(line, "0x%02X", (uint8_t)text[i]);
+        char hex[] = {'\t', '.', 'b', 'y', 't', 'e', ' ', '0', 'x',
+                      HEX[byte >> 4], HEX[byte & 0xF], '\n'};
+        buffer_write(rodata, hex, sizeof(hex));
+        c++;
     }
 
     // Always end with a null-terminator
-    buffer_puts(line, ", 0\n");
+    buffer_put_literal(rodata, "\t.byte 0\n");
+}
 
-    EMIT(SECTION_DATA, line->data);
+// Emits each entry of the string literal pool to the read-only data section.
+void x86_literals()
+{
+    buffer_t* rodata = g_codegen->rodata;
+    for (uint32_t i = 0; i < g_ctx.sema->pool_count; i++)
+    {
+        const char* text = g_ctx.tree->strings + g_ctx.sema->pool[i];
+        buffer_write(g_codegen->rodata_bytes, text, strlen(text) + 1);
+        if (x86_gas())
+        {
+            x86_literal_gas(rodata, i, text);
+            continue;
+        }
 
-    buffer_free(line);
-    g_ctx.string_count++;
+        buffer_put_literal(rodata, "\tstring_");
+        buffer_put_int(rodata, i);
+        buffer_put_literal(rodata, ": db ");
+
+        // Runs of printable characters are quoted as they are, and every
+        // other byte is written in hexadecimal. NASM does not interpret
+        // escapes within double quotes, so a '\' in the source stays two
+        // characters, as it is in the input.
+        //
+        // "say \"hi\"" => "say ", 0x22, "hi", 0x22, 0
+        const char* c = text;
+        while (*c != '\0')
+        {
+            uint8_t byte = (uint8_t)*c;
+            if (byte >= 0x20 && byte < 0x7F && byte != '"')
+            {
+                const char* run = c;
+                while ((uint8_t)*c >= 0x20 && (uint8_t)*c < 0x7F && *c != '"')
+                {
+                    c++;
+                }
+                buffer_putc(rodata, '"');
+                buffer_write(rodata, run, (size_t)(c - run));
+                buffer_put_literal(rodata, "\", ");
+                continue;
+            }
+            char hex[] = {'0', 'x', HEX[byte >> 4], HEX[byte & 0xF], ',', ' '};
+            buffer_write(rodata, hex, sizeof(hex));
+            c++;
+        }
 
-    // Return the name of the string's symbol
-    return string_name;
+        // Always end with a null-terminator
+        buffer_put_literal(rodata, "0\n");
+    }
 }
 
-char* x86_expr(ast* node)
+x86_reg_t x86_expr(node_t node)
 {
     ENTER(EXPR);
 
     // The resultant register of this expression. This register contains
     // the final computed value of the expression.
-    char* reg = NULL;
+    x86_reg_t reg = REG_NONE;
 
-    switch (node->type)
+    switch (KIND(node))
     {
     case AST_BINOP:
         // Emit a binary operation (+, -, *, /, etc.)
@@ -1144,32 +891,38 @@ char* x86_expr(ast* node)
     case AST_CONSTANT:
         // Get a new register to store the constant
         reg = register_lock();
-        if (node->data.constant.type == TYPE_STRING)
+        ASSERT(reg != REG_NONE,
+               "Ran out of registers evaluating an expression.");
+        const tree_constant_t* constant = tree_constant(g_ctx.tree, node);
+        if (constant->type == TYPE_STRING)
         {
-            char* string_label = x86_string(node->data.constant.string_value);
-            EMIT(SECTION_TEXT, "\tlea %s, [%s]\n", reg, string_label);
+            // Equal literals share the label of their pool entry.
+            INST2(X86_LEA, x86_reg(reg),
+                  x86_mem_symbol(X86_SYMBOL_STRING,
+                                 (int32_t)sema_literal(g_ctx.sema, node)));
         }
         else
         {
             // Move the constant into this register
-            EMIT(SECTION_TEXT, "\tmov %s, %d\n", reg,
-                 node->data.constant.value);
+            INST2(X86_MOV, x86_reg(reg), x86_imm(constant->value));
         }
         break;
     case AST_IDENTIFIER:
         // Get a new register to store the identifier's value
         reg = register_lock();
+        ASSERT(reg != REG_NONE,
+               "Ran out of registers evaluating an expression.");
         {
-            symbol_t* symbol = symbol_resolve(node->data.identifier.name);
+            symbol_t* symbol = SYMBOL(node);
             if (symbol->type == SYMBOL_GLOBAL)
             {
-                EMIT(SECTION_TEXT, "\tmov %s, [%s]\n", reg, symbol->name);
+                INST2(X86_MOV, x86_reg(reg), x86_mem_global(symbol->name));
             }
             else
             {
                 // Load local values via their recorded stack offset.
-                EMIT(SECTION_TEXT, "\tmov %s, [rbp%+td]\n", reg,
-                     symbol->offset);
+                INST2(X86_MOV, x86_reg(reg),
+                      x86_mem(X86_RBP, (int32_t)symbol->offset));
             }
         }
         break;
@@ -1184,11 +937,11 @@ char* x86_expr(ast* node)
     return reg;
 }
 
-void x86_statement(ast* node)
+void x86_statement(node_t node)
 {
     ENTER(STMT);
     // Dispatch to the appropriate emitter for each supported statement type.
-    switch (node->type)
+    switch (KIND(node))
     {
     case AST_ASSIGN:
         x86_assign(node);
@@ -1217,67 +970,120 @@ void x86_statement(ast* node)
     EXIT(STMT);
 }
 
-void x86_body(ast* node)
+void x86_body(node_t node)
 {
-    ASSERT(node->type == AST_BODY, "Wanted node type BODY, got %s", node->type);
+    ASSERT(KIND(node) == AST_BODY, "Wanted node type BODY, got %s",
+           ast_to_string(KIND(node)));
     ENTER(BODY);
-    for (size_t i = 0; i < node->data.body.count; i++)
+    tree_list_t body = tree_list(g_ctx.tree, node);
+    for (uint32_t i = 0; i < body.count; i++)
     {
-        ast* statement = node->data.body.statements[i];
+        node_t statement = tree_child(g_ctx.tree, body, i);
         // Bodies emit statements sequentially, preserving source order.
-        x86_statement(statement);
+        if (g_codegen->cache == NULL)
+        {
+            x86_statement(statement);
+            continue;
+        }
+
+        // Bodies only appear at the top level, so each statement's nodes run
+        // up to the next statement, or to the end of the tree.
+        node_t last = i + 1 < body.count ? tree_child(g_ctx.tree, body, i + 1)
+                                         : g_ctx.tree->count;
+        int32_t state[] = {g_ctx.branch_count, g_ctx.has_returned};
+        size_t state_count = sizeof(state) / sizeof(state[0]);
+        if (!codegen_cache_replay(g_ctx.tree, g_ctx.sema, statement, last,
+                                  state, state_count))
+        {
+            x86_statement(statement);
+            state[0] = g_ctx.branch_count;
+            state[1] = g_ctx.has_returned;
+            codegen_cache_store(state, state_count);
+            continue;
+        }
+        g_ctx.branch_count = state[0];
+        g_ctx.has_returned = state[1];
     }
     EXIT(BODY);
 }
 
-void x86_program(ast* node)
+void x86_program(tree_t* tree, sema_t* sema)
 {
-    ASSERT(node->type == AST_PROGRAM, "Wanted node type PROGRAM, got %s",
-           node->type);
+    g_ctx.tree = tree;
+    g_ctx.sema = sema;
+    node_t node = tree->root;
+    ASSERT(KIND(node) == AST_PROGRAM, "Wanted node type PROGRAM, got %s",
+           ast_to_string(KIND(node)));
     ENTER(PROGRAM);
 
-    // Initialize scope state
-    scope_free(g_ctx.global_scope);
-    g_ctx.global_scope = scope_new(NULL);
-    g_ctx.current_scope = g_ctx.global_scope;
-    g_ctx.in_function = false;
-    g_ctx.stack_offset = 0;
     g_ctx.branch_count = 0;
-    g_ctx.current_function_name = NULL;
-    g_ctx.expected_return_type = SYMBOL_VALUE_UNKNOWN;
-    g_ctx.pending_function = NULL;
-
-    // Collect all global symbols prior to emitting any code.
-    x86_globals(node);
-
-    // Make all symbol references RIP-relative by default
-    // https://www.nasm.us/doc/nasm08.html#section-8.2.1
-    EMIT(SECTION_GLOBAL, "default rel\n");
+    g_ctx.has_returned = false;
+    g_ctx.pending_function = NODE_NONE;
 
-    // Initialize sections
-    EMIT(SECTION_BSS, "section .bss\n");
-    EMIT(SECTION_DATA, "section .data\n");
-    EMIT(SECTION_TEXT, "section .text\n");
+    if (x86_gas())
+    {
+        // Intel operand order and register names, as NASM takes them.
+        // Symbols are made RIP-relative operand by operand instead.
+        EMIT(SECTION_GLOBAL, ".intel_syntax noprefix\n");
+
+        // Initialize sections
+        EMIT(SECTION_BSS, ".section .bss\n");
+        EMIT(SECTION_DATA, ".section .data\n");
+        EMIT(SECTION_RODATA, ".section .rodata\n");
+        EMIT(SECTION_TEXT, ".section .text\n");
+    }
+    else
+    {
+        // Make all symbol references RIP-relative by default
+        // https://www.nasm.us/doc/nasm08.html#section-8.2.1
+        EMIT(SECTION_GLOBAL, "default rel\n");
+
+        // Initialize sections
+        EMIT(SECTION_BSS, "section .bss\n");
+        EMIT(SECTION_DATA, "section .data\n");
+        EMIT(SECTION_RODATA, "section .rodata\n");
+        EMIT(SECTION_TEXT, "section .text\n");
+    }
 
     emit_concat();
 
-    // External built-ins
-    EMIT(SECTION_GLOBAL, "extern printf\n");
-    EMIT(SECTION_GLOBAL, "extern malloc\n");
-    EMIT(SECTION_GLOBAL, "extern free\n");
-    EMIT(SECTION_GLOBAL, "extern memcpy\n");
-    EMIT(SECTION_GLOBAL, "extern strlen\n");
-    EMIT(SECTION_GLOBAL, "extern strcat\n");
-    EMIT(SECTION_GLOBAL, "extern strcpy\n");
+    // External built-ins. GAS takes any symbol left undefined to be one.
+    if (!x86_gas())
+    {
+        EMIT(SECTION_GLOBAL, "extern printf\n");
+        EMIT(SECTION_GLOBAL, "extern malloc\n");
+        EMIT(SECTION_GLOBAL, "extern free\n");
+        EMIT(SECTION_GLOBAL, "extern memcpy\n");
+        EMIT(SECTION_GLOBAL, "extern strlen\n");
+        EMIT(SECTION_GLOBAL, "extern strcat\n");
+        EMIT(SECTION_GLOBAL, "extern strcpy\n");
+    }
+
+    tree_list_t program = tree_list(tree, node);
+    for (uint32_t i = 0; i < program.count; i++)
+    {
+        x86_body(tree_child(tree, program, i));
+    }
+    x86_literals();
 
-    for (size_t i = 0; i < node->data.program.count; i++)
+    // Print the instruction records as the text section. Records are written
+    // whole, so each chunk holds a run of complete ones.
+    for (const buffer_chunk_t* chunk = g_codegen->records->head; chunk;
+         chunk = chunk->next)
     {
-        ast* body = node->data.program.body[i];
-        x86_body(body);
+        const x86_inst_t* insts = (const x86_inst_t*)chunk->data;
+        size_t count = chunk->size / sizeof(x86_inst_t);
+        if (x86_gas())
+        {
+            x86_print_gas(insts, count, g_codegen->text);
+        }
+        else
+        {
+            x86_print_nasm(insts, count, g_codegen->text);
+        }
     }
 
-    scope_free(g_ctx.global_scope);
-    g_ctx.global_scope = NULL;
-    g_ctx.current_scope = NULL;
+    g_ctx.tree = NULL;
+    g_ctx.sema = NULL;
     EXIT(PROGRAM);
 }
\ No newline at end of file
@@ -0,0 +1,544 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf64.h"
+#include "macros.h"
+#include "x86_64_encode.h"
+
+// Sections of a relocatable object, in section header order.
+typedef enum x86_elf_section_t
+{
+    X86_ELF_NULL,
+    X86_ELF_TEXT,
+    X86_ELF_DATA,
+    X86_ELF_RODATA,
+    X86_ELF_BSS,
+    X86_ELF_RELA_TEXT,
+    X86_ELF_SYMTAB,
+    X86_ELF_STRTAB,
+    X86_ELF_SHSTRTAB,
+    // Marks the stack as not executable.
+    X86_ELF_NOTE_STACK,
+    X86_ELF_SECTIONS,
+} x86_elf_section_t;
+
+static const char* X86_ELF_SECTION_NAMES[X86_ELF_SECTIONS] = {
+    [X86_ELF_NULL] = "",
+    [X86_ELF_TEXT] = ".text",
+    [X86_ELF_DATA] = ".data",
+    [X86_ELF_RODATA] = ".rodata",
+    [X86_ELF_BSS] = ".bss",
+    [X86_ELF_RELA_TEXT] = ".rela.text",
+    [X86_ELF_SYMTAB] = ".symtab",
+    [X86_ELF_STRTAB] = ".strtab",
+    [X86_ELF_SHSTRTAB] = ".shstrtab",
+    [X86_ELF_NOTE_STACK] = ".note.GNU-stack",
+};
+
+// ELF section defining the symbols of each encoder section.
+static const uint16_t X86_ELF_SYMBOL_SECTIONS[X86_SECTION_COUNT] = {
+    [X86_SECTION_UNDEFINED] = ELF64_SECTION_UNDEF,
+    [X86_SECTION_TEXT] = X86_ELF_TEXT,
+    [X86_SECTION_DATA] = X86_ELF_DATA,
+    [X86_SECTION_RODATA] = X86_ELF_RODATA,
+};
+
+// Appends zeros to `out` up to `offset` bytes from `base`.
+static void x86_elf_pad(buffer_t* out, size_t base, uint64_t offset)
+{
+    static const char ZEROS[64] = {0};
+    while (out->size - base < offset)
+    {
+        size_t count = (size_t)(offset - (out->size - base));
+        buffer_write(out, ZEROS, count < sizeof(ZEROS) ? count : sizeof(ZEROS));
+    }
+}
+
+// Fills in the header of a section, keeping its name.
+static void x86_elf_section(elf64_section_t* section, uint32_t type,
+                            uint64_t flags, uint64_t size, uint64_t align)
+{
+    section->type = type;
+    section->flags = flags;
+    section->size = size;
+    section->align = align;
+}
+
+static uint64_t x86_elf_align(uint64_t offset, uint64_t align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+void x86_elf_object(const codegen_t* codegen, buffer_t* out)
+{
+    x86_object_t* object = x86_encode(codegen);
+
+    // Locals must come before globals, so symbols are written in two passes
+    // and relocations follow them to their new index.
+    uint32_t symbol_count = object->symbols_count + 1;
+    elf64_symbol_t* symbols =
+        (elf64_symbol_t*)calloc(symbol_count, sizeof(elf64_symbol_t));
+    uint32_t* indices = (uint32_t*)calloc(symbol_count, sizeof(uint32_t));
+    elf64_rela_t* relas = (elf64_rela_t*)calloc(
+        object->relocs_count ? object->relocs_count : 1, sizeof(elf64_rela_t));
+    ASSERT(symbols != NULL && indices != NULL && relas != NULL,
+           "Out of memory writing an object file.");
+
+    uint32_t next = 1;
+    uint32_t first_global = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool global = pass == 1;
+        if (global)
+        {
+            first_global = next;
+        }
+        for (uint32_t i = 0; i < object->symbols_count; i++)
+        {
+            const x86_object_symbol_t* symbol = &object->symbols[i];
+            if (symbol->global != global)
+            {
+                continue;
+            }
+            uint8_t type = symbol->section == X86_SECTION_UNDEFINED
+                               ? ELF64_SYMBOL_NOTYPE
+                           : symbol->function ? ELF64_SYMBOL_FUNC
+                                              : ELF64_SYMBOL_OBJECT;
+            elf64_symbol_t* elf = &symbols[next];
+            elf->name = symbol->name;
+            elf->info = ELF64_SYMBOL_INFO(
+                global ? ELF64_SYMBOL_GLOBAL : ELF64_SYMBOL_LOCAL, type);
+            elf->section = X86_ELF_SYMBOL_SECTIONS[symbol->section];
+            elf->value = symbol->offset;
+            elf->size = symbol->size;
+            indices[i] = next++;
+        }
+    }
+
+    for (uint32_t i = 0; i < object->relocs_count; i++)
+    {
+        const x86_reloc_t* reloc = &object->relocs[i];
+        relas[i].offset = reloc->offset;
+        relas[i].info = ELF64_RELOC_INFO(indices[reloc->symbol],
+                                         reloc->type == X86_RELOC_PLT32
+                                             ? ELF64_RELOC_X86_64_PLT32
+                                             : ELF64_RELOC_X86_64_PC32);
+        relas[i].addend = reloc->addend;
+    }
+
+    // Section names, each NULL-terminated.
+    char shstrtab[128];
+    uint32_t shstrtab_size = 0;
+    elf64_section_t sections[X86_ELF_SECTIONS];
+    memset(sections, 0, sizeof(sections));
+    for (int i = 0; i < X86_ELF_SECTIONS; i++)
+    {
+        size_t length = strlen(X86_ELF_SECTION_NAMES[i]) + 1;
+        memcpy(shstrtab + shstrtab_size, X86_ELF_SECTION_NAMES[i], length);
+        sections[i].name = shstrtab_size;
+        shstrtab_size += (uint32_t)length;
+    }
+
+    // Contents of each section, which are laid out in section order.
+    const void* contents[X86_ELF_SECTIONS] = {
+        [X86_ELF_TEXT] = object->text,
+        [X86_ELF_RODATA] = object->rodata,
+        [X86_ELF_RELA_TEXT] = relas,
+        [X86_ELF_SYMTAB] = symbols,
+        [X86_ELF_STRTAB] = object->names,
+        [X86_ELF_SHSTRTAB] = shstrtab,
+    };
+    x86_elf_section(&sections[X86_ELF_TEXT], ELF64_SECTION_PROGBITS,
+                    ELF64_SECTION_ALLOC | ELF64_SECTION_EXEC,
+                    object->text_count, 16);
+    x86_elf_section(&sections[X86_ELF_DATA], ELF64_SECTION_PROGBITS,
+                    ELF64_SECTION_ALLOC | ELF64_SECTION_WRITE,
+                    object->data_size, 8);
+    x86_elf_section(&sections[X86_ELF_RODATA], ELF64_SECTION_PROGBITS,
+                    ELF64_SECTION_ALLOC, object->rodata_count, 1);
+    x86_elf_section(&sections[X86_ELF_BSS], ELF64_SECTION_NOBITS,
+                    ELF64_SECTION_ALLOC | ELF64_SECTION_WRITE, 0, 8);
+    x86_elf_section(&sections[X86_ELF_RELA_TEXT], ELF64_SECTION_RELA,
+                    ELF64_SECTION_INFO_LINK,
+                    object->relocs_count * sizeof(elf64_rela_t), 8);
+    sections[X86_ELF_RELA_TEXT].link = X86_ELF_SYMTAB;
+    sections[X86_ELF_RELA_TEXT].info = X86_ELF_TEXT;
+    sections[X86_ELF_RELA_TEXT].entry_size = sizeof(elf64_rela_t);
+    x86_elf_section(&sections[X86_ELF_SYMTAB], ELF64_SECTION_SYMTAB, 0,
+                    symbol_count * sizeof(elf64_symbol_t), 8);
+    // `info` is one past the last local symbol.
+    sections[X86_ELF_SYMTAB].link = X86_ELF_STRTAB;
+    sections[X86_ELF_SYMTAB].info = first_global;
+    sections[X86_ELF_SYMTAB].entry_size = sizeof(elf64_symbol_t);
+    x86_elf_section(&sections[X86_ELF_STRTAB], ELF64_SECTION_STRTAB, 0,
+                    object->names_count, 1);
+    x86_elf_section(&sections[X86_ELF_SHSTRTAB], ELF64_SECTION_STRTAB, 0,
+                    shstrtab_size, 1);
+    x86_elf_section(&sections[X86_ELF_NOTE_STACK], ELF64_SECTION_PROGBITS, 0,
+                    0, 1);
+
+    uint64_t offset = sizeof(elf64_header_t);
+    for (int i = 1; i < X86_ELF_SECTIONS; i++)
+    {
+        offset = x86_elf_align(offset, sections[i].align);
+        sections[i].offset = offset;
+        if (sections[i].type != ELF64_SECTION_NOBITS)
+        {
+            offset += sections[i].size;
+        }
+    }
+    uint64_t section_offset = x86_elf_align(offset, 8);
+
+    elf64_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.ident[0] = 0x7F;
+    header.ident[1] = 'E';
+    header.ident[2] = 'L';
+    header.ident[3] = 'F';
+    header.ident[4] = ELF64_CLASS;
+    header.ident[5] = ELF64_DATA_LSB;
+    header.ident[6] = ELF64_VERSION;
+    header.ident[7] = ELF64_OSABI_SYSV;
+    header.type = ELF64_FILE_REL;
+    header.machine = ELF64_MACHINE_X86_64;
+    header.version = ELF64_VERSION;
+    header.section_offset = section_offset;
+    header.header_size = sizeof(elf64_header_t);
+    header.section_entry_size = sizeof(elf64_section_t);
+    header.section_count = X86_ELF_SECTIONS;
+    header.section_names = X86_ELF_SHSTRTAB;
+
+    size_t base = out->size;
+    buffer_write(out, &header, sizeof(header));
+    for (int i = 1; i < X86_ELF_SECTIONS; i++)
+    {
+        if (sections[i].type == ELF64_SECTION_NOBITS)
+        {
+            continue;
+        }
+        x86_elf_pad(out, base, sections[i].offset);
+        if (contents[i] != NULL)
+        {
+            buffer_write(out, contents[i], (size_t)sections[i].size);
+        }
+        else
+        {
+            // The data section, which holds only zeros.
+            x86_elf_pad(out, base, sections[i].offset + sections[i].size);
+        }
+    }
+    x86_elf_pad(out, base, section_offset);
+    buffer_write(out, sections, sizeof(sections));
+
+    free(symbols);
+    free(indices);
+    free(relas);
+    x86_object_free(object);
+}
+
+/* Executables */
+
+// Load address of the executable, as the linker would choose.
+#define X86_ELF_BASE 0x400000ull
+#define X86_ELF_PAGE 0x1000ull
+#define X86_ELF_INTERPRETER "/lib64/ld-linux-x86-64.so.2"
+#define X86_ELF_LIBC "libc.so.6"
+
+// Segments of an executable, in program header order.
+typedef enum x86_elf_segment_t
+{
+    X86_ELF_SEGMENT_PHDR,
+    X86_ELF_SEGMENT_INTERP,
+    // Headers, dynamic symbols and relocations, and read-only data.
+    X86_ELF_SEGMENT_READ,
+    // Program text, `_start` and the stubs of external functions.
+    X86_ELF_SEGMENT_TEXT,
+    // The dynamic section, the slot of each external function, then the
+    // global variables.
+    X86_ELF_SEGMENT_WRITE,
+    X86_ELF_SEGMENT_DYNAMIC,
+    X86_ELF_SEGMENT_STACK,
+    X86_ELF_SEGMENTS,
+} x86_elf_segment_t;
+
+// Entry point, as in the C library's crt1.o: hands `main` to
+// __libc_start_main, which sets up the library, calls `main` and exits with
+// its result.
+static const uint8_t X86_ELF_START[] = {
+    0x31, 0xED,                   // xor ebp, ebp
+    0x49, 0x89, 0xD1,             // mov r9, rdx (rtld_fini)
+    0x5E,                         // pop rsi (argc)
+    0x48, 0x89, 0xE2,             // mov rdx, rsp (argv)
+    0x48, 0x83, 0xE4, 0xF0,       // and rsp, -16
+    0x50,                         // push rax
+    0x54,                         // push rsp (stack_end)
+    0x45, 0x31, 0xC0,             // xor r8d, r8d (fini)
+    0x31, 0xC9,                   // xor ecx, ecx (init)
+    0x48, 0x8D, 0x3D, 0, 0, 0, 0, // lea rdi, [rip + main]
+    0xFF, 0x15, 0, 0, 0, 0,       // call [rip + __libc_start_main]
+    0xF4,                         // hlt
+};
+// Offsets of the rel32 fields within X86_ELF_START.
+#define X86_ELF_START_MAIN 23
+#define X86_ELF_START_LIBC 29
+
+void x86_elf_executable(const codegen_t* codegen, buffer_t* out)
+{
+    x86_object_t* object = x86_encode(codegen);
+
+    // Every external function gets a dynamic symbol, a slot bound by the
+    // dynamic linker when the program loads and a stub jumping through it.
+    // The first is __libc_start_main, for `_start`.
+    uint32_t* externals =
+        (uint32_t*)calloc(object->symbols_count + 1, sizeof(uint32_t));
+    ASSERT(externals != NULL, "Out of memory writing an executable.");
+    uint32_t external_count = 1;
+    uint32_t main_symbol = UINT32_MAX;
+    buffer_t* dynstr = buffer_new();
+    buffer_put_literal(dynstr, "\0" X86_ELF_LIBC "\0__libc_start_main\0");
+    for (uint32_t i = 0; i < object->symbols_count; i++)
+    {
+        const x86_object_symbol_t* symbol = &object->symbols[i];
+        const char* name = object->names + symbol->name;
+        if (symbol->section != X86_SECTION_UNDEFINED)
+        {
+            if (symbol->function && strcmp(name, "main") == 0)
+            {
+                main_symbol = i;
+            }
+            continue;
+        }
+        externals[i] = external_count++;
+    }
+    ASSERT(main_symbol != UINT32_MAX, "The program has no main function.");
+
+    uint32_t dynsym_count = external_count + 1;
+    elf64_symbol_t* dynsyms =
+        (elf64_symbol_t*)calloc(dynsym_count, sizeof(elf64_symbol_t));
+    // One bucket chaining every symbol, as nothing is looked up here.
+    uint32_t hash_count = 2 + 1 + dynsym_count;
+    uint32_t* hash = (uint32_t*)calloc(hash_count, sizeof(uint32_t));
+    elf64_rela_t* relas =
+        (elf64_rela_t*)calloc(external_count, sizeof(elf64_rela_t));
+    ASSERT(dynsyms != NULL && hash != NULL && relas != NULL,
+           "Out of memory writing an executable.");
+
+    // The library name takes the first name after the empty one.
+    dynsyms[1].name = (uint32_t)sizeof(X86_ELF_LIBC) + 1;
+    for (uint32_t i = 0; i < object->symbols_count; i++)
+    {
+        if (object->symbols[i].section == X86_SECTION_UNDEFINED)
+        {
+            dynsyms[externals[i] + 1].name = (uint32_t)dynstr->size;
+            buffer_puts(dynstr, object->names + object->symbols[i].name);
+            buffer_putc(dynstr, '\0');
+        }
+    }
+    for (uint32_t i = 1; i < dynsym_count; i++)
+    {
+        dynsyms[i].info =
+            ELF64_SYMBOL_INFO(ELF64_SYMBOL_GLOBAL, ELF64_SYMBOL_FUNC);
+    }
+    hash[0] = 1;
+    hash[1] = dynsym_count;
+    hash[2] = dynsym_count - 1;
+    for (uint32_t i = 1; i < dynsym_count; i++)
+    {
+        hash[3 + i] = i - 1;
+    }
+
+    // Lay out the read-only segment from the start of the file.
+    uint64_t offset = sizeof(elf64_header_t) +
+                      X86_ELF_SEGMENTS * sizeof(elf64_segment_t);
+    uint64_t interp_offset = offset;
+    offset += sizeof(X86_ELF_INTERPRETER);
+    uint64_t dynsym_offset = offset = x86_elf_align(offset, 8);
+    offset += dynsym_count * sizeof(elf64_symbol_t);
+    uint64_t dynstr_offset = offset;
+    offset += dynstr->size;
+    uint64_t hash_offset = offset = x86_elf_align(offset, 8);
+    offset += hash_count * sizeof(uint32_t);
+    uint64_t rela_offset = offset = x86_elf_align(offset, 8);
+    offset += external_count * sizeof(elf64_rela_t);
+    uint64_t rodata_offset = offset;
+    offset += object->rodata_count;
+
+    // Then the text segment, and the writable one.
+    uint64_t text_offset = offset = x86_elf_align(offset, X86_ELF_PAGE);
+    offset += object->text_count;
+    uint64_t start_offset = offset = x86_elf_align(offset, 16);
+    offset += sizeof(X86_ELF_START);
+    uint64_t stubs_offset = offset = x86_elf_align(offset, X86_STUB_SIZE);
+    offset += external_count * X86_STUB_SIZE;
+    uint64_t text_end = offset;
+
+    elf64_dynamic_t dynamic[] = {
+        {ELF64_DYNAMIC_NEEDED, 1},
+        {ELF64_DYNAMIC_HASH, X86_ELF_BASE + hash_offset},
+        {ELF64_DYNAMIC_STRTAB, X86_ELF_BASE + dynstr_offset},
+        {ELF64_DYNAMIC_SYMTAB, X86_ELF_BASE + dynsym_offset},
+        {ELF64_DYNAMIC_STRSZ, dynstr->size},
+        {ELF64_DYNAMIC_SYMENT, sizeof(elf64_symbol_t)},
+        {ELF64_DYNAMIC_RELA, X86_ELF_BASE + rela_offset},
+        {ELF64_DYNAMIC_RELASZ, external_count * sizeof(elf64_rela_t)},
+        {ELF64_DYNAMIC_RELAENT, sizeof(elf64_rela_t)},
+        {ELF64_DYNAMIC_FLAGS, ELF64_DYNAMIC_FLAG_BIND_NOW},
+        {ELF64_DYNAMIC_NULL, 0},
+    };
+    uint64_t dynamic_offset = offset = x86_elf_align(offset, X86_ELF_PAGE);
+    offset += sizeof(dynamic);
+    uint64_t slots_offset = offset;
+    offset += external_count * sizeof(uint64_t);
+    uint64_t data_offset = offset = x86_elf_align(offset, 8);
+    uint64_t file_end = data_offset;
+
+    for (uint32_t i = 0; i < external_count; i++)
+    {
+        relas[i].offset = X86_ELF_BASE + slots_offset + i * sizeof(uint64_t);
+        relas[i].info = ELF64_RELOC_INFO(i + 1, ELF64_RELOC_X86_64_GLOB_DAT);
+    }
+
+    // Place every symbol and link the text against them.
+    uint64_t* addresses =
+        (uint64_t*)calloc(object->symbols_count + 1, sizeof(uint64_t));
+    ASSERT(addresses != NULL, "Out of memory writing an executable.");
+    const uint64_t section_offsets[X86_SECTION_COUNT] = {
+        [X86_SECTION_TEXT] = text_offset,
+        [X86_SECTION_DATA] = data_offset,
+        [X86_SECTION_RODATA] = rodata_offset,
+    };
+    for (uint32_t i = 0; i < object->symbols_count; i++)
+    {
+        const x86_object_symbol_t* symbol = &object->symbols[i];
+        addresses[i] =
+            symbol->section == X86_SECTION_UNDEFINED
+                ? X86_ELF_BASE + stubs_offset + externals[i] * X86_STUB_SIZE
+                : X86_ELF_BASE + section_offsets[symbol->section] +
+                      symbol->offset;
+    }
+    x86_link(object, X86_ELF_BASE + text_offset, addresses);
+
+    uint8_t start[sizeof(X86_ELF_START)];
+    memcpy(start, X86_ELF_START, sizeof(start));
+    uint64_t start_address = X86_ELF_BASE + start_offset;
+    int32_t main_rel = (int32_t)(addresses[main_symbol] -
+                                 (start_address + X86_ELF_START_MAIN + 4));
+    int32_t libc_rel = (int32_t)(X86_ELF_BASE + slots_offset -
+                                 (start_address + X86_ELF_START_LIBC + 4));
+    memcpy(start + X86_ELF_START_MAIN, &main_rel, sizeof(main_rel));
+    memcpy(start + X86_ELF_START_LIBC, &libc_rel, sizeof(libc_rel));
+
+    elf64_segment_t segments[X86_ELF_SEGMENTS];
+    memset(segments, 0, sizeof(segments));
+    const struct
+    {
+        uint32_t type;
+        uint32_t flags;
+        uint64_t offset;
+        uint64_t file_size;
+        uint64_t memory_size;
+        uint64_t align;
+    } layout[X86_ELF_SEGMENTS] = {
+        [X86_ELF_SEGMENT_PHDR] = {ELF64_SEGMENT_PHDR, ELF64_SEGMENT_READ,
+                                  sizeof(elf64_header_t),
+                                  sizeof(segments), sizeof(segments), 8},
+        [X86_ELF_SEGMENT_INTERP] = {ELF64_SEGMENT_INTERP, ELF64_SEGMENT_READ,
+                                    interp_offset, sizeof(X86_ELF_INTERPRETER),
+                                    sizeof(X86_ELF_INTERPRETER), 1},
+        [X86_ELF_SEGMENT_READ] = {ELF64_SEGMENT_LOAD, ELF64_SEGMENT_READ, 0,
+                                  text_offset, text_offset, X86_ELF_PAGE},
+        [X86_ELF_SEGMENT_TEXT] = {ELF64_SEGMENT_LOAD,
+                                  ELF64_SEGMENT_READ | ELF64_SEGMENT_EXEC,
+                                  text_offset, text_end - text_offset,
+                                  text_end - text_offset, X86_ELF_PAGE},
+        [X86_ELF_SEGMENT_WRITE] = {ELF64_SEGMENT_LOAD,
+                                   ELF64_SEGMENT_READ | ELF64_SEGMENT_WRITE,
+                                   dynamic_offset, file_end - dynamic_offset,
+                                   file_end - dynamic_offset +
+                                       object->data_size,
+                                   X86_ELF_PAGE},
+        [X86_ELF_SEGMENT_DYNAMIC] = {ELF64_SEGMENT_DYNAMIC,
+                                     ELF64_SEGMENT_READ | ELF64_SEGMENT_WRITE,
+                                     dynamic_offset, sizeof(dynamic),
+                                     sizeof(dynamic), 8},
+        [X86_ELF_SEGMENT_STACK] = {ELF64_SEGMENT_GNU_STACK,
+                                   ELF64_SEGMENT_READ | ELF64_SEGMENT_WRITE, 0,
+                                   0, 0, 16},
+    };
+    for (int i = 0; i < X86_ELF_SEGMENTS; i++)
+    {
+        segments[i].type = layout[i].type;
+        segments[i].flags = layout[i].flags;
+        segments[i].offset = layout[i].offset;
+        segments[i].file_size = layout[i].file_size;
+        segments[i].memory_size = layout[i].memory_size;
+        segments[i].align = layout[i].align;
+        if (layout[i].type != ELF64_SEGMENT_GNU_STACK)
+        {
+            segments[i].address = X86_ELF_BASE + layout[i].offset;
+            segments[i].physical_address = segments[i].address;
+        }
+    }
+
+    elf64_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.ident[0] = 0x7F;
+    header.ident[1] = 'E';
+    header.ident[2] = 'L';
+    header.ident[3] = 'F';
+    header.ident[4] = ELF64_CLASS;
+    header.ident[5] = ELF64_DATA_LSB;
+    header.ident[6] = ELF64_VERSION;
+    header.ident[7] = ELF64_OSABI_SYSV;
+    header.type = ELF64_FILE_EXEC;
+    header.machine = ELF64_MACHINE_X86_64;
+    header.version = ELF64_VERSION;
+    header.entry = start_address;
+    header.program_offset = sizeof(elf64_header_t);
+    header.header_size = sizeof(elf64_header_t);
+    header.program_entry_size = sizeof(elf64_segment_t);
+    header.program_count = X86_ELF_SEGMENTS;
+
+    size_t base = out->size;
+    buffer_write(out, &header, sizeof(header));
+    buffer_write(out, segments, sizeof(segments));
+    buffer_write(out, X86_ELF_INTERPRETER, sizeof(X86_ELF_INTERPRETER));
+    x86_elf_pad(out, base, dynsym_offset);
+    buffer_write(out, dynsyms, dynsym_count * sizeof(elf64_symbol_t));
+    for (const buffer_chunk_t* chunk = dynstr->head; chunk; chunk = chunk->next)
+    {
+        buffer_write(out, chunk->data, chunk->size);
+    }
+    x86_elf_pad(out, base, hash_offset);
+    buffer_write(out, hash, hash_count * sizeof(uint32_t));
+    x86_elf_pad(out, base, rela_offset);
+    buffer_write(out, relas, external_count * sizeof(elf64_rela_t));
+    buffer_write(out, object->rodata, object->rodata_count);
+
+    x86_elf_pad(out, base, text_offset);
+    buffer_write(out, object->text, object->text_count);
+    x86_elf_pad(out, base, start_offset);
+    buffer_write(out, start, sizeof(start));
+    x86_elf_pad(out, base, stubs_offset);
+    for (uint32_t i = 0; i < external_count; i++)
+    {
+        uint8_t stub[X86_STUB_SIZE];
+        uint64_t address = X86_ELF_BASE + stubs_offset + i * X86_STUB_SIZE;
+        x86_write_stub(stub, address,
+                       X86_ELF_BASE + slots_offset + i * sizeof(uint64_t));
+        buffer_write(out, stub, sizeof(stub));
+    }
+
+    // Slots start out zero, until the dynamic linker binds them.
+    x86_elf_pad(out, base, dynamic_offset);
+    buffer_write(out, dynamic, sizeof(dynamic));
+    x86_elf_pad(out, base, file_end);
+
+    free(addresses);
+    free(relas);
+    free(hash);
+    free(dynsyms);
+    free(externals);
+    buffer_free(dynstr);
+    x86_object_free(object);
+}
@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "macros.h"
+#include "x86_64_encode.h"
+#include "x86_64_inst.h"
+
+#define X86_INITIAL_CAPACITY 64
+// Slots of the label table, kept at most half full.
+#define X86_INITIAL_SLOTS 256
+#define X86_NONE UINT32_MAX
+
+// A label, as named by a symbol operand: a function, a global variable, a
+// string literal or a branch target within a function.
+typedef struct x86_label_t
+{
+    // Symbol kind in the high word, symbol value in the low word.
+    uint64_t key;
+    // X86_SECTION_UNDEFINED until the label is defined.
+    uint8_t section;
+    bool global;
+    bool function;
+    uint32_t offset;
+    uint32_t size;
+} x86_label_t;
+
+typedef enum x86_fixup_kind_t
+{
+    // rel32 of a jump or call.
+    X86_FIXUP_BRANCH,
+    // disp32 of a RIP-relative memory operand.
+    X86_FIXUP_DATA,
+} x86_fixup_kind_t;
+
+// A 32-bit field of the text section waiting on the address of a label.
+typedef struct x86_fixup_t
+{
+    uint32_t offset;
+    uint32_t label;
+    int32_t addend;
+    uint8_t kind;
+} x86_fixup_t;
+
+typedef struct x86_encoder_t
+{
+    x86_object_t* object;
+    // Labels in order of their first definition or use, found by key through
+    // an open-addressed table holding each label's index + 1.
+    X86_OBJECT_COLUMN(x86_label_t, labels)
+    uint32_t* slots;
+    uint32_t slot_count;
+    X86_OBJECT_COLUMN(x86_fixup_t, fixups)
+    // Label of the function being encoded, or X86_NONE before the first.
+    uint32_t function;
+} x86_encoder_t;
+
+// Makes room for `n` more elements of `size` bytes in a column of `count`,
+// returning the column.
+static void* x86_grow(void* data, uint32_t count, uint32_t* capacity,
+                      size_t size, uint32_t n)
+{
+    if (count + n > *capacity)
+    {
+        uint32_t new_capacity = *capacity ? *capacity : X86_INITIAL_CAPACITY;
+        while (new_capacity < count + n)
+        {
+            new_capacity *= 2;
+        }
+        data = realloc(data, new_capacity * size);
+        ASSERT(data != NULL, "Out of memory encoding instructions.");
+        *capacity = new_capacity;
+    }
+    return data;
+}
+
+#define X86_RESERVE(owner, name, n)                                            \
+    ((owner)->name =                                                           \
+         x86_grow((owner)->name, (owner)->name##_count,                        \
+                  &(owner)->name##_capacity, sizeof(*(owner)->name), (n)))
+
+/* Labels */
+
+static uint64_t x86_label_key(uint8_t symbol, int32_t value)
+{
+    return ((uint64_t)symbol << 32) | (uint32_t)value;
+}
+
+static size_t x86_label_slot(const x86_encoder_t* enc, uint64_t key)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) &
+           (enc->slot_count - 1);
+}
+
+static void x86_label_rehash(x86_encoder_t* enc, uint32_t slot_count)
+{
+    free(enc->slots);
+    enc->slots = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    ASSERT(enc->slots != NULL, "Out of memory encoding instructions.");
+    enc->slot_count = slot_count;
+    for (uint32_t i = 0; i < enc->labels_count; i++)
+    {
+        size_t slot = x86_label_slot(enc, enc->labels[i].key);
+        while (enc->slots[slot] != 0)
+        {
+            slot = (slot + 1) & (enc->slot_count - 1);
+        }
+        enc->slots[slot] = i + 1;
+    }
+}
+
+// Returns the index of the label named by `symbol` and `value`, adding it
+// undefined on first use.
+static uint32_t x86_label(x86_encoder_t* enc, uint8_t symbol, int32_t value)
+{
+    uint64_t key = x86_label_key(symbol, value);
+    size_t slot = x86_label_slot(enc, key);
+    while (enc->slots[slot] != 0)
+    {
+        if (enc->labels[enc->slots[slot] - 1].key == key)
+        {
+            return enc->slots[slot] - 1;
+        }
+        slot = (slot + 1) & (enc->slot_count - 1);
+    }
+
+    uint32_t index = enc->labels_count;
+    X86_RESERVE(enc, labels, 1);
+    x86_label_t* label = &enc->labels[enc->labels_count++];
+    memset(label, 0, sizeof(x86_label_t));
+    label->key = key;
+    enc->slots[slot] = index + 1;
+    if (enc->labels_count * 2 > enc->slot_count)
+    {
+        x86_label_rehash(enc, enc->slot_count * 2);
+    }
+    return index;
+}
+
+static uint32_t x86_operand_label(x86_encoder_t* enc,
+                                  const x86_operand_t* operand)
+{
+    return x86_label(enc, operand->symbol, operand->value);
+}
+
+static void x86_define(x86_encoder_t* enc, uint32_t index, uint8_t section,
+                       uint32_t offset)
+{
+    x86_label_t* label = &enc->labels[index];
+    ASSERT(label->section == X86_SECTION_UNDEFINED,
+           "Label %u of kind %u is defined twice.", (uint32_t)label->key,
+           (uint32_t)(label->key >> 32));
+    label->section = section;
+    label->offset = offset;
+}
+
+// Ends the function being encoded, if any, at the current offset.
+static void x86_end_function(x86_encoder_t* enc)
+{
+    if (enc->function != X86_NONE)
+    {
+        x86_label_t* label = &enc->labels[enc->function];
+        label->size = enc->object->text_count - label->offset;
+    }
+}
+
+/* Machine code */
+
+static void x86_put(x86_encoder_t* enc, const void* data, uint32_t size)
+{
+    x86_object_t* object = enc->object;
+    X86_RESERVE(object, text, size);
+    memcpy(object->text + object->text_count, data, size);
+    object->text_count += size;
+}
+
+static void x86_put8(x86_encoder_t* enc, uint8_t byte)
+{
+    x86_put(enc, &byte, 1);
+}
+
+static void x86_put32(x86_encoder_t* enc, int32_t value)
+{
+    // Little-endian, as is the host.
+    x86_put(enc, &value, 4);
+}
+
+// Appends a zero rel32 or disp32 to be resolved to the label at `index`.
+static void x86_put_fixup(x86_encoder_t* enc, x86_fixup_kind_t kind,
+                          uint32_t index, int32_t addend)
+{
+    X86_RESERVE(enc, fixups, 1);
+    x86_fixup_t* fixup = &enc->fixups[enc->fixups_count++];
+    fixup->offset = enc->object->text_count;
+    fixup->label = index;
+    fixup->addend = addend;
+    fixup->kind = (uint8_t)kind;
+    x86_put32(enc, 0);
+}
+
+static bool x86_fits_int8(int32_t value)
+{
+    return value >= -128 && value <= 127;
+}
+
+// Whether `rm` is addressed through a register numbered 8 or above.
+static bool x86_rm_extended(const x86_operand_t* rm)
+{
+    return (rm->kind == X86_OPERAND_REG ||
+            (rm->kind == X86_OPERAND_MEM && rm->reg != X86_REG_COUNT)) &&
+           (rm->reg & 8);
+}
+
+// Appends a 64-bit instruction: REX.W, `opcode` (two bytes when above 0xFF),
+// then the ModRM byte addressing `rm` with `reg` in its reg field, and any
+// SIB byte and displacement. `trailing` immediate bytes follow, which a
+// RIP-relative displacement has to reach past.
+static void x86_put_rm(x86_encoder_t* enc, uint16_t opcode, uint8_t reg,
+                       const x86_operand_t* rm, uint32_t trailing)
+{
+    uint8_t rex = 0x48 | ((reg & 8) ? 0x04 : 0) | (x86_rm_extended(rm) ? 1 : 0);
+    x86_put8(enc, rex);
+    if (opcode > 0xFF)
+    {
+        x86_put8(enc, (uint8_t)(opcode >> 8));
+    }
+    x86_put8(enc, (uint8_t)opcode);
+
+    uint8_t field = (uint8_t)((reg & 7) << 3);
+    if (rm->kind == X86_OPERAND_REG)
+    {
+        x86_put8(enc, 0xC0 | field | (rm->reg & 7));
+        return;
+    }
+    ASSERT(rm->kind == X86_OPERAND_MEM, "Cannot encode operand kind %u.",
+           rm->kind);
+
+    if (rm->reg == X86_REG_COUNT)
+    {
+        // [rip + disp32], with the displacement left to the label.
+        x86_put8(enc, field | 0x05);
+        x86_put_fixup(enc, X86_FIXUP_DATA, x86_operand_label(enc, rm),
+                      -(int32_t)(4 + trailing));
+        return;
+    }
+
+    // [base], [base + disp8] or [base + disp32]. A base of rbp or r13 with
+    // no displacement would mean rip instead, so those always get a disp8.
+    uint8_t base = rm->reg & 7;
+    int32_t disp = rm->value;
+    uint8_t mod = disp == 0 && base != 5 ? 0x00
+                  : x86_fits_int8(disp)  ? 0x40
+                                         : 0x80;
+    x86_put8(enc, mod | field | base);
+    if (base == 4)
+    {
+        // rsp and r12 can only be a base through a SIB byte with no index.
+        x86_put8(enc, 0x24);
+    }
+    if (mod == 0x40)
+    {
+        x86_put8(enc, (uint8_t)disp);
+    }
+    else if (mod == 0x80)
+    {
+        x86_put32(enc, disp);
+    }
+}
+
+// Appends an instruction of the add/sub/xor/cmp group, each of which has a
+// form storing to r/m, a form loading from it, and an immediate form
+// selected by the `extension` in ModRM's reg field.
+static void x86_put_arith(x86_encoder_t* enc, const x86_inst_t* inst,
+                          uint8_t store, uint8_t load, uint8_t extension)
+{
+    const x86_operand_t* dst = &inst->dst;
+    const x86_operand_t* src = &inst->src;
+    switch (src->kind)
+    {
+    case X86_OPERAND_REG:
+        x86_put_rm(enc, store, src->reg, dst, 0);
+        break;
+    case X86_OPERAND_MEM:
+        ASSERT(dst->kind == X86_OPERAND_REG,
+               "Cannot encode a memory to memory operation.");
+        x86_put_rm(enc, load, dst->reg, src, 0);
+        break;
+    case X86_OPERAND_IMM:
+        if (x86_fits_int8(src->value))
+        {
+            x86_put_rm(enc, 0x83, extension, dst, 1);
+            x86_put8(enc, (uint8_t)src->value);
+        }
+        else
+        {
+            x86_put_rm(enc, 0x81, extension, dst, 4);
+            x86_put32(enc, src->value);
+        }
+        break;
+    default:
+        ASSERT(false, "Cannot encode operand kind %u.", src->kind);
+    }
+}
+
+static void x86_put_mov(x86_encoder_t* enc, const x86_inst_t* inst)
+{
+    const x86_operand_t* dst = &inst->dst;
+    const x86_operand_t* src = &inst->src;
+    if (src->kind != X86_OPERAND_IMM)
+    {
+        x86_put_arith(enc, inst, 0x89, 0x8B, 0);
+        return;
+    }
+
+    if (dst->kind == X86_OPERAND_REG && src->value >= 0)
+    {
+        // mov r32, imm32 is shorter and zero-extends to the whole register.
+        if (dst->reg & 8)
+        {
+            x86_put8(enc, 0x41);
+        }
+        x86_put8(enc, 0xB8 + (dst->reg & 7));
+        x86_put32(enc, src->value);
+        return;
+    }
+    // mov r/m64, imm32, sign-extended.
+    x86_put_rm(enc, 0xC7, 0, dst, 4);
+    x86_put32(enc, src->value);
+}
+
+// Appends imul, lea or a cmov: instructions loading from r/m into the
+// register `dst`.
+static void x86_put_load(x86_encoder_t* enc, const x86_inst_t* inst,
+                         uint16_t opcode)
+{
+    ASSERT(inst->dst.kind == X86_OPERAND_REG,
+           "Cannot encode %u without a register destination.", inst->opcode);
+    x86_put_rm(enc, opcode, inst->dst.reg, &inst->src, 0);
+}
+
+static void x86_put_imul(x86_encoder_t* enc, const x86_inst_t* inst)
+{
+    if (inst->src.kind != X86_OPERAND_IMM)
+    {
+        x86_put_load(enc, inst, 0x0FAF);
+        return;
+    }
+
+    // imul r64, r/m64, imm multiplies the destination by the immediate.
+    const x86_operand_t* dst = &inst->dst;
+    if (x86_fits_int8(inst->src.value))
+    {
+        x86_put_rm(enc, 0x6B, dst->reg, dst, 1);
+        x86_put8(enc, (uint8_t)inst->src.value);
+    }
+    else
+    {
+        x86_put_rm(enc, 0x69, dst->reg, dst, 4);
+        x86_put32(enc, inst->src.value);
+    }
+}
+
+// Appends push (`base` 0x50) or pop (`base` 0x58).
+static void x86_put_stack(x86_encoder_t* enc, const x86_inst_t* inst,
+                          uint8_t base)
+{
+    const x86_operand_t* operand = &inst->dst;
+    if (operand->kind == X86_OPERAND_REG)
+    {
+        if (operand->reg & 8)
+        {
+            x86_put8(enc, 0x41);
+        }
+        x86_put8(enc, base + (operand->reg & 7));
+        return;
+    }
+    ASSERT(base == 0x50 && operand->kind == X86_OPERAND_IMM,
+           "Cannot encode operand kind %u.", operand->kind);
+    x86_put8(enc, 0x68);
+    x86_put32(enc, operand->value);
+}
+
+// Appends a jump or call to the symbol in the first operand.
+static void x86_put_branch(x86_encoder_t* enc, const x86_inst_t* inst,
+                           uint16_t opcode)
+{
+    ASSERT(inst->dst.kind == X86_OPERAND_SYMBOL,
+           "Cannot encode a branch to operand kind %u.", inst->dst.kind);
+    if (opcode > 0xFF)
+    {
+        x86_put8(enc, (uint8_t)(opcode >> 8));
+    }
+    x86_put8(enc, (uint8_t)opcode);
+    x86_put_fixup(enc, X86_FIXUP_BRANCH, x86_operand_label(enc, &inst->dst),
+                  -4);
+}
+
+static void x86_encode_inst(x86_encoder_t* enc, const x86_inst_t* inst)
+{
+    x86_object_t* object = enc->object;
+    switch (inst->opcode)
+    {
+    case X86_FUNCTION:
+    {
+        x86_end_function(enc);
+        uint32_t index = x86_operand_label(enc, &inst->dst);
+        x86_define(enc, index, X86_SECTION_TEXT, object->text_count);
+        enc->labels[index].function = true;
+        enc->function = index;
+        break;
+    }
+    case X86_LABEL:
+        x86_define(enc, x86_operand_label(enc, &inst->dst), X86_SECTION_TEXT,
+                   object->text_count);
+        break;
+    case X86_COMMENT:
+        break;
+    case X86_GLOBAL:
+    {
+        // Adding the label may move the labels, so index them after.
+        uint32_t index = x86_operand_label(enc, &inst->dst);
+        enc->labels[index].global = true;
+        break;
+    }
+    case X86_VARIABLE:
+    {
+        uint32_t index = x86_operand_label(enc, &inst->dst);
+        x86_define(enc, index, X86_SECTION_DATA, object->data_size);
+        enc->labels[index].size = 8;
+        object->data_size += 8;
+        break;
+    }
+    case X86_MOV:
+        x86_put_mov(enc, inst);
+        break;
+    case X86_LEA:
+        x86_put_load(enc, inst, 0x8D);
+        break;
+    case X86_ADD:
+        x86_put_arith(enc, inst, 0x01, 0x03, 0);
+        break;
+    case X86_SUB:
+        x86_put_arith(enc, inst, 0x29, 0x2B, 5);
+        break;
+    case X86_XOR:
+        x86_put_arith(enc, inst, 0x31, 0x33, 6);
+        break;
+    case X86_CMP:
+        x86_put_arith(enc, inst, 0x39, 0x3B, 7);
+        break;
+    case X86_IMUL:
+        x86_put_imul(enc, inst);
+        break;
+    case X86_CMOVE:
+        x86_put_load(enc, inst, 0x0F44);
+        break;
+    case X86_CMOVG:
+        x86_put_load(enc, inst, 0x0F4F);
+        break;
+    case X86_CMOVL:
+        x86_put_load(enc, inst, 0x0F4C);
+        break;
+    case X86_PUSH:
+        x86_put_stack(enc, inst, 0x50);
+        break;
+    case X86_POP:
+        x86_put_stack(enc, inst, 0x58);
+        break;
+    case X86_JMP:
+        x86_put_branch(enc, inst, 0xE9);
+        break;
+    case X86_JE:
+        x86_put_branch(enc, inst, 0x0F84);
+        break;
+    case X86_CALL:
+        x86_put_branch(enc, inst, 0xE8);
+        break;
+    case X86_RET:
+        x86_put8(enc, 0xC3);
+        break;
+    case X86_SYSCALL:
+        x86_put8(enc, 0x0F);
+        x86_put8(enc, 0x05);
+        break;
+    default:
+        ASSERT(false, "Cannot encode opcode %u.", inst->opcode);
+    }
+}
+
+// Places each NULL-terminated string literal of `bytes` in the read-only
+// data section, as string_0, string_1 and so on.
+static void x86_encode_literals(x86_encoder_t* enc, const buffer_t* bytes)
+{
+    x86_object_t* object = enc->object;
+    ASSERT(bytes->size <= UINT32_MAX, "Too many string literals to encode.");
+    X86_RESERVE(object, rodata, (uint32_t)bytes->size);
+    buffer_read(bytes, 0, object->rodata, bytes->size);
+    object->rodata_count = (uint32_t)bytes->size;
+
+    uint32_t start = 0;
+    for (uint32_t i = 0; start < object->rodata_count; i++)
+    {
+        uint32_t length = (uint32_t)strlen((char*)object->rodata + start);
+        uint32_t index = x86_label(enc, X86_SYMBOL_STRING, (int32_t)i);
+        x86_define(enc, index, X86_SECTION_RODATA, start);
+        enc->labels[index].size = length + 1;
+        start += length + 1;
+    }
+}
+
+// Patches each fixup whose label is in the text section, and turns the rest
+// into relocations against the label, whose index they keep for now.
+static void x86_resolve(x86_encoder_t* enc)
+{
+    x86_object_t* object = enc->object;
+    for (uint32_t i = 0; i < enc->fixups_count; i++)
+    {
+        const x86_fixup_t* fixup = &enc->fixups[i];
+        x86_label_t* label = &enc->labels[fixup->label];
+        if (label->section == X86_SECTION_TEXT)
+        {
+            int32_t value =
+                (int32_t)(label->offset - fixup->offset) + fixup->addend;
+            memcpy(object->text + fixup->offset, &value, sizeof(value));
+            continue;
+        }
+
+        // Only names can be defined outside the program.
+        ASSERT(label->section != X86_SECTION_UNDEFINED ||
+                   (label->key >> 32) == X86_SYMBOL_NAME,
+               "Label %u of kind %u is never defined.", (uint32_t)label->key,
+               (uint32_t)(label->key >> 32));
+        if (label->section == X86_SECTION_UNDEFINED)
+        {
+            label->global = true;
+        }
+
+        X86_RESERVE(object, relocs, 1);
+        x86_reloc_t* reloc = &object->relocs[object->relocs_count++];
+        reloc->offset = fixup->offset;
+        reloc->symbol = fixup->label;
+        reloc->addend = fixup->addend;
+        reloc->type = fixup->kind == X86_FIXUP_BRANCH ? X86_RELOC_PLT32
+                                                      : X86_RELOC_PC32;
+    }
+}
+
+static void x86_put_name(x86_object_t* object, const char* name,
+                         uint32_t length)
+{
+    X86_RESERVE(object, names, length + 1);
+    memcpy(object->names + object->names_count, name, length);
+    object->names[object->names_count + length] = '\0';
+    object->names_count += length + 1;
+}
+
+// Gives each named label a symbol, and points relocations at symbols rather
+// than labels. Branch targets within functions stay local to the encoder.
+static void x86_assign_symbols(x86_encoder_t* enc)
+{
+    x86_object_t* object = enc->object;
+    uint32_t* symbols = (uint32_t*)malloc(
+        (enc->labels_count ? enc->labels_count : 1) * sizeof(uint32_t));
+    ASSERT(symbols != NULL, "Out of memory encoding instructions.");
+
+    x86_put_name(object, "", 0);
+    for (uint32_t i = 0; i < enc->labels_count; i++)
+    {
+        const x86_label_t* label = &enc->labels[i];
+        uint8_t kind = (uint8_t)(label->key >> 32);
+        int32_t value = (int32_t)(uint32_t)label->key;
+        symbols[i] = X86_NONE;
+        if (kind != X86_SYMBOL_NAME && kind != X86_SYMBOL_STRING)
+        {
+            continue;
+        }
+
+        X86_RESERVE(object, symbols, 1);
+        symbols[i] = object->symbols_count;
+        x86_object_symbol_t* symbol = &object->symbols[object->symbols_count++];
+        symbol->name = object->names_count;
+        symbol->section = label->section;
+        symbol->global = label->global;
+        symbol->function = label->function;
+        symbol->offset = label->offset;
+        symbol->size = label->size;
+
+        if (kind == X86_SYMBOL_NAME)
+        {
+            x86_put_name(object, atom_name((atom_t)value),
+                         (uint32_t)atom_length((atom_t)value));
+        }
+        else
+        {
+            char name[32];
+            int length = snprintf(name, sizeof(name), "string_%d", value);
+            x86_put_name(object, name, (uint32_t)length);
+        }
+    }
+
+    for (uint32_t i = 0; i < object->relocs_count; i++)
+    {
+        object->relocs[i].symbol = symbols[object->relocs[i].symbol];
+    }
+    free(symbols);
+}
+
+x86_object_t* x86_encode(const codegen_t* codegen)
+{
+    x86_encoder_t enc;
+    memset(&enc, 0, sizeof(enc));
+    enc.object = (x86_object_t*)calloc(1, sizeof(x86_object_t));
+    ASSERT(enc.object != NULL, "Out of memory encoding instructions.");
+    enc.function = X86_NONE;
+    x86_label_rehash(&enc, X86_INITIAL_SLOTS);
+
+    // Records are written whole, so each chunk holds a run of complete ones.
+    for (const buffer_chunk_t* chunk = codegen->records->head; chunk;
+         chunk = chunk->next)
+    {
+        const x86_inst_t* insts = (const x86_inst_t*)chunk->data;
+        size_t count = chunk->size / sizeof(x86_inst_t);
+        for (size_t i = 0; i < count; i++)
+        {
+            x86_encode_inst(&enc, &insts[i]);
+        }
+    }
+    x86_end_function(&enc);
+    x86_encode_literals(&enc, codegen->rodata_bytes);
+
+    x86_resolve(&enc);
+    x86_assign_symbols(&enc);
+
+    free(enc.labels);
+    free(enc.slots);
+    free(enc.fixups);
+    return enc.object;
+}
+
+// Stores the 32-bit displacement from the end of a field at `field` to
+// `target`.
+static void x86_put_rel32(uint8_t* field, uint64_t target, int64_t addend,
+                          uint64_t field_address)
+{
+    int64_t value = (int64_t)(target - field_address) + addend;
+    ASSERT(value >= INT32_MIN && value <= INT32_MAX,
+           "Symbol is out of reach of a 32-bit displacement.");
+    int32_t rel = (int32_t)value;
+    memcpy(field, &rel, sizeof(rel));
+}
+
+void x86_link(x86_object_t* object, uint64_t text_address,
+              const uint64_t* addresses)
+{
+    for (uint32_t i = 0; i < object->relocs_count; i++)
+    {
+        const x86_reloc_t* reloc = &object->relocs[i];
+        x86_put_rel32(object->text + reloc->offset, addresses[reloc->symbol],
+                      reloc->addend, text_address + reloc->offset);
+    }
+}
+
+void x86_write_stub(uint8_t* out, uint64_t address, uint64_t slot)
+{
+    // jmp [rip + slot], padded with int3.
+    out[0] = 0xFF;
+    out[1] = 0x25;
+    x86_put_rel32(out + 2, slot, -4, address + 2);
+    out[6] = 0xCC;
+    out[7] = 0xCC;
+}
+
+void x86_object_free(x86_object_t* object)
+{
+    if (!object)
+    {
+        return;
+    }
+    free(object->text);
+    free(object->rodata);
+    free(object->symbols);
+    free(object->names);
+    free(object->relocs);
+    free(object);
+}
@@ -0,0 +1,118 @@
+#ifndef X86_64_ENCODE_H
+#define X86_64_ENCODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "codegen.h"
+
+/* Encoder
+ *
+ * Encodes the instruction records of a program into machine code, laid out
+ * in sections as an assembler would. Jumps and calls within the text section
+ * are resolved in place. Every other reference to a symbol, i.e. to a global
+ * variable, a string literal or an external function, is left as a
+ * relocation for whatever places the sections in memory: a linker, or a
+ * loader in the same process.
+ */
+
+typedef enum x86_section_t
+{
+    // Symbols defined outside the program, such as printf.
+    X86_SECTION_UNDEFINED,
+    X86_SECTION_TEXT,
+    // Global variables. Every byte is zero until the program runs.
+    X86_SECTION_DATA,
+    // String literals.
+    X86_SECTION_RODATA,
+    X86_SECTION_COUNT,
+} x86_section_t;
+
+typedef struct x86_object_symbol_t
+{
+    // Offset of the NULL-terminated name within `x86_object_t::names`.
+    uint32_t name;
+    uint8_t section;
+    // Whether the symbol is visible outside the program. Undefined symbols
+    // always are.
+    bool global;
+    bool function;
+    // Offset and size within `section`.
+    uint32_t offset;
+    uint32_t size;
+} x86_object_symbol_t;
+
+typedef enum x86_reloc_type_t
+{
+    // The 32-bit field holds symbol + addend - field address: a RIP-relative
+    // displacement, with the addend reaching back to the end of the
+    // instruction.
+    X86_RELOC_PC32,
+    // As X86_RELOC_PC32, for a call that may go through a linker stub.
+    X86_RELOC_PLT32,
+} x86_reloc_type_t;
+
+typedef struct x86_reloc_t
+{
+    // Offset of the 32-bit field within the text section.
+    uint32_t offset;
+    // Index into `x86_object_t::symbols`.
+    uint32_t symbol;
+    int32_t addend;
+    uint8_t type;
+} x86_reloc_t;
+
+// Declares a growable column named `name` of `type` elements.
+#define X86_OBJECT_COLUMN(type, name)                                          \
+    type* name;                                                                \
+    uint32_t name##_count;                                                     \
+    uint32_t name##_capacity;
+
+typedef struct x86_object_t
+{
+    // Contents of the text and read-only data sections.
+    X86_OBJECT_COLUMN(uint8_t, text)
+    X86_OBJECT_COLUMN(uint8_t, rodata)
+    // Size of the data section, which holds only zeros.
+    uint32_t data_size;
+
+    // Symbols in order of their first definition or use, with the names of
+    // all of them. `names` starts with an empty name, so it doubles as an
+    // ELF string table.
+    X86_OBJECT_COLUMN(x86_object_symbol_t, symbols)
+    X86_OBJECT_COLUMN(char, names)
+    // References from the text section to symbols, in text order.
+    X86_OBJECT_COLUMN(x86_reloc_t, relocs)
+} x86_object_t;
+
+// Encodes the records and read-only data held by `codegen`. Identifiers are
+// still interned, so this runs before `intern_free`.
+x86_object_t* x86_encode(const codegen_t* codegen);
+void x86_object_free(x86_object_t* object);
+
+// Applies every relocation of `object` for a text section placed at
+// `text_address` and each symbol placed at `addresses[symbol]`.
+void x86_link(x86_object_t* object, uint64_t text_address,
+              const uint64_t* addresses);
+
+// Size of a stub jumping through the pointer at `slot`. Calls to a symbol
+// defined elsewhere land on a stub next to the text, so the symbol itself
+// may lie further away than a rel32 reaches.
+#define X86_STUB_SIZE 8
+// Writes the stub placed at `address` to `out`.
+void x86_write_stub(uint8_t* out, uint64_t address, uint64_t slot);
+
+// Encodes `codegen` as an ELF64 relocatable object appended to `out`.
+void x86_elf_object(const codegen_t* codegen, buffer_t* out);
+// Encodes `codegen` as an ELF64 executable appended to `out`, linked
+// dynamically against the C library.
+void x86_elf_executable(const codegen_t* codegen, buffer_t* out);
+
+// Encodes `codegen` into memory of this process, binds its external
+// functions to the ones the compiler itself links and calls its `main`,
+// storing the result in `status`. Returns false if the program could not be
+// loaded.
+bool x86_jit_run(const codegen_t* codegen, int* status);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "x86_64_inst.h"
+
+static const char* X86_REG_NAMES[X86_REG_COUNT] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static const char* X86_MNEMONICS[X86_OPCODE_COUNT] = {
+    [X86_MOV] = "mov",     [X86_LEA] = "lea",     [X86_ADD] = "add",
+    [X86_SUB] = "sub",     [X86_IMUL] = "imul",   [X86_XOR] = "xor",
+    [X86_CMP] = "cmp",     [X86_CMOVE] = "cmove", [X86_CMOVG] = "cmovg",
+    [X86_CMOVL] = "cmovl", [X86_PUSH] = "push",   [X86_POP] = "pop",
+    [X86_JMP] = "jmp",     [X86_JE] = "je",       [X86_CALL] = "call",
+    [X86_RET] = "ret",     [X86_SYSCALL] = "syscall",
+};
+
+// Prefixes of generated labels, followed by their number.
+static const char* X86_SYMBOL_PREFIXES[] = {
+    [X86_SYMBOL_STRING] = "string_",
+    [X86_SYMBOL_ELSE] = ".Lelse_",
+    [X86_SYMBOL_ENDIF] = ".Lendif_",
+    [X86_SYMBOL_WHILE_BEGIN] = ".Lwhile_begin_",
+    [X86_SYMBOL_WHILE_END] = ".Lwhile_end_",
+};
+
+void x86_inst(buffer_t* records, x86_opcode_t opcode, x86_operand_t dst,
+              x86_operand_t src)
+{
+    x86_inst_t inst = {(uint8_t)opcode, dst, src};
+    buffer_write(records, &inst, sizeof(inst));
+}
+
+/* Printers
+ *
+ * NASM and GAS take the same Intel operand order and mostly the same
+ * operands. GAS spells an operand's size `qword ptr`, needs RIP-relative
+ * addressing asked for on each operand rather than once with `default rel`,
+ * and starts comments with '#', as ';' separates statements.
+ */
+
+static void put_string(buffer_t* out, const char* text)
+{
+    buffer_write(out, text, strlen(text));
+}
+
+static void put_symbol(buffer_t* out, uint8_t symbol, int32_t value)
+{
+    if (symbol == X86_SYMBOL_NAME)
+    {
+        atom_t atom = (atom_t)value;
+        buffer_write(out, atom_name(atom), atom_length(atom));
+        return;
+    }
+    put_string(out, X86_SYMBOL_PREFIXES[symbol]);
+    buffer_put_int(out, value);
+}
+
+static void put_operand(buffer_t* out, const x86_operand_t* operand, bool gas)
+{
+    switch (operand->kind)
+    {
+    case X86_OPERAND_REG:
+        put_string(out, X86_REG_NAMES[operand->reg]);
+        break;
+    case X86_OPERAND_IMM:
+        buffer_put_int(out, operand->value);
+        break;
+    case X86_OPERAND_MEM:
+        buffer_putc(out, '[');
+        if (operand->reg == X86_REG_COUNT)
+        {
+            if (gas)
+            {
+                buffer_put_literal(out, "rip+");
+            }
+            put_symbol(out, operand->symbol, operand->value);
+        }
+        else
+        {
+            put_string(out, X86_REG_NAMES[operand->reg]);
+            if (operand->value > 0)
+            {
+                buffer_putc(out, '+');
+            }
+            if (operand->value != 0)
+            {
+                buffer_put_int(out, operand->value);
+            }
+        }
+        buffer_putc(out, ']');
+        break;
+    case X86_OPERAND_SYMBOL:
+        put_symbol(out, operand->symbol, operand->value);
+        break;
+    default:
+        break;
+    }
+}
+
+static void x86_print(const x86_inst_t* insts, size_t count, buffer_t* out,
+                      bool gas)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const x86_inst_t* inst = &insts[i];
+        switch (inst->opcode)
+        {
+        case X86_FUNCTION:
+        case X86_LABEL:
+            put_operand(out, &inst->dst, gas);
+            buffer_put_literal(out, ":\n");
+            continue;
+        case X86_COMMENT:
+            put_string(out, gas ? "# " : "; ");
+            put_symbol(out, X86_SYMBOL_NAME, inst->dst.value);
+            buffer_putc(out, '\n');
+            continue;
+        case X86_GLOBAL:
+        case X86_VARIABLE:
+            continue;
+        default:
+            break;
+        }
+
+        buffer_putc(out, '\t');
+        put_string(out, X86_MNEMONICS[inst->opcode]);
+        if (inst->dst.kind != X86_OPERAND_NONE)
+        {
+            buffer_putc(out, ' ');
+            // Nothing else gives the size of an immediate stored to memory.
+            if (inst->dst.kind == X86_OPERAND_MEM &&
+                inst->src.kind == X86_OPERAND_IMM)
+            {
+                put_string(out, gas ? "qword ptr " : "qword ");
+            }
+            put_operand(out, &inst->dst, gas);
+        }
+        if (inst->src.kind != X86_OPERAND_NONE)
+        {
+            buffer_put_literal(out, ", ");
+            put_operand(out, &inst->src, gas);
+        }
+        buffer_putc(out, '\n');
+    }
+}
+
+void x86_print_nasm(const x86_inst_t* insts, size_t count, buffer_t* out)
+{
+    x86_print(insts, count, out, false);
+}
+
+void x86_print_gas(const x86_inst_t* insts, size_t count, buffer_t* out)
+{
+    x86_print(insts, count, out, true);
+}
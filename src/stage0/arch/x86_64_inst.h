@@ -0,0 +1,184 @@
+#ifndef X86_64_INST_H
+#define X86_64_INST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "intern.h"
+
+/* Instruction records
+ *
+ * The x86-64 emitter appends each instruction of the text section as a
+ * fixed-size record rather than formatting it as text. Records hold an
+ * opcode and up to two typed operands, so later stages can inspect or
+ * encode the instruction stream, and printing it as assembly is a separate
+ * final pass.
+ *
+ * Records of a whole program form a single stream. Each function starts at
+ * an X86_FUNCTION record and runs up to the next one, which lets the codegen
+ * cache keep and replay the records of a statement as a plain byte range.
+ *
+ * Directives describe symbols rather than code, for encoding the stream as
+ * an object. They print nothing, as the assembly carries the same in its
+ * global and data sections.
+ */
+
+// Registers, numbered as in their machine encoding.
+typedef enum x86_reg_t
+{
+    X86_RAX,
+    X86_RCX,
+    X86_RDX,
+    X86_RBX,
+    X86_RSP,
+    X86_RBP,
+    X86_RSI,
+    X86_RDI,
+    X86_R8,
+    X86_R9,
+    X86_R10,
+    X86_R11,
+    X86_R12,
+    X86_R13,
+    X86_R14,
+    X86_R15,
+    X86_REG_COUNT,
+} x86_reg_t;
+
+typedef enum x86_opcode_t
+{
+    // Defines the label in the first operand and starts a new function.
+    X86_FUNCTION,
+    // Defines the label in the first operand within the current function.
+    X86_LABEL,
+    // Comment naming the atom in the first operand's symbol value.
+    X86_COMMENT,
+    // Directive exporting the function named by the first operand.
+    X86_GLOBAL,
+    // Directive defining the global variable named by the first operand, a
+    // zeroed quadword in the data section.
+    X86_VARIABLE,
+    X86_MOV,
+    X86_LEA,
+    X86_ADD,
+    X86_SUB,
+    X86_IMUL,
+    X86_XOR,
+    X86_CMP,
+    X86_CMOVE,
+    X86_CMOVG,
+    X86_CMOVL,
+    X86_PUSH,
+    X86_POP,
+    X86_JMP,
+    X86_JE,
+    X86_CALL,
+    X86_RET,
+    X86_SYSCALL,
+    X86_OPCODE_COUNT,
+} x86_opcode_t;
+
+typedef enum x86_operand_kind_t
+{
+    X86_OPERAND_NONE,
+    X86_OPERAND_REG,
+    X86_OPERAND_IMM,
+    // Quadword at [base + value], or at the symbol when `base` is
+    // X86_REG_COUNT.
+    X86_OPERAND_MEM,
+    // Address of the symbol, as a jump or call target.
+    X86_OPERAND_SYMBOL,
+} x86_operand_kind_t;
+
+// How a symbol operand's `value` names its symbol.
+typedef enum x86_symbol_t
+{
+    // `value` is the atom of the name.
+    X86_SYMBOL_NAME,
+    // `value` numbers a generated label.
+    X86_SYMBOL_STRING,
+    X86_SYMBOL_ELSE,
+    X86_SYMBOL_ENDIF,
+    X86_SYMBOL_WHILE_BEGIN,
+    X86_SYMBOL_WHILE_END,
+} x86_symbol_t;
+
+typedef struct x86_operand_t
+{
+    uint8_t kind;
+    // X86_OPERAND_REG: the register. X86_OPERAND_MEM: the base register.
+    uint8_t reg;
+    // X86_OPERAND_SYMBOL, and X86_OPERAND_MEM without a base register.
+    uint8_t symbol;
+    // Immediate, displacement or symbol, depending on `kind`.
+    int32_t value;
+} x86_operand_t;
+
+typedef struct x86_inst_t
+{
+    uint8_t opcode;
+    x86_operand_t dst;
+    x86_operand_t src;
+} x86_inst_t;
+
+static inline x86_operand_t x86_none()
+{
+    x86_operand_t operand = {X86_OPERAND_NONE, 0, 0, 0};
+    return operand;
+}
+
+static inline x86_operand_t x86_reg(x86_reg_t reg)
+{
+    x86_operand_t operand = {X86_OPERAND_REG, (uint8_t)reg, 0, 0};
+    return operand;
+}
+
+static inline x86_operand_t x86_imm(int32_t value)
+{
+    x86_operand_t operand = {X86_OPERAND_IMM, 0, 0, value};
+    return operand;
+}
+
+// Quadword at [base + offset].
+static inline x86_operand_t x86_mem(x86_reg_t base, int32_t offset)
+{
+    x86_operand_t operand = {X86_OPERAND_MEM, (uint8_t)base, 0, offset};
+    return operand;
+}
+
+// Quadword at a symbol, addressed relative to RIP.
+static inline x86_operand_t x86_mem_symbol(x86_symbol_t symbol, int32_t value)
+{
+    x86_operand_t operand = {X86_OPERAND_MEM, X86_REG_COUNT, (uint8_t)symbol,
+                             value};
+    return operand;
+}
+
+// Quadword at the global named `name`.
+static inline x86_operand_t x86_mem_global(atom_t name)
+{
+    return x86_mem_symbol(X86_SYMBOL_NAME, (int32_t)name);
+}
+
+static inline x86_operand_t x86_symbol(x86_symbol_t symbol, int32_t value)
+{
+    x86_operand_t operand = {X86_OPERAND_SYMBOL, 0, (uint8_t)symbol, value};
+    return operand;
+}
+
+static inline x86_operand_t x86_name(atom_t name)
+{
+    return x86_symbol(X86_SYMBOL_NAME, (int32_t)name);
+}
+
+// Appends an instruction to `records`.
+void x86_inst(buffer_t* records, x86_opcode_t opcode, x86_operand_t dst,
+              x86_operand_t src);
+
+// Prints `count` records as NASM assembly to `out`.
+void x86_print_nasm(const x86_inst_t* insts, size_t count, buffer_t* out);
+// Prints `count` records as GNU assembler Intel syntax to `out`.
+void x86_print_gas(const x86_inst_t* insts, size_t count, buffer_t* out);
+
+#endif
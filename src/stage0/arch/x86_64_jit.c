@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+#include "macros.h"
+#include "x86_64_encode.h"
+
+#ifndef _WIN32
+
+// Entry point called in place of `main`. Generated code uses the registers
+// the C calling convention has a caller keep, which an executable never
+// returns from `main` to need; here the compiler does, so they are saved
+// around the call.
+static const uint8_t X86_JIT_ENTRY[] = {
+    0x53,                   // push rbx
+    0x41, 0x54,             // push r12
+    0x41, 0x55,             // push r13
+    0x41, 0x56,             // push r14
+    0x41, 0x57,             // push r15
+    0xE8, 0, 0, 0, 0,       // call main
+    0x41, 0x5F,             // pop r15
+    0x41, 0x5E,             // pop r14
+    0x41, 0x5D,             // pop r13
+    0x41, 0x5C,             // pop r12
+    0x5B,                   // pop rbx
+    0xC3,                   // ret
+};
+// Offset of the rel32 field within X86_JIT_ENTRY.
+#define X86_JIT_ENTRY_MAIN 10
+
+static uint64_t x86_jit_align(uint64_t offset, uint64_t align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+bool x86_jit_run(const codegen_t* codegen, int* status)
+{
+    x86_object_t* object = x86_encode(codegen);
+
+    // Every external function gets a slot holding its address in this
+    // process and a stub jumping through it, as in an executable.
+    uint32_t* externals =
+        (uint32_t*)calloc(object->symbols_count + 1, sizeof(uint32_t));
+    uint64_t* addresses =
+        (uint64_t*)calloc(object->symbols_count + 1, sizeof(uint64_t));
+    ASSERT(externals != NULL && addresses != NULL,
+           "Out of memory loading the program.");
+    uint32_t external_count = 0;
+    uint32_t main_symbol = UINT32_MAX;
+    for (uint32_t i = 0; i < object->symbols_count; i++)
+    {
+        const x86_object_symbol_t* symbol = &object->symbols[i];
+        if (symbol->section == X86_SECTION_UNDEFINED)
+        {
+            externals[i] = external_count++;
+        }
+        else if (symbol->function &&
+                 strcmp(object->names + symbol->name, "main") == 0)
+        {
+            main_symbol = i;
+        }
+    }
+    ASSERT(main_symbol != UINT32_MAX, "The program has no main function.");
+
+    // Lay out one mapping: text, entry, stubs and slots, executable once
+    // filled in; then the string literals, read-only; then the globals,
+    // writable. Each part starts on its own page so it can be protected on
+    // its own, and all of them lie within reach of a rel32.
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t offset = object->text_count;
+    uint64_t entry_offset = offset = x86_jit_align(offset, 16);
+    offset += sizeof(X86_JIT_ENTRY);
+    uint64_t stubs_offset = offset = x86_jit_align(offset, X86_STUB_SIZE);
+    offset += external_count * X86_STUB_SIZE;
+    uint64_t slots_offset = offset;
+    offset += external_count * sizeof(uint64_t);
+    uint64_t rodata_offset = offset = x86_jit_align(offset, page);
+    offset += object->rodata_count;
+    uint64_t data_offset = offset = x86_jit_align(offset, page);
+    offset += object->data_size;
+    uint64_t size = x86_jit_align(offset, page);
+
+    uint8_t* image = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED)
+    {
+        perror("Error mapping the program");
+        free(externals);
+        free(addresses);
+        x86_object_free(object);
+        return false;
+    }
+    uint64_t base = (uint64_t)(uintptr_t)image;
+
+    // Bind each external function to the definition this process already
+    // links, e.g. the C library's printf.
+    bool resolved = true;
+    void* self = dlopen(NULL, RTLD_NOW);
+    const uint64_t section_offsets[X86_SECTION_COUNT] = {
+        [X86_SECTION_TEXT] = 0,
+        [X86_SECTION_DATA] = data_offset,
+        [X86_SECTION_RODATA] = rodata_offset,
+    };
+    for (uint32_t i = 0; i < object->symbols_count; i++)
+    {
+        const x86_object_symbol_t* symbol = &object->symbols[i];
+        if (symbol->section != X86_SECTION_UNDEFINED)
+        {
+            addresses[i] =
+                base + section_offsets[symbol->section] + symbol->offset;
+            continue;
+        }
+
+        const char* name = object->names + symbol->name;
+        void* function = self ? dlsym(self, name) : NULL;
+        if (!function)
+        {
+            log_error("Undefined function %s.", name);
+            resolved = false;
+            continue;
+        }
+        uint64_t stub = base + stubs_offset + externals[i] * X86_STUB_SIZE;
+        uint64_t slot = base + slots_offset + externals[i] * sizeof(uint64_t);
+        uint64_t target = (uint64_t)(uintptr_t)function;
+        memcpy(image + (slot - base), &target, sizeof(target));
+        x86_write_stub(image + (stub - base), stub, slot);
+        addresses[i] = stub;
+    }
+
+    if (resolved)
+    {
+        x86_link(object, base, addresses);
+        memcpy(image, object->text, object->text_count);
+        memcpy(image + entry_offset, X86_JIT_ENTRY, sizeof(X86_JIT_ENTRY));
+        int32_t main_rel = (int32_t)(addresses[main_symbol] -
+                                     (base + entry_offset +
+                                      X86_JIT_ENTRY_MAIN + 4));
+        memcpy(image + entry_offset + X86_JIT_ENTRY_MAIN, &main_rel,
+               sizeof(main_rel));
+        if (object->rodata_count > 0)
+        {
+            memcpy(image + rodata_offset, object->rodata,
+                   object->rodata_count);
+        }
+        resolved =
+            mprotect(image, rodata_offset, PROT_READ | PROT_EXEC) == 0 &&
+            mprotect(image + rodata_offset, data_offset - rodata_offset,
+                     PROT_READ) == 0;
+        if (!resolved)
+        {
+            perror("Error protecting the program");
+        }
+    }
+
+    if (resolved)
+    {
+        int (*entry)(void) = (int (*)(void))(uintptr_t)(base + entry_offset);
+        // The program writes through this same stdout; keep what the
+        // compiler printed ahead of it, and what it printed ahead of
+        // whatever follows.
+        fflush(stdout);
+        *status = entry();
+        fflush(stdout);
+    }
+
+    if (self)
+    {
+        dlclose(self);
+    }
+    munmap(image, size);
+    free(externals);
+    free(addresses);
+    x86_object_free(object);
+    return resolved;
+}
+
+#else
+
+bool x86_jit_run(const codegen_t* codegen, int* status)
+{
+    (void)codegen;
+    (void)status;
+    log_error("Running in process is not supported on this platform.");
+    return false;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "arena.h"
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct arena_chunk_t
+{
+    arena_chunk_t* next;
+    size_t used;
+    size_t capacity;
+    // Offset of the most recent allocation, so it can be grown in place.
+    size_t last;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+};
+
+static size_t align_up(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static arena_chunk_t* arena_reserve(arena_t* arena, size_t size)
+{
+    // Oversized requests get a chunk of their own.
+    size_t capacity = size > ARENA_CHUNK_SIZE ? align_up(size)
+                                               : ARENA_CHUNK_SIZE;
+    arena_chunk_t* chunk =
+        (arena_chunk_t*)malloc(sizeof(arena_chunk_t) + capacity);
+    ASSERT(chunk != NULL, "Out of memory reserving %zu arena bytes.",
+           capacity);
+    chunk->next = arena->head;
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    chunk->last = 0;
+    arena->head = chunk;
+    arena->reserved += capacity;
+    arena->chunks++;
+    return chunk;
+}
+
+arena_t* arena_new()
+{
+    arena_t* arena = (arena_t*)calloc(1, sizeof(arena_t));
+    ASSERT(arena != NULL, "Out of memory creating arena.");
+    return arena;
+}
+
+void arena_free(arena_t* arena)
+{
+    if (!arena)
+    {
+        return;
+    }
+
+    arena_chunk_t* chunk = arena->head;
+    while (chunk)
+    {
+        arena_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    size = align_up(size ? size : 1);
+
+    arena_chunk_t* chunk = arena->head;
+    if (!chunk || chunk->capacity - chunk->used < size)
+    {
+        chunk = arena_reserve(arena, size);
+    }
+
+    void* ptr = chunk->data + chunk->used;
+    chunk->last = chunk->used;
+    chunk->used += size;
+    arena->allocations++;
+    arena->used += size;
+    return ptr;
+}
+
+void* arena_calloc(arena_t* arena, size_t size)
+{
+    void* ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void* arena_grow(arena_t* arena, void* ptr, size_t old_size, size_t new_size)
+{
+    if (!ptr)
+    {
+        return arena_alloc(arena, new_size);
+    }
+
+    // Extend the most recent allocation in place when the chunk has room.
+    arena_chunk_t* chunk = arena->head;
+    size_t old_aligned = align_up(old_size ? old_size : 1);
+    size_t new_aligned = align_up(new_size ? new_size : 1);
+    if ((char*)ptr == chunk->data + chunk->last &&
+        chunk->last + old_aligned == chunk->used &&
+        chunk->capacity - chunk->last >= new_aligned)
+    {
+        if (new_aligned > old_aligned)
+        {
+            chunk->used = chunk->last + new_aligned;
+            arena->used += new_aligned - old_aligned;
+        }
+        return ptr;
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+void arena_merge(arena_t* arena, arena_t* other)
+{
+    if (other->head)
+    {
+        arena_chunk_t* tail = other->head;
+        while (tail->next)
+        {
+            tail = tail->next;
+        }
+
+        // Link the chunks behind `arena`'s head, which keeps allocating.
+        if (arena->head)
+        {
+            tail->next = arena->head->next;
+            arena->head->next = other->head;
+        }
+        else
+        {
+            arena->head = other->head;
+        }
+    }
+
+    arena->allocations += other->allocations;
+    arena->used += other->used;
+    arena->reserved += other->reserved;
+    arena->chunks += other->chunks;
+    free(other);
+}
+
+char* arena_strndup(arena_t* arena, const char* str, size_t length)
+{
+    char* copy = (char*)arena_alloc(arena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
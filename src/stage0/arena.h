@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator. Memory is handed out from large chunks in allocation order
+// and is only ever released all at once by `arena_free`.
+typedef struct arena_chunk_t arena_chunk_t;
+
+typedef struct arena_t
+{
+    // Chunk currently being allocated from. Older chunks are linked behind it.
+    arena_chunk_t* head;
+    // Number of allocations made.
+    size_t allocations;
+    // Bytes handed out, including alignment padding.
+    size_t used;
+    // Bytes reserved across all chunks. As nothing is released before
+    // `arena_free`, this is also the arena's peak footprint.
+    size_t reserved;
+    // Number of chunks reserved.
+    size_t chunks;
+} arena_t;
+
+arena_t* arena_new();
+// Releases every allocation made from `arena`, and the arena itself.
+void arena_free(arena_t* arena);
+// Returns `size` bytes of uninitialized memory.
+void* arena_alloc(arena_t* arena, size_t size);
+// Returns `size` bytes of zeroed memory.
+void* arena_calloc(arena_t* arena, size_t size);
+// Resizes the allocation at `ptr` from `old_size` to `new_size` bytes. The
+// most recent allocation grows in place; anything else is copied.
+void* arena_grow(arena_t* arena, void* ptr, size_t old_size, size_t new_size);
+// Moves every allocation of `other` into `arena`, which then owns and frees
+// them, and frees `other`.
+void arena_merge(arena_t* arena, arena_t* other);
+// Returns a NULL-terminated copy of the `length` bytes at `str`.
+char* arena_strndup(arena_t* arena, const char* str, size_t length);
+
+#endif
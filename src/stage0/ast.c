@@ -3,18 +3,28 @@
 #include "buffer.h"
 #include "codegen.h"
 #include "log.h"
+#include "macros.h"
 #include "strings.h"
 #include "tokenize.h"
+#include "tree.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-// Track the current token
-static char* g_raw = NULL;
-static token_t* g_cur = NULL;
-static token_t* g_error_token = NULL;
+#include <unistd.h>
+
+// Track the current token. `g_cur` always points at the head of the lexer's
+// lookahead ring. Parser state is per thread, so workers can parse separate
+// declarations concurrently.
+static _Thread_local source_t* g_source = NULL;
+static _Thread_local token_t* g_cur = NULL;
+static _Thread_local token_t* g_error_token = NULL;
+// Arena the current thread allocates nodes from.
+static _Thread_local arena_t* g_arena = NULL;
+// Atoms of the names in `TYPES`, so type names are matched by id.
+static atom_t g_type_atoms[sizeof(TYPES) / sizeof(TYPES[0])];
 static buffer_t* ast_buffer;
 
 char* ast_to_string(ast_node_t type)
@@ -93,11 +103,35 @@ char* ast_value_type_to_string(ast_value_type_t type)
 
 ast* ast_new(ast_node_t type)
 {
-    ast* node = (ast*)malloc(sizeof(ast));
+    ast* node = (ast*)arena_alloc(g_arena, sizeof(ast));
     node->type = type;
+    node->start = g_cur->start;
+    node->end = g_cur->end;
     return node;
 }
 
+static void ast_list_init(ast_list* list)
+{
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static void ast_list_push(ast_list* list, ast* node)
+{
+    if (list->count == list->capacity)
+    {
+        ASSERT(list->capacity <= UINT32_MAX / 2, "Too many child nodes.");
+        uint32_t capacity =
+            list->capacity ? list->capacity * 2 : AST_LIST_INITIAL;
+        list->items = (ast**)arena_grow(g_arena, list->items,
+                                        list->capacity * sizeof(ast*),
+                                        capacity * sizeof(ast*));
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = node;
+}
+
 void ast_fmt_buf(ast* n, buffer_t* out)
 {
     switch (n->type)
@@ -106,11 +140,11 @@ void ast_fmt_buf(ast* n, buffer_t* out)
     {
         buffer_printf(out, "{\"type\": \"%s\", \"body\": [",
                       ast_to_string(n->type));
-        for (int i = 0; i < n->data.program.count; i++)
+        for (uint32_t i = 0; i < n->data.program.body.count; i++)
         {
             if (i > 0)
                 buffer_puts(out, ", ");
-            ast_fmt_buf(n->data.program.body[i], out);
+            ast_fmt_buf(n->data.program.body.items[i], out);
         }
         buffer_puts(out, "]}");
         break;
@@ -120,22 +154,21 @@ void ast_fmt_buf(ast* n, buffer_t* out)
     {
         buffer_printf(out, "{\"type\": \"%s\", \"statements\": [",
                       ast_to_string(n->type));
-        int count =
-            (n->type == AST_BODY) ? n->data.body.count : n->data.block.count;
-        ast** stmts = (n->type == AST_BODY) ? n->data.body.statements
-                                            : n->data.block.statements;
-        for (int i = 0; i < count; i++)
+        ast_list* stmts = (n->type == AST_BODY) ? &n->data.body.statements
+                                                : &n->data.block.statements;
+        for (uint32_t i = 0; i < stmts->count; i++)
         {
             if (i > 0)
                 buffer_puts(out, ", ");
-            ast_fmt_buf(stmts[i], out);
+            ast_fmt_buf(stmts->items[i], out);
         }
         buffer_puts(out, "]}");
         break;
     }
     case AST_IDENTIFIER:
         buffer_printf(out, "{\"type\": \"%s\", \"name\": \"%s\"}",
-                      ast_to_string(n->type), n->data.identifier.name);
+                      ast_to_string(n->type),
+                      atom_name(n->data.identifier.atom));
         break;
     case AST_CONSTANT:
         if (n->data.constant.type == TYPE_STRING)
@@ -164,18 +197,17 @@ void ast_fmt_buf(ast* n, buffer_t* out)
                       "{\"type\": \"%s\", \"ident\": ", ast_to_string(n->type));
         ast_fmt_buf(n->data.declfn.identifier, out);
         buffer_puts(out, ", \"args\": [");
-        for (int i = 0; i < n->data.declfn.count; i++)
+        for (uint32_t i = 0; i < n->data.declfn.args.count; i++)
         {
             if (i > 0)
             {
                 buffer_puts(out, ", ");
             }
             buffer_puts(out, "{\"name\": ");
-            ast_fmt_buf(n->data.declfn.args[i], out);
-            ast_value_type_t arg_type =
-                (n->data.declfn.arg_types && i < n->data.declfn.count)
-                    ? n->data.declfn.arg_types[i]
-                    : TYPE_INT;
+            ast_fmt_buf(n->data.declfn.args.items[i], out);
+            ast_value_type_t arg_type = n->data.declfn.arg_types
+                                            ? n->data.declfn.arg_types[i]
+                                            : TYPE_INT;
             buffer_printf(out, ", \"type\": \"%s\"}",
                           ast_value_type_to_string(arg_type));
         }
@@ -195,14 +227,14 @@ void ast_fmt_buf(ast* n, buffer_t* out)
     {
         buffer_printf(out, "{\"type\": \"%s\", \"ident\": \"%s\", \"args\": [",
                       ast_to_string(n->type),
-                      n->data.call.identifier->data.identifier.name);
-        for (size_t i = 0; i < n->data.call.count; i++)
+                      atom_name(n->data.call.identifier->data.identifier.atom));
+        for (uint32_t i = 0; i < n->data.call.args.count; i++)
         {
             if (i > 0)
             {
                 buffer_puts(out, ", ");
             }
-            ast_fmt_buf(n->data.call.args[i], out);
+            ast_fmt_buf(n->data.call.args.items[i], out);
         }
         buffer_puts(out, "]}");
         break;
@@ -256,26 +288,21 @@ void ast_fmt_buf(ast* n, buffer_t* out)
     }
 }
 
-void ast_fmt(char* buffer, ast* node)
+char* ast_fmt(ast* node)
 {
-    // Helper that writes into a temporary buffer_t and copies result.
     buffer_t* buf = buffer_new();
-
-    // Build into buf and copy to caller-provided buffer
     ast_fmt_buf(node, buf);
-    // Ensure null-terminated and copy up to caller's buffer size (assume 4096)
-    size_t copy_len = buf->size < 4095 ? buf->size : 4095;
-    memcpy(buffer, buf->data, copy_len);
-    buffer[copy_len] = '\0';
-    buffer_free(buf);
+
+    return buffer_release(buf);
 }
 
-char* ast_codegen(ast* node, codegen_type_t type)
+codegen_t* ast_codegen(tree_t* tree, sema_t* sema, codegen_type_t type,
+                       codegen_cache_t* cache)
 {
-    if (node->type != AST_PROGRAM)
+    if (tree_kind(tree, tree->root) != AST_PROGRAM)
     {
-        log_error("Expected AST Program Node, got %d.", node->type);
-        log_context();
+        log_error("Expected AST Program Node, got %d.",
+                  tree_kind(tree, tree->root));
         exit(1);
     }
 
@@ -291,31 +318,16 @@ char* ast_codegen(ast* node, codegen_type_t type)
     log_info("Generating %s assembly...",
              codegen_type_to_string(g_codegen->type));
 
-    g_codegen->ops.program(node);
+    g_codegen->cache = cache;
+    g_codegen->ops.program(tree, sema);
     log_info("Completed emission.");
-
-    buffer_t* code_buffer = buffer_new();
-    if (g_codegen->global && g_codegen->global->size > 0)
-    {
-        buffer_puts(code_buffer, g_codegen->global->data);
-    }
-    if (g_codegen->data && g_codegen->data->size > 0)
+    if (cache)
     {
-        buffer_puts(code_buffer, g_codegen->data->data);
-    }
-    if (g_codegen->bss && g_codegen->bss->size > 0)
-    {
-        buffer_puts(code_buffer, g_codegen->bss->data);
-    }
-    if (g_codegen->text && g_codegen->text->size > 0)
-    {
-        buffer_puts(code_buffer, g_codegen->text->data);
+        codegen_cache_rotate(cache);
     }
 
-    char* code = strdup(code_buffer->data);
-    buffer_free(code_buffer);
-    codegen_free(g_codegen);
-    return code;
+    // The sections are written out as they are, without joining them.
+    return g_codegen;
 }
 
 void ast_free(ast* node)
@@ -325,117 +337,11 @@ void ast_free(ast* node)
         return;
     }
 
-    log_debug("Freeing %s", ast_to_string(node->type));
-
-    switch (node->type)
-    {
-    case AST_PROGRAM:
-        if (node->data.program.body)
-        {
-            // Free each body in the array
-            for (int i = 0; i < node->data.program.count; i++)
-            {
-                ast_free(node->data.program.body[i]);
-            }
-        }
-        // Free the body array itself
-        free(node->data.program.body);
-        node->data.program.body = NULL;
-        break;
-    case AST_BODY:
-        if (node->data.body.statements)
-        {
-            // Free each statement in the array
-            for (int i = 0; i < node->data.body.count; i++)
-            {
-                ast_free(node->data.body.statements[i]);
-            }
-        }
-        // Free the statement array itself
-        free(node->data.body.statements);
-        node->data.body.statements = NULL;
-        break;
-    case AST_BLOCK:
-        if (node->data.block.statements)
-        {
-            for (int i = 0; i < node->data.block.count; i++)
-            {
-                ast_free(node->data.block.statements[i]);
-            }
-        }
-        free(node->data.block.statements);
-        node->data.block.statements = NULL;
-        break;
-    case AST_DECLVAR:
-        ast_free(node->data.declvar.identifier);
-        break;
-    case AST_DECLFN:
-        ast_free(node->data.declfn.identifier);
-        if (node->data.declfn.args)
-        {
-            for (int i = 0; i < node->data.declfn.count; i++)
-            {
-                ast_free(node->data.declfn.args[i]);
-            }
-            free(node->data.declfn.args);
-            node->data.declfn.args = NULL;
-        }
-        if (node->data.declfn.arg_types)
-        {
-            free(node->data.declfn.arg_types);
-            node->data.declfn.arg_types = NULL;
-        }
-        ast_free(node->data.declfn.ret_type);
-        ast_free(node->data.declfn.block);
-        break;
-    case AST_IDENTIFIER:
-        free(node->data.identifier.name);
-        break;
-    case AST_CONSTANT:
-        if (node->data.constant.type == TYPE_STRING &&
-            node->data.constant.string_value)
-        {
-            free(node->data.constant.string_value);
-            node->data.constant.string_value = NULL;
-        }
-        break;
-    case AST_CALL:
-        if (node->data.call.args)
-        {
-            for (size_t i = 0; i < node->data.call.count; i++)
-            {
-                ast_free(node->data.call.args[i]);
-            }
-            free(node->data.call.args);
-            node->data.call.args = NULL;
-        }
-        ast_free(node->data.call.identifier);
-        node->data.call.identifier = NULL;
-        break;
-    case AST_ASSIGN:
-        ast_free(node->data.assign.lhs);
-        ast_free(node->data.assign.rhs);
-        break;
-    case AST_BINOP:
-        ast_free(node->data.binop.lhs);
-        ast_free(node->data.binop.rhs);
-        break;
-    case AST_RETURN:
-        ast_free(node->data.ret.node);
-        break;
-    case AST_IF:
-        ast_free(node->data.if_stmt.condition);
-        ast_free(node->data.if_stmt.then_branch);
-        if (node->data.if_stmt.else_branch)
-        {
-            ast_free(node->data.if_stmt.else_branch);
-        }
-        break;
-    default:
-        break;
-    }
-
-    free(node);
+    // The program node lives in its own arena, along with the rest of the
+    // tree.
+    ASSERT(node->type == AST_PROGRAM, "Cannot free a %s node on its own.",
+           ast_to_string(node->type));
+    arena_free(node->data.program.arena);
 }
 
 bool expect(token_type_t type)
@@ -450,22 +356,23 @@ bool expect_either(token_type_t type_a, token_type_t type_b)
 
 bool expect_n(token_type_t type, size_t offset)
 {
-    return (g_cur + offset)->type == type;
+    return tokenize_peek(offset)->type == type;
 }
 
 void log_context()
 {
     token_t* token = g_error_token ? g_error_token : g_cur;
-    if (!token || !g_raw)
+    if (!token || !g_source)
     {
         return;
     }
 
-    size_t buffer_len = strlen(g_raw);
+    const char* raw = g_source->data;
+
     size_t line_start = token->start;
     while (line_start > 0)
     {
-        char ch = g_raw[line_start - 1];
+        char ch = raw[line_start - 1];
         if (ch == '\n' || ch == '\r')
         {
             break;
@@ -474,9 +381,9 @@ void log_context()
     }
 
     size_t line_end = token->start;
-    while (line_end < buffer_len)
+    while (true)
     {
-        char ch = g_raw[line_end];
+        char ch = raw[line_end];
         if (ch == '\n' || ch == '\r' || ch == '\0')
         {
             break;
@@ -486,7 +393,7 @@ void log_context()
 
     size_t len = (line_end > line_start) ? (line_end - line_start) : 0;
     char* line_buf = (char*)calloc(len + 1, 1);
-    memcpy(line_buf, g_raw + line_start, len);
+    memcpy(line_buf, raw + line_start, len);
     line_buf[len] = '\0';
 
     size_t caret_column = token->start - line_start;
@@ -532,23 +439,24 @@ void require_n(token_type_t type, size_t offset)
               offset);
     if (!expect_n(type, offset))
     {
-        g_error_token = g_cur + offset;
+        g_error_token = tokenize_peek(offset);
         log_error("Expected token %s at offset %d, got %s.",
                   get_token_type_string(type), offset,
-                  get_token_type_string((g_cur + offset)->type));
+                  get_token_type_string(g_error_token->type));
         log_context();
         exit(1);
     }
-    log_debug("Found %s", get_token_type_string((g_cur + offset)->type));
+    log_debug("Found %s", get_token_type_string(tokenize_peek(offset)->type));
 }
 
 /* Move to the next token to parse. */
 void next()
 {
-    g_cur++;
-    log_debug("  Current token: start=%d, end=%d, type=%s, value='%s'",
+    tokenize_advance();
+    g_cur = tokenize_peek(0);
+    log_debug("  Current token: start=%d, end=%d, type=%s, value='%.*s'",
               g_cur->start, g_cur->end, get_token_type_string(g_cur->type),
-              g_cur->value);
+              (int)token_length(g_cur), token_text(g_cur));
 }
 
 /**
@@ -577,13 +485,13 @@ ast* parse_constant()
     ast* expr = ast_new(AST_CONSTANT);
     expr->data.constant.value = 0;
     expr->data.constant.string_value = NULL;
-    expr->start = g_cur->start;
-    expr->end = g_cur->end;
 
     if (expect(TOK_NUMBER))
     {
         expr->data.constant.type = TYPE_INT;
-        expr->data.constant.value = atoi(g_cur->value);
+        // The digits are always followed by a non-digit in the source, so
+        // the view can be converted in place.
+        expr->data.constant.value = atoi(token_text(g_cur));
     }
     else if (expect(TOK_TRUE) || expect(TOK_FALSE))
     {
@@ -593,12 +501,10 @@ ast* parse_constant()
     else if (expect(TOK_STRING))
     {
         expr->data.constant.type = TYPE_STRING;
-        expr->data.constant.string_value = strdup(g_cur->value);
-        if (!expr->data.constant.string_value)
-        {
-            log_error("Out of memory duplicating string literal.");
-            exit(1);
-        }
+        size_t length = 0;
+        const char* literal = token_literal(g_cur, &length);
+        expr->data.constant.string_value =
+            arena_strndup(g_arena, literal, length);
     }
     else
     {
@@ -616,7 +522,8 @@ ast* parse_identifier()
     log_debug("Parsing identifier...");
     require(TOK_IDENTIFIER);
     ast* expr = ast_new(AST_IDENTIFIER);
-    expr->data.identifier.name = strdup(g_cur->value);
+    // The lexer already interned the name; the node only keeps its atom.
+    expr->data.identifier.atom = g_cur->id;
     next();
     return expr;
 }
@@ -628,11 +535,11 @@ ast* parse_type()
 
     for (size_t i = 0; i < TYPE_COUNT; i++)
     {
-        if (streq(g_cur->value, TYPES[i]))
+        if (g_cur->type == TOK_IDENTIFIER && g_cur->id == g_type_atoms[i])
         {
-            next();
             ast* type = ast_new(AST_TYPE);
             type->data.type.type = (ast_value_type_t)i;
+            next();
             return type;
         }
     }
@@ -642,7 +549,8 @@ ast* parse_type()
     {
         types_list = strjoin(types_list, &capacity, TYPES[i], i > 0);
     }
-    log_error("Invalid type '%s', wanted one of %s.", g_cur->value,
+    log_error("Invalid type '%.*s', wanted one of %s.",
+              (int)token_length(g_cur), token_text(g_cur),
               types_list ? types_list : "<unknown>");
     free(types_list);
     exit(1);
@@ -685,68 +593,49 @@ ast* parse_factor()
     return NULL;
 }
 
-ast* parse_term()
+/* Binary operators
+ *
+ * Maps each operator token to its `ast_binop_t` and binding power. Higher
+ * powers bind tighter and operators of equal power associate to the left.
+ * Any token without an entry ends the expression. A new binary operator needs
+ * only its token, an `ast_binop_t` and an entry here.
+ */
+
+typedef struct binop_info_t
+{
+    uint8_t power;
+    ast_binop_t op;
+} binop_info_t;
+
+static const binop_info_t BINOPS[256] = {
+    [TOK_EQ] = {10, BIN_EQ},
+    [TOK_GT] = {20, BIN_GT},
+    [TOK_LT] = {20, BIN_LT},
+    [TOK_ADD] = {30, BIN_ADD},
+    [TOK_SUB] = {30, BIN_SUB},
+    [TOK_MUL] = {40, BIN_MUL},
+    [TOK_DIV] = {40, BIN_DIV},
+};
+
+// Parses operands joined by operators that bind tighter than `min_power`.
+// Runs of equal power are folded in a loop, so only a rise in precedence or
+// a parenthesis recurses.
+static ast* parse_binop(uint8_t min_power)
 {
     ast* node = parse_factor();
-    while (g_cur->type == TOK_MUL || g_cur->type == TOK_DIV)
+    while (true)
     {
-        ast* bin = ast_new(AST_BINOP);
-        bin->data.binop.lhs = node;
-        if (g_cur->type == TOK_MUL)
-        {
-            bin->data.binop.op = BIN_MUL;
-        }
-        else
+        const binop_info_t* info = &BINOPS[(uint8_t)g_cur->type];
+        if (info->power <= min_power)
         {
-            bin->data.binop.op = BIN_DIV;
+            break;
         }
-        next();
-        bin->data.binop.rhs = parse_factor();
-        node = bin;
-    }
-    return node;
-}
-
-static ast* parse_addition_chain()
-{
-    ast* node = parse_term();
-    while (g_cur->type == TOK_ADD || g_cur->type == TOK_SUB)
-    {
-        ast* bin = ast_new(AST_BINOP);
-        bin->data.binop.lhs = node;
-        bin->data.binop.op = (g_cur->type == TOK_ADD) ? BIN_ADD : BIN_SUB;
-        next();
-        bin->data.binop.rhs = parse_term();
-        node = bin;
-    }
-    return node;
-}
-
-static ast* parse_comparison_chain()
-{
-    ast* node = parse_addition_chain();
-    while (g_cur->type == TOK_GT || g_cur->type == TOK_LT)
-    {
-        ast* bin = ast_new(AST_BINOP);
-        bin->data.binop.lhs = node;
-        bin->data.binop.op = (g_cur->type == TOK_GT) ? BIN_GT : BIN_LT;
-        next();
-        bin->data.binop.rhs = parse_addition_chain();
-        node = bin;
-    }
-    return node;
-}
 
-static ast* parse_equality_chain()
-{
-    ast* node = parse_comparison_chain();
-    while (g_cur->type == TOK_EQ)
-    {
         ast* bin = ast_new(AST_BINOP);
         bin->data.binop.lhs = node;
-        bin->data.binop.op = BIN_EQ;
+        bin->data.binop.op = info->op;
         next();
-        bin->data.binop.rhs = parse_comparison_chain();
+        bin->data.binop.rhs = parse_binop(info->power);
         node = bin;
     }
     return node;
@@ -755,7 +644,7 @@ static ast* parse_equality_chain()
 ast* parse_expression()
 {
     log_debug("Parsing expression...");
-    return parse_equality_chain();
+    return parse_binop(0);
 }
 
 ast* parse_assignment()
@@ -783,29 +672,18 @@ ast* parse_call()
     log_debug("Parsing call...");
 
     ast* expr = ast_new(AST_CALL);
-    expr->data.call.args = NULL;
-    expr->data.call.count = 0;
+    ast_list_init(&expr->data.call.args);
     expr->data.call.identifier = parse_identifier();
 
     consume(TOK_L_PAREN);
 
-    size_t capacity = 0;
-
     // Parse arguments if the parenthesis are not immediately closed
     // e.g. ( ... ) as opposed to ()
     if (!expect(TOK_R_PAREN))
     {
-        capacity = 4;
-        expr->data.call.args = (ast**)calloc(capacity, sizeof(ast*));
         while (true)
         {
-            if (expr->data.call.count >= capacity)
-            {
-                capacity *= 2;
-                expr->data.call.args = (ast**)realloc(expr->data.call.args,
-                                                      capacity * sizeof(ast*));
-            }
-            expr->data.call.args[expr->data.call.count++] = parse_expression();
+            ast_list_push(&expr->data.call.args, parse_expression());
 
             if (expect(TOK_COMMA))
             {
@@ -857,9 +735,9 @@ ast* parse_declfn()
     consume(TOK_DECLFN);
 
     ast* expr = ast_new(AST_DECLFN);
-    expr->data.declfn.args = NULL;
+    ast_list* args = &expr->data.declfn.args;
+    ast_list_init(args);
     expr->data.declfn.arg_types = NULL;
-    expr->data.declfn.count = 0;
     expr->data.declfn.identifier = parse_identifier();
 
     consume(TOK_L_PAREN);
@@ -869,20 +747,18 @@ ast* parse_declfn()
     size_t capacity = 0;
     if (!expect(TOK_R_PAREN))
     {
-        capacity = 4;
-        expr->data.declfn.args = (ast**)calloc(capacity, sizeof(ast*));
-        expr->data.declfn.arg_types =
-            (ast_value_type_t*)calloc(capacity, sizeof(ast_value_type_t));
         while (true)
         {
-            if (expr->data.declfn.count >= capacity)
+            // Argument types run parallel to `args`.
+            if (args->count >= capacity)
             {
-                capacity *= 2;
-                expr->data.declfn.args = (ast**)realloc(
-                    expr->data.declfn.args, capacity * sizeof(ast*));
-                expr->data.declfn.arg_types = (ast_value_type_t*)realloc(
-                    expr->data.declfn.arg_types,
-                    capacity * sizeof(ast_value_type_t));
+                size_t new_capacity =
+                    capacity ? capacity * 2 : AST_LIST_INITIAL;
+                expr->data.declfn.arg_types = (ast_value_type_t*)arena_grow(
+                    g_arena, expr->data.declfn.arg_types,
+                    capacity * sizeof(ast_value_type_t),
+                    new_capacity * sizeof(ast_value_type_t));
+                capacity = new_capacity;
             }
             ast* arg_ident = parse_identifier();
             ast_value_type_t arg_type = TYPE_INT;
@@ -897,14 +773,9 @@ ast* parse_declfn()
                     log_error("Function parameters cannot have type void.");
                     exit(1);
                 }
-                ast_free(type_node);
-            }
-            expr->data.declfn.args[expr->data.declfn.count] = arg_ident;
-            if (expr->data.declfn.arg_types)
-            {
-                expr->data.declfn.arg_types[expr->data.declfn.count] = arg_type;
             }
-            expr->data.declfn.count++;
+            expr->data.declfn.arg_types[args->count] = arg_type;
+            ast_list_push(args, arg_ident);
 
             if (expect(TOK_COMMA))
             {
@@ -1084,16 +955,10 @@ ast* parse_block()
     consume(TOK_L_BRACKET);
 
     ast* expr = ast_new(AST_BLOCK);
-    struct ast_block* block = &expr->data.block;
-
-    // Assume a maximum of 32 statements.
-    block->statements = calloc(32, sizeof(ast*));
-
-    block->count = 0;
+    ast_list_init(&expr->data.block.statements);
     while (!expect(TOK_R_BRACKET))
     {
-        block->statements[block->count] = parse_statement();
-        block->count++;
+        ast_list_push(&expr->data.block.statements, parse_statement());
     }
 
     consume(TOK_R_BRACKET);
@@ -1106,17 +971,10 @@ ast* parse_body()
     log_debug("Parsing body...");
 
     ast* expr = ast_new(AST_BODY);
-
-    struct ast_body* body = &expr->data.body;
-
-    // Assume a maximum of 32 statements.
-    body->statements = calloc(32, sizeof(ast*));
-
-    body->count = 0;
+    ast_list_init(&expr->data.body.statements);
     while (can_continue())
     {
-        body->statements[body->count] = parse_statement();
-        body->count++;
+        ast_list_push(&expr->data.body.statements, parse_statement());
     }
 
     return expr;
@@ -1126,54 +984,367 @@ ast* parse_program()
 {
     ast* expr = ast_new(AST_PROGRAM);
 
-    // Assume a maximum of 32 bodies.
     struct ast_program* program = &expr->data.program;
-    program->body = calloc(32, sizeof(ast*));
+    program->arena = g_arena;
 
-    program->count = 0;
+    ast_list_init(&program->body);
     while (can_continue())
     {
-        program->body[program->count] = parse_body();
-        program->count++;
+        ast_list_push(&program->body, parse_body());
     }
 
     return expr;
 }
 
-ast* parse(char* buffer)
+/* Parallel parsing
+ *
+ * Large inputs are split at each top-level declaration before parsing. The
+ * split points come from `parse_declarations`. Neighbouring declarations are
+ * grouped into tasks of similar size. A pool of workers parses the tasks
+ * concurrently, each with its own lexer, parser state and arena. The
+ * statements of every task are then joined in source order, so the tree is
+ * the same as a serial parse.
+ */
+
+// Inputs smaller than this are parsed on the calling thread.
+#define PARSE_PARALLEL_MIN_BYTES (256 * 1024)
+// Tasks queued per worker, so workers that finish early can take more.
+#define PARSE_TASKS_PER_WORKER 4
+#define PARSE_MAX_WORKERS 64
+
+// Number of parser threads. 0 starts one per online CPU.
+#ifndef PARSE_WORKERS
+#define PARSE_WORKERS 0
+#endif
+
+typedef struct parse_task_t
 {
-    g_raw = strdup(buffer);
+    // Byte range of the top-level statements to parse.
+    size_t start;
+    size_t end;
+    ast_list statements;
+} parse_task_t;
 
-    log_debug("Tokenizing input...");
-    token_t* tokens = calloc(TOKEN_COUNT, sizeof(token_t));
-    size_t count = tokenize(buffer, tokens);
-    log_debug("Found %d tokens.", count);
+typedef struct parse_pool_t
+{
+    source_t* source;
+    parse_task_t* tasks;
+    size_t task_count;
+    // Index of the next task to hand out.
+    size_t next_task;
+} parse_pool_t;
+
+typedef struct parse_worker_t
+{
+    parse_pool_t* pool;
+    arena_t* arena;
+    pthread_t thread;
+} parse_worker_t;
 
-#ifdef _DEBUG
-    for (int i = 0; i < count; i++)
+static bool is_ident_byte(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+// Returns true if `keyword` starts at `i` in `data` as a whole word.
+static bool is_keyword_at(const char* data, size_t i, const char* keyword)
+{
+    size_t length = strlen(keyword);
+    // `strncmp` stops at the NULL-terminator, so this never reads past it.
+    return data[i] == keyword[0] && strncmp(data + i, keyword, length) == 0 &&
+           (i == 0 || !is_ident_byte(data[i - 1])) &&
+           !is_ident_byte(data[i + length]);
+}
+
+size_t* parse_declarations(const source_t* source, size_t* count,
+                           size_t* end)
+{
+    const char* data = source->data;
+    size_t size = source->size;
+    size_t* offsets = NULL;
+    size_t capacity = 0;
+    size_t depth = 0;
+    *count = 0;
+    *end = size;
+
+    // `data` is NULL-terminated, so reading one byte ahead is always safe.
+    for (size_t i = 0; i < size; i++)
     {
-        print_token(&tokens[i]);
+        char c = data[i];
+        if (c == '\0')
+        {
+            *end = i;
+            break;
+        }
+        if (c == '"')
+        {
+            // Skip the literal. As in the lexer, the next quote always ends
+            // it, even after a backslash.
+            i++;
+            while (i < size && data[i] != '"' && data[i] != '\0')
+            {
+                i++;
+            }
+            if (i >= size || data[i] == '\0')
+            {
+                *end = i < size ? i : size;
+                break;
+            }
+        }
+        else if (c == '/' && data[i + 1] == '/')
+        {
+            while (i + 1 < size && data[i + 1] != '\n' && data[i + 1] != '\0')
+            {
+                i++;
+            }
+        }
+        else if (c == '{')
+        {
+            depth++;
+        }
+        else if (c == '}')
+        {
+            depth -= depth > 0;
+        }
+        else if (depth == 0 && (is_keyword_at(data, i, "fn") ||
+                                is_keyword_at(data, i, "let")))
+        {
+            if (*count >= capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                offsets = (size_t*)realloc(offsets, capacity * sizeof(size_t));
+                ASSERT(offsets != NULL, "Out of memory prescanning source.");
+            }
+            offsets[(*count)++] = i;
+        }
     }
-#endif
+    return offsets;
+}
 
-    g_cur = &tokens[0];
+static void* parse_worker(void* arg)
+{
+    parse_worker_t* worker = (parse_worker_t*)arg;
+    parse_pool_t* pool = worker->pool;
+    g_source = pool->source;
+    g_arena = worker->arena;
 
-    ast* program = parse_program();
-    char* ast_buffer = (char*)calloc(1, 4096);
-    ast_fmt(ast_buffer, program);
-    log_debug("%s", ast_buffer);
-    free(ast_buffer);
+    while (true)
+    {
+        size_t index =
+            __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED);
+        if (index >= pool->task_count)
+        {
+            break;
+        }
+
+        parse_task_t* task = &pool->tasks[index];
+        tokenize_begin_range(pool->source, task->start, task->end);
+        g_cur = tokenize_peek(0);
+        ast_list_init(&task->statements);
+        while (can_continue())
+        {
+            ast_list_push(&task->statements, parse_statement());
+        }
+    }
+
+    tokenize_free();
+    return NULL;
+}
+
+// Returns the number of workers to parse `source` with, or 1 to parse it on
+// the calling thread.
+static size_t parse_worker_count(const source_t* source)
+{
+    // Splitting needs the whole input up front.
+    if (!source->complete || source->size < PARSE_PARALLEL_MIN_BYTES)
+    {
+        return 1;
+    }
+
+    long workers = PARSE_WORKERS ? PARSE_WORKERS : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+    {
+        return 1;
+    }
+    return workers > PARSE_MAX_WORKERS ? PARSE_MAX_WORKERS : (size_t)workers;
+}
+
+// Parses the program with `worker_count` workers, the calling thread being
+// one of them. Expects the lexer to be at the start of `source`.
+static ast* parse_program_parallel(source_t* source, size_t worker_count)
+{
+    size_t count = 0;
+    size_t end = 0;
+    size_t* offsets = parse_declarations(source, &count, &end);
+
+    // Group declarations into tasks of at least `target` bytes.
+    size_t target = end / (worker_count * PARSE_TASKS_PER_WORKER) + 1;
+    parse_task_t* tasks =
+        (parse_task_t*)calloc(count + 1, sizeof(parse_task_t));
+    ASSERT(tasks != NULL, "Out of memory creating parse tasks.");
+    size_t task_count = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (offsets[i] - start >= target)
+        {
+            tasks[task_count].start = start;
+            tasks[task_count].end = offsets[i];
+            task_count++;
+            start = offsets[i];
+        }
+    }
+    tasks[task_count].start = start;
+    tasks[task_count].end = end;
+    task_count++;
+    free(offsets);
 
-    for (int i = 0; i < count; i++)
+    if (task_count < worker_count)
     {
-        free_token(&tokens[i]);
+        worker_count = task_count;
     }
-    free(tokens);
 
-    free(g_raw);
-    g_raw = NULL;
+    // The program and its body take their spans from the first token, as in
+    // a serial parse.
+    ast* expr = ast_new(AST_PROGRAM);
+    expr->data.program.arena = g_arena;
+    ast_list_init(&expr->data.program.body);
+    ast* body = ast_new(AST_BODY);
+    ast_list_init(&body->data.body.statements);
+    ast_list_push(&expr->data.program.body, body);
+
+    parse_pool_t pool = {source, tasks, task_count, 0};
+    parse_worker_t workers[PARSE_MAX_WORKERS];
+    workers[0].pool = &pool;
+    workers[0].arena = g_arena;
+    for (size_t i = 1; i < worker_count; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].arena = arena_new();
+        int error = pthread_create(&workers[i].thread, NULL, parse_worker,
+                                   &workers[i]);
+        ASSERT(error == 0, "Unable to start parser worker: %s.",
+               strerror(error));
+    }
+    parse_worker(&workers[0]);
+    for (size_t i = 1; i < worker_count; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        arena_merge(g_arena, workers[i].arena);
+    }
+
+    for (size_t i = 0; i < task_count; i++)
+    {
+        ast_list* statements = &tasks[i].statements;
+        for (uint32_t j = 0; j < statements->count; j++)
+        {
+            ast_list_push(&body->data.body.statements, statements->items[j]);
+        }
+    }
+    free(tasks);
+
+    log_info("Parsed %zu declarations in %zu tasks on %zu workers.", count,
+             task_count, worker_count);
+    return expr;
+}
+
+// Prepares this thread's parser state to read `source`.
+static void parse_start(source_t* source)
+{
+    // Diagnostics read the source in place; it must outlive parsing.
+    g_source = source;
+
+    // Every node of the tree ends up in one arena. Parser workers allocate
+    // from arenas of their own, which are merged into it.
+    g_arena = arena_new();
+
+    for (size_t i = 0; i < TYPE_COUNT; i++)
+    {
+        g_type_atoms[i] = intern(TYPES[i], strlen(TYPES[i]));
+    }
+}
+
+// Releases this thread's parser state once `program` is complete, reporting
+// the size of its tree if `report` is set.
+static void parse_finish(ast* program, bool report)
+{
+#ifdef _DEBUG
+    // Formatting is linear in the size of the tree; skip it entirely unless
+    // it will be logged.
+    char* ast_text = ast_fmt(program);
+    log_debug("%s", ast_text);
+    free(ast_text);
+#else
+    (void)program;
+#endif
+
+    tokenize_free();
+
+    if (report)
+    {
+        log_info("AST arena: %zu allocations, %zu bytes used, %zu bytes peak "
+                 "in %zu chunks.",
+                 g_arena->allocations, g_arena->used, g_arena->reserved,
+                 g_arena->chunks);
+    }
+
+    g_arena = NULL;
+    g_source = NULL;
     g_cur = NULL;
     g_error_token = NULL;
+}
+
+ast* parse(source_t* source)
+{
+    parse_start(source);
+
+    // Tokens are lexed on demand as the parser advances.
+    tokenize_begin(source);
+    g_cur = tokenize_peek(0);
+
+    size_t workers = parse_worker_count(source);
+    ast* program = workers > 1 ? parse_program_parallel(source, workers)
+                               : parse_program();
+    parse_finish(program, true);
+    return program;
+}
+
+ast* parse_range(source_t* source, size_t start, size_t end)
+{
+    parse_start(source);
+    tokenize_begin_range(source, start, end);
+    g_cur = tokenize_peek(0);
+
+    ast* program = parse_program();
+    parse_finish(program, false);
+    return program;
+}
+
+ast* parse_each(source_t* source,
+                void (*declare)(ast* statement, void* context),
+                void* context)
+{
+    parse_start(source);
+    g_cur = tokenize_peek(0);
+
+    // Build the same single-body program as a serial parse.
+    ast* program = ast_new(AST_PROGRAM);
+    program->data.program.arena = g_arena;
+    ast_list_init(&program->data.program.body);
+    if (can_continue())
+    {
+        ast* body = ast_new(AST_BODY);
+        ast_list_init(&body->data.body.statements);
+        ast_list_push(&program->data.program.body, body);
+        while (can_continue())
+        {
+            ast* statement = parse_statement();
+            ast_list_push(&body->data.body.statements, statement);
+            declare(statement, context);
+        }
+    }
 
+    parse_finish(program, true);
     return program;
 }
@@ -2,7 +2,9 @@
 #define AST_H
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include "arena.h"
 #include "tokenize.h"
 
 #define ERROR_SPAN 10
@@ -11,6 +13,10 @@
 
 typedef enum codegen_type_t codegen_type_t;
 typedef struct ast ast;
+typedef struct tree_t tree_t;
+typedef struct sema_t sema_t;
+typedef struct codegen_cache_t codegen_cache_t;
+typedef struct codegen_t codegen_t;
 
 /* AST enums */
 
@@ -74,14 +80,29 @@ typedef enum ast_ident_t
 
 /* AST Node definitions
  *
- * Adding a new node definition requires 4 steps:
+ * Adding a new node definition requires 3 steps:
  *
  * 1. Declare the new node using the macros below.
  * 2. Add the node type to `ast_fmt`.
- * 3. Add the node type to `ast_free`.
- * 4. Add the node type to `ast_to_string`.
+ * 3. Add the node type to `ast_to_string`.
+ *
+ * Nodes, their child arrays and their strings are allocated from the arena
+ * owned by the program node, so nodes need no cleanup of their own.
  */
 
+// Children an `ast_list` has room for once its first child is added.
+#define AST_LIST_INITIAL 4
+
+// Growable list of child nodes, held in the arena and doubling as it grows.
+// Empty lists, e.g. the arguments of most calls, allocate nothing. Only the
+// header lives in the node, so nodes without lists stay as small as before.
+typedef struct ast_list
+{
+    ast** items;
+    uint32_t count;
+    uint32_t capacity;
+} ast_list;
+
 #define AST_PROP(type, name) type name;
 #define AST_NODE(name, ...)                                                    \
     typedef struct ast_##name                                                  \
@@ -89,19 +110,18 @@ typedef enum ast_ident_t
         __VA_ARGS__                                                            \
     } ast_##name
 
-AST_NODE(program, AST_PROP(ast**, body) AST_PROP(int, count));
-AST_NODE(body, AST_PROP(ast**, statements) AST_PROP(int, count));
-AST_NODE(block, AST_PROP(ast**, statements) AST_PROP(int, count));
+AST_NODE(program, AST_PROP(ast_list, body) AST_PROP(arena_t*, arena));
+AST_NODE(body, AST_PROP(ast_list, statements));
+AST_NODE(block, AST_PROP(ast_list, statements));
 AST_NODE(declvar, AST_PROP(ast*, identifier) AST_PROP(bool, is_const));
 AST_NODE(type, AST_PROP(ast_value_type_t, type));
-AST_NODE(declfn, AST_PROP(ast*, identifier) AST_PROP(ast**, args)
-                     AST_PROP(ast_value_type_t*, arg_types) AST_PROP(int, count)
+AST_NODE(declfn, AST_PROP(ast*, identifier) AST_PROP(ast_list, args)
+                     AST_PROP(ast_value_type_t*, arg_types)
                          AST_PROP(ast*, ret_type) AST_PROP(ast*, block));
-AST_NODE(identifier, AST_PROP(char*, name));
+AST_NODE(identifier, AST_PROP(atom_t, atom));
 AST_NODE(constant, AST_PROP(int, value) AST_PROP(char*, string_value)
                        AST_PROP(ast_value_type_t, type));
-AST_NODE(call, AST_PROP(ast*, identifier) AST_PROP(ast**, args)
-                   AST_PROP(size_t, count));
+AST_NODE(call, AST_PROP(ast*, identifier) AST_PROP(ast_list, args));
 AST_NODE(assign, AST_PROP(ast*, lhs) AST_PROP(ast*, rhs));
 AST_NODE(binop,
          AST_PROP(ast*, lhs) AST_PROP(ast*, rhs) AST_PROP(ast_binop_t, op));
@@ -143,6 +163,7 @@ struct ast
         struct ast_for_stmt for_stmt;
         struct ast_while_stmt while_stmt;
     } data;
+    // Span of the first token of this node within the source.
     size_t start;
     size_t end;
 };
@@ -150,9 +171,17 @@ struct ast
 /* AST functions */
 
 ast* ast_new(ast_node_t type);
+// Releases the tree rooted at the program node `node` in one call.
 void ast_free(ast* node);
-void ast_fmt(char* buffer, ast* node);
-char* ast_codegen(ast* node, codegen_type_t type);
+// Formats the tree rooted at `node` as JSON. The caller frees the result.
+char* ast_fmt(ast* node);
+// Emits assembly for the compact form of a parsed program, using the names
+// and types `sema_check` resolved for it. Statements unchanged since the
+// last compile through `cache` are replayed from it; `cache` may be NULL.
+// Returns the emitted sections, to write with `codegen_write` and release
+// with `codegen_free`.
+codegen_t* ast_codegen(tree_t* tree, sema_t* sema, codegen_type_t type,
+                       codegen_cache_t* cache);
 void log_context();
 
 /* Parsing functions for each AST Node type */
@@ -160,7 +189,6 @@ void log_context();
 ast* parse_constant();
 ast* parse_identifier();
 ast* parse_factor();
-ast* parse_term();
 ast* parse_expression();
 ast* parse_assignment();
 ast* parse_call();
@@ -175,14 +203,44 @@ ast* parse_block();
 ast* parse_body();
 ast* parse_program();
 
-/* @brief Parses the incoming `buffer` string in two passes:
+/* @brief Parses `source` into an abstract syntax tree.
  *
- * 1. Tokenizes the buffer, constructing an array of tokens from the raw text.
+ * Tokens are pulled from the lexer one at a time as the parser needs them,
+ * so only a few tokens of lookahead are held in memory at once.
+ *
+ */
+
+ast* parse(source_t* source);
+
+/* @brief Parses `source` like `parse`, passing each top-level statement to
+ * `declare` as soon as it is complete.
  *
- * 2. Parses the token array into an abstract syntax tree.
+ * Tokens are read from whatever lexer has been started on the calling
+ * thread, e.g. with `tokenize_begin_feed`. Statements are never modified
+ * after being declared.
+ */
+
+ast* parse_each(source_t* source,
+                void (*declare)(ast* statement, void* context),
+                void* context);
+
+/* @brief Parses the bytes [start, end) of a complete `source` as a program of
+ * their own, with an arena of its own. `start` and `end` must fall between
+ * top-level statements, e.g. at offsets from `parse_declarations`.
+ */
+
+ast* parse_range(source_t* source, size_t start, size_t end);
+
+/* @brief Returns the offsets of the top-level `fn` and `let` declarations of
+ * a complete `source`, found without parsing it, and stores their number in
+ * `count`. `end` receives the offset at which the lexer will stop, i.e. the
+ * first NULL byte. The caller frees the result.
  *
+ * Braces are matched to tell top-level keywords from nested ones, skipping
+ * comments and string literals as the lexer does.
  */
 
-ast* parse(char* buffer);
+size_t* parse_declarations(const source_t* source, size_t* count,
+                           size_t* end);
 
 #endif
@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "astfile.h"
+#include "intern.h"
+#include "log.h"
+#include "macros.h"
+
+#define ASTFILE_MAGIC "G2AST\0\r\n"
+#define ASTFILE_VERSION 2
+// Read back in a different byte order, this no longer matches.
+#define ASTFILE_BYTE_ORDER 0x01020304u
+#define ASTFILE_ALIGN 8
+
+// Columns of `tree_t` with an element per node, then columns with counts of
+// their own, in file order.
+#define ASTFILE_NODE_COLUMNS(X) X(kinds) X(payloads) X(spans)
+#define ASTFILE_COLUMNS(X)                                                     \
+    X(children)                                                                \
+    X(types)                                                                   \
+    X(strings)                                                                 \
+    X(lists)                                                                   \
+    X(declvars)                                                                \
+    X(declfns)                                                                 \
+    X(constants)                                                               \
+    X(calls)                                                                   \
+    X(assigns)                                                                 \
+    X(binops)                                                                  \
+    X(ifs)                                                                     \
+    X(fors)                                                                    \
+    X(whiles)
+
+typedef enum astfile_section_id_t
+{
+#define ASTFILE_SECTION_ID(name) ASTFILE_##name,
+    ASTFILE_NODE_COLUMNS(ASTFILE_SECTION_ID)
+    ASTFILE_COLUMNS(ASTFILE_SECTION_ID)
+#undef ASTFILE_SECTION_ID
+    // Offset of each identifier's name within ASTFILE_names.
+    ASTFILE_atoms,
+    // NULL-terminated identifier names.
+    ASTFILE_names,
+    ASTFILE_SECTIONS,
+} astfile_section_id_t;
+
+typedef struct astfile_section_t
+{
+    // Offset from the start of the file.
+    uint64_t offset;
+    uint32_t count;
+    // Size of one element, checked against the reader's own.
+    uint32_t size;
+} astfile_section_t;
+
+typedef struct astfile_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t source_hash;
+    // Hash of the whole file, with this field taken as zero, so a damaged
+    // file is not read as a different program.
+    uint64_t content_hash;
+    uint64_t file_size;
+    node_t root;
+    uint32_t section_count;
+    astfile_section_t sections[ASTFILE_SECTIONS];
+} astfile_header_t;
+
+static uint64_t astfile_align(uint64_t offset)
+{
+    return (offset + ASTFILE_ALIGN - 1) & ~(uint64_t)(ASTFILE_ALIGN - 1);
+}
+
+// Folds `size` bytes at `data` into `hash`.
+static uint64_t astfile_hash_more(uint64_t hash, const char* data, size_t size)
+{
+    // FNV-1a
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t astfile_hash(const char* data, size_t size)
+{
+    return astfile_hash_more(0xcbf29ce484222325ull, data, size);
+}
+
+/* Writing */
+
+typedef struct astfile_writer_t
+{
+    FILE* fp;
+    uint64_t position;
+    // Hash of the header, then of what has been written after it.
+    uint64_t hash;
+} astfile_writer_t;
+
+static bool astfile_write(astfile_writer_t* writer, const void* data,
+                          size_t size)
+{
+    writer->position += size;
+    writer->hash = astfile_hash_more(writer->hash, (const char*)data, size);
+    return size == 0 || fwrite(data, size, 1, writer->fp) == 1;
+}
+
+// Writes zeroes up to the offset `target`.
+static bool astfile_pad(astfile_writer_t* writer, uint64_t target)
+{
+    static const char zeroes[ASTFILE_ALIGN] = {0};
+    return astfile_write(writer, zeroes, (size_t)(target - writer->position));
+}
+
+bool astfile_save(const tree_t* tree, uint64_t source_hash, const char* path)
+{
+    // Number the atoms used by the tree in order of first use.
+    size_t atom_count = intern_count();
+    uint32_t* local = (uint32_t*)malloc((atom_count + 1) * sizeof(uint32_t));
+    uint32_t* payloads = (uint32_t*)malloc((tree->count + 1) * sizeof(uint32_t));
+    uint32_t* atoms = (uint32_t*)malloc((atom_count + 1) * sizeof(uint32_t));
+    atom_t* order = (atom_t*)malloc((atom_count + 1) * sizeof(atom_t));
+    ASSERT(local && payloads && atoms && order, "Out of memory writing %s.",
+           path);
+    memset(local, 0xff, (atom_count + 1) * sizeof(uint32_t));
+
+    uint32_t used = 0;
+    uint32_t names_size = 0;
+    memcpy(payloads, tree->payloads, tree->count * sizeof(uint32_t));
+    for (node_t node = 0; node < tree->count; node++)
+    {
+        if (tree_kind(tree, node) != AST_IDENTIFIER)
+        {
+            continue;
+        }
+        atom_t atom = tree_identifier(tree, node);
+        if (local[atom] == UINT32_MAX)
+        {
+            local[atom] = used;
+            order[used] = atom;
+            atoms[used++] = names_size;
+            names_size += (uint32_t)atom_length(atom) + 1;
+        }
+        payloads[node] = local[atom];
+    }
+
+    const void* data[ASTFILE_SECTIONS] = {
+        [ASTFILE_kinds] = tree->kinds,
+        [ASTFILE_payloads] = payloads,
+        [ASTFILE_spans] = tree->spans,
+        [ASTFILE_atoms] = atoms,
+        // Written name by name below.
+        [ASTFILE_names] = NULL,
+#define ASTFILE_DATA(name) [ASTFILE_##name] = tree->name,
+        ASTFILE_COLUMNS(ASTFILE_DATA)
+#undef ASTFILE_DATA
+    };
+
+    astfile_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ASTFILE_MAGIC, sizeof(header.magic));
+    header.version = ASTFILE_VERSION;
+    header.byte_order = ASTFILE_BYTE_ORDER;
+    header.source_hash = source_hash;
+    header.root = tree->root;
+    header.section_count = ASTFILE_SECTIONS;
+#define ASTFILE_SHAPE(name)                                                    \
+    header.sections[ASTFILE_##name].count = tree->count;                       \
+    header.sections[ASTFILE_##name].size = sizeof(*tree->name);
+    ASTFILE_NODE_COLUMNS(ASTFILE_SHAPE)
+#undef ASTFILE_SHAPE
+#define ASTFILE_SHAPE(name)                                                    \
+    header.sections[ASTFILE_##name].count = tree->name##_count;                \
+    header.sections[ASTFILE_##name].size = sizeof(*tree->name);
+    ASTFILE_COLUMNS(ASTFILE_SHAPE)
+#undef ASTFILE_SHAPE
+    header.sections[ASTFILE_atoms].count = used;
+    header.sections[ASTFILE_atoms].size = sizeof(uint32_t);
+    header.sections[ASTFILE_names].count = names_size;
+    header.sections[ASTFILE_names].size = sizeof(char);
+
+    uint64_t offset = astfile_align(sizeof(header));
+    for (size_t i = 0; i < ASTFILE_SECTIONS; i++)
+    {
+        astfile_section_t* section = &header.sections[i];
+        section->offset = offset;
+        offset = astfile_align(offset + (uint64_t)section->count * section->size);
+    }
+    header.file_size = offset;
+
+    // The header goes in last, once the hash of what follows it is known.
+    FILE* fp = fopen(path, "wb");
+    astfile_writer_t writer = {
+        fp, sizeof(header), astfile_hash((const char*)&header, sizeof(header))};
+    bool written = fp != NULL && fseek(fp, sizeof(header), SEEK_SET) == 0;
+    for (size_t i = 0; i < ASTFILE_SECTIONS && written; i++)
+    {
+        const astfile_section_t* section = &header.sections[i];
+        written = astfile_pad(&writer, section->offset);
+        if (i == ASTFILE_names)
+        {
+            for (uint32_t j = 0; j < used && written; j++)
+            {
+                written = astfile_write(&writer, atom_name(order[j]),
+                                        atom_length(order[j]) + 1);
+            }
+        }
+        else if (written)
+        {
+            written = astfile_write(&writer, data[i],
+                                    (size_t)section->count * section->size);
+        }
+    }
+    written = written && astfile_pad(&writer, header.file_size);
+    header.content_hash = writer.hash;
+    written = written && fseek(fp, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, fp) == 1;
+    bool ok = fp != NULL && fclose(fp) == 0 && written;
+    if (!ok)
+    {
+        log_error("Unable to write %s.", path);
+        remove(path);
+    }
+    else
+    {
+        log_info("Wrote %s: %u nodes, %u names, %llu bytes.", path,
+                 tree->count, used, (unsigned long long)header.file_size);
+    }
+
+    free(local);
+    free(payloads);
+    free(atoms);
+    free(order);
+    return ok;
+}
+
+/* Loading */
+
+// Returns true if `node` is a node of `tree`.
+static bool node_valid(const tree_t* tree, node_t node)
+{
+    return node < tree->count;
+}
+
+// Returns true if `child` is a node of `tree` that may be a child of
+// `parent`. Lowering appends a node before its children, so every child
+// lies after its parent; a file that breaks this could lead sema and codegen
+// around a cycle.
+static bool node_child(const tree_t* tree, node_t parent, node_t child)
+{
+    return child > parent && child < tree->count;
+}
+
+// Returns true if `child` is absent or a valid child of `parent`.
+static bool node_optional(const tree_t* tree, node_t parent, node_t child)
+{
+    return child == NODE_NONE || node_child(tree, parent, child);
+}
+
+static bool node_is_identifier(const tree_t* tree, node_t parent,
+                               node_t child)
+{
+    return node_child(tree, parent, child) &&
+           tree_kind(tree, child) == AST_IDENTIFIER;
+}
+
+// Returns true if `list` lies within the children of `tree` and each of its
+// nodes is a valid child of `parent`.
+static bool list_valid(const tree_t* tree, node_t parent, tree_list_t list)
+{
+    if (list.first > tree->children_count ||
+        list.count > tree->children_count - list.first)
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < list.count; i++)
+    {
+        if (!node_child(tree, parent, tree_child(tree, list, i)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks that following any index in `tree` stays within its columns and
+// leads from each node only to later ones, so a damaged file cannot make
+// codegen read out of bounds or recurse without end. Returns a description
+// of the first problem found, or NULL.
+static const char* astfile_check(const tree_t* tree, uint32_t atom_count)
+{
+    if (!node_valid(tree, tree->root) ||
+        tree_kind(tree, tree->root) != AST_PROGRAM)
+    {
+        return "bad root";
+    }
+    for (uint32_t i = 0; i < tree->children_count; i++)
+    {
+        if (!node_valid(tree, tree->children[i]))
+        {
+            return "bad child";
+        }
+    }
+    for (uint32_t i = 0; i < tree->types_count; i++)
+    {
+        if (tree->types[i] >= TYPE_COUNT)
+        {
+            return "bad argument type";
+        }
+    }
+    if (tree->strings_count > 0 &&
+        tree->strings[tree->strings_count - 1] != '\0')
+    {
+        return "unterminated string";
+    }
+
+    for (node_t node = 0; node < tree->count; node++)
+    {
+        uint32_t payload = tree->payloads[node];
+        switch (tree_kind(tree, node))
+        {
+        case AST_PROGRAM:
+        case AST_BODY:
+        case AST_BLOCK:
+            if (payload >= tree->lists_count ||
+                !list_valid(tree, node, tree->lists[payload]))
+            {
+                return "bad list";
+            }
+            break;
+        case AST_DECLVAR:
+            if (payload >= tree->declvars_count ||
+                !node_is_identifier(tree, node,
+                                    tree->declvars[payload].identifier))
+            {
+                return "bad variable declaration";
+            }
+            break;
+        case AST_DECLFN:
+        {
+            if (payload >= tree->declfns_count)
+            {
+                return "bad function declaration";
+            }
+            const tree_declfn_t* declfn = &tree->declfns[payload];
+            if (!node_is_identifier(tree, node, declfn->identifier) ||
+                !node_optional(tree, node, declfn->ret_type) ||
+                !node_child(tree, node, declfn->block) ||
+                !list_valid(tree, node, declfn->args) ||
+                declfn->arg_types > tree->types_count ||
+                declfn->args.count > tree->types_count - declfn->arg_types)
+            {
+                return "bad function declaration";
+            }
+            for (uint32_t i = 0; i < declfn->args.count; i++)
+            {
+                if (!node_is_identifier(tree, node,
+                                        tree_child(tree, declfn->args, i)))
+                {
+                    return "bad function argument";
+                }
+            }
+            break;
+        }
+        case AST_IDENTIFIER:
+            if (payload >= atom_count)
+            {
+                return "bad identifier";
+            }
+            break;
+        case AST_TYPE:
+            if (payload >= TYPE_COUNT)
+            {
+                return "bad type";
+            }
+            break;
+        case AST_RETURN:
+            if (!node_optional(tree, node, payload))
+            {
+                return "bad return";
+            }
+            break;
+        case AST_CONSTANT:
+        {
+            if (payload >= tree->constants_count)
+            {
+                return "bad constant";
+            }
+            const tree_constant_t* constant = &tree->constants[payload];
+            if (constant->type >= TYPE_COUNT ||
+                (constant->type == TYPE_STRING &&
+                 (uint32_t)constant->value >= tree->strings_count))
+            {
+                return "bad constant";
+            }
+            break;
+        }
+        case AST_CALL:
+            if (payload >= tree->calls_count ||
+                !node_is_identifier(tree, node,
+                                    tree->calls[payload].identifier) ||
+                !list_valid(tree, node, tree->calls[payload].args))
+            {
+                return "bad call";
+            }
+            break;
+        case AST_ASSIGN:
+            if (payload >= tree->assigns_count ||
+                !node_child(tree, node, tree->assigns[payload].lhs) ||
+                !node_child(tree, node, tree->assigns[payload].rhs))
+            {
+                return "bad assignment";
+            }
+            break;
+        case AST_BINOP:
+            if (payload >= tree->binops_count ||
+                !node_child(tree, node, tree->binops[payload].lhs) ||
+                !node_child(tree, node, tree->binops[payload].rhs) ||
+                tree->binops[payload].op > BIN_LT)
+            {
+                return "bad binary operation";
+            }
+            break;
+        case AST_IF:
+            if (payload >= tree->ifs_count ||
+                !node_child(tree, node, tree->ifs[payload].condition) ||
+                !node_child(tree, node, tree->ifs[payload].then_branch) ||
+                !node_optional(tree, node, tree->ifs[payload].else_branch))
+            {
+                return "bad if";
+            }
+            break;
+        case AST_FOR:
+            if (payload >= tree->fors_count ||
+                !node_is_identifier(tree, node,
+                                    tree->fors[payload].identifier) ||
+                !node_child(tree, node, tree->fors[payload].expr) ||
+                !node_child(tree, node, tree->fors[payload].block))
+            {
+                return "bad for";
+            }
+            break;
+        case AST_WHILE:
+            if (payload >= tree->whiles_count ||
+                !node_child(tree, node, tree->whiles[payload].condition) ||
+                !node_child(tree, node, tree->whiles[payload].block))
+            {
+                return "bad while";
+            }
+            break;
+        default:
+            return "bad node kind";
+        }
+    }
+    return NULL;
+}
+
+// Checks the header of a mapped file of `size` bytes. Returns a description
+// of the first problem found, or NULL.
+static const char* astfile_check_header(const astfile_header_t* header,
+                                        size_t size)
+{
+    if (size < sizeof(astfile_header_t) ||
+        memcmp(header->magic, ASTFILE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        return "not an AST file";
+    }
+    if (header->version != ASTFILE_VERSION ||
+        header->byte_order != ASTFILE_BYTE_ORDER ||
+        header->section_count != ASTFILE_SECTIONS)
+    {
+        return "written by another version";
+    }
+    if (header->file_size != size)
+    {
+        return "truncated";
+    }
+
+    uint32_t sizes[ASTFILE_SECTIONS] = {
+        [ASTFILE_kinds] = sizeof(uint8_t),
+        [ASTFILE_payloads] = sizeof(uint32_t),
+        [ASTFILE_spans] = sizeof(span_t),
+        [ASTFILE_atoms] = sizeof(uint32_t),
+        [ASTFILE_names] = sizeof(char),
+#define ASTFILE_SIZE(name) [ASTFILE_##name] = sizeof(*((tree_t*)0)->name),
+        ASTFILE_COLUMNS(ASTFILE_SIZE)
+#undef ASTFILE_SIZE
+    };
+    for (size_t i = 0; i < ASTFILE_SECTIONS; i++)
+    {
+        const astfile_section_t* section = &header->sections[i];
+        if (section->size != sizes[i])
+        {
+            return "written by another version";
+        }
+        if (section->offset % ASTFILE_ALIGN != 0 || section->offset > size ||
+            section->count > (size - section->offset) / section->size)
+        {
+            return "section out of bounds";
+        }
+    }
+    uint32_t nodes = header->sections[ASTFILE_kinds].count;
+    if (header->sections[ASTFILE_payloads].count != nodes ||
+        header->sections[ASTFILE_spans].count != nodes)
+    {
+        return "mismatched node columns";
+    }
+    return NULL;
+}
+
+tree_t* astfile_load(const char* path, uint64_t source_hash)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // Identifier payloads are rewritten with this process's atoms, so the
+    // mapping is private and writable; only the pages touched are copied.
+    size_t size = (size_t)info.st_size;
+    char* base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                             fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("Error mapping AST file");
+        return NULL;
+    }
+
+    const astfile_header_t* header = (const astfile_header_t*)base;
+    const char* problem = astfile_check_header(header, size);
+    if (problem == NULL && header->source_hash != source_hash)
+    {
+        problem = "built from another version of the source";
+    }
+    if (problem == NULL)
+    {
+        astfile_header_t unhashed = *header;
+        unhashed.content_hash = 0;
+        uint64_t hash = astfile_hash_more(
+            astfile_hash((const char*)&unhashed, sizeof(unhashed)),
+            base + sizeof(unhashed), size - sizeof(unhashed));
+        if (hash != header->content_hash)
+        {
+            problem = "damaged";
+        }
+    }
+    if (problem)
+    {
+        log_info("Ignoring %s: %s.", path, problem);
+        munmap(base, size);
+        return NULL;
+    }
+
+    tree_t* tree = (tree_t*)calloc(1, sizeof(tree_t));
+    ASSERT(tree != NULL, "Out of memory loading %s.", path);
+    tree->mapping = base;
+    tree->mapping_size = size;
+    tree->root = header->root;
+    tree->count = tree->capacity = header->sections[ASTFILE_kinds].count;
+#define ASTFILE_MAP(name)                                                      \
+    tree->name =                                                               \
+        (void*)(base + header->sections[ASTFILE_##name].offset);
+    ASTFILE_NODE_COLUMNS(ASTFILE_MAP)
+#undef ASTFILE_MAP
+#define ASTFILE_MAP(name)                                                      \
+    tree->name = (void*)(base + header->sections[ASTFILE_##name].offset);      \
+    tree->name##_count = tree->name##_capacity =                               \
+        header->sections[ASTFILE_##name].count;
+    ASTFILE_COLUMNS(ASTFILE_MAP)
+#undef ASTFILE_MAP
+
+    const astfile_section_t* atoms_section = &header->sections[ASTFILE_atoms];
+    const astfile_section_t* names_section = &header->sections[ASTFILE_names];
+    const uint32_t* atoms = (const uint32_t*)(base + atoms_section->offset);
+    const char* names = base + names_section->offset;
+    problem = astfile_check(tree, atoms_section->count);
+    if (problem == NULL && names_section->count > 0 &&
+        names[names_section->count - 1] != '\0')
+    {
+        problem = "unterminated name";
+    }
+    for (uint32_t i = 0; problem == NULL && i < atoms_section->count; i++)
+    {
+        if (atoms[i] >= names_section->count)
+        {
+            problem = "bad name";
+        }
+    }
+    if (problem)
+    {
+        log_info("Ignoring %s: %s.", path, problem);
+        tree_free(tree);
+        return NULL;
+    }
+
+    // Re-intern each name, then point identifiers at their atoms.
+    atom_t* local = (atom_t*)malloc((atoms_section->count + 1) * sizeof(atom_t));
+    ASSERT(local != NULL, "Out of memory loading %s.", path);
+    for (uint32_t i = 0; i < atoms_section->count; i++)
+    {
+        local[i] = intern(names + atoms[i], strlen(names + atoms[i]));
+    }
+    for (node_t node = 0; node < tree->count; node++)
+    {
+        if (tree_kind(tree, node) == AST_IDENTIFIER)
+        {
+            tree->payloads[node] = local[tree->payloads[node]];
+        }
+    }
+    free(local);
+
+    log_info("Loaded %s: %u nodes without parsing.", path, tree->count);
+    return tree;
+#else
+    return NULL;
+#endif
+}
@@ -0,0 +1,37 @@
+#ifndef ASTFILE_H
+#define ASTFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+/* Binary AST files (.g2ast)
+ *
+ * A compact tree written to disk as-is, so a later compile of the same
+ * source can map it and go straight to semantic analysis and codegen
+ * without lexing or parsing. The tree already refers to nodes, lists and
+ * strings by index rather than by pointer, so its columns are written
+ * verbatim and read back in place.
+ *
+ * The file starts with a versioned header holding the hash of the source it
+ * was built from, a hash of the whole file and a table of sections, one per
+ * column, each 8-byte aligned. Identifier atoms only mean something to the
+ * process that interned them, so identifiers are written as indices into a
+ * table of names stored in the file, and re-interned when it is loaded.
+ *
+ * Files are only read back by the same build of the compiler on the same
+ * machine; anything else fails validation and is rebuilt.
+ */
+
+// Returns the hash of `size` bytes of source that files are keyed on.
+uint64_t astfile_hash(const char* data, size_t size);
+// Writes `tree`, built from a source hashing to `source_hash`, to `path`.
+// Returns false on failure.
+bool astfile_save(const tree_t* tree, uint64_t source_hash, const char* path);
+// Maps the file at `path` and returns its tree, or NULL if it is missing,
+// invalid, damaged or was built from a different source. `tree_free` unmaps it.
+tree_t* astfile_load(const char* path, uint64_t source_hash);
+
+#endif
@@ -1,16 +1,17 @@
 #include "buffer.h"
 #include "log.h"
+#include "macros.h"
 
 #include <stdio.h>
 
-#define BUFFER_INITIAL_CAPACITY 8
+// Room `buffer_printf` asks for before formatting, so most lines are
+// formatted in a single attempt.
+#define BUFFER_PRINTF_RESERVE 256
 
 buffer_t* buffer_new()
 {
     buffer_t* buf = (buffer_t*)calloc(1, sizeof(buffer_t));
-    buf->data = (char*)calloc(1, BUFFER_INITIAL_CAPACITY);
-    buf->size = 0;
-    buf->capacity = BUFFER_INITIAL_CAPACITY;
+    ASSERT(buf != NULL, "Out of memory allocating a buffer.");
     return buf;
 }
 
@@ -21,62 +22,54 @@ void buffer_free(buffer_t* buf)
         return;
     }
 
-    if (buf->data != NULL)
+    // Free each chunk, then the buffer itself
+    buffer_chunk_t* chunk = buf->head;
+    while (chunk != NULL)
     {
-        // Free the buffer data
-        free(buf->data);
-
-        buf->data = NULL;
+        buffer_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
-
-    // Free the buffer itself
     free(buf);
 }
 
-void buffer_realloc(buffer_t* buf)
+char* buffer_reserve(buffer_t* buf, size_t size)
 {
-    size_t new_capacity = buf->capacity * 2;
-    char* new_data = (char*)malloc(new_capacity);
-    if (!new_data)
-    {
-        return;
-    }
-    size_t to_copy = buf->size;
-    if (to_copy > 0)
-    {
-        memcpy(new_data, buf->data, to_copy);
+    buffer_chunk_t* tail = buf->tail;
+    if (tail == NULL || tail->capacity - tail->size < size)
+    {
+        // Start a new chunk rather than growing this one, so nothing
+        // written so far moves.
+        size_t capacity = size > BUFFER_CHUNK_SIZE ? size : BUFFER_CHUNK_SIZE;
+        buffer_chunk_t* chunk =
+            (buffer_chunk_t*)malloc(sizeof(buffer_chunk_t) + capacity);
+        ASSERT(chunk != NULL, "Out of memory growing a buffer.");
+        chunk->next = NULL;
+        chunk->prev = tail;
+        chunk->size = 0;
+        chunk->capacity = capacity;
+        if (tail)
+        {
+            tail->next = chunk;
+        }
+        else
+        {
+            buf->head = chunk;
+        }
+        buf->tail = tail = chunk;
     }
-    new_data[to_copy] = '\0';
-    free(buf->data);
-    buf->data = new_data;
-    buf->capacity = new_capacity;
+    return tail->data + tail->size;
 }
 
-void buffer_recalloc(buffer_t* buf, size_t new_capacity)
+size_t buffer_available(const buffer_t* buf)
 {
-    if (new_capacity == 0)
-    {
-        return;
-    }
-    char* new_data = (char*)malloc(new_capacity);
-    if (!new_data)
-    {
-        return;
-    }
-    size_t to_copy = buf->size;
-    if (to_copy >= new_capacity)
-    {
-        to_copy = new_capacity - 1;
-    }
-    if (to_copy > 0)
-    {
-        memcpy(new_data, buf->data, to_copy);
-    }
-    new_data[to_copy] = '\0';
-    buf->size = to_copy;
-    free(buf->data);
-    buf->data = new_data;
-    buf->capacity = new_capacity;
+    return buf->tail ? buf->tail->capacity - buf->tail->size : 0;
+}
+
+void buffer_commit(buffer_t* buf, size_t size)
+{
+    buf->tail->size += size;
+    buf->size += size;
 }
 
 void buffer_putc(buffer_t* buf, char c)
@@ -86,96 +79,128 @@ void buffer_putc(buffer_t* buf, char c)
         return;
     }
 
-    // Reallocate memory by doubling it until we have enough
-    // memory (size) plus 1 (to account for the NULL terminator)
-    while (buf->size + 1 >= buf->capacity)
-    {
-        size_t new_capacity = buf->capacity * 2;
-        buffer_recalloc(buf, new_capacity);
-    }
-
-    // Actually set the character at the current buffer size
-    buf->data[buf->size] = c;
-
-    // Append the NULL terminator to the end
-    buf->size++;
-    buf->data[buf->size] = 0;
+    *buffer_reserve(buf, 1) = c;
+    buffer_commit(buf, 1);
 }
 
-void buffer_puts(buffer_t* buf, char* str)
+void buffer_puts(buffer_t* buf, const char* str)
 {
     if (buf == NULL || str == NULL)
     {
         return;
     }
 
-    size_t length = strlen(str);
-    // Need room for the string plus terminating null
-    size_t remaining = buf->capacity - buf->size;
-    if (remaining <= length)
+    buffer_write(buf, str, strlen(str));
+}
+
+void buffer_write(buffer_t* buf, const void* data, size_t size)
+{
+    if (buf == NULL || size == 0)
     {
-        size_t needed = buf->size + length + 1;
-        size_t new_capacity = buf->capacity * 2;
-        while (new_capacity < needed)
-        {
-            new_capacity *= 2;
-        }
-        buffer_recalloc(buf, new_capacity);
+        return;
     }
 
-    for (size_t i = 0; i < length; i++)
+    memcpy(buffer_reserve(buf, size), data, size);
+    buffer_commit(buf, size);
+}
+
+void buffer_put_int(buffer_t* buf, long long value)
+{
+    char digits[24];
+    size_t at = sizeof(digits);
+    unsigned long long magnitude =
+        value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+    do
     {
-        buf->data[buf->size] = str[i];
-        buf->size++;
+        digits[--at] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0)
+    {
+        digits[--at] = '-';
     }
+    buffer_write(buf, digits + at, sizeof(digits) - at);
+}
 
-    buf->data[buf->size] = '\0';
+void buffer_printf(buffer_t* buf, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    buffer_vprintf(buf, format, args);
+    va_end(args);
 }
 
-void buffer_printf(buffer_t* buf, char* format, ...)
+void buffer_vprintf(buffer_t* buf, const char* format, va_list in_args)
 {
+    // Format into whatever room the last chunk has left. Only output longer
+    // than that is formatted a second time, into a chunk of its own.
     va_list args;
-    while (1)
+    char* out = buffer_reserve(buf, BUFFER_PRINTF_RESERVE);
+    size_t available = buffer_available(buf);
+    va_copy(args, in_args);
+    int written = vsnprintf(out, available, format, args);
+    va_end(args);
+    if (written < 0)
     {
-        size_t remaining = buf->capacity - buf->size;
-        va_start(args, format);
+        return;
+    }
 
-        // Format `args` into `buf` with the specified `format`.
-        size_t written =
-            vsnprintf(buf->data + buf->size, remaining, format, args);
+    if ((size_t)written >= available)
+    {
+        // vsnprintf always writes a NULL-terminator, so ask for room for it.
+        out = buffer_reserve(buf, (size_t)written + 1);
+        va_copy(args, in_args);
+        vsnprintf(out, (size_t)written + 1, format, args);
         va_end(args);
-        if (remaining <= written)
-        {
-            buffer_realloc(buf);
-            continue;
-        }
-        buf->size += written;
-        return;
     }
+    buffer_commit(buf, (size_t)written);
 }
 
-void buffer_vprintf(buffer_t* buf, char* format, va_list in_args)
+void buffer_read(const buffer_t* buf, size_t offset, void* out, size_t size)
 {
-    va_list args;
-    while (1)
+    ASSERT(offset + size <= buf->size, "Read past the end of a buffer.");
+    if (size == 0)
     {
-        size_t remaining = buf->capacity - buf->size;
-        va_copy(args, in_args);
+        return;
+    }
 
-        // Format `args` into `buf` with the specified `format`.
-        size_t written =
-            vsnprintf(buf->data + buf->size, remaining, format, args);
-        va_end(args);
-        if (remaining <= written)
+    // Reads are usually of what was just written, so find the chunk holding
+    // `offset` from the end.
+    buffer_chunk_t* chunk = buf->tail;
+    size_t start = buf->size - chunk->size;
+    while (start > offset)
+    {
+        chunk = chunk->prev;
+        start -= chunk->size;
+    }
+
+    char* dest = (char*)out;
+    size_t skip = offset - start;
+    while (size > 0)
+    {
+        size_t count = chunk->size - skip;
+        if (count > size)
         {
-            buffer_realloc(buf);
-            continue;
+            count = size;
         }
-        buf->size += written;
-        return;
+        memcpy(dest, chunk->data + skip, count);
+        dest += count;
+        size -= count;
+        skip = 0;
+        chunk = chunk->next;
     }
 }
 
+char* buffer_release(buffer_t* buf)
+{
+    char* text = (char*)malloc(buf->size + 1);
+    ASSERT(text != NULL, "Out of memory joining a buffer.");
+    buffer_read(buf, 0, text, buf->size);
+    text[buf->size] = '\0';
+    buffer_free(buf);
+    return text;
+}
+
 char* formats(const char* format, ...)
 {
     va_list args;
@@ -204,4 +229,4 @@ char* formats(const char* format, ...)
     va_end(args);
 
     return buffer;
-}
\ No newline at end of file
+}
@@ -5,24 +5,64 @@
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct buffer_t
+/* Buffers
+ *
+ * A buffer is a list of large chunks rather than one array, so appending
+ * never moves the bytes already written: a full chunk is left as it is and a
+ * new one is started. Each write lands whole within a single chunk, so a
+ * chunk only ever holds complete writes, e.g. complete records when every
+ * write is one or more records.
+ *
+ * The contents are read back chunk by chunk, from `head` through `next`.
+ */
+
+// Size of a chunk. Writes larger than this get a chunk of their own size.
+#define BUFFER_CHUNK_SIZE (64 * 1024)
+
+typedef struct buffer_chunk_t
 {
-    // Character data within this buffer
-    char* data;
-    // The character count within this buffer
+    struct buffer_chunk_t* next;
+    struct buffer_chunk_t* prev;
+    // Bytes written to `data`, and the room it has.
     size_t size;
-    // The current capacity of this buffer in bytes
     size_t capacity;
+    char data[];
+} buffer_chunk_t;
+
+typedef struct buffer_t
+{
+    // Chunks in order, or NULL before the first write.
+    buffer_chunk_t* head;
+    buffer_chunk_t* tail;
+    // The byte count across all chunks
+    size_t size;
 } buffer_t;
 
 buffer_t* buffer_new();
 void buffer_free(buffer_t* buf);
-void buffer_realloc(buffer_t* buf);
-void buffer_recalloc(buffer_t* buf, size_t new_capacity);
+// Returns room for at least `size` contiguous bytes at the end of `buf`,
+// which become part of it once passed to `buffer_commit`.
+char* buffer_reserve(buffer_t* buf, size_t size);
+// Returns how many bytes the last `buffer_reserve` made room for.
+size_t buffer_available(const buffer_t* buf);
+// Appends the first `size` bytes of the room returned by `buffer_reserve`.
+void buffer_commit(buffer_t* buf, size_t size);
 void buffer_putc(buffer_t* buf, char c);
-void buffer_puts(buffer_t* buf, char* str);
-void buffer_printf(buffer_t* buf, char* format, ...);
-void buffer_vprintf(buffer_t* buf, char* format, va_list in_args);
+void buffer_puts(buffer_t* buf, const char* str);
+// Appends `size` bytes of `data`, which may include NULL bytes.
+void buffer_write(buffer_t* buf, const void* data, size_t size);
+// Appends the string literal `text` without measuring it.
+#define buffer_put_literal(buf, text)                                          \
+    buffer_write((buf), (text), sizeof(text) - 1)
+// Appends `value` in decimal, without going through printf.
+void buffer_put_int(buffer_t* buf, long long value);
+void buffer_printf(buffer_t* buf, const char* format, ...);
+void buffer_vprintf(buffer_t* buf, const char* format, va_list in_args);
+// Copies the `size` bytes starting at `offset` to `out`.
+void buffer_read(const buffer_t* buf, size_t offset, void* out, size_t size);
+// Frees `buf` and returns its contents as a single NULL-terminated string,
+// which the caller frees.
+char* buffer_release(buffer_t* buf);
 char* formats(const char* format, ...);
 
-#endif
\ No newline at end of file
+#endif
@@ -2,36 +2,59 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+#include <io.h>
+
+struct iovec
+{
+    void* iov_base;
+    size_t iov_len;
+};
+#endif
 
 #include "codegen.h"
 #include "log.h"
+#include "macros.h"
+#include "sema.h"
+#include "vm.h"
 #include "x86_64.h"
 
 codegen_t* g_codegen = NULL;
 
+// Chunks handed to each `writev`.
+#define CODEGEN_WRITE_VECTORS 64
+
 void codegen_emit(section_type_t section, char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
+    buffer_vprintf(codegen_section(section), fmt, args);
+    va_end(args);
+}
 
+buffer_t* codegen_section(section_type_t section)
+{
     switch (section)
     {
     case SECTION_GLOBAL:
-        buffer_vprintf(g_codegen->global, fmt, args);
-        break;
+        return g_codegen->global;
+    case SECTION_BSS:
+        return g_codegen->bss;
     case SECTION_TEXT:
-        buffer_vprintf(g_codegen->text, fmt, args);
-        break;
+        return g_codegen->text;
+    case SECTION_RODATA:
+        return g_codegen->rodata;
     case SECTION_DATA:
-        buffer_vprintf(g_codegen->data, fmt, args);
-        break;
-    case SECTION_BSS:
-        buffer_vprintf(g_codegen->bss, fmt, args);
-        break;
     default:
-        break;
+        return g_codegen->data;
     }
-    va_end(args);
 }
 
 codegen_t* codegen_new(codegen_type_t type)
@@ -48,6 +71,16 @@ codegen_t* codegen_new(codegen_type_t type)
         template = &CODEGEN_X86_64;
         break;
     }
+    case X86_64_GAS:
+    {
+        template = &CODEGEN_X86_64_GAS;
+        break;
+    }
+    case BYTECODE:
+    {
+        template = &CODEGEN_BYTECODE;
+        break;
+    }
     case X86_32:
     default:
         // If no architecture is specified or it's invalid, free
@@ -71,6 +104,9 @@ codegen_t* codegen_new(codegen_type_t type)
     g_codegen->data = buffer_new();
     g_codegen->text = buffer_new();
     g_codegen->bss = buffer_new();
+    g_codegen->rodata = buffer_new();
+    g_codegen->rodata_bytes = buffer_new();
+    g_codegen->records = buffer_new();
     log_debug("Completed section buffer allocation.");
 
     return g_codegen;
@@ -86,6 +122,613 @@ void codegen_free(codegen_t* codegen)
     buffer_free(codegen->data);
     buffer_free(codegen->text);
     buffer_free(codegen->bss);
+    buffer_free(codegen->rodata);
+    buffer_free(codegen->rodata_bytes);
+    buffer_free(codegen->records);
     free(codegen);
     g_codegen = NULL;
 }
+
+// Writes `count` vectors to `fd`, resuming writes that pipes or signals
+// cut short.
+static bool codegen_write_vectors(int fd, struct iovec* next, int count)
+{
+    while (count > 0)
+    {
+#ifndef _WIN32
+        ptrdiff_t written = writev(fd, next, count);
+#else
+        ptrdiff_t written =
+            _write(fd, next->iov_base, (unsigned int)next->iov_len);
+#endif
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error writing assembly");
+            return false;
+        }
+        while (count > 0 && (size_t)written >= next->iov_len)
+        {
+            written -= (ptrdiff_t)next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0)
+        {
+            next->iov_base = (char*)next->iov_base + written;
+            next->iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+
+// Writes the contents of each of `buffers` in turn to `fd`.
+static bool codegen_write_buffers(const buffer_t* const* buffers,
+                                  size_t buffer_count, int fd)
+{
+    size_t next = 0;
+    const buffer_chunk_t* chunk = NULL;
+    while (true)
+    {
+        // Gather the next run of chunks, across buffers.
+        struct iovec vectors[CODEGEN_WRITE_VECTORS];
+        int count = 0;
+        while (count < CODEGEN_WRITE_VECTORS)
+        {
+            if (chunk == NULL)
+            {
+                if (next == buffer_count)
+                {
+                    break;
+                }
+                chunk = buffers[next++]->head;
+                continue;
+            }
+            if (chunk->size > 0)
+            {
+                vectors[count].iov_base = (void*)chunk->data;
+                vectors[count].iov_len = chunk->size;
+                count++;
+            }
+            chunk = chunk->next;
+        }
+        if (count == 0)
+        {
+            return true;
+        }
+        if (!codegen_write_vectors(fd, vectors, count))
+        {
+            return false;
+        }
+    }
+}
+
+bool codegen_write(const codegen_t* codegen, int fd)
+{
+    // Sections in the order they appear in the assembly.
+    const buffer_t* sections[] = {codegen->global, codegen->data,
+                                  codegen->rodata, codegen->bss,
+                                  codegen->text};
+    return codegen_write_buffers(sections,
+                                 sizeof(sections) / sizeof(sections[0]), fd);
+}
+
+// Writes what `encode` appends for `codegen` to `fd`.
+static bool codegen_write_encoded(const codegen_t* codegen, int fd,
+                                  void (*encode)(const codegen_t* codegen,
+                                                 buffer_t* out))
+{
+    ASSERT(encode != NULL, "%s cannot encode its output.",
+           codegen_type_to_string(codegen->type));
+    buffer_t* out = buffer_new();
+    encode(codegen, out);
+    const buffer_t* buffers[] = {out};
+    bool written = codegen_write_buffers(buffers, 1, fd);
+    buffer_free(out);
+    return written;
+}
+
+bool codegen_write_object(const codegen_t* codegen, int fd)
+{
+    return codegen_write_encoded(codegen, fd, codegen->ops.object);
+}
+
+bool codegen_write_executable(const codegen_t* codegen, int fd)
+{
+    return codegen_write_encoded(codegen, fd, codegen->ops.executable);
+}
+
+bool codegen_run(const codegen_t* codegen, int* status)
+{
+    ASSERT(codegen->ops.run != NULL, "%s cannot run its output.",
+           codegen_type_to_string(codegen->type));
+    return codegen->ops.run(codegen, status);
+}
+
+/* Codegen cache */
+
+// Each section, then the instruction records.
+#define CODEGEN_SECTIONS (SECTION_COUNT + 1)
+#define CODEGEN_RECORDS SECTION_COUNT
+// Words of emitter state an architecture may key statements on.
+#define CODEGEN_STATE_MAX 8
+
+typedef struct codegen_entry_t
+{
+    uint64_t hash;
+    // Key the statement was emitted under; NULL for an empty slot.
+    uint32_t* key;
+    size_t key_count;
+    // Bytes appended to each section, indexed by `section_type_t`, and to
+    // the instruction records.
+    char* output[CODEGEN_SECTIONS];
+    size_t output_size[CODEGEN_SECTIONS];
+    // Emitter state after the statement.
+    int32_t state[CODEGEN_STATE_MAX];
+    // Set once a later compile has taken over the entry.
+    bool moved;
+} codegen_entry_t;
+
+struct codegen_cache_t
+{
+    // Entries of the previous compile, open-addressed by hash. Always a
+    // power of two slots, or none.
+    codegen_entry_t* previous;
+    size_t previous_slots;
+
+    // Entries of the current compile, in emission order.
+    codegen_entry_t* current;
+    size_t current_count;
+    size_t current_capacity;
+
+    // Key of the statement being looked up, and the size of each section
+    // before it if it has to be emitted.
+    uint32_t* key;
+    size_t key_count;
+    size_t key_capacity;
+    uint64_t hash;
+    size_t marks[CODEGEN_SECTIONS];
+
+    size_t replayed;
+    size_t emitted;
+};
+
+codegen_cache_t* codegen_cache_new()
+{
+    codegen_cache_t* cache =
+        (codegen_cache_t*)calloc(1, sizeof(codegen_cache_t));
+    ASSERT(cache != NULL, "Out of memory creating the codegen cache.");
+    return cache;
+}
+
+static void codegen_entry_free(codegen_entry_t* entry)
+{
+    free(entry->key);
+    for (size_t i = 0; i < CODEGEN_SECTIONS; i++)
+    {
+        free(entry->output[i]);
+    }
+}
+
+void codegen_cache_free(codegen_cache_t* cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    for (size_t i = 0; i < cache->previous_slots; i++)
+    {
+        if (cache->previous[i].key && !cache->previous[i].moved)
+        {
+            codegen_entry_free(&cache->previous[i]);
+        }
+    }
+    for (size_t i = 0; i < cache->current_count; i++)
+    {
+        codegen_entry_free(&cache->current[i]);
+    }
+    free(cache->previous);
+    free(cache->current);
+    free(cache->key);
+    free(cache);
+}
+
+static buffer_t* codegen_output(size_t index)
+{
+    return index == CODEGEN_RECORDS ? g_codegen->records
+                                    : codegen_section((section_type_t)index);
+}
+
+static void key_push(codegen_cache_t* cache, uint32_t word)
+{
+    if (cache->key_count == cache->key_capacity)
+    {
+        cache->key_capacity = cache->key_capacity ? cache->key_capacity * 2 : 256;
+        cache->key = (uint32_t*)realloc(cache->key,
+                                        cache->key_capacity * sizeof(uint32_t));
+        ASSERT(cache->key != NULL, "Out of memory growing a codegen key.");
+    }
+    cache->key[cache->key_count++] = word;
+}
+
+// Pushes a reference to `node` relative to the statement starting at
+// `first`, so the key does not depend on where the statement sits.
+static void key_push_node(codegen_cache_t* cache, node_t first, node_t node)
+{
+    key_push(cache, node == NODE_NONE ? NODE_NONE : node - first);
+}
+
+static void key_push_list(codegen_cache_t* cache, const tree_t* tree,
+                          node_t first, tree_list_t list)
+{
+    key_push(cache, list.count);
+    for (uint32_t i = 0; i < list.count; i++)
+    {
+        key_push_node(cache, first, tree_child(tree, list, i));
+    }
+}
+
+// Pushes everything codegen reads about `node`: its fields and the names and
+// types resolved for it.
+static void key_push_fields(codegen_cache_t* cache, const tree_t* tree,
+                            const sema_t* sema, node_t first, node_t node)
+{
+    ast_node_t kind = tree_kind(tree, node);
+    key_push(cache, kind);
+    switch (kind)
+    {
+    case AST_PROGRAM:
+    case AST_BODY:
+    case AST_BLOCK:
+        key_push_list(cache, tree, first, tree_list(tree, node));
+        break;
+    case AST_DECLVAR:
+    {
+        const tree_declvar_t* declvar = tree_declvar(tree, node);
+        key_push_node(cache, first, declvar->identifier);
+        key_push(cache, declvar->is_const);
+        break;
+    }
+    case AST_DECLFN:
+    {
+        const tree_declfn_t* declfn = tree_declfn(tree, node);
+        key_push_node(cache, first, declfn->identifier);
+        key_push_node(cache, first, declfn->ret_type);
+        key_push_node(cache, first, declfn->block);
+        key_push_list(cache, tree, first, declfn->args);
+        for (uint32_t i = 0; i < declfn->args.count; i++)
+        {
+            key_push(cache, tree_arg_type(tree, declfn, i));
+        }
+        break;
+    }
+    case AST_IDENTIFIER:
+    case AST_TYPE:
+        key_push(cache, tree->payloads[node]);
+        break;
+    case AST_RETURN:
+        key_push_node(cache, first, tree_return(tree, node));
+        break;
+    case AST_CONSTANT:
+    {
+        const tree_constant_t* constant = tree_constant(tree, node);
+        key_push(cache, constant->type);
+        if (constant->type != TYPE_STRING)
+        {
+            key_push(cache, (uint32_t)constant->value);
+            break;
+        }
+        // The label a literal is emitted under stands for its text.
+        key_push(cache, sema_literal(sema, node));
+        break;
+    }
+    case AST_CALL:
+    {
+        const tree_call_t* call = tree_call(tree, node);
+        key_push_node(cache, first, call->identifier);
+        key_push_list(cache, tree, first, call->args);
+        break;
+    }
+    case AST_ASSIGN:
+    {
+        const tree_assign_t* assign = tree_assign(tree, node);
+        key_push_node(cache, first, assign->lhs);
+        key_push_node(cache, first, assign->rhs);
+        break;
+    }
+    case AST_BINOP:
+    {
+        const tree_binop_t* binop = tree_binop(tree, node);
+        key_push_node(cache, first, binop->lhs);
+        key_push_node(cache, first, binop->rhs);
+        key_push(cache, binop->op);
+        break;
+    }
+    case AST_IF:
+    {
+        const tree_if_t* if_node = tree_if(tree, node);
+        key_push_node(cache, first, if_node->condition);
+        key_push_node(cache, first, if_node->then_branch);
+        key_push_node(cache, first, if_node->else_branch);
+        break;
+    }
+    case AST_FOR:
+    {
+        const tree_for_t* for_node = tree_for(tree, node);
+        key_push_node(cache, first, for_node->identifier);
+        key_push_node(cache, first, for_node->expr);
+        key_push_node(cache, first, for_node->block);
+        break;
+    }
+    case AST_WHILE:
+    {
+        const tree_while_t* while_node = tree_while(tree, node);
+        key_push_node(cache, first, while_node->condition);
+        key_push_node(cache, first, while_node->block);
+        break;
+    }
+    }
+
+    key_push(cache, sema_type(sema, node));
+    const symbol_t* symbol = sema_symbol(sema, node);
+    key_push(cache, symbol != NULL);
+    if (symbol)
+    {
+        key_push(cache, symbol->name);
+        key_push(cache, symbol->type);
+        key_push(cache, symbol->value_type);
+        key_push(cache, symbol->ret_type);
+        key_push(cache, (uint32_t)symbol->offset);
+        key_push(cache, (uint32_t)((uint64_t)symbol->offset >> 32));
+    }
+}
+
+// FNV-1a over the words of the current key.
+static uint64_t key_hash(const codegen_cache_t* cache)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < cache->key_count; i++)
+    {
+        hash = (hash ^ cache->key[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static codegen_entry_t* codegen_cache_find(codegen_cache_t* cache)
+{
+    if (cache->previous_slots == 0)
+    {
+        return NULL;
+    }
+    size_t mask = cache->previous_slots - 1;
+    for (size_t i = cache->hash & mask;; i = (i + 1) & mask)
+    {
+        codegen_entry_t* entry = &cache->previous[i];
+        if (entry->key == NULL)
+        {
+            return NULL;
+        }
+        if (!entry->moved && entry->hash == cache->hash &&
+            entry->key_count == cache->key_count &&
+            memcmp(entry->key, cache->key,
+                   cache->key_count * sizeof(uint32_t)) == 0)
+        {
+            return entry;
+        }
+    }
+}
+
+static codegen_entry_t* codegen_cache_push(codegen_cache_t* cache)
+{
+    if (cache->current_count == cache->current_capacity)
+    {
+        cache->current_capacity =
+            cache->current_capacity ? cache->current_capacity * 2 : 64;
+        cache->current = (codegen_entry_t*)realloc(
+            cache->current, cache->current_capacity * sizeof(codegen_entry_t));
+        ASSERT(cache->current != NULL, "Out of memory growing the codegen cache.");
+    }
+    return &cache->current[cache->current_count++];
+}
+
+bool codegen_cache_replay(tree_t* tree, sema_t* sema, node_t first,
+                          node_t last, int32_t* state, size_t state_count)
+{
+    codegen_cache_t* cache = g_codegen->cache;
+    ASSERT(state_count <= CODEGEN_STATE_MAX,
+           "Codegen state of %zu words is too large to cache.", state_count);
+
+    cache->key_count = 0;
+    for (size_t i = 0; i < state_count; i++)
+    {
+        key_push(cache, (uint32_t)state[i]);
+    }
+    for (node_t node = first; node < last; node++)
+    {
+        key_push_fields(cache, tree, sema, first, node);
+    }
+    cache->hash = key_hash(cache);
+
+    codegen_entry_t* entry = codegen_cache_find(cache);
+    if (entry == NULL)
+    {
+        for (size_t i = 0; i < CODEGEN_SECTIONS; i++)
+        {
+            cache->marks[i] = codegen_output(i)->size;
+        }
+        cache->emitted++;
+        return false;
+    }
+
+    for (size_t i = 0; i < CODEGEN_SECTIONS; i++)
+    {
+        buffer_write(codegen_output(i), entry->output[i],
+                     entry->output_size[i]);
+    }
+    memcpy(state, entry->state, state_count * sizeof(int32_t));
+
+    // The entry now belongs to this compile.
+    *codegen_cache_push(cache) = *entry;
+    entry->moved = true;
+    cache->replayed++;
+    return true;
+}
+
+void codegen_cache_store(const int32_t* state, size_t state_count)
+{
+    codegen_cache_t* cache = g_codegen->cache;
+    codegen_entry_t* entry = codegen_cache_push(cache);
+    memset(entry, 0, sizeof(codegen_entry_t));
+    entry->hash = cache->hash;
+    entry->key_count = cache->key_count;
+    entry->key = (uint32_t*)malloc(cache->key_count * sizeof(uint32_t));
+    ASSERT(entry->key != NULL, "Out of memory storing a codegen key.");
+    memcpy(entry->key, cache->key, cache->key_count * sizeof(uint32_t));
+
+    for (size_t i = 0; i < CODEGEN_SECTIONS; i++)
+    {
+        buffer_t* section = codegen_output(i);
+        size_t size = section->size - cache->marks[i];
+        entry->output[i] = (char*)malloc(size + 1);
+        ASSERT(entry->output[i] != NULL,
+               "Out of memory storing codegen output.");
+        buffer_read(section, cache->marks[i], entry->output[i], size);
+        entry->output_size[i] = size;
+    }
+    memcpy(entry->state, state, state_count * sizeof(int32_t));
+}
+
+// Moves the entries of the current compile into a table of their own, for
+// the next compile to look up.
+static void codegen_cache_index(codegen_cache_t* cache)
+{
+    // Keep the table at most half full.
+    size_t slots = 16;
+    while (slots < cache->current_count * 2)
+    {
+        slots *= 2;
+    }
+    cache->previous =
+        (codegen_entry_t*)calloc(slots, sizeof(codegen_entry_t));
+    ASSERT(cache->previous != NULL, "Out of memory rotating the codegen cache.");
+    cache->previous_slots = slots;
+    for (size_t i = 0; i < cache->current_count; i++)
+    {
+        codegen_entry_t* entry = &cache->current[i];
+        size_t slot = entry->hash & (slots - 1);
+        while (cache->previous[slot].key != NULL)
+        {
+            slot = (slot + 1) & (slots - 1);
+        }
+        cache->previous[slot] = *entry;
+        cache->previous[slot].moved = false;
+    }
+
+    cache->current_count = 0;
+}
+
+void codegen_cache_rotate(codegen_cache_t* cache)
+{
+    log_info("Codegen cache: %zu statements replayed, %zu emitted.",
+             cache->replayed, cache->emitted);
+
+    for (size_t i = 0; i < cache->previous_slots; i++)
+    {
+        if (cache->previous[i].key && !cache->previous[i].moved)
+        {
+            codegen_entry_free(&cache->previous[i]);
+        }
+    }
+    free(cache->previous);
+    codegen_cache_index(cache);
+    cache->replayed = 0;
+    cache->emitted = 0;
+}
+
+static bool cache_write(FILE* fp, const void* data, size_t size)
+{
+    return size == 0 || fwrite(data, size, 1, fp) == 1;
+}
+
+static bool cache_read(FILE* fp, void* data, size_t size)
+{
+    return size == 0 || fread(data, size, 1, fp) == 1;
+}
+
+bool codegen_cache_write(const codegen_cache_t* cache, FILE* fp)
+{
+    ASSERT(cache->current_count == 0,
+           "Cannot write the codegen cache during a compile.");
+
+    size_t count = 0;
+    for (size_t i = 0; i < cache->previous_slots; i++)
+    {
+        count += cache->previous[i].key != NULL;
+    }
+    bool written = cache_write(fp, &count, sizeof(count));
+    for (size_t i = 0; i < cache->previous_slots && written; i++)
+    {
+        const codegen_entry_t* entry = &cache->previous[i];
+        if (entry->key == NULL)
+        {
+            continue;
+        }
+        written = cache_write(fp, &entry->hash, sizeof(entry->hash)) &&
+                  cache_write(fp, &entry->key_count,
+                              sizeof(entry->key_count)) &&
+                  cache_write(fp, entry->key,
+                              entry->key_count * sizeof(uint32_t)) &&
+                  cache_write(fp, entry->output_size,
+                              sizeof(entry->output_size)) &&
+                  cache_write(fp, entry->state, sizeof(entry->state));
+        for (size_t j = 0; j < CODEGEN_SECTIONS && written; j++)
+        {
+            written = cache_write(fp, entry->output[j],
+                                  entry->output_size[j]);
+        }
+    }
+    return written;
+}
+
+codegen_cache_t* codegen_cache_read(FILE* fp)
+{
+    codegen_cache_t* cache = codegen_cache_new();
+    size_t count = 0;
+    bool read = cache_read(fp, &count, sizeof(count));
+    for (size_t i = 0; i < count && read; i++)
+    {
+        codegen_entry_t* entry = codegen_cache_push(cache);
+        memset(entry, 0, sizeof(codegen_entry_t));
+        read = cache_read(fp, &entry->hash, sizeof(entry->hash)) &&
+               cache_read(fp, &entry->key_count, sizeof(entry->key_count));
+        if (!read)
+        {
+            break;
+        }
+        // A key is never empty, as it holds the statement's root node.
+        entry->key = (uint32_t*)malloc(entry->key_count * sizeof(uint32_t));
+        ASSERT(entry->key != NULL, "Out of memory reading a codegen key.");
+        read = cache_read(fp, entry->key,
+                          entry->key_count * sizeof(uint32_t)) &&
+               cache_read(fp, entry->output_size,
+                          sizeof(entry->output_size)) &&
+               cache_read(fp, entry->state, sizeof(entry->state));
+        for (size_t j = 0; j < CODEGEN_SECTIONS && read; j++)
+        {
+            entry->output[j] = (char*)malloc(entry->output_size[j] + 1);
+            ASSERT(entry->output[j] != NULL,
+                   "Out of memory reading codegen output.");
+            read = cache_read(fp, entry->output[j], entry->output_size[j]);
+        }
+    }
+    if (!read)
+    {
+        codegen_cache_free(cache);
+        return NULL;
+    }
+    codegen_cache_index(cache);
+    return cache;
+}
@@ -2,15 +2,23 @@
 #define TARGETS_H
 
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "buffer.h"
+#include "tree.h"
+#include "x86_64_inst.h"
 
-typedef struct ast ast;
+typedef struct sema_t sema_t;
+typedef struct codegen_t codegen_t;
 
 typedef enum codegen_type_t
 {
     X86_32,
     X86_64,
+    // x86-64 in GNU assembler Intel syntax rather than NASM's.
+    X86_64_GAS,
+    // Bytecode run by the compiler's own VM.
+    BYTECODE,
 } codegen_type_t;
 
 typedef enum section_type_t
@@ -18,7 +26,10 @@ typedef enum section_type_t
     SECTION_GLOBAL,
     SECTION_BSS,
     SECTION_TEXT,
-    SECTION_DATA
+    SECTION_DATA,
+    // Read-only data, e.g. string literals.
+    SECTION_RODATA,
+    SECTION_COUNT
 } section_type_t;
 
 typedef struct codegen_section_t
@@ -29,27 +40,47 @@ typedef struct codegen_section_t
 
 typedef struct codegen_ops_t
 {
-    void (*program)(ast* node);
-    void (*body)(ast* node);
-    void (*statement)(ast* node);
-    char* (*binop)(ast* node);
-    void (*declfn)(ast* node);
-    void (*declvar)(ast* node);
-    void (*assign)(ast* node);
-    char* (*call)(ast* node);
-    char* (*string)(char* text);
-    void (*ret)(ast* node);
-    char* (*expr)(ast* node);
+    void (*program)(tree_t* tree, sema_t* sema);
+    void (*body)(node_t node);
+    void (*statement)(node_t node);
+    x86_reg_t (*binop)(node_t node);
+    void (*declfn)(node_t node);
+    void (*declvar)(node_t node);
+    void (*assign)(node_t node);
+    x86_reg_t (*call)(node_t node);
+    void (*ret)(node_t node);
+    x86_reg_t (*expr)(node_t node);
     void (*syscall)(int code);
     void (*comment)(char* text);
     void (*prologue)();
     void (*epilogue)(bool emit_ret);
+    // Encodes the emitted program as a relocatable object, or as an
+    // executable, appended to `out`.
+    void (*object)(const codegen_t* codegen, buffer_t* out);
+    void (*executable)(const codegen_t* codegen, buffer_t* out);
+    // Loads the emitted program into this process and runs it.
+    bool (*run)(const codegen_t* codegen, int* status);
 } codegen_ops_t;
 
+/* Codegen cache
+ *
+ * Keeps the output of each top-level statement between compiles of the same
+ * program, e.g. in watch mode. A statement is keyed on its compact tree, the
+ * names and types resolved for it and the emitter's state before it, so a
+ * statement that would emit the same text is replayed instead of emitted
+ * again. Only the entries of the latest compile are kept.
+ */
+typedef struct codegen_cache_t codegen_cache_t;
+
+codegen_cache_t* codegen_cache_new();
+void codegen_cache_free(codegen_cache_t* cache);
+
 typedef struct codegen_t
 {
     codegen_type_t type;
     codegen_ops_t ops;
+    // Statement cache, or NULL to emit everything.
+    codegen_cache_t* cache;
 
     void (*emit)(section_type_t section, char* fmt, ...);
 
@@ -57,6 +88,14 @@ typedef struct codegen_t
     buffer_t* data;
     buffer_t* text;
     buffer_t* bss;
+    buffer_t* rodata;
+    // Contents of the read-only data section: each string literal in order,
+    // NULL-terminated. `rodata` holds the same as assembly.
+    buffer_t* rodata_bytes;
+    // Instruction records of the text section, for targets which build them
+    // rather than text. Only the target knows their layout; it prints them
+    // to `text` once the program has been emitted.
+    buffer_t* records;
 } codegen_t;
 
 extern codegen_t* g_codegen;
@@ -69,6 +108,10 @@ static const char* codegen_type_to_string(codegen_type_t type)
         return "x86-32";
     case X86_64:
         return "x86-64";
+    case X86_64_GAS:
+        return "x86-64-gas";
+    case BYTECODE:
+        return "bytecode";
     default:
         break;
     }
@@ -82,6 +125,41 @@ codegen_t* codegen_new(codegen_type_t type);
 void codegen_free(codegen_t* codegen);
 // Emits the formatted string to the corresponding ASM `section`.
 void codegen_emit(section_type_t section, char* fmt, ...);
+// Returns the buffer of `section` in the current codegen object.
+buffer_t* codegen_section(section_type_t section);
+// Writes the assembly held by `codegen` to the file or pipe `fd`, handing
+// the chunks of each section to the kernel in place rather than joining
+// them first. Returns false on failure.
+bool codegen_write(const codegen_t* codegen, int fd);
+// Encodes the program held by `codegen` as a relocatable object file and
+// writes it to `fd`, skipping the assembler. Returns false on failure.
+bool codegen_write_object(const codegen_t* codegen, int fd);
+// Encodes the program held by `codegen` as an executable and writes it to
+// `fd`, skipping the assembler and the linker. Returns false on failure.
+bool codegen_write_executable(const codegen_t* codegen, int fd);
+// Loads the program held by `codegen` into this process and calls its main
+// function, storing its result in `status`. Nothing touches the disk and no
+// process is started. Returns false if the program could not be loaded.
+bool codegen_run(const codegen_t* codegen, int* status);
+
+// Looks up the top-level statement spanning nodes [first, last) of `tree`,
+// emitted from the emitter state `state`. On a hit, appends its cached output
+// to each section, updates `state` to the state after it and returns true.
+// On a miss, the caller emits the statement and then calls
+// `codegen_cache_store` with the state after it.
+bool codegen_cache_replay(tree_t* tree, sema_t* sema, node_t first,
+                          node_t last, int32_t* state, size_t state_count);
+void codegen_cache_store(const int32_t* state, size_t state_count);
+// Drops the entries of the previous compile once the current one is done.
+void codegen_cache_rotate(codegen_cache_t* cache);
+
+// Writes the entries `cache` keeps for the next compile to `fp`, so another
+// process can carry on from them. Atoms in the entries only mean the same to
+// a process that has interned the same names in the same order.
+bool codegen_cache_write(const codegen_cache_t* cache, FILE* fp);
+// Reads a cache written by `codegen_cache_write`. Returns NULL if `fp` does
+// not hold a whole one.
+codegen_cache_t* codegen_cache_read(FILE* fp);
 
 // Macro to simplify emitting ASM
 #define EMIT g_codegen->emit
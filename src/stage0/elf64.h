@@ -0,0 +1,151 @@
+#ifndef ELF64_H
+#define ELF64_H
+
+#include <stdint.h>
+
+/* ELF64
+ *
+ * The parts of the ELF64 file format the output writers use, declared here
+ * as not every platform ships <elf.h>. Files are written in the host's byte
+ * order, which is little-endian on every target stage0 emits code for.
+ */
+
+#define ELF64_CLASS 2
+#define ELF64_DATA_LSB 1
+#define ELF64_VERSION 1
+#define ELF64_OSABI_SYSV 0
+#define ELF64_MACHINE_X86_64 62
+
+typedef enum elf64_file_type_t
+{
+    ELF64_FILE_REL = 1,
+    ELF64_FILE_EXEC = 2,
+} elf64_file_type_t;
+
+typedef struct elf64_header_t
+{
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t program_offset;
+    uint64_t section_offset;
+    uint32_t flags;
+    uint16_t header_size;
+    uint16_t program_entry_size;
+    uint16_t program_count;
+    uint16_t section_entry_size;
+    uint16_t section_count;
+    uint16_t section_names;
+} elf64_header_t;
+
+typedef enum elf64_section_type_t
+{
+    ELF64_SECTION_NULL = 0,
+    ELF64_SECTION_PROGBITS = 1,
+    ELF64_SECTION_SYMTAB = 2,
+    ELF64_SECTION_STRTAB = 3,
+    ELF64_SECTION_RELA = 4,
+    ELF64_SECTION_NOBITS = 8,
+} elf64_section_type_t;
+
+#define ELF64_SECTION_WRITE 0x1
+#define ELF64_SECTION_ALLOC 0x2
+#define ELF64_SECTION_EXEC 0x4
+#define ELF64_SECTION_INFO_LINK 0x40
+
+typedef struct elf64_section_t
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t address;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t align;
+    uint64_t entry_size;
+} elf64_section_t;
+
+#define ELF64_SYMBOL_LOCAL 0
+#define ELF64_SYMBOL_GLOBAL 1
+#define ELF64_SYMBOL_NOTYPE 0
+#define ELF64_SYMBOL_OBJECT 1
+#define ELF64_SYMBOL_FUNC 2
+#define ELF64_SYMBOL_INFO(binding, type) (uint8_t)(((binding) << 4) | (type))
+#define ELF64_SECTION_UNDEF 0
+
+typedef struct elf64_symbol_t
+{
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t section;
+    uint64_t value;
+    uint64_t size;
+} elf64_symbol_t;
+
+#define ELF64_RELOC_X86_64_PC32 2
+#define ELF64_RELOC_X86_64_PLT32 4
+#define ELF64_RELOC_X86_64_GLOB_DAT 6
+#define ELF64_RELOC_INFO(symbol, type) (((uint64_t)(symbol) << 32) | (type))
+
+typedef struct elf64_rela_t
+{
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+} elf64_rela_t;
+
+typedef enum elf64_segment_type_t
+{
+    ELF64_SEGMENT_LOAD = 1,
+    ELF64_SEGMENT_DYNAMIC = 2,
+    ELF64_SEGMENT_INTERP = 3,
+    ELF64_SEGMENT_PHDR = 6,
+    ELF64_SEGMENT_GNU_STACK = 0x6474E551,
+} elf64_segment_type_t;
+
+#define ELF64_SEGMENT_EXEC 0x1
+#define ELF64_SEGMENT_WRITE 0x2
+#define ELF64_SEGMENT_READ 0x4
+
+typedef struct elf64_segment_t
+{
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t address;
+    uint64_t physical_address;
+    uint64_t file_size;
+    uint64_t memory_size;
+    uint64_t align;
+} elf64_segment_t;
+
+typedef enum elf64_dynamic_tag_t
+{
+    ELF64_DYNAMIC_NULL = 0,
+    ELF64_DYNAMIC_NEEDED = 1,
+    ELF64_DYNAMIC_HASH = 4,
+    ELF64_DYNAMIC_STRTAB = 5,
+    ELF64_DYNAMIC_SYMTAB = 6,
+    ELF64_DYNAMIC_RELA = 7,
+    ELF64_DYNAMIC_RELASZ = 8,
+    ELF64_DYNAMIC_RELAENT = 9,
+    ELF64_DYNAMIC_STRSZ = 10,
+    ELF64_DYNAMIC_SYMENT = 11,
+    ELF64_DYNAMIC_FLAGS = 30,
+} elf64_dynamic_tag_t;
+
+// Binds every symbol when the program is loaded.
+#define ELF64_DYNAMIC_FLAG_BIND_NOW 0x8
+
+typedef struct elf64_dynamic_t
+{
+    int64_t tag;
+    uint64_t value;
+} elf64_dynamic_t;
+
+#endif
@@ -0,0 +1,218 @@
+#include "intern.h"
+#include "macros.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INITIAL_SLOTS 256
+#define INTERN_BLOCK_SIZE 4096
+// Entries in each thread's cache of recently interned names.
+#define INTERN_CACHE_SLOTS 1024
+
+typedef struct atom_entry_t
+{
+    const char* name;
+    uint32_t length;
+    uint32_t hash;
+} atom_entry_t;
+
+// Names are copied into fixed-size blocks which are never moved, so pointers
+// handed out by `atom_name` remain stable as the table grows.
+typedef struct name_block_t
+{
+    struct name_block_t* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} name_block_t;
+
+// Open-addressing table of atom ids, indexed by hash.
+static atom_t* g_slots = NULL;
+static size_t g_slot_count = 0;
+
+// Atom id -> entry.
+static atom_entry_t* g_entries = NULL;
+static size_t g_entry_count = 0;
+static size_t g_entry_capacity = 0;
+
+static name_block_t* g_blocks = NULL;
+
+// Guards the table, entries and blocks above. Parser workers intern
+// concurrently.
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bumped by `intern_free`, invalidating every thread's cache.
+static uint32_t g_generation = 0;
+
+// Direct-mapped cache of names this thread has interned, indexed by hash.
+// Names repeat heavily within a program, so most lookups are answered here
+// without taking the lock. Cached names point into the blocks, which never
+// move.
+typedef struct intern_cache_t
+{
+    const char* name;
+    uint32_t length;
+    uint32_t hash;
+    uint32_t generation;
+    atom_t atom;
+} intern_cache_t;
+
+static _Thread_local intern_cache_t g_cache[INTERN_CACHE_SLOTS];
+
+// FNV-1a over the raw name bytes.
+static uint32_t intern_hash(const char* str, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char* intern_store(const char* str, size_t length)
+{
+    size_t needed = length + 1;
+    if (!g_blocks || g_blocks->capacity - g_blocks->used < needed)
+    {
+        size_t capacity =
+            needed > INTERN_BLOCK_SIZE ? needed : INTERN_BLOCK_SIZE;
+        name_block_t* block =
+            (name_block_t*)malloc(sizeof(name_block_t) + capacity);
+        ASSERT(block != NULL, "Out of memory interning '%.*s'.", (int)length,
+               str);
+        block->next = g_blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        g_blocks = block;
+    }
+
+    char* name = g_blocks->data + g_blocks->used;
+    memcpy(name, str, length);
+    name[length] = '\0';
+    g_blocks->used += needed;
+    return name;
+}
+
+static void intern_rehash(size_t slot_count)
+{
+    atom_t* slots = (atom_t*)malloc(slot_count * sizeof(atom_t));
+    ASSERT(slots != NULL, "Out of memory growing the intern table.");
+    memset(slots, 0xFF, slot_count * sizeof(atom_t));
+
+    for (size_t i = 0; i < g_entry_count; i++)
+    {
+        size_t slot = g_entries[i].hash & (slot_count - 1);
+        while (slots[slot] != ATOM_NONE)
+        {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (atom_t)i;
+    }
+
+    free(g_slots);
+    g_slots = slots;
+    g_slot_count = slot_count;
+}
+
+// Looks up or adds the name with the precomputed `hash`. Called with the lock
+// held.
+static atom_t intern_locked(const char* str, size_t length, uint32_t hash)
+{
+    // Keep the load factor at or below one half so probe chains stay short.
+    if ((g_entry_count + 1) * 2 > g_slot_count)
+    {
+        intern_rehash(g_slot_count ? g_slot_count * 2 : INTERN_INITIAL_SLOTS);
+    }
+
+    size_t slot = hash & (g_slot_count - 1);
+    while (g_slots[slot] != ATOM_NONE)
+    {
+        atom_entry_t* entry = &g_entries[g_slots[slot]];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->name, str, length) == 0)
+        {
+            return g_slots[slot];
+        }
+        slot = (slot + 1) & (g_slot_count - 1);
+    }
+
+    if (g_entry_count >= g_entry_capacity)
+    {
+        g_entry_capacity = g_entry_capacity ? g_entry_capacity * 2 : 64;
+        g_entries = (atom_entry_t*)realloc(
+            g_entries, g_entry_capacity * sizeof(atom_entry_t));
+        ASSERT(g_entries != NULL, "Out of memory growing the intern table.");
+    }
+
+    atom_t atom = (atom_t)g_entry_count++;
+    g_entries[atom].name = intern_store(str, length);
+    g_entries[atom].length = (uint32_t)length;
+    g_entries[atom].hash = hash;
+    g_slots[slot] = atom;
+    return atom;
+}
+
+atom_t intern(const char* str, size_t length)
+{
+    uint32_t hash = intern_hash(str, length);
+    uint32_t generation = __atomic_load_n(&g_generation, __ATOMIC_RELAXED);
+    intern_cache_t* cached = &g_cache[hash & (INTERN_CACHE_SLOTS - 1)];
+    if (cached->name && cached->generation == generation &&
+        cached->hash == hash && cached->length == length &&
+        memcmp(cached->name, str, length) == 0)
+    {
+        return cached->atom;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    atom_t atom = intern_locked(str, length, hash);
+    const char* name = g_entries[atom].name;
+    pthread_mutex_unlock(&g_lock);
+
+    cached->name = name;
+    cached->length = (uint32_t)length;
+    cached->hash = hash;
+    cached->generation = generation;
+    cached->atom = atom;
+    return atom;
+}
+
+const char* atom_name(atom_t atom)
+{
+    ASSERT(atom < g_entry_count, "Invalid atom %u.", atom);
+    return g_entries[atom].name;
+}
+
+size_t atom_length(atom_t atom)
+{
+    ASSERT(atom < g_entry_count, "Invalid atom %u.", atom);
+    return g_entries[atom].length;
+}
+
+size_t intern_count(void)
+{
+    return g_entry_count;
+}
+
+void intern_free(void)
+{
+    pthread_mutex_lock(&g_lock);
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELAXED);
+    while (g_blocks)
+    {
+        name_block_t* next = g_blocks->next;
+        free(g_blocks);
+        g_blocks = next;
+    }
+    free(g_slots);
+    free(g_entries);
+    g_slots = NULL;
+    g_slot_count = 0;
+    g_entries = NULL;
+    g_entry_count = 0;
+    g_entry_capacity = 0;
+    pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,27 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sentinel for "no atom", e.g. tokens that are not identifiers.
+#define ATOM_NONE ((atom_t)-1)
+
+// Stable id for an interned name. Two equal names always share one atom.
+typedef uint32_t atom_t;
+
+// Returns the atom for the `length` bytes at `str`, storing a NULL-terminated
+// copy of the name the first time it is seen. Safe to call from several
+// threads at once.
+atom_t intern(const char* str, size_t length);
+// Returns the NULL-terminated name of `atom`. The pointer stays valid until
+// `intern_free` is called. Not safe while another thread is interning.
+const char* atom_name(atom_t atom);
+// Returns the length of the name of `atom`, excluding the NULL-terminator.
+size_t atom_length(atom_t atom);
+// Returns the number of distinct names interned so far.
+size_t intern_count(void);
+// Releases every interned name and resets the table.
+void intern_free(void);
+
+#endif
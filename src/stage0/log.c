@@ -3,9 +3,20 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+static bool g_quiet = false;
+
+void log_set_quiet(bool quiet)
+{
+    g_quiet = quiet;
+}
+
 void log_debug(const char* format, ...)
 {
 #ifdef _DEBUG
+    if (g_quiet)
+    {
+        return;
+    }
     printf("%s", "\033[30m[DBG] - ");
     va_list args;
     va_start(args, format);
@@ -17,6 +28,10 @@ void log_debug(const char* format, ...)
 
 void log_info(const char* format, ...)
 {
+    if (g_quiet)
+    {
+        return;
+    }
     printf("%s", "\033[0m[INF] - ");
     va_list args;
     va_start(args, format);
@@ -2,9 +2,13 @@
 #define LOG_H
 
 #include <stdarg.h>
+#include <stdbool.h>
 
 void log_debug(const char* format, ...);
 void log_info(const char* format, ...);
 void log_error(const char* format, ...);
+// Silences debug and info messages while `quiet` is set. Errors are always
+// logged.
+void log_set_quiet(bool quiet);
 
 #endif
\ No newline at end of file
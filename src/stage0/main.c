@@ -17,15 +17,48 @@
 #include <sys/stat.h>
 
 #ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/wait.h>
+#include <unistd.h>
 #else
 #include <direct.h>
+#include <fcntl.h>
+#include <io.h>
+
+#define popen _popen
+#define pclose _pclose
 #endif
 
 #include "ast.h"
+#include "astfile.h"
 #include "buffer.h"
 #include "codegen.h"
+#include "intern.h"
 #include "log.h"
+#include "pipeline.h"
+#include "sema.h"
+#include "source.h"
+#include "tree.h"
+#include "watch.h"
+
+// Directory receiving every file a build writes.
+#define BUILD_DIRECTORY "./build"
+
+// What a build produces.
+typedef enum output_format_t
+{
+    // Assembly, assembled by nasm.
+    OUTPUT_ASM,
+    // GNU assembler syntax, piped straight into the assembler.
+    OUTPUT_GAS,
+    // A relocatable object encoded by the compiler itself.
+    OUTPUT_OBJ,
+    // An executable encoded by the compiler itself, with no linker.
+    OUTPUT_EXE,
+    // Nothing on disk: the program is loaded into the compiler and run there.
+    OUTPUT_JIT,
+} output_format_t;
 
 static int ensure_directory_exists(const char* path)
 {
@@ -94,6 +127,23 @@ static void derive_output_name(const char* input, char* out, size_t out_sz)
     out[copy] = '\0';
 }
 
+// Decodes the status of a finished command as a shell would report it.
+static int exit_status(int status)
+{
+#ifndef _WIN32
+    if (WIFEXITED(status))
+    {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status))
+    {
+        return 128 + WTERMSIG(status);
+    }
+#endif
+
+    return status;
+}
+
 static int run_command_fmt(const char* format, ...)
 {
     char stack_cmd[512];
@@ -133,76 +183,243 @@ static int run_command_fmt(const char* format, ...)
         return -1;
     }
 
-#ifndef _WIN32
-    if (WIFEXITED(status))
+    return exit_status(status);
+}
+
+// Starts `command` and writes `code` to its standard input through `write`,
+// e.g. `codegen_write`, so the command reads it while it is written rather
+// than from a file. Returns the command's exit status, or -1 if it could not
+// be started or fed.
+static int pipe_command(const char* command, const codegen_t* code,
+                        bool (*write)(const codegen_t* code, int fd))
+{
+    log_info("Running: %s", command);
+    fflush(stdout);
+    FILE* pipe = popen(command, "w");
+    if (pipe == NULL)
     {
-        return WEXITSTATUS(status);
+        perror("popen");
+        return -1;
     }
-    if (WIFSIGNALED(status))
+
+#ifndef _WIN32
+    // A command that exits early fails the write rather than the compiler.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    bool written = write(code, fileno(pipe));
+    int status = pclose(pipe);
+    if (status == -1)
     {
-        return 128 + WTERMSIG(status);
+        perror("pclose");
+        return -1;
     }
-#endif
 
-    return status;
+    status = exit_status(status);
+    return (written || status != 0) ? status : -1;
 }
 
-char* read_file(const char* filename)
+// Writes `code` to `filename` through `write`, e.g. `codegen_write`, with
+// the permissions `mode`.
+bool write_file(const char* filename, const codegen_t* code,
+                bool (*write)(const codegen_t* code, int fd), int mode)
 {
-    FILE* fp = NULL;
-    long file_size = 0;
-    char* buffer = NULL;
-
-    fp = fopen(filename, "r");
-    if (fp == NULL)
+#ifndef _WIN32
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, mode);
+#else
+    int fd = _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                   _S_IREAD | _S_IWRITE);
+#endif
+    if (fd < 0)
     {
         perror("Error opening file");
-        return NULL;
+        return false;
     }
 
-    // Determine file size
-    fseek(fp, 0, SEEK_END);
-    file_size = ftell(fp);
-    rewind(fp); // Go back to the beginning
+    bool written = write(code, fd);
+#ifndef _WIN32
+    written = close(fd) == 0 && written;
+#else
+    written = _close(fd) == 0 && written;
+#endif
+    return written;
+}
+
+// Writes `code` to build/<name>.asm and assembles it, pipes it into the GNU
+// assembler or encodes it straight to build/<name>.o, then links it, unless
+// it was encoded straight to the executable build/<name>. Runs the result if
+// `exec` is set. A JIT build only runs `code`, within this process. Frees
+// `code`.
+static int build_outputs(const char* input_name, codegen_t* code,
+                         output_format_t format, bool exec)
+{
+#ifdef _DEBUG
+    fflush(stdout);
+    codegen_write(code, fileno(stdout));
+#endif
 
-    // Allocate memory for the buffer
-    buffer = (char*)malloc(file_size + 1); // +1 for null terminator
-    if (buffer == NULL)
+    if (format == OUTPUT_JIT)
     {
-        perror("Error allocating memory");
-        fclose(fp);
-        return NULL;
+        int status = 0;
+        bool ran = codegen_run(code, &status);
+        codegen_free(code);
+        if (!ran)
+        {
+            return 1;
+        }
+        log_info("Program exited with %d.", status);
+        return 0;
     }
 
-    // Read the file content into the buffer
-    size_t bytes_read = fread(buffer, 1, file_size, fp);
-    if (bytes_read != file_size)
+    const char* build_dir = BUILD_DIRECTORY;
+    if (ensure_directory_exists(build_dir) != 0)
     {
-        perror("Error reading file");
-        free(buffer);
-        fclose(fp);
-        return NULL;
+        codegen_free(code);
+        return 1;
     }
 
-    // Add null terminator
-    buffer[file_size] = '\0';
+    char output_name[512];
+    derive_output_name(input_name, output_name, sizeof(output_name));
 
-    fclose(fp);
-    return buffer;
+    char asm_filepath[1024];
+    char obj_filepath[1024];
+    char bin_filepath[1024];
+    snprintf(asm_filepath, sizeof(asm_filepath), "%s/%s.asm", build_dir,
+             output_name);
+    snprintf(obj_filepath, sizeof(obj_filepath), "%s/%s.o", build_dir,
+             output_name);
+    snprintf(bin_filepath, sizeof(bin_filepath), "%s/%s", build_dir,
+             output_name);
+
+    // Output to asm file, to the assembler through a pipe, or to an object
+    // file or executable without going through one
+    bool written = false;
+    switch (format)
+    {
+    case OUTPUT_OBJ:
+        written = write_file(obj_filepath, code, codegen_write_object, 0644);
+        break;
+    case OUTPUT_EXE:
+        written =
+            write_file(bin_filepath, code, codegen_write_executable, 0755);
+        break;
+    case OUTPUT_GAS:
+    {
+        char command[1100];
+        snprintf(command, sizeof(command), "gcc -x assembler -c - -o %s",
+                 obj_filepath);
+        written = pipe_command(command, code, codegen_write) == 0;
+        break;
+    }
+    case OUTPUT_ASM:
+    default:
+        written = write_file(asm_filepath, code, codegen_write, 0644);
+        break;
+    }
+    codegen_free(code);
+    if (!written)
+    {
+        return 1;
+    }
+
+    if (format == OUTPUT_ASM)
+    {
+        run_command_fmt("nasm -f elf64 %s -o %s", asm_filepath, obj_filepath);
+    }
+    if (format != OUTPUT_EXE)
+    {
+        run_command_fmt("gcc %s -o %s -z noexecstack -no-pie", obj_filepath,
+                        bin_filepath);
+    }
+    if (exec)
+    {
+        run_command_fmt("%s", bin_filepath);
+    }
+
+    return 0;
 }
 
-void write_file(const char* filename, char* buffer)
+// Compiles `file_name` for `target` each time it is saved, until watching
+// fails.
+static int watch_program(const char* file_name, codegen_type_t target,
+                         output_format_t format, bool exec)
 {
-    FILE* fp = NULL;
-    fp = fopen(filename, "w");
-    if (fp == NULL)
+#ifndef _WIN32
+    watch_t* watch = watch_new(file_name, target);
+    if (!watch)
     {
-        perror("Error opening file");
-        return;
+        return 1;
     }
 
-    fputs(buffer, fp);
-    fclose(fp);
+    while (true)
+    {
+        // Both processes below work from this one snapshot, so a save
+        // landing in between cannot make them disagree.
+        log_info("Compiling %s...", file_name);
+        source_t* source = source_read(file_name);
+        // Errors exit the process that hits them, so each build runs in a
+        // child. Only once it succeeds does the resident state follow, from
+        // what the child hands back rather than from a second compile.
+        FILE* handoff = source ? tmpfile() : NULL;
+        if (source && !handoff)
+        {
+            perror("Error running build");
+        }
+        if (handoff)
+        {
+            fflush(stdout);
+            pid_t child = fork();
+            if (child == 0)
+            {
+                int status = build_outputs(
+                    file_name, watch_compile(watch, source), format, exec);
+                if (status == 0 && !watch_save(watch, handoff))
+                {
+                    perror("Error saving watch state");
+                }
+                exit(status);
+            }
+
+            int status = 0;
+            if (child < 0 || waitpid(child, &status, 0) < 0)
+            {
+                perror("Error running build");
+            }
+            else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            {
+                rewind(handoff);
+                log_set_quiet(true);
+                bool loaded = watch_load(watch, source, handoff);
+                log_set_quiet(false);
+                if (!loaded)
+                {
+                    log_error("Dropped the codegen cache of %s.", file_name);
+                }
+            }
+            else
+            {
+                log_error("Build of %s failed.", file_name);
+            }
+            fclose(handoff);
+        }
+        if (source)
+        {
+            source_close(source);
+        }
+
+        log_info("Watching %s for changes...", file_name);
+        fflush(stdout);
+        if (!watch_wait(watch))
+        {
+            break;
+        }
+    }
+
+    watch_free(watch);
+    return 1;
+#else
+    log_error("Watch mode is not supported on this platform.");
+    return 1;
+#endif
 }
 
 int main(int argc, char** argv)
@@ -214,75 +431,182 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    // Parse 'exec' option
+    // Parse options following the file name
     bool exec = false;
-    if (argc >= 3)
+    bool run = false;
+    bool pipeline = false;
+    bool watch = false;
+    bool ast_cache = false;
+    output_format_t format = OUTPUT_ASM;
+    bool emit = false;
+    for (int i = 2; i < argc; i++)
     {
-        exec = streq(argv[2], "--exec");
+        if (streq(argv[i], "--exec"))
+        {
+            exec = true;
+        }
+        else if (streq(argv[i], "--run"))
+        {
+            // Compile to bytecode and run it in the compiler's own VM.
+            run = true;
+        }
+        else if (streq(argv[i], "--pipeline"))
+        {
+            // Lex, parse and flatten on separate threads.
+            pipeline = true;
+        }
+        else if (streq(argv[i], "--watch"))
+        {
+            // Stay resident and recompile each time the file is saved.
+            watch = true;
+        }
+        else if (streq(argv[i], "--ast-cache"))
+        {
+            // Load build/<name>.g2ast instead of parsing when it was built
+            // from this same source, and write it otherwise.
+            ast_cache = true;
+        }
+        else if (streq(argv[i], "--emit=asm"))
+        {
+            format = OUTPUT_ASM;
+            emit = true;
+        }
+        else if (streq(argv[i], "--emit=obj"))
+        {
+            // Encode an object file directly rather than running nasm.
+            format = OUTPUT_OBJ;
+            emit = true;
+        }
+        else if (streq(argv[i], "--emit=exe"))
+        {
+            // Encode a dynamically linked executable rather than running
+            // nasm and then gcc to link it.
+            format = OUTPUT_EXE;
+            emit = true;
+        }
+        else if (streq(argv[i], "--emit=gas"))
+        {
+            // Print GNU assembler syntax and pipe it into gcc rather than
+            // writing it out for nasm.
+            format = OUTPUT_GAS;
+            emit = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    // Without an output asked for, --exec runs the program in process rather
+    // than writing, assembling and linking it first. Bytecode only ever runs
+    // in process.
+    codegen_type_t target = format == OUTPUT_GAS ? X86_64_GAS : X86_64;
+    if (run)
+    {
+        if (emit)
+        {
+            fprintf(stderr, "--run writes no output to --emit.\n");
+            return 1;
+        }
+        target = BYTECODE;
+        format = OUTPUT_JIT;
+    }
+    else if (exec && !emit)
+    {
+        format = OUTPUT_JIT;
     }
     log_info("Exec: %s", exec ? "true" : "false");
 
-    // Ensure the file exists
+    // Ensure the file exists. "-" reads the program from stdin.
     const char* file_name = argv[1];
+    bool from_stdin = strcmp(file_name, "-") == 0;
     struct stat stat_buffer;
-    if (stat(file_name, &stat_buffer) != 0)
+    if (!from_stdin && stat(file_name, &stat_buffer) != 0)
     {
         fprintf(stderr, "File %s does not exist.", file_name);
         return 1;
     }
 
-    // Read the contents of the file.
-    // 1. Open the file.
-    // 2. Get the file size.
-    // 3. Read the file data into a buffer.
-    // 4. Close the file.
-    log_info("Compiling %s...", file_name);
-    char* buf = read_file(file_name);
-
-    // Parse the file content into an AST
-    log_info("Parsing file...");
-    log_debug("%s", buf);
-    ast* root_node = parse(buf);
-    free(buf);
-
-    // Generate assembly code
-    log_info("Generating assembly...");
-    char* code = ast_codegen(root_node, X86_64);
-    ast_free(root_node);
-
-    log_debug("%s", code);
+    if (watch)
+    {
+        if (from_stdin)
+        {
+            fprintf(stderr, "Cannot watch stdin.\n");
+            return 1;
+        }
+        return watch_program(file_name, target, format, exec);
+    }
 
-    const char* build_dir = "./build";
-    if (ensure_directory_exists(build_dir) != 0)
+    // Open the file. Regular files are mapped whole; pipes are read in
+    // pieces as the lexer asks for more. The lexer, parser and diagnostics all
+    // read this one copy in place.
+    log_info("Compiling %s...", file_name);
+    source_t* source = source_open(file_name);
+    if (!source)
     {
-        free(code);
         return 1;
     }
 
-    char output_name[512];
-    derive_output_name(file_name, output_name, sizeof(output_name));
-
-    char asm_filepath[1024];
-    char obj_filepath[1024];
-    char bin_filepath[1024];
-    snprintf(asm_filepath, sizeof(asm_filepath), "%s/%s.asm", build_dir,
-             output_name);
-    snprintf(obj_filepath, sizeof(obj_filepath), "%s/%s.o", build_dir,
-             output_name);
-    snprintf(bin_filepath, sizeof(bin_filepath), "%s/%s", build_dir,
-             output_name);
+    tree_t* tree = NULL;
+    uint64_t source_hash = 0;
+    char ast_filepath[1024];
+    if (ast_cache)
+    {
+        while (source_fill(source))
+        {
+        }
+        source_hash = astfile_hash(source->data, source->size);
+        char output_name[512];
+        derive_output_name(from_stdin ? "stdin" : file_name, output_name,
+                           sizeof(output_name));
+        snprintf(ast_filepath, sizeof(ast_filepath), "%s/%s.g2ast",
+                 BUILD_DIRECTORY, output_name);
+        tree = astfile_load(ast_filepath, source_hash);
+    }
 
-    // Output to asm file
-    write_file(asm_filepath, code);
-    free(code);
+    if (tree)
+    {
+        source_close(source);
+    }
+    else if (pipeline)
+    {
+        log_info("Parsing file in a pipeline...");
+        tree = pipeline_build(source);
+        source_close(source);
+    }
+    else
+    {
+        // Parse the file content into an AST
+        log_info("Parsing file...");
+        ast* root_node = parse(source);
+        source_close(source);
+
+        // Flatten the AST into its compact form for codegen and release the
+        // pointer tree.
+        tree = tree_build(root_node);
+        ast_free(root_node);
+    }
 
-    run_command_fmt("nasm -f elf64 %s -o %s", asm_filepath, obj_filepath);
-    run_command_fmt("gcc %s -o %s -z noexecstack -no-pie", obj_filepath,
-                    bin_filepath);
-    if (exec)
+    if (ast_cache && !tree->mapping &&
+        ensure_directory_exists(BUILD_DIRECTORY) == 0)
     {
-        run_command_fmt("%s", bin_filepath);
+        astfile_save(tree, source_hash, ast_filepath);
     }
 
-    return 0;
-}
\ No newline at end of file
+    // Resolve every name and type once, so codegen only reads the results.
+    log_info("Checking program...");
+    sema_t* sema = sema_check(tree);
+
+    // Generate assembly code
+    log_info("Generating assembly...");
+    codegen_t* code = ast_codegen(tree, sema, target, NULL);
+    sema_free(sema);
+    tree_free(tree);
+
+    // Identifiers stay interned until the output is written, as encoding an
+    // object names its symbols.
+    int status =
+        build_outputs(from_stdin ? "stdin" : file_name, code, format, exec);
+    intern_free();
+    return status;
+}
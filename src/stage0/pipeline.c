@@ -0,0 +1,249 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "log.h"
+#include "macros.h"
+#include "pipeline.h"
+#include "tokenize.h"
+
+// Tokens in flight between the lexer and the parser.
+#define PIPELINE_TOKENS 4096
+// Statements in flight between the parser and the tree builder.
+#define PIPELINE_STATEMENTS 256
+// Polls of a full or empty ring before yielding the CPU.
+#define PIPELINE_SPINS 64
+
+#define CACHE_LINE 64
+
+/* Single-producer, single-consumer ring
+ *
+ * `head` is only written by the consumer and `tail` only by the producer, so
+ * neither side needs a lock. Each index sits on a cache line of its own,
+ * next to the copy of the other side's index it last read; the other index
+ * is only reloaded once the ring looks full or empty.
+ */
+typedef struct spsc_ring_t
+{
+    _Alignas(CACHE_LINE) size_t head;
+    size_t cached_tail;
+
+    _Alignas(CACHE_LINE) size_t tail;
+    size_t cached_head;
+
+    _Alignas(CACHE_LINE) char* items;
+    size_t item_size;
+    // Always a power of two.
+    size_t capacity;
+} spsc_ring_t;
+
+static void spsc_init(spsc_ring_t* ring, size_t item_size, size_t capacity)
+{
+    memset(ring, 0, sizeof(spsc_ring_t));
+    ring->items = (char*)malloc(item_size * capacity);
+    ASSERT(ring->items != NULL, "Out of memory creating a pipeline ring.");
+    ring->item_size = item_size;
+    ring->capacity = capacity;
+}
+
+static void spsc_free(spsc_ring_t* ring)
+{
+    free(ring->items);
+    ring->items = NULL;
+}
+
+// Waits a little for the other side of a ring to make progress.
+static void spsc_wait(size_t* spins)
+{
+    if (++*spins < PIPELINE_SPINS)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+    *spins = 0;
+    sched_yield();
+}
+
+static void spsc_push(spsc_ring_t* ring, const void* item)
+{
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    size_t spins = 0;
+    while (tail - ring->cached_head == ring->capacity)
+    {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->cached_head == ring->capacity)
+        {
+            spsc_wait(&spins);
+        }
+    }
+
+    size_t slot = tail & (ring->capacity - 1);
+    memcpy(ring->items + slot * ring->item_size, item, ring->item_size);
+    // Publish the item only once it has been written.
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void spsc_pop(spsc_ring_t* ring, void* item)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    size_t spins = 0;
+    while (head == ring->cached_tail)
+    {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->cached_tail)
+        {
+            spsc_wait(&spins);
+        }
+    }
+
+    size_t slot = head & (ring->capacity - 1);
+    memcpy(item, ring->items + slot * ring->item_size, ring->item_size);
+    // Hand the slot back only once it has been read.
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Stages */
+
+typedef struct pipeline_t
+{
+    source_t* source;
+    // Lexer to parser, of `token_t`. Ends with TOK_EOF.
+    spsc_ring_t tokens;
+    // Parser to tree builder, of `ast*`. Ends with NULL.
+    spsc_ring_t statements;
+
+    // Parser only: the TOK_EOF ending `tokens`, once it has been read.
+    bool lexed;
+    token_t eof;
+    // Set by the parser before it ends `statements`.
+    ast* program;
+} pipeline_t;
+
+static void pipeline_emit(const token_t* tokens, size_t count, void* context)
+{
+    pipeline_t* pipeline = (pipeline_t*)context;
+    for (size_t i = 0; i < count; i++)
+    {
+        spsc_push(&pipeline->tokens, &tokens[i]);
+    }
+}
+
+static void* pipeline_lex(void* arg)
+{
+    pipeline_t* pipeline = (pipeline_t*)arg;
+
+    // Large sources are lexed in chunks on several threads of their own,
+    // this one putting the chunks back in order.
+    size_t workers = tokenize_worker_count(pipeline->source);
+    if (workers > 1)
+    {
+        tokenize_parallel(pipeline->source, workers, pipeline_emit, pipeline);
+        return NULL;
+    }
+
+    tokenize_begin(pipeline->source);
+
+    token_t token;
+    do
+    {
+        tokenize_next(&token);
+        spsc_push(&pipeline->tokens, &token);
+    } while (token.type != TOK_EOF);
+
+    tokenize_free();
+    return NULL;
+}
+
+static void pipeline_feed(token_t* token, void* context)
+{
+    pipeline_t* pipeline = (pipeline_t*)context;
+    // EOF is sticky, as it is for the lexer itself.
+    if (pipeline->lexed)
+    {
+        *token = pipeline->eof;
+        return;
+    }
+
+    spsc_pop(&pipeline->tokens, token);
+    if (token->type == TOK_EOF)
+    {
+        pipeline->lexed = true;
+        pipeline->eof = *token;
+    }
+}
+
+static void pipeline_declare(ast* statement, void* context)
+{
+    pipeline_t* pipeline = (pipeline_t*)context;
+    spsc_push(&pipeline->statements, &statement);
+}
+
+static void* pipeline_parse(void* arg)
+{
+    pipeline_t* pipeline = (pipeline_t*)arg;
+    tokenize_begin_feed(pipeline->source, pipeline_feed, pipeline);
+    pipeline->program =
+        parse_each(pipeline->source, pipeline_declare, pipeline);
+
+    ast* end = NULL;
+    spsc_push(&pipeline->statements, &end);
+    return NULL;
+}
+
+tree_t* pipeline_build(source_t* source)
+{
+    if (!source->complete)
+    {
+        log_info("Input is still being read; parsing without a pipeline.");
+        ast* program = parse(source);
+        tree_t* tree = tree_build(program);
+        ast_free(program);
+        return tree;
+    }
+
+    pipeline_t* pipeline = (pipeline_t*)calloc(1, sizeof(pipeline_t));
+    ASSERT(pipeline != NULL, "Out of memory creating the pipeline.");
+    pipeline->source = source;
+    spsc_init(&pipeline->tokens, sizeof(token_t), PIPELINE_TOKENS);
+    spsc_init(&pipeline->statements, sizeof(ast*), PIPELINE_STATEMENTS);
+
+    pthread_t lexer;
+    pthread_t parser;
+    int error = pthread_create(&lexer, NULL, pipeline_lex, pipeline);
+    ASSERT(error == 0, "Unable to start the lexer thread: %s.",
+           strerror(error));
+    error = pthread_create(&parser, NULL, pipeline_parse, pipeline);
+    ASSERT(error == 0, "Unable to start the parser thread: %s.",
+           strerror(error));
+
+    // Flatten each statement as soon as the parser has finished it.
+    tree_t* tree = tree_begin();
+    size_t count = 0;
+    while (true)
+    {
+        ast* statement = NULL;
+        spsc_pop(&pipeline->statements, &statement);
+        if (statement == NULL)
+        {
+            break;
+        }
+        tree_append(tree, statement);
+        count++;
+    }
+
+    pthread_join(lexer, NULL);
+    pthread_join(parser, NULL);
+    tree_finish(tree, pipeline->program);
+    ast_free(pipeline->program);
+    log_info("Pipelined %zu top-level statements.", count);
+
+    spsc_free(&pipeline->tokens);
+    spsc_free(&pipeline->statements);
+    free(pipeline);
+    return tree;
+}
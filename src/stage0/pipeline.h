@@ -0,0 +1,27 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "source.h"
+#include "tree.h"
+
+/* Pipelined front end
+ *
+ * Lexing, parsing and flattening run at the same time, each on a thread of
+ * its own. The lexer hands tokens to the parser through a lock-free
+ * single-producer, single-consumer ring. The parser hands each finished
+ * top-level statement to the calling thread through a second ring, and the
+ * calling thread flattens it into the compact tree straight away. Wall time
+ * then approaches that of the slowest stage rather than the sum of all three.
+ * Large sources are lexed in chunks by several threads, so lexing is rarely
+ * that stage.
+ *
+ * Semantic analysis collects every global before checking any function, so
+ * it and codegen still start once the whole program has been flattened.
+ */
+
+// Parses `source` and flattens it into a compact tree, as `parse` followed by
+// `tree_build` would. Sources still being read are not pipelined, as their
+// buffer may move while the parser is reading it.
+tree_t* pipeline_build(source_t* source);
+
+#endif
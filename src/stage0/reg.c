@@ -1,40 +1,27 @@
 #include <stddef.h>
-#include <string.h>
 
 #include "macros.h"
 #include "reg.h"
 
 reg_t g_registers[REG_COUNT] = {
-    {"rax", false}, //
-    {"rbx", false}, //
-    {"rcx", false}, //
-    {"rdx", false}, //
-    {"rsi", false}, //
-    {"rdi", false}, //
-    {"r8", false},  //
-    {"r9", false},  //
-    {"r10", false}, //
-    {"r11", false}, //
-    {"r12", false}, //
-    {"r13", false}, //
-    {"r14", false}, //
-    {"r15", false}, //
+    {X86_RAX, false}, //
+    {X86_RBX, false}, //
+    {X86_RCX, false}, //
+    {X86_RDX, false}, //
+    {X86_RSI, false}, //
+    {X86_RDI, false}, //
+    {X86_R8, false},  //
+    {X86_R9, false},  //
+    {X86_R10, false}, //
+    {X86_R11, false}, //
+    {X86_R12, false}, //
+    {X86_R13, false}, //
+    {X86_R14, false}, //
+    {X86_R15, false}, //
 };
 size_t g_lock_count = 0;
 size_t g_unlock_count = 0;
 
-reg_t* register_get(char* name)
-{
-    for (int i = 0; i < REG_COUNT; i++)
-    {
-        if (strcmp(g_registers[i].name, name) == 0)
-        {
-            return &g_registers[i];
-        }
-    }
-    return NULL;
-}
-
 void register_assert()
 {
     ASSERT(g_unlock_count <= g_lock_count,
@@ -42,7 +29,7 @@ void register_assert()
            g_lock_count, g_unlock_count);
 }
 
-char* register_lock()
+x86_reg_t register_lock()
 {
     for (int i = 0; i < REG_COUNT; i++)
     {
@@ -53,13 +40,13 @@ char* register_lock()
             register_assert();
             reg->locked = true;
 
-            return reg->name;
+            return reg->reg;
         }
     }
-    return NULL;
+    return REG_NONE;
 }
 
-char* register_unlock()
+x86_reg_t register_unlock()
 {
     // Release the most-recently locked register (last-in, first-out).
     // Start from the end so that we free the last locked register first.
@@ -71,8 +58,21 @@ char* register_unlock()
             g_unlock_count++;
             register_assert();
             reg->locked = false;
-            return reg->name;
+            return reg->reg;
+        }
+    }
+    return REG_NONE;
+}
+
+size_t register_free_count()
+{
+    size_t count = 0;
+    for (int i = 0; i < REG_COUNT; i++)
+    {
+        if (!g_registers[i].locked)
+        {
+            count++;
         }
     }
-    return NULL;
+    return count;
 }
@@ -2,37 +2,22 @@
 #define REG_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "x86_64_inst.h"
 
 #define REG_COUNT 14
 
-// General purpose registers
-#define RAX "rax"
-#define RBX "rbx"
-#define RCX "rcx"
-#define RDX "rdx"
-#define RSI "rsi"
-#define RDI "rdi"
-#define R8 "r8"
-#define R9 "r9"
-#define R10 "r10"
-#define R11 "r11"
-#define R12 "r12"
-#define R13 "r13"
-#define R14 "r14"
-#define R15 "r15"
-
-// Stack registers
-#define RBP "rbp" // Snapshot of stack pointer
-#define RSP "rsp" // Stack pointer
+// Returned by `register_lock` and `register_unlock` when there is no
+// register to hand out or release.
+#define REG_NONE X86_REG_COUNT
 
 typedef struct reg_t
 {
-    char* name;
+    x86_reg_t reg;
     bool locked;
 } reg_t;
 
-reg_t* register_get(char* name);
-
 /**
  * Assert that the unlock count is less than or equal to the lock count. If the
  * unlock count is greater than lock count, there's a mismatch with how many
@@ -42,14 +27,18 @@ void register_assert();
 
 /**
  * Returns the next available register. Registers are prioritized in order
- * in the `g_registers` array. If no register is available, return a NULL
- * pointer.
+ * in the `g_registers` array. If no register is available, return REG_NONE.
  */
-char* register_lock();
+x86_reg_t register_lock();
 
 /**
  * Release the most-recently retrieved register.
  */
-char* register_unlock();
+x86_reg_t register_unlock();
+
+/**
+ * Returns the number of registers `register_lock` can still hand out.
+ */
+size_t register_free_count();
 
 #endif
\ No newline at end of file
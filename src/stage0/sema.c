@@ -0,0 +1,872 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "log.h"
+#include "macros.h"
+#include "sema.h"
+
+// Shorthands for reading the compact tree being checked.
+#define KIND(node) tree_kind(g_ctx.sema->tree, (node))
+#define IDENT(node) tree_identifier(g_ctx.sema->tree, (node))
+#define NAME(node) tree_name(g_ctx.sema->tree, (node))
+
+typedef struct sema_context_t
+{
+    // Program being checked
+    sema_t* sema;
+    // Current offset on the stack
+    ptrdiff_t stack_offset;
+
+    // Are we currently in a function declaration?
+    bool in_function;
+    // Current function name
+    const char* current_function_name;
+    // Current function return type
+    symbol_value_t expected_return_type;
+    // Has this function called return at least once?
+    bool has_returned;
+    // Pending function whose arguments need binding when entering its block
+    node_t pending_function;
+} sema_context_t;
+
+static sema_context_t g_ctx = {
+    .sema = NULL,
+    .stack_offset = 0,
+    .in_function = false,
+    .current_function_name = NULL,
+    .expected_return_type = SYMBOL_VALUE_UNKNOWN,
+    .has_returned = false,
+    .pending_function = NODE_NONE,
+};
+
+static void sema_statement(node_t node);
+
+static void record(node_t node, symbol_value_t type, symbol_t* symbol)
+{
+    g_ctx.sema->types[node] = (uint8_t)type;
+    g_ctx.sema->symbols[node] = symbol;
+}
+
+static symbol_value_t symbol_value_from_ast_type(ast_value_type_t type)
+{
+    switch (type)
+    {
+    case TYPE_BOOL:
+        return SYMBOL_VALUE_BOOL;
+    case TYPE_INT:
+        return SYMBOL_VALUE_INT;
+    case TYPE_STRING:
+        return SYMBOL_VALUE_STRING;
+    case TYPE_VOID:
+    default:
+        ASSERT(false, "Invalid or unsupported parameter type: %d", type);
+        return SYMBOL_VALUE_UNKNOWN;
+    }
+}
+
+/* Scope & Symbols */
+
+#define SYMBOL_TABLE_INITIAL_SLOTS 64
+
+// Fibonacci hashing spreads the dense atom ids over the table.
+static size_t symbol_slot_index(const symbol_table_t* table, atom_t name)
+{
+    return (size_t)(name * 2654435769u) & (table->slot_count - 1);
+}
+
+// Returns the slot for `name`, which is empty if the name was never bound.
+static symbol_slot_t* symbol_table_find(const symbol_table_t* table,
+                                        atom_t name)
+{
+    size_t index = symbol_slot_index(table, name);
+    while (table->slots[index].name != name &&
+           table->slots[index].name != ATOM_NONE)
+    {
+        index = (index + 1) & (table->slot_count - 1);
+    }
+    return &table->slots[index];
+}
+
+static void symbol_table_rehash(symbol_table_t* table, size_t slot_count)
+{
+    symbol_slot_t* old_slots = table->slots;
+    size_t old_count = table->slot_count;
+
+    table->slots = (symbol_slot_t*)malloc(slot_count * sizeof(symbol_slot_t));
+    ASSERT(table->slots != NULL, "Out of memory growing the symbol table.");
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        table->slots[i].name = ATOM_NONE;
+        table->slots[i].symbol = NULL;
+    }
+    table->slot_count = slot_count;
+
+    for (size_t i = 0; i < old_count; i++)
+    {
+        if (old_slots[i].name != ATOM_NONE)
+        {
+            *symbol_table_find(table, old_slots[i].name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Returns the slot for `name`, claiming an empty one if necessary.
+static symbol_slot_t* symbol_table_claim(symbol_table_t* table, atom_t name)
+{
+    // Keep the load factor at or below one half so probe chains stay short.
+    if ((table->slot_used + 1) * 2 > table->slot_count)
+    {
+        symbol_table_rehash(table, table->slot_count * 2);
+    }
+
+    symbol_slot_t* slot = symbol_table_find(table, name);
+    if (slot->name == ATOM_NONE)
+    {
+        slot->name = name;
+        table->slot_used++;
+    }
+    return slot;
+}
+
+void symbol_table_init(symbol_table_t* table)
+{
+    memset(table, 0, sizeof(symbol_table_t));
+    table->arena = arena_new();
+    symbol_table_rehash(table, SYMBOL_TABLE_INITIAL_SLOTS);
+}
+
+void symbol_table_free(symbol_table_t* table)
+{
+    free(table->slots);
+    free(table->locals);
+    free(table->marks);
+    if (table->arena)
+    {
+        arena_free(table->arena);
+    }
+    memset(table, 0, sizeof(symbol_table_t));
+}
+
+void scope_push()
+{
+    symbol_table_t* table = &g_ctx.sema->table;
+    ASSERT(table->slots != NULL, "Cannot push scope with no parent.");
+    if (table->depth >= table->mark_capacity)
+    {
+        table->mark_capacity =
+            table->mark_capacity ? table->mark_capacity * 2 : 16;
+        table->marks = (size_t*)realloc(
+            table->marks, table->mark_capacity * sizeof(size_t));
+        ASSERT(table->marks != NULL, "Out of memory pushing a scope.");
+    }
+    // Remember where this scope's locals begin in the undo log.
+    table->marks[table->depth++] = table->local_count;
+}
+
+void scope_pop()
+{
+    symbol_table_t* table = &g_ctx.sema->table;
+    ASSERT(table->depth > SCOPE_GLOBAL, "Cannot pop the global scope.");
+    size_t mark = table->marks[--table->depth];
+    // Unbind this scope's locals newest first, so each name ends up bound to
+    // whatever it pointed at before the scope was pushed.
+    while (table->local_count > mark)
+    {
+        symbol_t* symbol = table->locals[--table->local_count];
+        symbol_table_find(table, symbol->name)->symbol = symbol->shadowed;
+    }
+}
+
+symbol_t* scope_lookup_shallow(size_t depth, atom_t name)
+{
+    // Bindings deeper than `depth` hide the one we want; look beneath them.
+    symbol_t* symbol = symbol_table_find(&g_ctx.sema->table, name)->symbol;
+    while (symbol && symbol->depth > depth)
+    {
+        symbol = symbol->shadowed;
+    }
+    return symbol && symbol->depth == depth ? symbol : NULL;
+}
+
+symbol_t* scope_lookup(atom_t name)
+{
+    return symbol_table_find(&g_ctx.sema->table, name)->symbol;
+}
+
+symbol_t* scope_add_symbol(size_t depth, atom_t name, symbol_scope_t type)
+{
+    symbol_table_t* table = &g_ctx.sema->table;
+    ASSERT(table->slots != NULL, "Symbol table is not initialized.");
+    ASSERT(depth == SCOPE_GLOBAL || depth == table->depth,
+           "Symbols can only be added to the global or current scope.");
+
+    symbol_slot_t* slot = symbol_table_claim(table, name);
+    symbol_t* symbol = (symbol_t*)arena_alloc(table->arena, sizeof(symbol_t));
+    if (depth != SCOPE_GLOBAL)
+    {
+        if (table->local_count == table->local_capacity)
+        {
+            table->local_capacity =
+                table->local_capacity ? table->local_capacity * 2 : 64;
+            table->locals = (symbol_t**)realloc(
+                table->locals, table->local_capacity * sizeof(symbol_t*));
+            ASSERT(table->locals != NULL, "Out of memory adding a symbol.");
+        }
+        table->locals[table->local_count++] = symbol;
+    }
+
+    symbol->name = name;
+    symbol->type = type;
+    symbol->value_type = SYMBOL_VALUE_UNKNOWN;
+    symbol->ret_type = SYMBOL_VALUE_UNKNOWN;
+    symbol->offset = 0;
+    symbol->depth = depth;
+
+    // Insert the symbol into the name's chain of bindings beneath every
+    // deeper one, so popping those scopes uncovers it.
+    symbol_t** link = &slot->symbol;
+    while (*link && (*link)->depth > depth)
+    {
+        link = &(*link)->shadowed;
+    }
+    symbol->shadowed = *link;
+    *link = symbol;
+
+    char* message = symbol_to_string(symbol);
+    log_debug("New symbol: %s", message);
+    free(message);
+    return symbol;
+}
+
+// Reserves the next slot of the current stack frame and returns its offset.
+static ptrdiff_t allocate_stack_slot()
+{
+    ASSERT(g_ctx.in_function,
+           "Stack slots can only be allocated inside functions.");
+    // Slots are handed out in declaration order, which is also the order
+    // codegen moves the stack pointer in, so locals can be addressed relative
+    // to RBP.
+    g_ctx.stack_offset += 8;
+    return -g_ctx.stack_offset;
+}
+
+// Declares a symbol in the global scope table.
+static symbol_t* symbol_define_global(atom_t name)
+{
+    symbol_t* existing = scope_lookup_shallow(SCOPE_GLOBAL, name);
+    ASSERT(existing == NULL, "Global symbol %s already defined.",
+           atom_name(name));
+    // Record the new binding in the global scope table so it can be referenced
+    // from anywhere in the program.
+    return scope_add_symbol(SCOPE_GLOBAL, name, SYMBOL_GLOBAL);
+}
+
+// Declares a symbol that belongs to the current local scope.
+static symbol_t* symbol_define_local(atom_t name)
+{
+    size_t depth = g_ctx.sema->table.depth;
+    ASSERT(depth != SCOPE_GLOBAL,
+           "Local declarations require a function scope.");
+    symbol_t* existing = scope_lookup_shallow(depth, name);
+    ASSERT(existing == NULL, "Symbol %s already defined in this scope.",
+           atom_name(name));
+
+    symbol_t* symbol = scope_add_symbol(depth, name, SYMBOL_LOCAL);
+    // Locals reside on the stack, so reserve and record their frame offset.
+    symbol->offset = allocate_stack_slot();
+    return symbol;
+}
+
+// Resolves a symbol name and asserts it exists within reachable scopes.
+static symbol_t* symbol_resolve(atom_t name)
+{
+    // Walk outward through scopes (starting from current) until a declaration
+    // appears. This enforces Gentoo's requirement that identifiers must be
+    // defined in an enclosing lexical scope.
+    symbol_t* symbol = scope_lookup(name);
+    ASSERT(symbol != NULL, "Undefined symbol: %s", atom_name(name));
+    return symbol;
+}
+
+/* Expressions */
+
+static symbol_value_t sema_value(node_t node);
+
+static symbol_value_t sema_binop(node_t node)
+{
+    const tree_binop_t* binop = tree_binop(g_ctx.sema->tree, node);
+    symbol_value_t lhs = sema_value(binop->lhs);
+    symbol_value_t rhs = sema_value(binop->rhs);
+
+    ASSERT(lhs != SYMBOL_VALUE_UNKNOWN, "Left-hand symbol has unknown type.");
+    ASSERT(rhs != SYMBOL_VALUE_UNKNOWN, "Right-hand symbol has unknown type.");
+
+    log_debug("lhs: %s", ast_to_string(KIND(binop->lhs)));
+    log_debug("rhs: %s", ast_to_string(KIND(binop->rhs)));
+
+    switch (binop->op)
+    {
+    case BIN_ADD:
+    { // Strings can only be added to strings
+        if (lhs == SYMBOL_VALUE_STRING && rhs == SYMBOL_VALUE_STRING)
+        {
+            return SYMBOL_VALUE_STRING;
+        }
+
+        // Otherwise only allow adding ints to ints.
+        ASSERT(lhs == SYMBOL_VALUE_INT && rhs == SYMBOL_VALUE_INT,
+               "Cannot add %s to %s.", symbol_value_to_string(lhs),
+               symbol_value_to_string(rhs));
+        return SYMBOL_VALUE_INT;
+    }
+    case BIN_SUB:
+    case BIN_MUL:
+    case BIN_DIV:
+    { // Only allow subtracting, multiplying, and dividing ints by ints.
+        ASSERT(lhs == SYMBOL_VALUE_INT && rhs == SYMBOL_VALUE_INT,
+               "Operator %s only supports integers.",
+               binop_to_string(binop->op));
+        return SYMBOL_VALUE_INT;
+    }
+    case BIN_EQ:
+    {
+        ASSERT(lhs == rhs, "Equality only supports comparing same types.");
+        if (lhs == SYMBOL_VALUE_STRING)
+        {
+            g_ctx.sema->compares_strings = true;
+        }
+        return SYMBOL_VALUE_BOOL;
+    }
+    case BIN_GT:
+    case BIN_LT:
+    {
+        ASSERT(lhs == SYMBOL_VALUE_INT && rhs == SYMBOL_VALUE_INT,
+               "Operator %s only supports integers.",
+               binop_to_string(binop->op));
+        return SYMBOL_VALUE_BOOL;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    return SYMBOL_VALUE_UNKNOWN;
+}
+
+// Resolves the names within the expression `node` and records its type, which
+// is unknown for calls to undeclared functions and for names not yet
+// assigned.
+static symbol_value_t sema_expr(node_t node)
+{
+    if (node == NODE_NONE)
+    {
+        return SYMBOL_VALUE_UNKNOWN;
+    }
+
+    symbol_value_t type = SYMBOL_VALUE_UNKNOWN;
+    symbol_t* symbol = NULL;
+
+    // Determine the value type by looking at the syntactic shape; literals and
+    // explicit type annotations provide their type immediately, while
+    // identifiers require symbol resolution.
+    switch (KIND(node))
+    {
+    case AST_TYPE:
+    {
+        switch (tree_type(g_ctx.sema->tree, node))
+        {
+        case TYPE_VOID:
+            type = SYMBOL_VALUE_VOID;
+            break;
+        case TYPE_BOOL:
+            type = SYMBOL_VALUE_BOOL;
+            break;
+        case TYPE_STRING:
+            type = SYMBOL_VALUE_STRING;
+            break;
+        case TYPE_INT:
+        default:
+            type = SYMBOL_VALUE_INT;
+            break;
+        }
+        break;
+    }
+    // Constants can only be one of BOOL, INT, or STRING
+    case AST_CONSTANT:
+    {
+        switch (tree_constant(g_ctx.sema->tree, node)->type)
+        {
+        case TYPE_BOOL:
+            type = SYMBOL_VALUE_BOOL;
+            break;
+        case TYPE_STRING:
+            type = SYMBOL_VALUE_STRING;
+            break;
+        default:
+            type = SYMBOL_VALUE_INT;
+            break;
+        }
+        break;
+    }
+    case AST_IDENTIFIER:
+    {
+        symbol = symbol_resolve(IDENT(node));
+        type = symbol->value_type;
+        break;
+    }
+    case AST_BINOP:
+    {
+        type = sema_binop(node);
+        break;
+    }
+    // Calls take the callee's return type. Functions that were never declared
+    // (such as `printf`) are external, so only their arguments are checked.
+    case AST_CALL:
+    {
+        const tree_call_t* call = tree_call(g_ctx.sema->tree, node);
+        symbol = scope_lookup(IDENT(call->identifier));
+        for (uint32_t i = 0; i < call->args.count; i++)
+        {
+            sema_expr(tree_child(g_ctx.sema->tree, call->args, i));
+        }
+        type = symbol ? symbol->ret_type : SYMBOL_VALUE_UNKNOWN;
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    record(node, type, symbol);
+    return type;
+}
+
+// Like `sema_expr`, for an expression whose value is used, and so must have a
+// known type.
+static symbol_value_t sema_value(node_t node)
+{
+    symbol_value_t type = sema_expr(node);
+    if (type != SYMBOL_VALUE_UNKNOWN)
+    {
+        return type;
+    }
+
+    if (KIND(node) == AST_IDENTIFIER)
+    {
+        ASSERT(false, "Symbol '%s' has unknown type.", NAME(node));
+    }
+    else if (KIND(node) == AST_CALL)
+    {
+        node_t callee = tree_call(g_ctx.sema->tree, node)->identifier;
+        ASSERT(g_ctx.sema->symbols[node] != NULL, "Undefined symbol: %s",
+               NAME(callee));
+    }
+    return type;
+}
+
+/* Statements */
+
+static void sema_globals(node_t node)
+{
+    tree_t* tree = g_ctx.sema->tree;
+    tree_list_t program = tree_list(tree, node);
+    for (uint32_t i = 0; i < program.count; i++)
+    {
+        node_t body_node = tree_child(tree, program, i);
+        if (KIND(body_node) != AST_BODY)
+        {
+            continue;
+        }
+
+        tree_list_t body = tree_list(tree, body_node);
+        for (uint32_t j = 0; j < body.count; j++)
+        {
+            node_t statement = tree_child(tree, body, j);
+            if (KIND(statement) != AST_ASSIGN)
+            {
+                continue;
+            }
+
+            const tree_assign_t* assign = tree_assign(tree, statement);
+            if (KIND(assign->lhs) == AST_DECLVAR)
+            {
+                // Only declarations at the top level become globals; record
+                // them so every symbol is known up front.
+                atom_t name = IDENT(tree_declvar(tree, assign->lhs)->identifier);
+                symbol_t* symbol = scope_lookup_shallow(SCOPE_GLOBAL, name);
+                if (symbol == NULL)
+                {
+                    symbol = scope_add_symbol(SCOPE_GLOBAL, name,
+                                              SYMBOL_GLOBAL);
+                }
+
+                symbol_value_t rhs_type = sema_value(assign->rhs);
+                // The first assignment sets the type, subsequent ones must
+                // match to avoid conflicting global definitions.
+                if (symbol->value_type == SYMBOL_VALUE_UNKNOWN)
+                {
+                    symbol->value_type = rhs_type;
+                }
+                else
+                {
+                    ASSERT(symbol->value_type == rhs_type,
+                           "Global '%s' type mismatch (%s vs %s).",
+                           atom_name(name),
+                           symbol_value_to_string(symbol->value_type),
+                           symbol_value_to_string(rhs_type));
+                }
+            }
+        }
+    }
+}
+
+static void sema_bind_function_args(node_t block_node)
+{
+    node_t pending_node = g_ctx.pending_function;
+    if (pending_node == NODE_NONE)
+    {
+        return;
+    }
+    const tree_declfn_t* pending = tree_declfn(g_ctx.sema->tree, pending_node);
+    if (pending->block != block_node)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < pending->args.count; i++)
+    {
+        node_t arg_ident = tree_child(g_ctx.sema->tree, pending->args, i);
+        symbol_t* symbol = symbol_define_local(IDENT(arg_ident));
+        ast_value_type_t arg_type =
+            tree_arg_type(g_ctx.sema->tree, pending, i);
+        symbol->value_type = symbol_value_from_ast_type(arg_type);
+        record(arg_ident, symbol->value_type, symbol);
+    }
+
+    g_ctx.pending_function = NODE_NONE;
+}
+
+static void sema_block(node_t node)
+{
+    ASSERT(KIND(node) == AST_BLOCK, "Expected BLOCK node, got %s",
+           ast_to_string(KIND(node)));
+
+    // Each block introduces a fresh scope to keep locals isolated.
+    scope_push();
+    sema_bind_function_args(node);
+    tree_list_t block = tree_list(g_ctx.sema->tree, node);
+    for (uint32_t i = 0; i < block.count; i++)
+    {
+        sema_statement(tree_child(g_ctx.sema->tree, block, i));
+    }
+    scope_pop();
+}
+
+static void sema_declfn(node_t node)
+{
+    const tree_declfn_t* declfn = tree_declfn(g_ctx.sema->tree, node);
+    atom_t atom = IDENT(declfn->identifier);
+    const char* name = atom_name(atom);
+
+    // Define a new global symbol if it's not found
+    symbol_t* symbol = scope_lookup_shallow(SCOPE_GLOBAL, atom);
+    if (!symbol)
+    {
+        symbol = symbol_define_global(atom);
+        symbol->ret_type = sema_expr(declfn->ret_type);
+    }
+    else
+    {
+        log_error("Symbol %s already defined.", name);
+        exit(1);
+    }
+    record(node, SYMBOL_VALUE_FN, symbol);
+    record(declfn->identifier, SYMBOL_VALUE_FN, symbol);
+
+    bool prev_in_function = g_ctx.in_function;
+    ptrdiff_t prev_stack_offset = g_ctx.stack_offset;
+    const char* prev_function_name = g_ctx.current_function_name;
+    symbol_value_t prev_return_type = g_ctx.expected_return_type;
+
+    g_ctx.in_function = true;
+    g_ctx.stack_offset = 0;
+    g_ctx.current_function_name = name;
+    g_ctx.expected_return_type = symbol->ret_type;
+    g_ctx.has_returned = false;
+
+    g_ctx.pending_function = node;
+    sema_block(declfn->block);
+
+    // Void functions may omit their return; codegen emits one for them.
+    if (symbol->ret_type != SYMBOL_VALUE_VOID && !g_ctx.has_returned)
+    {
+        log_error("Missing return type in function '%s' (expected %s).",
+                  name, symbol_value_to_string(symbol->ret_type));
+        exit(1);
+    }
+    g_ctx.has_returned = false;
+    g_ctx.pending_function = NODE_NONE;
+
+    g_ctx.in_function = prev_in_function;
+    g_ctx.stack_offset = prev_stack_offset;
+    g_ctx.current_function_name = prev_function_name;
+    g_ctx.expected_return_type = prev_return_type;
+}
+
+static void sema_assign(node_t node)
+{
+    const tree_assign_t* assign = tree_assign(g_ctx.sema->tree, node);
+    // The right hand side is checked before the left is declared, so
+    // `let x = x + 1;` reads any outer `x`.
+    symbol_value_t rhs_type = sema_value(assign->rhs);
+
+    node_t lhs = assign->lhs;
+    atom_t name = ATOM_NONE;
+    symbol_t* symbol = NULL;
+
+    switch (KIND(lhs))
+    {
+    // If it's a new variable, declare it
+    case AST_DECLVAR:
+        name = IDENT(tree_declvar(g_ctx.sema->tree, lhs)->identifier);
+        if (g_ctx.in_function)
+        {
+            // Locals consume stack slots inside the current function.
+            symbol = symbol_define_local(name);
+        }
+        else
+        {
+            symbol = scope_lookup_shallow(SCOPE_GLOBAL, name);
+            if (!symbol)
+            {
+                symbol = symbol_define_global(name);
+            }
+        }
+        break;
+    // Otherwise obtain the existing variable name
+    case AST_IDENTIFIER:
+        name = IDENT(lhs);
+        symbol = symbol_resolve(name);
+        break;
+    default:
+        break;
+    }
+
+    ASSERT(symbol != NULL, "Failed to resolve symbol for %s",
+           name != ATOM_NONE ? atom_name(name) : "<unknown>");
+
+    // Fix up the symbol's value type the first time we encounter it and ensure
+    // subsequent assignments respect the inferred/static type.
+    if (symbol->value_type == SYMBOL_VALUE_UNKNOWN)
+    {
+        symbol->value_type = rhs_type;
+    }
+    else
+    {
+        ASSERT(symbol->value_type == rhs_type,
+               "Cannot assign %s value to %s (expected %s).",
+               symbol_value_to_string(rhs_type), atom_name(name),
+               symbol_value_to_string(symbol->value_type));
+    }
+    record(lhs, symbol->value_type, symbol);
+}
+
+static void sema_return(node_t node)
+{
+    node_t rhs = tree_return(g_ctx.sema->tree, node);
+    symbol_value_t expected_type = g_ctx.expected_return_type;
+    ASSERT(expected_type != SYMBOL_VALUE_UNKNOWN,
+           "Return statement outside of a function context.");
+
+    symbol_value_t actual_type =
+        rhs != NODE_NONE ? sema_value(rhs) : SYMBOL_VALUE_VOID;
+    const char* fn_name = g_ctx.current_function_name
+                              ? g_ctx.current_function_name
+                              : "<anonymous>";
+
+    // Enforce that void signatures never produce a value and non-void
+    // signatures always return exactly one value of the right type.
+    if (expected_type == SYMBOL_VALUE_VOID)
+    {
+        ASSERT(rhs == NODE_NONE || actual_type == SYMBOL_VALUE_VOID,
+               "Function '%s' declared void cannot return a value.", fn_name);
+    }
+    else
+    {
+        ASSERT(rhs != NODE_NONE, "Function '%s' must return a %s value.",
+               fn_name, symbol_value_to_string(expected_type));
+        ASSERT(actual_type == expected_type,
+               "Return type mismatch in function '%s' (expected %s, got %s).",
+               fn_name, symbol_value_to_string(expected_type),
+               symbol_value_to_string(actual_type));
+    }
+
+    g_ctx.has_returned = true;
+}
+
+static void sema_statement(node_t node)
+{
+    tree_t* tree = g_ctx.sema->tree;
+    switch (KIND(node))
+    {
+    case AST_ASSIGN:
+        sema_assign(node);
+        break;
+    case AST_DECLFN:
+        sema_declfn(node);
+        break;
+    case AST_BLOCK:
+        sema_block(node);
+        break;
+    case AST_RETURN:
+        sema_return(node);
+        break;
+    case AST_CALL:
+        sema_expr(node);
+        break;
+    case AST_IF:
+    {
+        const tree_if_t* stmt = tree_if(tree, node);
+        sema_expr(stmt->condition);
+        sema_statement(stmt->then_branch);
+        if (stmt->else_branch != NODE_NONE)
+        {
+            sema_statement(stmt->else_branch);
+        }
+        break;
+    }
+    case AST_WHILE:
+    {
+        const tree_while_t* stmt = tree_while(tree, node);
+        sema_expr(stmt->condition);
+        sema_statement(stmt->block);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Gives each distinct string constant of the program an entry in the pool,
+// or each string constant one if the program compares strings.
+static void sema_literals(sema_t* sema)
+{
+    tree_t* tree = sema->tree;
+    sema->literals = (uint32_t*)calloc(tree->constants_count + 1,
+                                       sizeof(uint32_t));
+    sema->pool = (uint32_t*)calloc(tree->constants_count + 1,
+                                   sizeof(uint32_t));
+
+    // Open-addressed by the hash of the text, holding entry + 1 or zero.
+    size_t slot_count = 16;
+    while (slot_count < (size_t)tree->constants_count * 2)
+    {
+        slot_count *= 2;
+    }
+    uint32_t* slots = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    ASSERT(sema->literals != NULL && sema->pool != NULL && slots != NULL,
+           "Out of memory pooling string literals.");
+
+    for (uint32_t i = 0; i < tree->constants_count; i++)
+    {
+        const tree_constant_t* constant = &tree->constants[i];
+        if (constant->type != TYPE_STRING)
+        {
+            continue;
+        }
+
+        if (sema->compares_strings)
+        {
+            sema->literals[i] = sema->pool_count;
+            sema->pool[sema->pool_count++] = (uint32_t)constant->value;
+            continue;
+        }
+
+        // FNV-1a
+        const char* text = tree_string(tree, constant);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const char* c = text; *c != '\0'; c++)
+        {
+            hash = (hash ^ (uint8_t)*c) * 0x100000001b3ull;
+        }
+
+        size_t slot = hash & (slot_count - 1);
+        while (slots[slot] != 0 &&
+               strcmp(tree->strings + sema->pool[slots[slot] - 1], text) != 0)
+        {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        if (slots[slot] == 0)
+        {
+            sema->pool[sema->pool_count++] = (uint32_t)constant->value;
+            slots[slot] = sema->pool_count;
+        }
+        sema->literals[i] = slots[slot] - 1;
+    }
+    free(slots);
+}
+
+sema_t* sema_check(tree_t* tree)
+{
+    sema_t* sema = (sema_t*)calloc(1, sizeof(sema_t));
+    ASSERT(sema != NULL, "Out of memory allocating semantic analysis.");
+    sema->tree = tree;
+    sema->types = (uint8_t*)calloc(tree->count, sizeof(uint8_t));
+    sema->symbols = (symbol_t**)calloc(tree->count, sizeof(symbol_t*));
+    ASSERT(sema->types != NULL && sema->symbols != NULL,
+           "Out of memory allocating semantic analysis.");
+    symbol_table_init(&sema->table);
+
+    g_ctx.sema = sema;
+    g_ctx.stack_offset = 0;
+    g_ctx.in_function = false;
+    g_ctx.current_function_name = NULL;
+    g_ctx.expected_return_type = SYMBOL_VALUE_UNKNOWN;
+    g_ctx.has_returned = false;
+    g_ctx.pending_function = NODE_NONE;
+
+    node_t node = tree->root;
+    ASSERT(KIND(node) == AST_PROGRAM, "Wanted node type PROGRAM, got %s",
+           ast_to_string(KIND(node)));
+
+    // Collect all global symbols prior to checking any statement.
+    sema_globals(node);
+
+    tree_list_t program = tree_list(tree, node);
+    for (uint32_t i = 0; i < program.count; i++)
+    {
+        node_t body_node = tree_child(tree, program, i);
+        ASSERT(KIND(body_node) == AST_BODY, "Wanted node type BODY, got %s",
+               ast_to_string(KIND(body_node)));
+        tree_list_t body = tree_list(tree, body_node);
+        for (uint32_t j = 0; j < body.count; j++)
+        {
+            sema_statement(tree_child(tree, body, j));
+        }
+    }
+
+    sema_literals(sema);
+
+    g_ctx.sema = NULL;
+    return sema;
+}
+
+void sema_free(sema_t* sema)
+{
+    if (!sema)
+    {
+        return;
+    }
+    symbol_table_free(&sema->table);
+    free(sema->types);
+    free(sema->symbols);
+    free(sema->literals);
+    free(sema->pool);
+    free(sema);
+}
@@ -0,0 +1,194 @@
+#ifndef SEMA_H
+#define SEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "buffer.h"
+#include "intern.h"
+#include "tree.h"
+
+typedef enum symbol_scope_t
+{
+    SYMBOL_GLOBAL,
+    SYMBOL_LOCAL,
+} symbol_scope_t;
+
+typedef enum symbol_value_t
+{
+    SYMBOL_VALUE_UNKNOWN,
+    SYMBOL_VALUE_VOID,
+    SYMBOL_VALUE_INT,
+    SYMBOL_VALUE_BOOL,
+    SYMBOL_VALUE_STRING,
+    SYMBOL_VALUE_FN,
+} symbol_value_t;
+
+// Returns a printable name for the provided symbol type.
+static inline char* symbol_type_to_string(symbol_scope_t type)
+{
+    return type == SYMBOL_GLOBAL ? "GLOBAL" : "LOCAL";
+}
+
+static inline char* symbol_value_to_string(symbol_value_t type)
+{
+    switch (type)
+    {
+    case SYMBOL_VALUE_INT:
+        return "INT";
+    case SYMBOL_VALUE_BOOL:
+        return "BOOL";
+    case SYMBOL_VALUE_STRING:
+        return "STRING";
+    case SYMBOL_VALUE_FN:
+        return "FN";
+    case SYMBOL_VALUE_UNKNOWN:
+    default:
+        return "UNKNOWN";
+    }
+}
+
+typedef struct symbol_t
+{
+    // Interned name; symbols are matched by comparing atoms.
+    atom_t name;
+    symbol_scope_t type;
+    symbol_value_t value_type;
+    symbol_value_t ret_type;
+    ptrdiff_t offset; // Stack offset
+    // Depth of the scope declaring this symbol; 0 for globals.
+    size_t depth;
+    // Binding of the same name hidden by this symbol, restored when its scope
+    // is popped.
+    struct symbol_t* shadowed;
+} symbol_t;
+
+// Formats a symbol into a human-readable string for logging/debugging.
+static inline char* symbol_to_string(symbol_t* symbol)
+{
+    return formats("'%s', %s, %s, 0x%02x", atom_name(symbol->name),
+                   symbol_type_to_string(symbol->type),
+                   symbol_value_to_string(symbol->value_type), symbol->offset);
+}
+
+// Depth of the global scope.
+#define SCOPE_GLOBAL 0
+
+typedef struct symbol_slot_t
+{
+    atom_t name;
+    // Innermost visible symbol for `name`, or NULL if none is in scope.
+    symbol_t* symbol;
+} symbol_slot_t;
+
+/* Symbol table
+ *
+ * Every visible symbol is found through one open-addressing hash table keyed
+ * by name, which always maps a name to its innermost binding. A symbol that
+ * shadows another keeps a pointer to it.
+ *
+ * Locals are also appended to an undo log in declaration order. Pushing a
+ * scope only records the length of the log; popping it walks the log back to
+ * that mark, rebinding each name to the symbol it shadowed.
+ */
+typedef struct symbol_table_t
+{
+    // Names are never removed, so no tombstones are needed.
+    symbol_slot_t* slots;
+    size_t slot_count;
+    size_t slot_used;
+
+    // Undo log of the locals currently in scope.
+    symbol_t** locals;
+    size_t local_count;
+    size_t local_capacity;
+
+    // Length of the undo log when each open scope was pushed.
+    size_t* marks;
+    size_t mark_capacity;
+    // Depth of the innermost open scope.
+    size_t depth;
+
+    // Every symbol, global or local, lives until the table is freed, so
+    // nodes can keep pointing at symbols whose scope has been popped.
+    arena_t* arena;
+} symbol_table_t;
+
+/* Scope
+ *
+ * These operate on the table of the program being checked by `sema_check`.
+ */
+
+// Prepares an empty table holding only the global scope.
+void symbol_table_init(symbol_table_t* table);
+// Releases all memory owned by the table.
+void symbol_table_free(symbol_table_t* table);
+// Opens a new innermost scope.
+void scope_push();
+// Closes the innermost scope, unbinding its symbols.
+void scope_pop();
+// Returns the symbol bound to `name` in the scope at `depth` (the current
+// depth or SCOPE_GLOBAL), ignoring other scopes.
+symbol_t* scope_lookup_shallow(size_t depth, atom_t name);
+// Returns the innermost symbol bound to `name`.
+symbol_t* scope_lookup(atom_t name);
+// Declares `name` in the scope at `depth` (the current depth or
+// SCOPE_GLOBAL).
+symbol_t* scope_add_symbol(size_t depth, atom_t name, symbol_scope_t type);
+
+/* Semantic analysis
+ *
+ * `sema_check` walks a program once, in the order codegen emits it, resolving
+ * every name against its scope and checking the type of every expression.
+ * The results are kept in columns parallel to the tree's nodes, so codegen
+ * reads a node's type and symbol instead of working them out again.
+ */
+typedef struct sema_t
+{
+    // Program that was checked.
+    tree_t* tree;
+    // `symbol_value_t` of each expression and type node, indexed by `node_t`.
+    uint8_t* types;
+    // Symbol each identifier, declaration and call is bound to, indexed by
+    // `node_t`. NULL for calls to undeclared (external) functions.
+    symbol_t** symbols;
+    // Owns every symbol referenced by `symbols`.
+    symbol_table_t table;
+
+    // String literal pool. Literals with the same text are emitted once and
+    // share a label: `literals` maps each string constant, indexed like
+    // `tree_t::constants`, to its entry, and `pool` holds the offset of each
+    // entry's text within `tree_t::strings`, in order of first use.
+    //
+    // `==` compares strings by address, so sharing a label would make equal
+    // literals compare equal. A program that compares strings keeps one
+    // entry per literal, each a string of its own as written.
+    uint32_t* literals;
+    uint32_t* pool;
+    uint32_t pool_count;
+    // Does the program compare strings with `==`?
+    bool compares_strings;
+} sema_t;
+
+// Resolves and type checks `tree`. Errors are fatal, as in codegen.
+sema_t* sema_check(tree_t* tree);
+void sema_free(sema_t* sema);
+
+static inline symbol_value_t sema_type(const sema_t* sema, node_t node)
+{
+    return (symbol_value_t)sema->types[node];
+}
+
+static inline symbol_t* sema_symbol(const sema_t* sema, node_t node)
+{
+    return sema->symbols[node];
+}
+
+// Returns the pool entry of the string constant `node`.
+static inline uint32_t sema_literal(const sema_t* sema, node_t node)
+{
+    return sema->literals[sema->tree->payloads[node]];
+}
+
+#endif
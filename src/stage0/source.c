@@ -0,0 +1,231 @@
+#include "source.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#define read _read
+#define close _close
+#endif
+
+#define SOURCE_READ_CHUNK 65536
+
+#ifndef _WIN32
+// Maps a regular file read-only. The mapping always extends at least one byte
+// past the end of the file so the contents are followed by a zero byte: the
+// kernel zero-fills the tail of the last page, and when the file ends exactly
+// on a page boundary an extra anonymous zero page is reserved behind it.
+static bool source_map(source_t* source, int fd, size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (size + 1 + page - 1) / page * page;
+
+    char* data = NULL;
+    if (size % page != 0)
+    {
+        data = (char*)mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        data = (char*)mmap(NULL, mapped_size, PROT_READ,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+        if (mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+            MAP_FAILED)
+        {
+            munmap(data, mapped_size);
+            return false;
+        }
+    }
+
+    // The file is read front to back exactly once.
+    madvise(data, mapped_size, MADV_SEQUENTIAL);
+
+    source->data = data;
+    source->size = size;
+    source->complete = true;
+    source->mapped = true;
+    source->mapped_size = mapped_size;
+    return true;
+}
+#endif
+
+source_t* source_open(const char* path)
+{
+    source_t* source = (source_t*)calloc(1, sizeof(source_t));
+    if (!source)
+    {
+        perror("Error allocating memory");
+        return NULL;
+    }
+    source->fd = -1;
+
+    int fd = 0;
+    if (strcmp(path, "-") != 0)
+    {
+#ifndef _WIN32
+        fd = open(path, O_RDONLY);
+#else
+        fd = _open(path, _O_RDONLY | _O_BINARY);
+#endif
+        if (fd < 0)
+        {
+            perror("Error opening file");
+            free(source);
+            return NULL;
+        }
+    }
+
+#ifndef _WIN32
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+        source_map(source, fd, (size_t)info.st_size))
+    {
+        if (fd != 0)
+        {
+            close(fd);
+        }
+        log_debug("Mapped %zu bytes from %s.", source->size, path);
+        return source;
+    }
+#endif
+
+    // Fall back to reading the input incrementally as the lexer asks for it.
+    source->capacity = SOURCE_READ_CHUNK;
+    source->data = (char*)malloc(source->capacity + 1);
+    if (!source->data)
+    {
+        perror("Error allocating memory");
+        if (fd != 0)
+        {
+            close(fd);
+        }
+        free(source);
+        return NULL;
+    }
+    source->data[0] = '\0';
+    source->fd = fd;
+    source_fill(source);
+    return source;
+}
+
+bool source_fill(source_t* source)
+{
+    if (source->complete)
+    {
+        return false;
+    }
+
+    if (source->size == source->capacity)
+    {
+        size_t capacity = source->capacity * 2;
+        char* data = (char*)realloc(source->data, capacity + 1);
+        if (!data)
+        {
+            log_error("Out of memory reading source (%zu bytes).",
+                      source->size);
+            exit(1);
+        }
+        source->data = data;
+        source->capacity = capacity;
+    }
+
+    // `read` returns as soon as some input is available, so a pipe is
+    // consumed as it is written rather than only once it is closed.
+    ptrdiff_t bytes_read = read(source->fd, source->data + source->size,
+                                source->capacity - source->size);
+    if (bytes_read < 0)
+    {
+        perror("Error reading file");
+        exit(1);
+    }
+    if (bytes_read == 0)
+    {
+        source->complete = true;
+        if (source->fd != 0)
+        {
+            close(source->fd);
+        }
+        source->fd = -1;
+        log_debug("Read %zu bytes incrementally.", source->size);
+        return false;
+    }
+
+    source->size += (size_t)bytes_read;
+    source->data[source->size] = '\0';
+    return true;
+}
+
+source_t* source_read(const char* path)
+{
+    source_t* source = source_open(path);
+    if (!source)
+    {
+        return NULL;
+    }
+
+    while (source_fill(source))
+    {
+    }
+
+#ifndef _WIN32
+    if (source->mapped)
+    {
+        char* data = (char*)malloc(source->size + 1);
+        if (!data)
+        {
+            perror("Error allocating memory");
+            source_close(source);
+            return NULL;
+        }
+        memcpy(data, source->data, source->size);
+        data[source->size] = '\0';
+        munmap(source->data, source->mapped_size);
+        source->data = data;
+        source->capacity = source->size;
+        source->mapped = false;
+        source->mapped_size = 0;
+    }
+#endif
+    return source;
+}
+
+void source_close(source_t* source)
+{
+    if (!source)
+    {
+        return;
+    }
+
+    if (source->fd > 0)
+    {
+        close(source->fd);
+    }
+#ifndef _WIN32
+    if (source->mapped)
+    {
+        munmap(source->data, source->mapped_size);
+    }
+    else
+#endif
+    {
+        free(source->data);
+    }
+    free(source);
+}
@@ -0,0 +1,46 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A source file loaded once and shared, read-only, by the lexer, the parser
+// and diagnostics.
+//
+// Regular files are mapped whole. Anything else (pipes, stdin, character
+// devices) is read incrementally: `data` starts out holding whatever was
+// available and grows through `source_fill` as the lexer asks for more, so
+// `data` may move after each fill and readers should hold offsets into it.
+typedef struct source_t
+{
+    // Contents read so far, always followed by a NULL-terminator.
+    char* data;
+    // Size of the contents in bytes, excluding the NULL-terminator.
+    size_t size;
+    // True once `data` holds the entire input.
+    bool complete;
+    // True if `data` is a read-only mapping of the file, false if it is a heap
+    // buffer.
+    bool mapped;
+    // Length of the mapping, including the zero-filled tail.
+    size_t mapped_size;
+    // Heap buffer capacity, excluding the NULL-terminator.
+    size_t capacity;
+    // Descriptor still being read from, or -1.
+    int fd;
+} source_t;
+
+// Opens the file at `path` ("-" for stdin), mapping it into memory when
+// possible. Returns NULL on failure.
+source_t* source_open(const char* path);
+// Reads the whole file at `path` into a heap buffer of its own, so that
+// later writes to the file leave the result untouched. Returns NULL on
+// failure.
+source_t* source_read(const char* path);
+// Reads the next chunk of an incremental source. Returns false once there is
+// nothing more to read.
+bool source_fill(source_t* source);
+// Unmaps or frees the source contents and the source itself.
+void source_close(source_t* source);
+
+#endif
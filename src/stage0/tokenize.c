@@ -1,41 +1,153 @@
 #include "tokenize.h"
 #include "log.h"
+#include "macros.h"
 #include "strings.h"
 
-#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+// Lexer state is per thread, so parser workers can each read their own part
+// of the source.
+static _Thread_local source_t* g_source = NULL;
+static _Thread_local char* g_buf = NULL;
+// End of the input to lex: the bytes read so far, or the end of a range.
+static _Thread_local size_t g_len = 0;
+static _Thread_local size_t g_pos = 0;
+
+// Offset of the last newline read from an incremental source. Tokens other
+// than string literals never span lines, so once a newline follows `g_pos`
+// the next token is known to be entirely in memory.
+static _Thread_local size_t g_last_newline = 0;
+
+// Tokens the parser can currently see, starting at the current token.
+static _Thread_local token_t g_ring[TOKEN_LOOKAHEAD];
+static _Thread_local size_t g_ring_head = 0;
+static _Thread_local size_t g_ring_count = 0;
+
+// Decoded contents of string literals which contained escape sequences. All
+// other literals are read straight from the source buffer. Literals are
+// decoded by the thread reading them, when the parser asks for them, so
+// tokens can be lexed on another thread. The slots are reused round-robin and
+// keep their allocations.
+#define LITERAL_SLOTS (TOKEN_LOOKAHEAD * 2)
+
+typedef struct literal_slot_t
+{
+    char* data;
+    size_t capacity;
+} literal_slot_t;
+
+static _Thread_local literal_slot_t g_literals[LITERAL_SLOTS];
+static _Thread_local size_t g_literal_count = 0;
 
-static int g_pos = 0;
-static char* g_buf = NULL;
+// Reads tokens for the lookahead ring when they are lexed elsewhere.
+static _Thread_local tokenize_feed_t g_feed = NULL;
+static _Thread_local void* g_feed_context = NULL;
 
-token_t* new_token()
+static const char* decode_literal(const char* str, size_t length)
 {
-    token_t* token = calloc(1, sizeof(token_t));
-    token->value = NULL;
-    return token;
+    literal_slot_t* slot = &g_literals[g_literal_count++ % LITERAL_SLOTS];
+    if (slot->capacity < length + 1)
+    {
+        slot->capacity = length + 1;
+        slot->data = (char*)realloc(slot->data, slot->capacity);
+    }
+
+    memcpy(slot->data, str, length);
+    slot->data[length] = '\0';
+    stresc(slot->data);
+    return slot->data;
 }
 
-void alloc_token(token_t* token, size_t size)
+void tokenize_free()
 {
-    if (!token)
+    for (size_t i = 0; i < LITERAL_SLOTS; i++)
+    {
+        free(g_literals[i].data);
+        g_literals[i].data = NULL;
+        g_literals[i].capacity = 0;
+    }
+    g_literal_count = 0;
+    g_feed = NULL;
+    g_feed_context = NULL;
+    g_source = NULL;
+    g_buf = NULL;
+    g_len = 0;
+    g_pos = 0;
+    g_ring_head = 0;
+    g_ring_count = 0;
+}
+
+/* Pulls the next chunk from an incremental source. Returns false if the source
+ * is complete. */
+static bool tokenize_fill()
+{
+    // Complete sources never grow, and may be lexed as a range.
+    if (g_source->complete)
     {
-        return;
+        return false;
     }
-    if (token->value)
+
+    bool filled = source_fill(g_source);
+
+    // The buffer may have moved; token offsets remain valid.
+    g_buf = g_source->data;
+    g_len = g_source->size;
+    if (!filled)
     {
-        free(token->value);
+        return false;
     }
-    token->value = (char*)calloc(1, size);
+    for (size_t i = g_len; i > g_last_newline; i--)
+    {
+        if (g_buf[i - 1] == '\n')
+        {
+            g_last_newline = i - 1;
+            break;
+        }
+    }
+    return true;
+}
+
+const char* token_text(token_t* token)
+{
+    return g_buf + token->start;
+}
+
+size_t token_length(token_t* token)
+{
+    return token->end - token->start;
+}
+
+bool token_equals(token_t* token, const char* str)
+{
+    size_t length = token_length(token);
+    return strlen(str) == length && memcmp(token_text(token), str, length) == 0;
 }
 
-void free_token(token_t* token)
+const char* token_literal(token_t* token, size_t* length)
 {
-    if (token && token->value)
+    // Strip the surrounding quotes. An unterminated literal runs to the end of
+    // the source and has no closing quote.
+    size_t start = token->start + 1;
+    size_t end = token->end;
+    if (end > start && g_buf[end - 1] == '"')
+    {
+        end--;
+    }
+
+    if (token->id == LITERAL_ESCAPED)
     {
-        free(token->value);
-        token->value = NULL;
+        const char* literal = decode_literal(g_buf + start, end - start);
+        *length = strlen(literal);
+        return literal;
     }
+
+    *length = end - start;
+    return g_buf + start;
 }
 
 #define CASE(t)                                                                \
@@ -87,198 +199,353 @@ char* get_token_type_string(enum token_type_t type)
 
 void print_token(token_t* token)
 {
-    if (!token || token->type == TOK_EOF || !token->value)
+    if (!token || token->type == TOK_EOF)
     {
         return;
     }
-    log_debug("  [%s, %d, %d] -> %s", get_token_type_string(token->type),
-              token->start, token->end, token->value);
+    log_debug("  [%s, %d, %d] -> %.*s", get_token_type_string(token->type),
+              token->start, token->end, (int)token_length(token),
+              token_text(token));
 }
 
-bool is_whitespace(char c)
+/* Character classes
+ *
+ * Every byte is classified once through `CHAR_CLASS` instead of a chain of
+ * ctype calls. A byte may belong to several classes.
+ */
+
+#define CC_SPACE 0x01    // ' ', '\t', '\n', '\r'
+#define CC_DIGIT 0x02    // 0-9
+#define CC_ALPHA 0x04    // a-z, A-Z
+#define CC_IDENT 0x08    // a-z, A-Z, 0-9, _
+#define CC_OPERATOR 0x10 // + - * / = > <
+
+static const uint8_t CHAR_CLASS[256] = {
+    [' '] = CC_SPACE,
+    ['\t'] = CC_SPACE,
+    ['\n'] = CC_SPACE,
+    ['\r'] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT | CC_IDENT,
+    ['a' ... 'z'] = CC_ALPHA | CC_IDENT,
+    ['A' ... 'Z'] = CC_ALPHA | CC_IDENT,
+    ['_'] = CC_IDENT,
+    ['+'] = CC_OPERATOR,
+    ['-'] = CC_OPERATOR,
+    ['*'] = CC_OPERATOR,
+    ['/'] = CC_OPERATOR,
+    ['='] = CC_OPERATOR,
+    ['>'] = CC_OPERATOR,
+    ['<'] = CC_OPERATOR,
+};
+
+#define IS_CLASS(c, cls) ((CHAR_CLASS[(unsigned char)(c)] & (cls)) != 0)
+
+/* Vector scanning
+ *
+ * Runs of whitespace, identifier characters, digits, comments and string
+ * bodies are skipped a full vector at a time. Each `scan_*` function returns
+ * the offset of the first byte at or after `pos` which ends the run. Vector
+ * loads are only issued while a whole vector fits before `g_len`, so the scan
+ * never reads past the end of the source; the remaining tail is finished one
+ * byte at a time through `CHAR_CLASS`.
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEX_VECTOR_WIDTH 32
+typedef __m256i lex_vec_t;
+#define VEC_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define VEC_SET(c) _mm256_set1_epi8((char)(c))
+#define VEC_EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define VEC_GT(a, b) _mm256_cmpgt_epi8(a, b)
+#define VEC_OR(a, b) _mm256_or_si256(a, b)
+#define VEC_XOR(a, b) _mm256_xor_si256(a, b)
+#define VEC_SUB(a, b) _mm256_sub_epi8(a, b)
+#define VEC_MASK(v) ((uint32_t)_mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LEX_VECTOR_WIDTH 16
+typedef __m128i lex_vec_t;
+#define VEC_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define VEC_SET(c) _mm_set1_epi8((char)(c))
+#define VEC_EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define VEC_GT(a, b) _mm_cmpgt_epi8(a, b)
+#define VEC_OR(a, b) _mm_or_si128(a, b)
+#define VEC_XOR(a, b) _mm_xor_si128(a, b)
+#define VEC_SUB(a, b) _mm_sub_epi8(a, b)
+#define VEC_MASK(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+#ifdef LEX_VECTOR_WIDTH
+#define VEC_ALL ((uint32_t)((1ull << LEX_VECTOR_WIDTH) - 1))
+
+// Lanes of `v` within the inclusive range [lo, hi]. SSE2 only offers signed
+// comparisons, so the bytes are shifted into the signed range first.
+static inline lex_vec_t vec_in_range(lex_vec_t v, char lo, char hi)
 {
-    return c == TOK_SPACE || c == TOK_TAB || c == TOK_NEWLINE ||
-           c == TOK_CARRIAGE;
+    lex_vec_t shifted = VEC_XOR(VEC_SUB(v, VEC_SET(lo)), VEC_SET(0x80));
+    return VEC_GT(VEC_SET((char)(hi - lo + 1 - 128)), shifted);
 }
 
-bool is_keyword(char c)
+static inline uint32_t vec_space_mask(lex_vec_t v)
 {
-    return isalnum((unsigned char)c) || c == '_';
+    lex_vec_t space = VEC_OR(VEC_EQ(v, VEC_SET(' ')), VEC_EQ(v, VEC_SET('\t')));
+    lex_vec_t line = VEC_OR(VEC_EQ(v, VEC_SET('\n')), VEC_EQ(v, VEC_SET('\r')));
+    return VEC_MASK(VEC_OR(space, line));
 }
 
-bool is_string(char c)
+static inline uint32_t vec_digit_mask(lex_vec_t v)
 {
-    return c == '"';
+    return VEC_MASK(vec_in_range(v, '0', '9'));
 }
 
-bool is_comment(char* str)
+static inline uint32_t vec_ident_mask(lex_vec_t v)
 {
-    return str[0] == '/' && str[1] == '/';
+    // Setting bit 5 folds upper case letters onto lower case.
+    lex_vec_t lower = VEC_OR(v, VEC_SET(0x20));
+    lex_vec_t alpha = vec_in_range(lower, 'a', 'z');
+    lex_vec_t digit = vec_in_range(v, '0', '9');
+    lex_vec_t under = VEC_EQ(v, VEC_SET('_'));
+    return VEC_MASK(VEC_OR(alpha, VEC_OR(digit, under)));
 }
 
-bool is_operator(char c)
+static inline uint32_t vec_line_end_mask(lex_vec_t v)
 {
-    return c == '+' || c == '-' || c == '*' || c == '/' || c == '=' ||
-           c == '>' || c == '<';
+    return VEC_MASK(VEC_EQ(v, VEC_SET('\n')));
 }
 
-bool is_semicolon(char c)
+static inline uint32_t vec_string_end_mask(lex_vec_t v)
 {
-    return c == ';';
+    return VEC_MASK(VEC_OR(VEC_EQ(v, VEC_SET('"')), VEC_EQ(v, VEC_SET('\\'))));
 }
 
-bool is_compound_op(char* str)
+// Advances `pos` while every lane of the vector at `pos` is in the run
+// described by `in_run`, returning the offset of the first byte that ends the
+// run or the offset at which the vector loop could not continue.
+#define SCAN_WHILE(pos, in_run)                                                \
+    while ((pos) + LEX_VECTOR_WIDTH <= g_len)                                  \
+    {                                                                          \
+        uint32_t stop = ~in_run(VEC_LOAD(g_buf + (pos))) & VEC_ALL;            \
+        if (stop)                                                              \
+        {                                                                      \
+            return (pos) + __builtin_ctz(stop);                                \
+        }                                                                      \
+        (pos) += LEX_VECTOR_WIDTH;                                             \
+    }
+
+// Same as `SCAN_WHILE`, but stops at the first lane flagged by `is_end`.
+#define SCAN_UNTIL(pos, is_end)                                                \
+    while ((pos) + LEX_VECTOR_WIDTH <= g_len)                                  \
+    {                                                                          \
+        uint32_t stop = is_end(VEC_LOAD(g_buf + (pos)));                       \
+        if (stop)                                                              \
+        {                                                                      \
+            return (pos) + __builtin_ctz(stop);                                \
+        }                                                                      \
+        (pos) += LEX_VECTOR_WIDTH;                                             \
+    }
+#else
+#define SCAN_WHILE(pos, in_run)
+#define SCAN_UNTIL(pos, is_end)
+#endif
+
+static size_t scan_class(size_t pos, uint8_t cls)
 {
-    if (is_operator(str[0]) && str[1] == '=')
-    {
-        return true;
-    }
-    if (str[0] == '=' && str[1] == '>')
+    while (IS_CLASS(g_buf[pos], cls))
     {
-        return true;
+        pos++;
     }
-    return false;
+    return pos;
 }
 
-token_t* tokenize_comment()
-{
-    token_t* token = new_token();
-    token->start = g_pos;
-    token->type = TOK_COMMENT;
+// Most runs (indentation, names, numbers) are only a few bytes long and are
+// cheaper to finish through the table than to set up a vector compare. Each
+// scan therefore probes `SCAN_PROBE` bytes one at a time before switching to
+// vector loads.
+#define SCAN_PROBE 8
 
-    // Keep going until we hit a new line
-    while (g_buf[g_pos] != '\n')
-    {
-        g_pos++;
+#define PROBE_CLASS(pos, cls)                                                  \
+    for (size_t end = (pos) + SCAN_PROBE; (pos) < end; (pos)++)                \
+    {                                                                          \
+        if (!IS_CLASS(g_buf[pos], cls))                                        \
+        {                                                                      \
+            return (pos);                                                      \
+        }                                                                      \
     }
 
-    token->end = g_pos;
-    return token;
+static size_t scan_space(size_t pos)
+{
+    PROBE_CLASS(pos, CC_SPACE);
+    SCAN_WHILE(pos, vec_space_mask);
+    return scan_class(pos, CC_SPACE);
 }
 
-token_t* tokenize_number()
+static size_t scan_digits(size_t pos)
 {
-    token_t* token = new_token();
-    token->start = g_pos;
-    token->type = TOK_NUMBER;
-
-    int count = 0;
-    while (isdigit((unsigned char)g_buf[g_pos + count]))
-    {
-        count++;
-    }
-
-    alloc_token(token, count + 1);
-    memcpy(token->value, &g_buf[g_pos], count);
-    token->value[count] = 0;
-    g_pos += count;
-
-    token->end = g_pos;
-    return token;
+    PROBE_CLASS(pos, CC_DIGIT);
+    SCAN_WHILE(pos, vec_digit_mask);
+    return scan_class(pos, CC_DIGIT);
 }
 
-token_t* tokenize_keyword()
+static size_t scan_ident(size_t pos)
 {
-    token_t* token = new_token();
-    token->start = g_pos;
+    PROBE_CLASS(pos, CC_IDENT);
+    SCAN_WHILE(pos, vec_ident_mask);
+    return scan_class(pos, CC_IDENT);
+}
 
-    int count = 0;
-    while (is_keyword(g_buf[g_pos + count]))
+// Comments and string bodies are usually long enough to go straight to
+// vector loads.
+static size_t scan_line(size_t pos)
+{
+    SCAN_UNTIL(pos, vec_line_end_mask);
+    while (g_buf[pos] != '\0' && g_buf[pos] != '\n')
     {
-        count++;
+        pos++;
     }
-    alloc_token(token, count + 1);
-    memcpy(token->value, &g_buf[g_pos], count);
-    token->value[count] = 0;
+    return pos;
+}
 
-    if (streq(token->value, "const"))
-    {
-        token->type = TOK_DECLVAR;
-    }
-    else if (streq(token->value, "let"))
-    {
-        token->type = TOK_DECLVAR;
-    }
-    else if (streq(token->value, "fn"))
-    {
-        token->type = TOK_DECLFN;
-    }
-    else if (streq(token->value, "return"))
-    {
-        token->type = TOK_RETURN;
-    }
-    else if (streq(token->value, "if"))
-    {
-        token->type = TOK_IF;
-    }
-    else if (streq(token->value, "else"))
-    {
-        token->type = TOK_ELSE;
-    }
-    else if (streq(token->value, "for"))
-    {
-        token->type = TOK_FOR;
-    }
-    else if (streq(token->value, "in"))
-    {
-        token->type = TOK_IN;
-    }
-    else if (streq(token->value, "while"))
+// Stops at the closing quote, a backslash or the end of the source.
+static size_t scan_string(size_t pos)
+{
+    SCAN_UNTIL(pos, vec_string_end_mask);
+    while (g_buf[pos] != '\0' && g_buf[pos] != '"' && g_buf[pos] != '\\')
     {
-        token->type = TOK_WHILE;
+        pos++;
     }
-    else if (streq(token->value, "true"))
+    return pos;
+}
+
+bool is_compound_op(char* str)
+{
+    if (IS_CLASS(str[0], CC_OPERATOR) && str[1] == '=')
     {
-        token->type = TOK_TRUE;
+        return true;
     }
-    else if (streq(token->value, "false"))
+    if (str[0] == '=' && str[1] == '>')
     {
-        token->type = TOK_FALSE;
+        return true;
     }
-    else
+    return false;
+}
+
+// Keyword lookup dispatching on length and first character, so each
+// identifier costs at most one `memcmp`.
+static token_type_t keyword_type(const char* str, size_t length)
+{
+#define KEYWORD(word, type)                                                    \
+    return memcmp(str, word, length) == 0 ? type : TOK_IDENTIFIER
+
+    switch (length)
     {
-        token->type = TOK_IDENTIFIER;
+    case 2:
+        switch (str[0])
+        {
+        case 'f':
+            KEYWORD("fn", TOK_DECLFN);
+        case 'i':
+            return str[1] == 'f'   ? TOK_IF
+                   : str[1] == 'n' ? TOK_IN
+                                   : TOK_IDENTIFIER;
+        }
+        break;
+    case 3:
+        switch (str[0])
+        {
+        case 'l':
+            KEYWORD("let", TOK_DECLVAR);
+        case 'f':
+            KEYWORD("for", TOK_FOR);
+        }
+        break;
+    case 4:
+        switch (str[0])
+        {
+        case 'e':
+            KEYWORD("else", TOK_ELSE);
+        case 't':
+            KEYWORD("true", TOK_TRUE);
+        }
+        break;
+    case 5:
+        switch (str[0])
+        {
+        case 'c':
+            KEYWORD("const", TOK_DECLVAR);
+        case 'w':
+            KEYWORD("while", TOK_WHILE);
+        case 'f':
+            KEYWORD("false", TOK_FALSE);
+        }
+        break;
+    case 6:
+        if (str[0] == 'r')
+        {
+            KEYWORD("return", TOK_RETURN);
+        }
+        break;
     }
-    g_pos += count;
+    return TOK_IDENTIFIER;
+#undef KEYWORD
+}
+
+void tokenize_number(token_t* token)
+{
+    token->start = g_pos;
+    token->type = TOK_NUMBER;
+    g_pos = scan_digits(g_pos);
+    token->end = g_pos;
+}
 
+void tokenize_keyword(token_t* token)
+{
+    token->start = g_pos;
+    g_pos = scan_ident(g_pos);
     token->end = g_pos;
 
-    return token;
+    token->type = keyword_type(token_text(token), token_length(token));
+    if (token->type == TOK_IDENTIFIER)
+    {
+        token->id = intern(token_text(token), token_length(token));
+    }
 }
 
-token_t* tokenize_string()
+void tokenize_string(token_t* token)
 {
-    token_t* token = new_token();
     token->start = g_pos;
 
     // Skip the opening quote
     g_pos++;
 
-    int count = 0;
-    int start = g_pos;
+    bool escaped = false;
 
-    // Increment count and position until we reach either another quote
-    // or a null-terminator.
-    while (g_buf[g_pos] != '\0' && g_buf[g_pos] != '"')
+    // Advance until we reach either another quote or the end of the source,
+    // noting any escape sequences on the way. String literals may span lines,
+    // so an incremental source is read further until the literal is closed.
+    while (true)
     {
-        count++;
-        g_pos++;
+        g_pos = scan_string(g_pos);
+        if (g_buf[g_pos] == '\\')
+        {
+            escaped = true;
+            g_pos++;
+            continue;
+        }
+        if (g_pos >= g_len && tokenize_fill())
+        {
+            continue;
+        }
+        break;
     }
 
-    // Make a new token with its value's size equal to the count + 1 (for
-    // the null-terminator).
-    alloc_token(token, count + 1);
-
-    // Copy the string's content into the token's value.
-    if (count > 0)
+    // Only literals containing escape sequences need decoding; everything
+    // else is read straight from the source.
+    if (escaped)
     {
-        memcpy(token->value, &g_buf[start], count);
+        token->id = LITERAL_ESCAPED;
     }
 
-    // Null-terminate
-    token->value[count] = '\0';
-    stresc(token->value);
-
     // Skip closing quote
     if (g_buf[g_pos] == '"')
     {
@@ -286,26 +553,20 @@ token_t* tokenize_string()
     }
     token->type = TOK_STRING;
     token->end = g_pos;
-    return token;
 }
 
-token_t* tokenize_operator()
+void tokenize_operator(token_t* token)
 {
-    token_t* token = new_token();
+    token->start = g_pos;
 
     // Parse compound (2 character) operators
     if (is_compound_op(&g_buf[g_pos]))
     {
-        alloc_token(token, 3);
-        token->value[0] = g_buf[g_pos];
-        token->value[1] = g_buf[g_pos + 1];
-        token->value[2] = 0;
-        token->start = g_pos;
-        if (strcmp(token->value, "=>") == 0)
+        if (g_buf[g_pos] == '=' && g_buf[g_pos + 1] == '>')
         {
             token->type = TOK_ARROW;
         }
-        else if (strcmp(token->value, "==") == 0)
+        else if (g_buf[g_pos] == '=' && g_buf[g_pos + 1] == '=')
         {
             token->type = TOK_EQ;
         }
@@ -314,15 +575,11 @@ token_t* tokenize_operator()
             token->type = TOK_UNKNOWN;
         }
         g_pos += 2;
-        token->end = g_pos;
     }
     // Parse simple (1 character) operators
     else
     {
-        alloc_token(token, 2);
-        token->value[0] = g_buf[g_pos];
-        token->value[1] = 0;
-        switch (token->value[0])
+        switch (g_buf[g_pos])
         {
         case '>':
             token->type = TOK_GT;
@@ -331,132 +588,168 @@ token_t* tokenize_operator()
             token->type = TOK_LT;
             break;
         default:
-            token->type = (token_type_t)token->value[0];
+            token->type = (token_type_t)g_buf[g_pos];
             break;
         }
-        token->start = g_pos;
         g_pos++;
-        token->end = g_pos;
     }
-    return token;
+    token->end = g_pos;
 }
 
-token_t* tokenize_semicolon()
+void tokenize_semicolon(token_t* token)
 {
-    token_t* token = new_token();
     token->type = TOK_SEMICOLON;
-    alloc_token(token, 2);
-    token->value[0] = ';';
-    token->value[1] = 0;
     token->start = g_pos;
     g_pos++;
     token->end = g_pos;
-    return token;
 }
 
-token_t* tokenize_next()
+/* Reads the token starting at the current position into `token`. Returns
+ * false if it is a comment. */
+static bool tokenize_one(token_t* token)
 {
-    while (g_buf[g_pos] != '\0' && is_whitespace(g_buf[g_pos]))
+    unsigned char c = (unsigned char)g_buf[g_pos];
+    token->id = ATOM_NONE;
+
+    uint8_t cls = CHAR_CLASS[c];
+    if (cls & CC_DIGIT)
     {
-        g_pos++;
+        tokenize_number(token);
+        return true;
     }
-
-    if (g_buf[g_pos] == '\0')
+    if (cls & CC_ALPHA)
     {
-        return NULL;
+        tokenize_keyword(token);
+        return true;
     }
-
-    char c = g_buf[g_pos];
-
-    if (is_comment(&g_buf[g_pos]))
+    if (cls & CC_OPERATOR)
     {
-        // Keep going until we hit a new line
-        while (g_buf[g_pos] != '\n')
+        if (c == '/' && g_buf[g_pos + 1] == '/')
         {
-            g_pos++;
+            // Skip to the end of the line
+            g_pos = scan_line(g_pos + 2);
+            return false;
         }
-        return NULL;
-    }
-    if (isdigit((unsigned char)c))
-    {
-        return tokenize_number();
-    }
-    if (isalpha((unsigned char)c))
-    {
-        return tokenize_keyword();
-    }
-    if (is_string(c))
-    {
-        return tokenize_string();
+        tokenize_operator(token);
+        return true;
     }
-    if (is_operator(c))
+    if (c == '"')
     {
-        return tokenize_operator();
+        tokenize_string(token);
+        return true;
     }
-    if (is_semicolon(c))
+    if (c == ';')
     {
-        return tokenize_semicolon();
+        tokenize_semicolon(token);
+        return true;
     }
 
-    token_t* token = new_token();
-    alloc_token(token, 2);
-    token->type = (token_type_t)c;
-    token->value[0] = c;
-    token->value[1] = 0;
+    token->type = (token_type_t)g_buf[g_pos];
     token->start = g_pos;
     g_pos++;
     token->end = g_pos;
-    return token;
+    return true;
 }
 
-size_t tokenize(char* buffer, token_t* tokens)
+void tokenize_begin(source_t* source)
 {
-    // Copy the input string buffer into a global buffer. This is freed at the
-    // end of this function.
-    g_buf = strdup(buffer);
-    g_pos = 0;
+    tokenize_free();
+
+    // Tokens are views into the source, so it is read in place rather than
+    // copied.
+    g_source = source;
+    g_buf = source->data;
+    g_len = source->size;
+    g_last_newline = 0;
+}
 
-    size_t token_count = 0;
+void tokenize_begin_range(source_t* source, size_t start, size_t end)
+{
+    ASSERT(source->complete, "Only a complete source can be lexed by range.");
+    ASSERT(start <= end && end <= source->size,
+           "Range %zu..%zu is outside the source.", start, end);
+    tokenize_begin(source);
+    g_pos = start;
+    g_len = end;
+}
 
-    // While we're not at the end of the buffer, keep constructing tokens.
-    while (g_buf[g_pos] != '\0')
+void tokenize_begin_feed(source_t* source, tokenize_feed_t feed,
+                         void* context)
+{
+    ASSERT(source->complete,
+           "Only a complete source can be lexed on another thread.");
+    tokenize_begin(source);
+    g_feed = feed;
+    g_feed_context = context;
+}
+
+void tokenize_next(token_t* token)
+{
+    while (true)
     {
-        // Get the next token.
-        token_t* t = tokenize_next();
+        g_pos = scan_space(g_pos);
+
+        if (g_pos >= g_len || g_buf[g_pos] == '\0')
+        {
+            // Whitespace ran to the end of what has been read so far.
+            if (g_pos >= g_len && tokenize_fill())
+            {
+                continue;
+            }
+            break;
+        }
 
-        // If the token is invalid, continue.
-        if (!t)
+        // Make sure the whole token is in memory before lexing it.
+        if (!g_source->complete && g_pos >= g_last_newline && tokenize_fill())
         {
             continue;
         }
 
-        // Copy the token into the token buffer.
-        tokens[token_count] = *t;
+        // Skip over comments until a real token.
+        if (tokenize_one(token))
+        {
+            return;
+        }
+    }
 
-        // Free the temporary token we had allocated.
-        free(t);
+    token->type = TOK_EOF;
+    token->start = g_pos;
+    token->end = g_pos;
+    token->id = ATOM_NONE;
+}
 
-        // Increement the token count.
-        token_count++;
+token_t* tokenize_peek(size_t offset)
+{
+    ASSERT(offset < TOKEN_LOOKAHEAD,
+           "Lookahead of %zu tokens exceeds the maximum of %d.", offset,
+           TOKEN_LOOKAHEAD);
 
-        // If we've exceeded the max token count, break.
-        if (token_count >= TOKEN_COUNT - 1)
+    // Lex on demand until the requested token is in the ring.
+    while (g_ring_count <= offset)
+    {
+        size_t slot = (g_ring_head + g_ring_count) % TOKEN_LOOKAHEAD;
+        if (g_feed)
         {
-            break;
+            g_feed(&g_ring[slot], g_feed_context);
+        }
+        else
+        {
+            tokenize_next(&g_ring[slot]);
         }
+        g_ring_count++;
     }
+    return &g_ring[(g_ring_head + offset) % TOKEN_LOOKAHEAD];
+}
 
-    // Construct an EOF token at the end.
-    tokens[token_count].type = TOK_EOF;
-    tokens[token_count].value = NULL;
-    tokens[token_count].start = g_pos;
-    token_count++;
-
-    // Free the temporary buffer of the input string
-    free(g_buf);
-
-    // Return the token count
-    return token_count;
+void tokenize_advance()
+{
+    // EOF is sticky; every read past the end keeps returning it.
+    if (tokenize_peek(0)->type == TOK_EOF)
+    {
+        return;
+    }
+    g_ring_head = (g_ring_head + 1) % TOKEN_LOOKAHEAD;
+    g_ring_count--;
 }
 
 bool is_binop(token_type_t type)
@@ -470,4 +763,224 @@ bool is_constant(token_type_t type)
 {
     return type == TOK_NUMBER || type == TOK_TRUE || type == TOK_FALSE ||
            type == TOK_STRING;
-}
\ No newline at end of file
+}
+/* Parallel tokenization
+ *
+ * The source is cut into chunks just after a newline and each chunk is
+ * lexed on a worker as if it started between tokens. Only a string literal
+ * can span a newline, so that guess is right unless the previous chunk's
+ * last token runs past the cut. The chunks are checked in order once lexed:
+ * a chunk whose guess was wrong is lexed again from where the previous one
+ * really stopped, and the runs of tokens are then handed on in order, the
+ * same stream a single lexer would produce.
+ */
+
+// Inputs smaller than this are lexed on one thread.
+#define TOKENIZE_PARALLEL_MIN_BYTES (4 * 1024 * 1024)
+// Approximate size of a chunk.
+#define TOKENIZE_CHUNK_BYTES (1024 * 1024)
+// Chunks lexed ahead of the consumer per worker, bounding the tokens held.
+#define TOKENIZE_CHUNKS_AHEAD 2
+#define TOKENIZE_MAX_WORKERS 64
+
+// Number of lexer threads. 0 starts one per online CPU.
+#ifndef TOKENIZE_WORKERS
+#define TOKENIZE_WORKERS 0
+#endif
+
+typedef struct token_chunk_t
+{
+    // Bytes in which the chunk's tokens start, or SIZE_MAX for the last.
+    size_t start;
+    size_t end;
+    token_t* tokens;
+    size_t count;
+    size_t capacity;
+    // End of the last token, or `start` if there is none.
+    size_t reach;
+    // Set once a worker has lexed the chunk.
+    bool done;
+} token_chunk_t;
+
+typedef struct token_pool_t
+{
+    source_t* source;
+    token_chunk_t* chunks;
+    size_t chunk_count;
+    // Index of the next chunk to hand out.
+    size_t next_chunk;
+    // Number of chunks handed on by the consumer.
+    size_t consumed;
+    size_t ahead;
+} token_pool_t;
+
+// Lexes the tokens of `chunk` starting from `from`, which lies between
+// tokens. The last chunk also gets the TOK_EOF.
+static void tokenize_chunk(source_t* source, token_chunk_t* chunk, size_t from)
+{
+    // A token starting in the chunk may end past it, so the lexer is given
+    // the rest of the source.
+    tokenize_begin_range(source, from, source->size);
+    chunk->count = 0;
+    chunk->reach = from;
+    while (true)
+    {
+        token_t token;
+        tokenize_next(&token);
+        bool last = token.type == TOK_EOF || token.start >= chunk->end;
+        if (last && (token.type != TOK_EOF || chunk->end != SIZE_MAX))
+        {
+            break;
+        }
+
+        if (chunk->count == chunk->capacity)
+        {
+            chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 4096;
+            chunk->tokens = (token_t*)realloc(
+                chunk->tokens, chunk->capacity * sizeof(token_t));
+            ASSERT(chunk->tokens != NULL, "Out of memory lexing a chunk.");
+        }
+        chunk->tokens[chunk->count++] = token;
+        if (last)
+        {
+            break;
+        }
+        chunk->reach = token.end;
+    }
+    tokenize_free();
+}
+
+static void* tokenize_worker(void* arg)
+{
+    token_pool_t* pool = (token_pool_t*)arg;
+    while (true)
+    {
+        size_t index =
+            __atomic_fetch_add(&pool->next_chunk, 1, __ATOMIC_RELAXED);
+        if (index >= pool->chunk_count)
+        {
+            break;
+        }
+
+        // Stay a bounded distance ahead of the consumer.
+        while (index >= __atomic_load_n(&pool->consumed, __ATOMIC_ACQUIRE) +
+                            pool->ahead)
+        {
+            sched_yield();
+        }
+
+        token_chunk_t* chunk = &pool->chunks[index];
+        tokenize_chunk(pool->source, chunk, chunk->start);
+        __atomic_store_n(&chunk->done, true, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+size_t tokenize_worker_count(const source_t* source)
+{
+    if (!source->complete || source->size < TOKENIZE_PARALLEL_MIN_BYTES)
+    {
+        return 1;
+    }
+
+    long workers =
+        TOKENIZE_WORKERS ? TOKENIZE_WORKERS : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+    {
+        return 1;
+    }
+    return workers > TOKENIZE_MAX_WORKERS ? TOKENIZE_MAX_WORKERS
+                                          : (size_t)workers;
+}
+
+// Cuts `source` into chunks of about TOKENIZE_CHUNK_BYTES, each starting
+// just after a newline. Returns the number of chunks.
+static size_t tokenize_split(const source_t* source, token_chunk_t** chunks)
+{
+    size_t capacity = source->size / TOKENIZE_CHUNK_BYTES + 1;
+    *chunks = (token_chunk_t*)calloc(capacity, sizeof(token_chunk_t));
+    ASSERT(*chunks != NULL, "Out of memory splitting the source.");
+
+    size_t count = 0;
+    size_t start = 0;
+    while (true)
+    {
+        token_chunk_t* chunk = &(*chunks)[count++];
+        chunk->start = start;
+
+        size_t cut = start + TOKENIZE_CHUNK_BYTES;
+        const char* newline =
+            cut < source->size
+                ? (const char*)memchr(source->data + cut, '\n',
+                                      source->size - cut)
+                : NULL;
+        if (newline == NULL || count == capacity)
+        {
+            chunk->end = SIZE_MAX;
+            return count;
+        }
+        start = (size_t)(newline - source->data) + 1;
+        chunk->end = start;
+    }
+}
+
+void tokenize_parallel(source_t* source, size_t workers,
+                       tokenize_emit_t emit, void* context)
+{
+    ASSERT(source->complete, "Only a complete source can be lexed in chunks.");
+
+    token_pool_t pool = {0};
+    pool.source = source;
+    pool.chunk_count = tokenize_split(source, &pool.chunks);
+
+    // Callers other than `tokenize_worker_count` may ask for more threads
+    // than there are slots for; the window only counts those started.
+    if (workers > TOKENIZE_MAX_WORKERS)
+    {
+        workers = TOKENIZE_MAX_WORKERS;
+    }
+    pool.ahead = workers * TOKENIZE_CHUNKS_AHEAD;
+    pthread_t threads[TOKENIZE_MAX_WORKERS];
+    for (size_t i = 0; i < workers; i++)
+    {
+        int error = pthread_create(&threads[i], NULL, tokenize_worker, &pool);
+        ASSERT(error == 0, "Unable to start lexer worker: %s.",
+               strerror(error));
+    }
+
+    size_t relexed = 0;
+    size_t reach = 0;
+    for (size_t i = 0; i < pool.chunk_count; i++)
+    {
+        token_chunk_t* chunk = &pool.chunks[i];
+        while (!__atomic_load_n(&chunk->done, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+
+        // The previous chunk's last token ran into this one, so it was lexed
+        // from the wrong place.
+        if (reach > chunk->start)
+        {
+            tokenize_chunk(source, chunk, reach);
+            relexed++;
+        }
+        if (chunk->count > 0)
+        {
+            emit(chunk->tokens, chunk->count, context);
+        }
+        reach = chunk->reach > reach ? chunk->reach : reach;
+
+        free(chunk->tokens);
+        chunk->tokens = NULL;
+        __atomic_store_n(&pool.consumed, i + 1, __ATOMIC_RELEASE);
+    }
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(pool.chunks);
+    log_debug("Lexed %zu chunks on %zu workers, %zu again.", pool.chunk_count,
+              workers, relexed);
+}
@@ -5,7 +5,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define TOKEN_COUNT 4096
+#include "intern.h"
+#include "source.h"
+
+// Number of tokens held in the lexer's lookahead ring: the current token plus
+// up to three tokens of lookahead.
+#define TOKEN_LOOKAHEAD 4
 
 typedef enum token_type_t
 {
@@ -54,22 +59,82 @@ typedef enum token_type_t
     TOK_UNKNOWN = 255,
 } token_type_t;
 
+// Tokens are views into the source and own no memory of their own. The source
+// must outlive every token read from it.
 typedef struct token_t
 {
     enum token_type_t type;
-    char* value;
+    // Offset of the first character of this token within the source.
     size_t start;
+    // Offset one past the last character of this token within the source.
     size_t end;
+    // TOK_IDENTIFIER: the interned name of the identifier.
+    // TOK_STRING: LITERAL_ESCAPED if the literal contains escape sequences,
+    // otherwise ATOM_NONE.
+    atom_t id;
 } token_t;
 
+// `token_t::id` of a string literal which must be decoded before use.
+#define LITERAL_ESCAPED ((atom_t)0)
+
+// Produces the next token into `token`, for lexing on another thread.
+typedef void (*tokenize_feed_t)(token_t* token, void* context);
+// Receives the next `count` tokens of a source lexed by `tokenize_parallel`.
+typedef void (*tokenize_emit_t)(const token_t* tokens, size_t count,
+                                void* context);
+
 bool is_binop(token_type_t type);
 bool is_constant(token_type_t type);
 
 // Tokenization
-size_t tokenize(char* buffer, token_t* tokens);
-token_t* new_token(void);
-void alloc_token(token_t* token, size_t size);
-void free_token(token_t* token);
+//
+// The lexer is pull-based: tokens are only read from the source when the
+// parser asks for them, and only the small ring of tokens the parser can see
+// is kept in memory. Lexer state is per thread.
+
+// Starts reading tokens from `source`.
+void tokenize_begin(source_t* source);
+// Starts reading tokens from the bytes [start, end) of a complete `source`.
+// `start` and `end` must fall between tokens. Offsets stay relative to the
+// start of the source.
+void tokenize_begin_range(source_t* source, size_t start, size_t end);
+// Starts reading the tokens of a complete `source` from `feed` rather than
+// lexing them on this thread. `feed` must return TOK_EOF forever once the
+// source is exhausted.
+void tokenize_begin_feed(source_t* source, tokenize_feed_t feed,
+                         void* context);
+// Reads the next token, skipping comments. Returns TOK_EOF at the end of the
+// source. Used by the lookahead ring; callers reading through `tokenize_peek`
+// should not also call this.
+void tokenize_next(token_t* token);
+// Returns the token `offset` positions after the current token, where
+// `offset` is less than TOKEN_LOOKAHEAD.
+token_t* tokenize_peek(size_t offset);
+// Moves to the next token.
+void tokenize_advance(void);
+// Releases the lexer's buffers and detaches it from its source.
+void tokenize_free(void);
+
+// Returns the number of threads to lex `source` with in
+// `tokenize_parallel`, or 1 if it is too small to be worth splitting.
+size_t tokenize_worker_count(const source_t* source);
+// Lexes a complete `source` on `workers` threads, passing every token to
+// `emit` in source order, ending with TOK_EOF. The tokens are the same as
+// those `tokenize_next` would read. Uses the lexer state of the calling
+// thread.
+void tokenize_parallel(source_t* source, size_t workers, tokenize_emit_t emit,
+                       void* context);
+
+// Token views
+const char* token_text(token_t* token);
+size_t token_length(token_t* token);
+bool token_equals(token_t* token, const char* str);
+// Returns the decoded contents of a TOK_STRING token and stores its length in
+// `length`. The result is not NULL-terminated when it points into the source.
+// A decoded literal is only valid until a few more have been decoded on this
+// thread.
+const char* token_literal(token_t* token, size_t* length);
+
 char* get_token_type_string(enum token_type_t type);
 void print_token(token_t* token);
 
@@ -0,0 +1,393 @@
+#include "tree.h"
+#include "log.h"
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#define TREE_INITIAL_CAPACITY 64
+// Node of the single body of a tree built with `tree_begin`.
+#define TREE_BODY 1
+
+// Appends `n` zeroed elements to the column `name` of `tree`, returning the
+// index of the first.
+#define TREE_RESERVE(tree, name, n)                                            \
+    tree_reserve((void**)&(tree)->name, &(tree)->name##_count,                 \
+                 &(tree)->name##_capacity, sizeof(*(tree)->name), (n))
+
+// Bytes used by the column `name` of `tree`.
+#define TREE_COLUMN_BYTES(tree, name)                                          \
+    ((size_t)(tree)->name##_count * sizeof(*(tree)->name))
+
+static uint32_t tree_reserve(void** data, uint32_t* count, uint32_t* capacity,
+                             size_t size, uint32_t n)
+{
+    ASSERT(n <= UINT32_MAX - *count, "Compact AST column overflow.");
+    if (n == 0)
+    {
+        return *count;
+    }
+    if (*count + n > *capacity)
+    {
+        uint32_t new_capacity = *capacity ? *capacity : TREE_INITIAL_CAPACITY;
+        while (new_capacity < *count + n)
+        {
+            new_capacity *= 2;
+        }
+        *data = realloc(*data, new_capacity * size);
+        ASSERT(*data != NULL, "Out of memory growing the compact AST.");
+        *capacity = new_capacity;
+    }
+
+    uint32_t first = *count;
+    memset((char*)*data + first * size, 0, n * size);
+    *count += n;
+    return first;
+}
+
+// Appends a node of kind `kind` spanning [start, end). Its payload is filled
+// in by the caller once its children have been lowered.
+static node_t tree_node_of(tree_t* tree, ast_node_t kind, size_t start,
+                           size_t end)
+{
+    ASSERT(end <= UINT32_MAX, "Source offset %zu is too large.", end);
+
+    if (tree->count >= tree->capacity)
+    {
+        tree->capacity =
+            tree->capacity ? tree->capacity * 2 : TREE_INITIAL_CAPACITY;
+        tree->kinds = (uint8_t*)realloc(tree->kinds, tree->capacity);
+        tree->payloads = (uint32_t*)realloc(
+            tree->payloads, tree->capacity * sizeof(uint32_t));
+        tree->spans =
+            (span_t*)realloc(tree->spans, tree->capacity * sizeof(span_t));
+        ASSERT(tree->kinds && tree->payloads && tree->spans,
+               "Out of memory growing the compact AST.");
+    }
+
+    node_t index = tree->count++;
+    tree->kinds[index] = (uint8_t)kind;
+    tree->payloads[index] = 0;
+    tree->spans[index].start = (uint32_t)start;
+    tree->spans[index].end = (uint32_t)end;
+    return index;
+}
+
+// Appends a node of the same kind and span as `node`.
+static node_t tree_node(tree_t* tree, ast* node)
+{
+    return tree_node_of(tree, node->type, node->start, node->end);
+}
+
+static node_t tree_lower(tree_t* tree, ast* node);
+
+// Lowers the nodes of `nodes` into a contiguous run of children.
+static tree_list_t tree_lower_list(tree_t* tree, const ast_list* nodes)
+{
+    tree_list_t list = {TREE_RESERVE(tree, children, nodes->count),
+                        nodes->count};
+    for (uint32_t i = 0; i < list.count; i++)
+    {
+        node_t child = tree_lower(tree, nodes->items[i]);
+        tree->children[list.first + i] = child;
+    }
+    return list;
+}
+
+static node_t tree_lower(tree_t* tree, ast* node)
+{
+    if (!node)
+    {
+        return NODE_NONE;
+    }
+
+    node_t index = tree_node(tree, node);
+    uint32_t payload = 0;
+
+    // Payload slots are reserved before lowering any children so that each
+    // column stays in pre-order, matching the nodes.
+    switch (node->type)
+    {
+    case AST_PROGRAM:
+    case AST_BODY:
+    case AST_BLOCK:
+    {
+        payload = TREE_RESERVE(tree, lists, 1);
+        tree_list_t list;
+        if (node->type == AST_PROGRAM)
+        {
+            list = tree_lower_list(tree, &node->data.program.body);
+        }
+        else if (node->type == AST_BODY)
+        {
+            list = tree_lower_list(tree, &node->data.body.statements);
+        }
+        else
+        {
+            list = tree_lower_list(tree, &node->data.block.statements);
+        }
+        tree->lists[payload] = list;
+        break;
+    }
+    case AST_DECLVAR:
+    {
+        payload = TREE_RESERVE(tree, declvars, 1);
+        tree_declvar_t declvar = {
+            .identifier = tree_lower(tree, node->data.declvar.identifier),
+            .is_const = node->data.declvar.is_const,
+        };
+        tree->declvars[payload] = declvar;
+        break;
+    }
+    case AST_DECLFN:
+    {
+        payload = TREE_RESERVE(tree, declfns, 1);
+        ast_declfn* src = &node->data.declfn;
+        tree_declfn_t declfn;
+        declfn.identifier = tree_lower(tree, src->identifier);
+        declfn.args = tree_lower_list(tree, &src->args);
+        declfn.arg_types = TREE_RESERVE(tree, types, src->args.count);
+        for (uint32_t i = 0; i < src->args.count; i++)
+        {
+            tree->types[declfn.arg_types + i] = (uint8_t)src->arg_types[i];
+        }
+        declfn.ret_type = tree_lower(tree, src->ret_type);
+        declfn.block = tree_lower(tree, src->block);
+        tree->declfns[payload] = declfn;
+        break;
+    }
+    case AST_IDENTIFIER:
+        payload = node->data.identifier.atom;
+        break;
+    case AST_TYPE:
+        payload = (uint32_t)node->data.type.type;
+        break;
+    case AST_CONSTANT:
+    {
+        payload = TREE_RESERVE(tree, constants, 1);
+        tree_constant_t constant = {
+            .type = node->data.constant.type,
+            .value = node->data.constant.value,
+        };
+        if (constant.type == TYPE_STRING)
+        {
+            const char* value = node->data.constant.string_value;
+            uint32_t length = (uint32_t)strlen(value) + 1;
+            uint32_t offset = TREE_RESERVE(tree, strings, length);
+            memcpy(tree->strings + offset, value, length);
+            constant.value = (int32_t)offset;
+        }
+        tree->constants[payload] = constant;
+        break;
+    }
+    case AST_CALL:
+    {
+        payload = TREE_RESERVE(tree, calls, 1);
+        tree_call_t call;
+        call.identifier = tree_lower(tree, node->data.call.identifier);
+        call.args = tree_lower_list(tree, &node->data.call.args);
+        tree->calls[payload] = call;
+        break;
+    }
+    case AST_ASSIGN:
+    {
+        payload = TREE_RESERVE(tree, assigns, 1);
+        tree_assign_t assign;
+        assign.lhs = tree_lower(tree, node->data.assign.lhs);
+        assign.rhs = tree_lower(tree, node->data.assign.rhs);
+        tree->assigns[payload] = assign;
+        break;
+    }
+    case AST_BINOP:
+    {
+        payload = TREE_RESERVE(tree, binops, 1);
+        tree_binop_t binop;
+        binop.lhs = tree_lower(tree, node->data.binop.lhs);
+        binop.rhs = tree_lower(tree, node->data.binop.rhs);
+        binop.op = node->data.binop.op;
+        tree->binops[payload] = binop;
+        break;
+    }
+    case AST_RETURN:
+        payload = tree_lower(tree, node->data.ret.node);
+        break;
+    case AST_IF:
+    {
+        payload = TREE_RESERVE(tree, ifs, 1);
+        tree_if_t stmt;
+        stmt.condition = tree_lower(tree, node->data.if_stmt.condition);
+        stmt.then_branch = tree_lower(tree, node->data.if_stmt.then_branch);
+        stmt.else_branch = tree_lower(tree, node->data.if_stmt.else_branch);
+        tree->ifs[payload] = stmt;
+        break;
+    }
+    case AST_FOR:
+    {
+        payload = TREE_RESERVE(tree, fors, 1);
+        tree_for_t stmt;
+        stmt.identifier = tree_lower(tree, node->data.for_stmt.identifier);
+        stmt.expr = tree_lower(tree, node->data.for_stmt.expr);
+        stmt.block = tree_lower(tree, node->data.for_stmt.block);
+        tree->fors[payload] = stmt;
+        break;
+    }
+    case AST_WHILE:
+    {
+        payload = TREE_RESERVE(tree, whiles, 1);
+        tree_while_t stmt;
+        stmt.condition = tree_lower(tree, node->data.while_stmt.condition);
+        stmt.block = tree_lower(tree, node->data.while_stmt.block);
+        tree->whiles[payload] = stmt;
+        break;
+    }
+    }
+
+    tree->payloads[index] = payload;
+    return index;
+}
+
+tree_t* tree_build(ast* program)
+{
+    ASSERT(program && program->type == AST_PROGRAM,
+           "Expected PROGRAM node when building the compact AST.");
+
+    tree_t* tree = (tree_t*)calloc(1, sizeof(tree_t));
+    ASSERT(tree != NULL, "Out of memory creating the compact AST.");
+    tree->root = tree_lower(tree, program);
+
+    log_info("Compact AST: %u nodes, %zu bytes.", tree->count,
+             tree_bytes(tree));
+    return tree;
+}
+
+tree_t* tree_begin()
+{
+    tree_t* tree = (tree_t*)calloc(1, sizeof(tree_t));
+    ASSERT(tree != NULL, "Out of memory creating the compact AST.");
+
+    // Spans and lists are filled in by `tree_finish`.
+    tree->root = tree_node_of(tree, AST_PROGRAM, 0, 0);
+    tree_node_of(tree, AST_BODY, 0, 0);
+    uint32_t lists = TREE_RESERVE(tree, lists, 2);
+    tree->payloads[tree->root] = lists;
+    tree->payloads[TREE_BODY] = lists + 1;
+    return tree;
+}
+
+void tree_append(tree_t* tree, ast* statement)
+{
+    node_t node = tree_lower(tree, statement);
+    if (tree->pending_count == tree->pending_capacity)
+    {
+        tree->pending_capacity =
+            tree->pending_capacity ? tree->pending_capacity * 2 : 64;
+        tree->pending = (node_t*)realloc(
+            tree->pending, tree->pending_capacity * sizeof(node_t));
+        ASSERT(tree->pending != NULL, "Out of memory growing the compact AST.");
+    }
+    tree->pending[tree->pending_count++] = node;
+}
+
+void tree_finish(tree_t* tree, ast* program)
+{
+    // Statements gathered from several programs have no single program to
+    // take spans from, so theirs are left empty.
+    if (program != NULL)
+    {
+        ASSERT(program->type == AST_PROGRAM,
+               "Expected PROGRAM node when building the compact AST.");
+        const ast_list* bodies = &program->data.program.body;
+        ASSERT(bodies->count <= 1, "Expected a single BODY, got %u.",
+               bodies->count);
+
+        tree->spans[tree->root].start = (uint32_t)program->start;
+        tree->spans[tree->root].end = (uint32_t)program->end;
+        ast* body = bodies->count ? bodies->items[0] : program;
+        tree->spans[TREE_BODY].start = (uint32_t)body->start;
+        tree->spans[TREE_BODY].end = (uint32_t)body->end;
+    }
+
+    // The statements are complete, so their run of children can now be
+    // reserved. An empty program gets an empty body, which emits nothing.
+    tree_list_t statements = {
+        TREE_RESERVE(tree, children, tree->pending_count),
+        tree->pending_count};
+    if (tree->pending_count > 0)
+    {
+        memcpy(tree->children + statements.first, tree->pending,
+               tree->pending_count * sizeof(node_t));
+    }
+    tree->lists[tree->payloads[TREE_BODY]] = statements;
+
+    tree_list_t bodies_list = {TREE_RESERVE(tree, children, 1), 1};
+    tree->children[bodies_list.first] = TREE_BODY;
+    tree->lists[tree->payloads[tree->root]] = bodies_list;
+
+    free(tree->pending);
+    tree->pending = NULL;
+    tree->pending_count = 0;
+    tree->pending_capacity = 0;
+
+    log_info("Compact AST: %u nodes, %zu bytes.", tree->count,
+             tree_bytes(tree));
+}
+
+void tree_free(tree_t* tree)
+{
+    if (!tree)
+    {
+        return;
+    }
+
+    if (tree->mapping)
+    {
+#ifndef _WIN32
+        munmap(tree->mapping, tree->mapping_size);
+#endif
+        free(tree);
+        return;
+    }
+
+    free(tree->kinds);
+    free(tree->payloads);
+    free(tree->spans);
+    free(tree->children);
+    free(tree->types);
+    free(tree->strings);
+    free(tree->lists);
+    free(tree->declvars);
+    free(tree->declfns);
+    free(tree->constants);
+    free(tree->calls);
+    free(tree->assigns);
+    free(tree->binops);
+    free(tree->ifs);
+    free(tree->fors);
+    free(tree->whiles);
+    free(tree->pending);
+    free(tree);
+}
+
+size_t tree_bytes(tree_t* tree)
+{
+    size_t bytes = (size_t)tree->count *
+                   (sizeof(uint8_t) + sizeof(uint32_t) + sizeof(span_t));
+    bytes += TREE_COLUMN_BYTES(tree, children);
+    bytes += TREE_COLUMN_BYTES(tree, types);
+    bytes += TREE_COLUMN_BYTES(tree, strings);
+    bytes += TREE_COLUMN_BYTES(tree, lists);
+    bytes += TREE_COLUMN_BYTES(tree, declvars);
+    bytes += TREE_COLUMN_BYTES(tree, declfns);
+    bytes += TREE_COLUMN_BYTES(tree, constants);
+    bytes += TREE_COLUMN_BYTES(tree, calls);
+    bytes += TREE_COLUMN_BYTES(tree, assigns);
+    bytes += TREE_COLUMN_BYTES(tree, binops);
+    bytes += TREE_COLUMN_BYTES(tree, ifs);
+    bytes += TREE_COLUMN_BYTES(tree, fors);
+    bytes += TREE_COLUMN_BYTES(tree, whiles);
+    return bytes;
+}
@@ -0,0 +1,298 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+#include "intern.h"
+
+/* Compact AST
+ *
+ * `tree_t` is a flattened copy of a parsed `ast` which codegen walks instead
+ * of the pointer tree. Nodes are 32-bit indices rather than pointers. Every
+ * node stores only its kind, a 32-bit payload word and a 32-bit source span;
+ * the rest of its fields live in a column dedicated to its kind, so small
+ * nodes such as identifiers and constants no longer pay for the largest
+ * variant.
+ *
+ * Nodes are laid out in pre-order, so emitting a program walks each column
+ * front to back.
+ */
+
+// Index of a node within a `tree_t`.
+typedef uint32_t node_t;
+
+// Sentinel for an absent child, e.g. an `if` without an `else`.
+#define NODE_NONE ((node_t)-1)
+
+// Byte offsets into the source, relative to its start.
+typedef struct span_t
+{
+    uint32_t start;
+    uint32_t end;
+} span_t;
+
+// A run of child nodes within `tree_t::children`.
+typedef struct tree_list_t
+{
+    uint32_t first;
+    uint32_t count;
+} tree_list_t;
+
+/* Per-kind payloads
+ *
+ * Kinds whose payload fits in 32 bits store it directly in the node's payload
+ * word instead:
+ *
+ * - AST_IDENTIFIER: the atom of its name.
+ * - AST_TYPE: its `ast_value_type_t`.
+ * - AST_RETURN: the returned expression, or NODE_NONE.
+ *
+ * For every other kind the payload word indexes the kind's column below.
+ */
+
+typedef struct tree_declvar_t
+{
+    node_t identifier;
+    bool is_const;
+} tree_declvar_t;
+
+typedef struct tree_declfn_t
+{
+    node_t identifier;
+    node_t ret_type;
+    node_t block;
+    tree_list_t args;
+    // Index of the first argument's type within `tree_t::types`.
+    uint32_t arg_types;
+} tree_declfn_t;
+
+typedef struct tree_constant_t
+{
+    ast_value_type_t type;
+    // TYPE_STRING: offset of the NULL-terminated value within
+    // `tree_t::strings`. Otherwise the value itself.
+    int32_t value;
+} tree_constant_t;
+
+typedef struct tree_call_t
+{
+    node_t identifier;
+    tree_list_t args;
+} tree_call_t;
+
+typedef struct tree_assign_t
+{
+    node_t lhs;
+    node_t rhs;
+} tree_assign_t;
+
+typedef struct tree_binop_t
+{
+    node_t lhs;
+    node_t rhs;
+    ast_binop_t op;
+} tree_binop_t;
+
+typedef struct tree_if_t
+{
+    node_t condition;
+    node_t then_branch;
+    node_t else_branch;
+} tree_if_t;
+
+typedef struct tree_for_t
+{
+    node_t identifier;
+    node_t expr;
+    node_t block;
+} tree_for_t;
+
+typedef struct tree_while_t
+{
+    node_t condition;
+    node_t block;
+} tree_while_t;
+
+// Declares a growable column named `name` of `type` elements.
+#define TREE_COLUMN(type, name)                                                \
+    type* name;                                                                \
+    uint32_t name##_count;                                                     \
+    uint32_t name##_capacity;
+
+typedef struct tree_t
+{
+    // Node columns, indexed by `node_t`.
+    uint8_t* kinds;
+    uint32_t* payloads;
+    span_t* spans;
+    uint32_t count;
+    uint32_t capacity;
+
+    // Child lists of programs, bodies, blocks, calls and function arguments.
+    TREE_COLUMN(node_t, children)
+    // Argument types of function declarations.
+    TREE_COLUMN(uint8_t, types)
+    // Contents of string constants, each NULL-terminated.
+    TREE_COLUMN(char, strings)
+
+    // AST_PROGRAM, AST_BODY and AST_BLOCK
+    TREE_COLUMN(tree_list_t, lists)
+    TREE_COLUMN(tree_declvar_t, declvars)
+    TREE_COLUMN(tree_declfn_t, declfns)
+    TREE_COLUMN(tree_constant_t, constants)
+    TREE_COLUMN(tree_call_t, calls)
+    TREE_COLUMN(tree_assign_t, assigns)
+    TREE_COLUMN(tree_binop_t, binops)
+    TREE_COLUMN(tree_if_t, ifs)
+    TREE_COLUMN(tree_for_t, fors)
+    TREE_COLUMN(tree_while_t, whiles)
+
+    // The AST_PROGRAM node.
+    node_t root;
+
+    // Top-level statements appended with `tree_append`, until `tree_finish`
+    // lists them under the body.
+    node_t* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+
+    // File the columns are mapped from by `astfile_load`, or NULL if they
+    // were allocated one by one.
+    void* mapping;
+    size_t mapping_size;
+} tree_t;
+
+#undef TREE_COLUMN
+
+// Flattens the tree rooted at the program node `program`. The result does
+// not reference `program`, which may be freed straight away.
+tree_t* tree_build(ast* program);
+// Incremental building, for a program whose top-level statements arrive one
+// at a time. `tree_begin` starts an empty program with a single body,
+// `tree_append` flattens the next statement and `tree_finish` completes the
+// tree with the program the statements came from, or NULL if they came from
+// several. The body's list of children is then the only part of the tree not
+// in pre-order.
+tree_t* tree_begin();
+void tree_append(tree_t* tree, ast* statement);
+void tree_finish(tree_t* tree, ast* program);
+void tree_free(tree_t* tree);
+// Returns the number of bytes used by the nodes and payloads of `tree`.
+size_t tree_bytes(tree_t* tree);
+
+/* Accessors
+ *
+ * Codegen reads the tree only through these, so the layout above can change
+ * without touching the emitters.
+ */
+
+static inline ast_node_t tree_kind(const tree_t* tree, node_t node)
+{
+    return (ast_node_t)tree->kinds[node];
+}
+
+static inline span_t tree_span(const tree_t* tree, node_t node)
+{
+    return tree->spans[node];
+}
+
+// Returns the `index`th node of `list`.
+static inline node_t tree_child(const tree_t* tree, tree_list_t list,
+                                uint32_t index)
+{
+    return tree->children[list.first + index];
+}
+
+// AST_PROGRAM, AST_BODY, AST_BLOCK
+static inline tree_list_t tree_list(const tree_t* tree, node_t node)
+{
+    return tree->lists[tree->payloads[node]];
+}
+
+static inline atom_t tree_identifier(const tree_t* tree, node_t node)
+{
+    return (atom_t)tree->payloads[node];
+}
+
+// Returns the name of an AST_IDENTIFIER node.
+static inline const char* tree_name(const tree_t* tree, node_t node)
+{
+    return atom_name(tree_identifier(tree, node));
+}
+
+static inline ast_value_type_t tree_type(const tree_t* tree, node_t node)
+{
+    return (ast_value_type_t)tree->payloads[node];
+}
+
+static inline node_t tree_return(const tree_t* tree, node_t node)
+{
+    return (node_t)tree->payloads[node];
+}
+
+static inline const tree_declvar_t* tree_declvar(const tree_t* tree,
+                                                 node_t node)
+{
+    return &tree->declvars[tree->payloads[node]];
+}
+
+static inline const tree_declfn_t* tree_declfn(const tree_t* tree, node_t node)
+{
+    return &tree->declfns[tree->payloads[node]];
+}
+
+// Returns the type of the `index`th argument of `declfn`.
+static inline ast_value_type_t tree_arg_type(const tree_t* tree,
+                                             const tree_declfn_t* declfn,
+                                             uint32_t index)
+{
+    return (ast_value_type_t)tree->types[declfn->arg_types + index];
+}
+
+static inline const tree_constant_t* tree_constant(const tree_t* tree,
+                                                   node_t node)
+{
+    return &tree->constants[tree->payloads[node]];
+}
+
+// Returns the contents of a TYPE_STRING constant.
+static inline const char* tree_string(const tree_t* tree,
+                                      const tree_constant_t* constant)
+{
+    return tree->strings + constant->value;
+}
+
+static inline const tree_call_t* tree_call(const tree_t* tree, node_t node)
+{
+    return &tree->calls[tree->payloads[node]];
+}
+
+static inline const tree_assign_t* tree_assign(const tree_t* tree, node_t node)
+{
+    return &tree->assigns[tree->payloads[node]];
+}
+
+static inline const tree_binop_t* tree_binop(const tree_t* tree, node_t node)
+{
+    return &tree->binops[tree->payloads[node]];
+}
+
+static inline const tree_if_t* tree_if(const tree_t* tree, node_t node)
+{
+    return &tree->ifs[tree->payloads[node]];
+}
+
+static inline const tree_for_t* tree_for(const tree_t* tree, node_t node)
+{
+    return &tree->fors[tree->payloads[node]];
+}
+
+static inline const tree_while_t* tree_while(const tree_t* tree, node_t node)
+{
+    return &tree->whiles[tree->payloads[node]];
+}
+
+#endif
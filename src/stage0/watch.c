@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "ast.h"
+#include "codegen.h"
+#include "intern.h"
+#include "log.h"
+#include "macros.h"
+#include "sema.h"
+#include "tree.h"
+#include "watch.h"
+
+// Quiet period after a change before compiling, so the several writes of a
+// single save are compiled once.
+#define WATCH_SETTLE_MS 50
+
+// A top-level declaration, along with anything following it up to the next
+// one. The first chunk holds whatever precedes the first declaration.
+typedef struct watch_chunk_t
+{
+    // Copy of the text the chunk was parsed from.
+    char* text;
+    size_t size;
+    // Offset of `text` within the source it was parsed from, which its spans
+    // are relative to.
+    size_t origin;
+    // Offset of `text` within the current source.
+    size_t start;
+    // Parsed program, or NULL for an empty chunk.
+    ast* program;
+} watch_chunk_t;
+
+struct watch_t
+{
+    watch_chunk_t* chunks;
+    size_t count;
+    codegen_cache_t* cache;
+    // Number of atoms interned before the last compile began.
+    size_t interned;
+    // Target every compile emits code for.
+    codegen_type_t target;
+
+    // Directory holding the watched file, and the file's name within it.
+    char* directory;
+    char* name;
+    int fd;
+};
+
+watch_t* watch_new(const char* path, codegen_type_t target)
+{
+#ifdef __linux__
+    watch_t* watch = (watch_t*)calloc(1, sizeof(watch_t));
+    ASSERT(watch != NULL, "Out of memory starting watch mode.");
+
+    // Watch the directory rather than the file, as editors often save by
+    // replacing the file with a new one.
+    const char* slash = strrchr(path, '/');
+    watch->directory = slash ? strndup(path, (size_t)(slash - path + 1))
+                             : strdup(".");
+    watch->name = strdup(slash ? slash + 1 : path);
+    ASSERT(watch->directory != NULL && watch->name != NULL,
+           "Out of memory starting watch mode.");
+
+    // Events queue up while a compile runs, so no change is missed.
+    watch->fd = inotify_init1(IN_CLOEXEC);
+    if (watch->fd < 0 ||
+        inotify_add_watch(watch->fd, watch->directory,
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        perror("Error watching file");
+        watch_free(watch);
+        return NULL;
+    }
+
+    watch->cache = codegen_cache_new();
+    watch->target = target;
+    return watch;
+#else
+    log_error("Watch mode is not supported on this platform.");
+    return NULL;
+#endif
+}
+
+void watch_free(watch_t* watch)
+{
+    if (!watch)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < watch->count; i++)
+    {
+        free(watch->chunks[i].text);
+        ast_free(watch->chunks[i].program);
+    }
+    free(watch->chunks);
+    codegen_cache_free(watch->cache);
+#ifdef __linux__
+    if (watch->fd >= 0)
+    {
+        close(watch->fd);
+    }
+#endif
+    free(watch->directory);
+    free(watch->name);
+    free(watch);
+}
+
+static bool chunk_matches(const watch_chunk_t* chunk, const char* text,
+                          size_t size)
+{
+    return chunk->size == size && memcmp(chunk->text, text, size) == 0;
+}
+
+// Appends the statements of `chunk` to `tree`, moving their spans to where
+// the chunk now sits in the source.
+static void chunk_append(tree_t* tree, const watch_chunk_t* chunk)
+{
+    if (chunk->program == NULL || chunk->program->data.program.body.count == 0)
+    {
+        return;
+    }
+
+    uint32_t shift = (uint32_t)(chunk->start - chunk->origin);
+    const ast* body = chunk->program->data.program.body.items[0];
+    const ast_list* statements = &body->data.body.statements;
+    for (uint32_t i = 0; i < statements->count; i++)
+    {
+        uint32_t first = tree->count;
+        tree_append(tree, statements->items[i]);
+        for (uint32_t node = first; node < tree->count; node++)
+        {
+            tree->spans[node].start += shift;
+            tree->spans[node].end += shift;
+        }
+    }
+}
+
+// Splits `source` into chunks, reparsing those that changed since the last
+// compile.
+static void watch_update(watch_t* watch, source_t* source)
+{
+    ASSERT(source->complete, "Watch mode needs a complete source.");
+
+    size_t count = 0;
+    size_t end = 0;
+    size_t* offsets = parse_declarations(source, &count, &end);
+
+    // Chunk `i` of the new source spans [bounds[i], bounds[i + 1]).
+    size_t chunk_count = count + 1;
+    size_t* bounds = (size_t*)malloc((chunk_count + 1) * sizeof(size_t));
+    ASSERT(bounds != NULL, "Out of memory splitting the source.");
+    bounds[0] = 0;
+    memcpy(bounds + 1, offsets, count * sizeof(size_t));
+    bounds[chunk_count] = end;
+    free(offsets);
+
+    // Edits usually touch a single region, so keep the unchanged chunks
+    // before and after it.
+    const char* data = source->data;
+    size_t prefix = 0;
+    while (prefix < chunk_count && prefix < watch->count &&
+           chunk_matches(&watch->chunks[prefix], data + bounds[prefix],
+                         bounds[prefix + 1] - bounds[prefix]))
+    {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < chunk_count - prefix && suffix < watch->count - prefix)
+    {
+        size_t i = chunk_count - 1 - suffix;
+        if (!chunk_matches(&watch->chunks[watch->count - 1 - suffix],
+                           data + bounds[i], bounds[i + 1] - bounds[i]))
+        {
+            break;
+        }
+        suffix++;
+    }
+
+    watch_chunk_t* chunks =
+        (watch_chunk_t*)calloc(chunk_count, sizeof(watch_chunk_t));
+    ASSERT(chunks != NULL, "Out of memory splitting the source.");
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        watch_chunk_t* chunk = &chunks[i];
+        if (i < prefix)
+        {
+            *chunk = watch->chunks[i];
+        }
+        else if (i >= chunk_count - suffix)
+        {
+            *chunk = watch->chunks[i - chunk_count + watch->count];
+        }
+        else
+        {
+            chunk->size = bounds[i + 1] - bounds[i];
+            chunk->text = (char*)malloc(chunk->size + 1);
+            ASSERT(chunk->text != NULL, "Out of memory copying the source.");
+            memcpy(chunk->text, data + bounds[i], chunk->size);
+            chunk->text[chunk->size] = '\0';
+            chunk->origin = bounds[i];
+            chunk->program = chunk->size > 0
+                                 ? parse_range(source, bounds[i], bounds[i + 1])
+                                 : NULL;
+        }
+        chunk->start = bounds[i];
+    }
+
+    // Release the chunks the edit replaced.
+    for (size_t i = prefix; i + suffix < watch->count; i++)
+    {
+        free(watch->chunks[i].text);
+        ast_free(watch->chunks[i].program);
+    }
+    free(watch->chunks);
+    free(bounds);
+    watch->chunks = chunks;
+    watch->count = chunk_count;
+    log_info("Reparsed %zu of %zu chunks.", chunk_count - prefix - suffix,
+             chunk_count);
+}
+
+codegen_t* watch_compile(watch_t* watch, source_t* source)
+{
+    watch->interned = intern_count();
+    watch_update(watch, source);
+
+    tree_t* tree = tree_begin();
+    for (size_t i = 0; i < watch->count; i++)
+    {
+        chunk_append(tree, &watch->chunks[i]);
+    }
+    tree_finish(tree, NULL);
+
+    sema_t* sema = sema_check(tree);
+    codegen_t* code = ast_codegen(tree, sema, watch->target, watch->cache);
+    sema_free(sema);
+    tree_free(tree);
+    return code;
+}
+
+bool watch_save(const watch_t* watch, FILE* fp)
+{
+    // The atoms the compile interned, in order, then the cache keyed on them.
+    size_t count = intern_count();
+    bool written = fwrite(&watch->interned, sizeof(size_t), 1, fp) == 1 &&
+                   fwrite(&count, sizeof(size_t), 1, fp) == 1;
+    for (size_t atom = watch->interned; atom < count && written; atom++)
+    {
+        size_t length = atom_length((atom_t)atom);
+        written = fwrite(&length, sizeof(size_t), 1, fp) == 1 &&
+                  fwrite(atom_name((atom_t)atom), length + 1, 1, fp) == 1;
+    }
+    return written && codegen_cache_write(watch->cache, fp) &&
+           fflush(fp) == 0;
+}
+
+// Reads the names written by `watch_save`. Returns NULL if `fp` does not
+// hold them all, or they were interned from a different table.
+static char** watch_load_names(FILE* fp, size_t* count)
+{
+    size_t first = 0;
+    size_t end = 0;
+    if (fread(&first, sizeof(size_t), 1, fp) != 1 ||
+        fread(&end, sizeof(size_t), 1, fp) != 1 || first != intern_count() ||
+        end < first)
+    {
+        return NULL;
+    }
+
+    *count = end - first;
+    char** names = (char**)calloc(*count + 1, sizeof(char*));
+    ASSERT(names != NULL, "Out of memory reading atoms.");
+    for (size_t i = 0; i < *count; i++)
+    {
+        size_t length = 0;
+        if (fread(&length, sizeof(size_t), 1, fp) != 1 ||
+            !(names[i] = (char*)malloc(length + 1)) ||
+            fread(names[i], length + 1, 1, fp) != 1)
+        {
+            for (size_t j = 0; j <= i; j++)
+            {
+                free(names[j]);
+            }
+            free(names);
+            return NULL;
+        }
+    }
+    return names;
+}
+
+bool watch_load(watch_t* watch, source_t* source, FILE* fp)
+{
+    size_t count = 0;
+    char** names = watch_load_names(fp, &count);
+    codegen_cache_t* cache = names ? codegen_cache_read(fp) : NULL;
+
+    // The chunks follow the source either way. Parsing it interns its names
+    // in the same order it did in the compile, which then interned the rest.
+    size_t first = intern_count();
+    watch_update(watch, source);
+    bool same = cache != NULL;
+    for (size_t i = 0; i < count; i++)
+    {
+        same = same &&
+               intern(names[i], strlen(names[i])) == (atom_t)(first + i);
+        free(names[i]);
+    }
+    free(names);
+
+    if (!same)
+    {
+        // Entries from a compile whose atoms differ would replay the wrong
+        // names, so start over with none.
+        codegen_cache_free(cache);
+        cache = codegen_cache_new();
+    }
+    codegen_cache_free(watch->cache);
+    watch->cache = cache;
+    return same;
+}
+
+bool watch_wait(watch_t* watch)
+{
+#ifdef __linux__
+    char events[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    while (true)
+    {
+        // Once the file has changed, wait only until the writes settle.
+        struct pollfd poller = {watch->fd, POLLIN, 0};
+        int ready = poll(&poller, 1, changed ? WATCH_SETTLE_MS : -1);
+        if (ready < 0)
+        {
+            perror("Error watching file");
+            return false;
+        }
+        if (ready == 0)
+        {
+            return true;
+        }
+
+        ptrdiff_t length = read(watch->fd, events, sizeof(events));
+        if (length <= 0)
+        {
+            perror("Error watching file");
+            return false;
+        }
+        for (char* p = events; p < events + length;)
+        {
+            const struct inotify_event* event = (struct inotify_event*)p;
+            if (event->len > 0 && strcmp(event->name, watch->name) == 0)
+            {
+                changed = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "codegen.h"
+#include "source.h"
+
+/* Watch mode
+ *
+ * Keeps a program resident between compiles so an edit only costs work in
+ * proportion to what it changed. The source is split at each top-level `fn`
+ * and `let` declaration without parsing it. Declarations whose text is
+ * unchanged since the last compile keep their parsed AST; only the run of
+ * changed declarations between them is lexed and parsed again. Statements
+ * that would emit the same assembly as last time are replayed from a
+ * codegen cache rather than emitted again.
+ *
+ * Flattening and semantic analysis still cover the whole program, as a
+ * changed declaration may change how any other one resolves.
+ */
+
+typedef struct watch_t watch_t;
+
+// Starts watching the file at `path` for changes, compiling it for
+// `target`. Returns NULL if the platform cannot watch files.
+watch_t* watch_new(const char* path, codegen_type_t target);
+void watch_free(watch_t* watch);
+
+// Compiles a complete `source` to code, reusing whatever the previous
+// compile through `watch` left unchanged. The caller frees the result with
+// `codegen_free`.
+codegen_t* watch_compile(watch_t* watch, source_t* source);
+
+// Writes to `fp` what the last `watch_compile` left resident that parsing
+// alone does not rebuild: the names it interned and its codegen cache.
+// Returns false if writing failed.
+bool watch_save(const watch_t* watch, FILE* fp);
+// Brings `watch` up to the compile of `source` that `watch_save` wrote to
+// `fp` from a copy of `watch`, reparsing the chunks but not checking or
+// emitting them. Returns false if the codegen cache could not be taken over,
+// in which case the next compile emits every statement.
+bool watch_load(watch_t* watch, source_t* source, FILE* fp);
+
+// Blocks until the watched file has been written again. Returns false if
+// watching failed.
+bool watch_wait(watch_t* watch);
+
+#endif
@@ -56,7 +56,7 @@ if [ ${#CFLAGS[@]} -gt 0 ]; then
     GCC_COMMAND+=("${CFLAGS[@]}")
 fi
 GCC_COMMAND+=("${INCLUDE_PATHS[@]}")
-GCC_COMMAND+=("${SOURCE_FILES[@]}" -o "${COMPILER_BIN}")
+GCC_COMMAND+=("${SOURCE_FILES[@]}" -pthread -ldl -o "${COMPILER_BIN}")
 "${GCC_COMMAND[@]}"
 
 # Determine input file (positional argument). If none given, use the example.